@@ -0,0 +1,68 @@
+#pragma once
+
+#include "vh/db_worker.h"
+
+/*!
+ * \brief Opens a second connection to the database and starts a thread that
+ * runs requests on it. Results are delivered on the default GLib main context.
+ * \param[in] uri Database to open. The database is switched to WAL mode, so
+ * that reads on the worker don't block writes on other connections.
+ * \return Returns NULL on error.
+ */
+struct db_worker*
+db_worker_start(struct db_interface* dbi, const char* uri);
+
+/*!
+ * \brief Waits for the running request to finish, then stops the thread and
+ * closes the connection. Requests that are still queued run first, so that
+ * no writes are lost, but none of the done callbacks are called anymore.
+ * Must be called from the main thread.
+ */
+void
+db_worker_stop(struct db_worker* worker);
+
+/*!
+ * \brief Queues a request. Must be called from the main thread.
+ * \param[in] func Runs on the worker thread.
+ * \param[in] done Optional. Runs on the main context with the value func
+ * returned.
+ * \param[in] data Passed to func and done.
+ * \param[in] destroy Optional. Called on the main thread with data once the
+ * request is finished or cancelled, and after done was called.
+ * \return Returns an ID greater than 0 that can be passed to
+ * db_worker_cancel(), or -1 on error. If an error occurs, destroy is not called.
+ */
+int
+db_worker_submit(
+        struct db_worker* worker,
+        enum db_worker_priority priority,
+        db_worker_func func,
+        db_worker_done_func done,
+        void* data,
+        void (*destroy)(void* data));
+
+/*!
+ * \brief Cancels a request, e.g. because its result would be stale. If the
+ * request is still queued, it never runs. If it is running or finished
+ * already, its done callback is not called. Cancelling a request that was
+ * already delivered, or an ID of 0, does nothing. Must be called from the
+ * main thread.
+ */
+void
+db_worker_cancel(struct db_worker* worker, int request_id);
+
+/*!
+ * \brief Can be called by func on the worker thread to abort long running
+ * requests early.
+ * \return Returns non-zero if the request that is currently running was
+ * cancelled.
+ */
+int
+db_worker_is_cancelled(struct db_worker* worker);
+
+/*!
+ * \brief Returns the functions above as an interface, which is handed to
+ * plugins together with the worker.
+ */
+struct db_worker_interface*
+db_worker_interface(void);
@@ -0,0 +1,322 @@
+#include "application/db_worker.h"
+
+#include "vh/db.h"
+#include "vh/init.h"
+#include "vh/log.h"
+#include "vh/mem.h"
+#include "vh/thread.h"
+#include "vh/vec.h"
+
+#include <glib.h>
+
+#define DB_WORKER_BUSY_TIMEOUT_MS 5000
+
+/*
+ * The worker owns its own connection, so a slow query never holds up the
+ * main thread's connection and vice versa.
+ *
+ * A request lives in exactly one place: One of the queues, "running", or
+ * "pending" while its idle source waits to be dispatched on the main
+ * context. Cancelling a queued request removes it. Cancelling a request
+ * that already left the queue only sets a flag, and the main context
+ * drops the result when it is delivered.
+ */
+struct db_request
+{
+    struct db_request* next;  /* In the pending list */
+    struct db_worker* worker;
+    db_worker_func func;
+    db_worker_done_func done;
+    void (*destroy)(void* data);
+    void* data;
+    int id;
+    int result;
+    guint source_id;
+    unsigned cancelled : 1;
+};
+
+struct db_worker
+{
+    struct db_interface* dbi;
+    struct db* db;  /* Worker thread only, once started */
+    struct thread thread;
+
+    /* Shared, protected by mutex */
+    struct mutex mutex;
+    struct cond cond;
+    struct vec queues[DB_WORKER_PRIORITY_COUNT];  /* struct db_request* */
+    struct db_request* pending;
+    struct db_request* running;
+    unsigned request_stop : 1;
+
+    /* Main thread only */
+    int next_id;
+};
+
+static void
+request_destroy(struct db_request* req)
+{
+    if (req->destroy)
+        req->destroy(req->data);
+    mem_free(req);
+}
+
+static gboolean
+on_request_done(gpointer user_data)
+{
+    struct db_request* req = user_data;
+    struct db_worker* worker = req->worker;
+    struct db_request** link;
+
+    mutex_lock(worker->mutex);
+        for (link = &worker->pending; *link; link = &(*link)->next)
+            if (*link == req)
+            {
+                *link = req->next;
+                break;
+            }
+    mutex_unlock(worker->mutex);
+
+    if (!req->cancelled && req->done)
+        req->done(req->result, req->data);
+    request_destroy(req);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Called with the mutex held */
+static struct db_request*
+take_next_request(struct db_worker* worker)
+{
+    struct db_request* req;
+    int priority;
+
+    for (priority = 0; priority != DB_WORKER_PRIORITY_COUNT; ++priority)
+        if (vec_count(&worker->queues[priority]))
+        {
+            req = *(struct db_request**)vec_front(&worker->queues[priority]);
+            vec_erase_index(&worker->queues[priority], 0);
+            return req;
+        }
+
+    return NULL;
+}
+
+static void*
+db_worker_run(void* args)
+{
+    struct db_worker* worker = args;
+    struct db_request* req;
+
+    vh_threadlocal_init();
+
+    mutex_lock(worker->mutex);
+    for (;;)
+    {
+        /* Queued requests are drained before stopping, they may be writes */
+        while ((req = take_next_request(worker)) == NULL && !worker->request_stop)
+            cond_wait(worker->cond, worker->mutex);
+        if (req == NULL)
+            break;
+
+        worker->running = req;
+        mutex_unlock(worker->mutex);
+
+        req->result = req->func(worker->dbi, worker->db, req->data);
+
+        /*
+         * The mutex is held while adding the source so that the callback
+         * can't run before the request was moved to the pending list.
+         */
+        mutex_lock(worker->mutex);
+        worker->running = NULL;
+        req->next = worker->pending;
+        worker->pending = req;
+        req->source_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, on_request_done, req, NULL);
+    }
+    mutex_unlock(worker->mutex);
+
+    vh_threadlocal_deinit();
+
+    return NULL;
+}
+
+struct db_worker*
+db_worker_start(struct db_interface* dbi, const char* uri)
+{
+    int priority;
+    struct db_worker* worker = mem_alloc(sizeof *worker);
+    if (worker == NULL)
+        goto alloc_worker_failed;
+
+    worker->dbi = dbi;
+    worker->db = dbi->open(uri);
+    if (worker->db == NULL)
+        goto open_db_failed;
+    if (!dbi->connection.is_threadsafe(worker->db))
+    {
+        log_err("The database backend isn't thread safe, can't query it on a worker thread\n");
+        goto not_threadsafe;
+    }
+    if (dbi->connection.enable_wal(worker->db, DB_WORKER_BUSY_TIMEOUT_MS) < 0)
+        goto enable_wal_failed;
+
+    for (priority = 0; priority != DB_WORKER_PRIORITY_COUNT; ++priority)
+        vec_init(&worker->queues[priority], sizeof(struct db_request*));
+    mutex_init(&worker->mutex);
+    cond_init(&worker->cond);
+    worker->pending = NULL;
+    worker->running = NULL;
+    worker->request_stop = 0;
+    worker->next_id = 0;
+
+    if (thread_start(&worker->thread, db_worker_run, worker) < 0)
+        goto start_thread_failed;
+
+    return worker;
+
+start_thread_failed:
+    cond_deinit(worker->cond);
+    mutex_deinit(worker->mutex);
+    for (priority = 0; priority != DB_WORKER_PRIORITY_COUNT; ++priority)
+        vec_deinit(&worker->queues[priority]);
+enable_wal_failed:
+not_threadsafe:
+    dbi->close(worker->db);
+open_db_failed:
+    mem_free(worker);
+alloc_worker_failed:
+    return NULL;
+}
+
+void
+db_worker_stop(struct db_worker* worker)
+{
+    int priority;
+    struct db_request* req;
+
+    mutex_lock(worker->mutex);
+        worker->request_stop = 1;
+        cond_signal(worker->cond);
+    mutex_unlock(worker->mutex);
+    thread_join(worker->thread, 0);
+
+    /* The queues are empty now. Drop results that were never delivered */
+    for (priority = 0; priority != DB_WORKER_PRIORITY_COUNT; ++priority)
+        vec_deinit(&worker->queues[priority]);
+    while ((req = worker->pending) != NULL)
+    {
+        worker->pending = req->next;
+        g_source_remove(req->source_id);
+        request_destroy(req);
+    }
+
+    cond_deinit(worker->cond);
+    mutex_deinit(worker->mutex);
+
+    /* Only available if vh was built with VH_DB_PROFILING */
+    if (worker->dbi->dump_stats)
+        worker->dbi->dump_stats(worker->db);
+    worker->dbi->close(worker->db);
+    mem_free(worker);
+}
+
+int
+db_worker_submit(
+        struct db_worker* worker,
+        enum db_worker_priority priority,
+        db_worker_func func,
+        db_worker_done_func done,
+        void* data,
+        void (*destroy)(void* data))
+{
+    int id;
+    struct db_request* req = mem_alloc(sizeof *req);
+    if (req == NULL)
+        return -1;
+
+    /* IDs are never 0, so that 0 can be used as "no request" */
+    if (++worker->next_id <= 0)
+        worker->next_id = 1;
+
+    req->next = NULL;
+    req->worker = worker;
+    req->func = func;
+    req->done = done;
+    req->destroy = destroy;
+    req->data = data;
+    req->id = id = worker->next_id;
+    req->result = 0;
+    req->source_id = 0;
+    req->cancelled = 0;
+
+    mutex_lock(worker->mutex);
+        if (vec_push(&worker->queues[priority], &req) < 0)
+        {
+            mutex_unlock(worker->mutex);
+            mem_free(req);
+            return -1;
+        }
+        cond_signal(worker->cond);
+    mutex_unlock(worker->mutex);
+
+    /* The request may already have finished */
+    return id;
+}
+
+void
+db_worker_cancel(struct db_worker* worker, int request_id)
+{
+    int priority;
+    struct db_request* req;
+    struct db_request* queued = NULL;
+
+    if (request_id == 0)
+        return;
+
+    mutex_lock(worker->mutex);
+        for (priority = 0; priority != DB_WORKER_PRIORITY_COUNT && queued == NULL; ++priority)
+        {
+            VEC_FOR_EACH(&worker->queues[priority], struct db_request*, preq)
+                if ((*preq)->id == request_id)
+                {
+                    queued = *preq;
+                    vec_erase_element(&worker->queues[priority], preq);
+                    break;
+                }
+            VEC_END_EACH
+        }
+
+        if (worker->running && worker->running->id == request_id)
+            worker->running->cancelled = 1;
+
+        for (req = worker->pending; req; req = req->next)
+            if (req->id == request_id)
+                req->cancelled = 1;
+    mutex_unlock(worker->mutex);
+
+    if (queued)
+        request_destroy(queued);
+}
+
+int
+db_worker_is_cancelled(struct db_worker* worker)
+{
+    int cancelled;
+    mutex_lock(worker->mutex);
+        cancelled = worker->running && worker->running->cancelled;
+    mutex_unlock(worker->mutex);
+    return cancelled;
+}
+
+static struct db_worker_interface worker_interface = {
+    db_worker_submit,
+    db_worker_cancel,
+    db_worker_is_cancelled
+};
+
+struct db_worker_interface*
+db_worker_interface(void)
+{
+    return &worker_interface;
+}
@@ -1,3 +1,4 @@
+#include "application/db_worker.h"
 #include "application/game_browser.h"
 #include "application/fighter_icons.h"
 
@@ -8,6 +9,7 @@
 #include "vh/vec.h"
 
 #include <gtk/gtk.h>
+#include <string.h>
 
 #define COLUMNS_LIST                                 \
     X(TIME,   column1,       column_1,    "Time")    \
@@ -17,7 +19,8 @@
     X(FORMAT, center_label,  column_n,    "Format")  \
     X(SCORE,  center_label,  column_n,    "Score")   \
     X(GAME,   center_label,  column_n,    "Game")    \
-    X(STAGE,  left_label,    column_n,    "Stage")
+    X(STAGE,  left_label,    column_n,    "Stage")   \
+    X(TAGS,   left_label,    column_n,    "Tags")
 
 enum column
 {
@@ -83,7 +86,8 @@ vhapp_game_tree_entry_new_game(
     struct str_view format,
     struct str_view score,
     struct str_view game,
-    struct str_view stage)
+    struct str_view stage,
+    struct str_view tags)
 {
     VhAppGameTreeEntry* obj = g_object_new(VHAPP_TYPE_GAME_TREE_ENTRY, NULL);
 
@@ -96,6 +100,7 @@ vhapp_game_tree_entry_new_game(
     strlist_add_terminated(&obj->columns, score);
     strlist_add_terminated(&obj->columns, game);
     strlist_add_terminated(&obj->columns, stage);
+    strlist_add_terminated(&obj->columns, tags);
 
     obj->children = NULL;
 
@@ -206,6 +211,17 @@ vhapp_game_tree_append(VhAppGameTree* self, VhAppGameTreeEntry* item)
     g_list_model_items_changed(G_LIST_MODEL(self), vec_count(&self->items) - 1, 0, 1);
 }
 
+/* Takes all items of "other", and leaves it with the previous items of "self" */
+static void
+vhapp_game_tree_swap(VhAppGameTree* self, VhAppGameTree* other)
+{
+    guint removed = vec_count(&self->items);
+    struct vec items = self->items;
+    self->items = other->items;
+    other->items = items;
+    g_list_model_items_changed(G_LIST_MODEL(self), 0, removed, vec_count(&self->items));
+}
+
 enum
 {
     SIGNAL_GAMES_SELECTED,
@@ -220,6 +236,9 @@ struct _VhAppGameBrowser
     VhAppGameTree* tree;
     GtkWidget* top_widget;
     struct vec selected_game_ids;
+    GtkWidget* search;
+    struct db_worker* worker;
+    int populate_request;
 };
 
 struct _VhAppGameBrowserClass
@@ -362,39 +381,27 @@ bind_column_n_cb(GtkSignalListItemFactory* self, GtkListItem* item, gpointer use
     g_object_unref(entry);
 }
 
-struct on_game_ctx
+struct populate_ctx
 {
     VhAppGameTree* tree;
     VhAppGameTree* games;
 
+    /* Only games with a tag that contains this text are listed */
+    const char* tag_filter;
+
     /* Last date + event returned from the db.
      * We use this to determine when to start a new root node */
     int year, month, mday;
     int event_id;
 };
 
-static int on_game(
-    int game_id,
-    int event_id,
-    uint64_t time_started,
-    int duration,
-    const char* tournament,
-    const char* event,
-    const char* stage,
-    const char* round,
-    const char* format,
-    const char* scores,
-    const char* slots,
-    const char* teams,
-    const char* players,
-    const char* fighter_ids,
-    const char* costumes,
-    void* user)
+static void
+append_game(struct populate_ctx* ctx, const struct db_game_get_all_row* game)
 {
     int i;
     int s1, s2, game_number;
+    uint64_t time_started;
     struct tm* tm;
-    struct on_game_ctx* ctx = user;
     struct str_view left = {0}, right = {0};
     struct str_view team1 = {0}, team2 = {0};
     struct str_view fighters1 = {0}, fighters2 = {0};
@@ -406,16 +413,19 @@ static int on_game(
     char scores_str[36];  /* -2147483648 - -2147483648 */
     char game_str[16];    /* -2147483648 */
 
-    time_started = time_started / 1000;
+    if (*ctx->tag_filter && strstr(game->tags, ctx->tag_filter) == NULL)
+        return;
+
+    time_started = game->time_started / 1000;
     tm = localtime((time_t*)&time_started);
     if (tm->tm_year > 9999)
         tm->tm_year = 9999;
     strftime(time_str, sizeof(time_str), "%H:%M", tm);
 
-    str_split2(cstr_view(teams), ',', &team1, &team2);
-    str_split2(cstr_view(fighter_ids), ',', &fighters1, &fighters2);
-    str_split2(cstr_view(costumes), ',', &costumes1, &costumes2);
-    str_split2(cstr_view(scores), ',', &score1, &score2);
+    str_split2(cstr_view(game->teams), ',', &team1, &team2);
+    str_split2(cstr_view(game->fighter_ids), ',', &fighters1, &fighters2);
+    str_split2(cstr_view(game->costumes), ',', &costumes1, &costumes2);
+    str_split2(cstr_view(game->scores), ',', &score1, &score2);
     sprintf(scores_str, "%.*s-%.*s", score1.len, score1.data, score2.len, score2.data);
 
     str_dec_to_int(score1, &s1);
@@ -427,32 +437,33 @@ static int on_game(
     if (ctx->mday != tm->tm_mday ||
          ctx->month != tm->tm_mon ||
          ctx->year != tm->tm_year ||
-         ctx->event_id != event_id)
+         ctx->event_id != game->event_id)
     {
         VhAppGameTreeEntry* event_obj;
         char date_str[11];  /* YYYY-MM-DD */
         strftime(date_str, sizeof(date_str), "%Y-%m-%d", tm);
         event_obj = vhapp_game_tree_entry_new_event(
                 cstr_view(date_str),
-                cstr_view(*event ? event : "Other"));
+                cstr_view(*game->event ? game->event : "Other"));
         ctx->games = event_obj->children;
         vhapp_game_tree_append(ctx->tree, event_obj);
 
         ctx->mday = tm->tm_mday;
         ctx->month = tm->tm_mon;
         ctx->year = tm->tm_year;
-        ctx->event_id = event_id;
+        ctx->event_id = game->event_id;
     }
 
     game_obj = vhapp_game_tree_entry_new_game(
-        game_id,
+        game->game_id,
         cstr_view(time_str),
         team1, team2,
-        cstr_view(round),
-        cstr_view(format),
+        cstr_view(game->round),
+        cstr_view(game->format),
         cstr_view(scores_str),
         cstr_view(game_str),
-        cstr_view(stage));
+        cstr_view(game->stage),
+        cstr_view(game->tags));
 
     str_split2(fighters1, '+', &left, &right);
     for (i = 0; left.len; str_split2(right, '+', &left, &right), i++)
@@ -471,19 +482,101 @@ static int on_game(
         str_dec_to_int(left, &game_obj->costumes[1][i]);
 
     vhapp_game_tree_append(ctx->games, game_obj);
-
-    return 0;
 }
 
+struct populate_request
+{
+    struct db_worker* worker;
+    VhAppGameBrowser* game_browser;
+    VhAppGameTree* tree;
+    struct str tag_filter;
+};
+
 static void
-populate_tree_from_db(VhAppGameTree* tree, struct db_interface* dbi, struct db* db)
+populate_request_destroy(void* user)
 {
-    struct on_game_ctx on_game_ctx = { 0 };
-    on_game_ctx.tree = tree;
+    struct populate_request* req = user;
+    g_object_unref(req->tree);
+    str_deinit(&req->tag_filter);
+    mem_free(req);
+}
+
+/*
+ * Runs on the db worker. The tree isn't part of the model yet, so it can be
+ * filled here and handed to the main thread when it's complete.
+ */
+static int
+load_games(struct db_interface* dbi, struct db* db, void* user)
+{
+    struct populate_request* req = user;
+    struct db_game_get_all_row row;
+    struct db_cursor* cursor;
+    struct populate_ctx ctx = { 0 };
+    int ret, rows = 0;
+    ctx.tree = req->tree;
+    ctx.tag_filter = req->tag_filter.len ? req->tag_filter.data : "";
 
     log_dbg("Querying games...\n");
-    dbi->game.get_all(db, on_game, &on_game_ctx);
+    cursor = dbi->game.get_all_open(db);
+    if (cursor == NULL)
+        return -1;
+    while ((ret = dbi->game.get_all_next(cursor, &row)) > 0)
+    {
+        append_game(&ctx, &row);
+
+        /* The filter changed again, nobody will see these games */
+        if (++rows % 1024 == 0 && db_worker_is_cancelled(req->worker))
+            break;
+    }
+    dbi->game.get_all_close(cursor);
+    if (ret < 0)
+        return -1;
+
     log_dbg("Loaded %d games\n", dbi->game.count(db));
+    return 0;
+}
+
+static void
+on_games_loaded(int result, void* user)
+{
+    struct populate_request* req = user;
+    req->game_browser->populate_request = 0;
+    if (result == 0)
+        vhapp_game_tree_swap(req->game_browser->tree, req->tree);
+}
+
+static void
+populate_tree_from_db(VhAppGameBrowser* game_browser, const char* tag_filter)
+{
+    struct populate_request* req;
+
+    /* The games of the previous filter are stale */
+    db_worker_cancel(game_browser->worker, game_browser->populate_request);
+    game_browser->populate_request = 0;
+
+    req = mem_alloc(sizeof *req);
+    if (req == NULL)
+        return;
+    req->worker = game_browser->worker;
+    req->game_browser = game_browser;
+    req->tree = vhapp_game_tree_new();
+    str_init(&req->tag_filter);
+    if (cstr_set(&req->tag_filter, tag_filter) < 0)
+        goto fail;
+    str_terminate(&req->tag_filter);
+
+    game_browser->populate_request = db_worker_submit(game_browser->worker, DB_WORKER_NORMAL,
+        load_games, on_games_loaded, req, populate_request_destroy);
+    if (game_browser->populate_request < 0)
+    {
+        game_browser->populate_request = 0;
+        goto fail;
+    }
+
+    return;
+
+fail:
+    populate_request_destroy(req);
 }
 
 static void
@@ -559,8 +652,16 @@ create_game_list(VhAppGameTree* tree, VhAppGameBrowser* game_browser)
     return column_view;
 }
 
+/* Games are tagged by the search plugin, see the game_tags table */
+static void
+search_changed_cb(GtkEntry* self, gpointer user_data)
+{
+    VhAppGameBrowser* game_browser = user_data;
+    populate_tree_from_db(game_browser, gtk_editable_get_text(GTK_EDITABLE(self)));
+}
+
 static GtkWidget*
-create_top_widget(GtkWidget* game_list)
+create_top_widget(GtkWidget* game_list, VhAppGameBrowser* game_browser)
 {
     GtkWidget* search;
     GtkWidget* games;
@@ -571,6 +672,9 @@ create_top_widget(GtkWidget* game_list)
 
     search = gtk_entry_new();
     gtk_entry_set_icon_from_icon_name(GTK_ENTRY(search), GTK_ENTRY_ICON_PRIMARY, "edit-find-symbolic");
+    gtk_entry_set_placeholder_text(GTK_ENTRY(search), "Filter by tag");
+    g_signal_connect(search, "changed", G_CALLBACK(search_changed_cb), game_browser);
+    game_browser->search = search;
 
     scroll = gtk_scrolled_window_new();
     gtk_scrolled_window_set_has_frame(GTK_SCROLLED_WINDOW(scroll), TRUE);
@@ -604,6 +708,8 @@ static void
 vhapp_game_browser_dispose(GObject* object)
 {
     VhAppGameBrowser* self = VHAPP_GAME_BROWSER(object);
+    db_worker_cancel(self->worker, self->populate_request);
+    self->populate_request = 0;
     gtk_widget_unparent(self->top_widget);
     vec_deinit(&self->selected_game_ids);
     mem_track_deallocation(object);
@@ -627,14 +733,15 @@ vhapp_game_browser_class_init(VhAppGameBrowserClass* class)
 }
 
 GtkWidget*
-vhapp_game_browser_new(struct db_interface* dbi, struct db* db)
+vhapp_game_browser_new(struct db_worker* worker)
 {
     GtkWidget* game_list;
     VhAppGameBrowser* game_browser = g_object_new(VHAPP_TYPE_GAME_BROWSER, NULL);
     game_browser->tree = vhapp_game_tree_new();
+    game_browser->worker = worker;
     game_list = create_game_list(game_browser->tree, game_browser);
-    populate_tree_from_db(game_browser->tree, dbi, db);
-    game_browser->top_widget = create_top_widget(game_list);
+    populate_tree_from_db(game_browser, "");
+    game_browser->top_widget = create_top_widget(game_list, game_browser);
     gtk_widget_set_parent(game_browser->top_widget, GTK_WIDGET(game_browser));
 
     mem_track_allocation(game_browser);
@@ -643,7 +750,7 @@ vhapp_game_browser_new(struct db_interface* dbi, struct db* db)
 }
 
 void
-vhapp_game_browser_refresh(VhAppGameBrowser* self, struct db_interface* dbi, struct db* db)
+vhapp_game_browser_refresh(VhAppGameBrowser* self)
 {
-    populate_tree_from_db(self->tree, dbi, db);
+    populate_tree_from_db(self, gtk_editable_get_text(GTK_EDITABLE(self->search)));
 }
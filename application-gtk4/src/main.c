@@ -1,3 +1,4 @@
+#include "application/db_worker.h"
 #include "application/game_browser.h"
 
 #include "vh/db.h"
@@ -6,12 +7,16 @@
 #include "vh/init.h"
 #include "vh/log.h"
 #include "vh/mem.h"
+#include "vh/motion_dict.h"
 #include "vh/plugin.h"
 #include "vh/plugin_loader.h"
 
 #include "vh/frame_data.h"
 
 #include <gtk/gtk.h>
+#include <string.h>
+
+#define DB_BUSY_TIMEOUT_MS 5000
 
 #define VHAPP_TYPE_PLUGIN_MODULE (vhapp_plugin_module_get_type())
 G_DECLARE_FINAL_TYPE(VhAppPluginModule, vhapp_plugin_module, VHAPP, PLUGIN_MODULE, GTypeModule)
@@ -71,7 +76,7 @@ track_plugin_widget_deallocation(GtkWidget* self, gpointer user_pointer)
 #endif
 
 static int
-open_plugin(GtkNotebook* center, GtkNotebook* pane, struct vec* plugins, struct db_interface* dbi, struct db* db, struct str_view plugin_name)
+open_plugin(GtkNotebook* center, GtkNotebook* pane, struct vec* plugins, struct db_interface* dbi, struct db* db, struct db_worker* worker, struct str_view plugin_name)
 {
     int insert_pos;
     struct plugin* plugin = vec_emplace(plugins);
@@ -82,7 +87,8 @@ open_plugin(GtkNotebook* center, GtkNotebook* pane, struct vec* plugins, struct
     plugin->plugin_module = g_object_new(VHAPP_TYPE_PLUGIN_MODULE, NULL);
     g_object_ref_sink(plugin->plugin_module);
 
-    plugin->ctx = plugin->lib.i->create(plugin->plugin_module, dbi, db);
+    plugin->ctx = plugin->lib.i->create(plugin->plugin_module,
+            dbi, db, db_worker_interface(), worker);
     if (plugin->ctx == NULL)
         goto create_context_failed;
 
@@ -162,14 +168,18 @@ load_plugin_failed:
 }
 
 static void
-close_plugin(struct plugin* plugin)
+clear_plugin(struct plugin* plugin)
 {
     if (plugin->lib.i->video && plugin->lib.i->video->is_open(plugin->ctx))
         plugin->lib.i->video->close(plugin->ctx);
     
     if (plugin->lib.i->replays)
         plugin->lib.i->replays->clear(plugin->ctx);
+}
 
+static void
+close_plugin(struct plugin* plugin)
+{
     if (plugin->ui_pane)
         plugin->lib.i->ui_pane->destroy(plugin->ctx, plugin->ui_pane);
     if (plugin->ui_center)
@@ -241,6 +251,7 @@ struct on_video_path_ctx
     int64_t frame_offset;
     struct str_view file_name;
     struct path file_path;
+    int update_path_hint;
 };
 
 static int
@@ -279,9 +290,7 @@ on_game_video(int video_id, const char* file_name, const char* path_hint, int64_
     {
         case 1  :
             /* Update path hint, since the hint failed but we found a matchinig file */
-            ctx->dbi->video.set_path_hint(ctx->db,
-                ctx->file_name,
-                path_dirname_view(&ctx->file_path));
+            ctx->update_path_hint = 1;
             return 1;
         case 0  : break;
         default : return -1;
@@ -294,31 +303,80 @@ struct app_activate_ctx
 {
     struct db_interface* dbi;
     struct db* db;
+    struct db_worker* worker;
     struct path current_video_file;
     struct vec plugins;
+    int selection_request;
+};
+
+struct selection
+{
+    struct app_activate_ctx* ctx;
+    struct on_video_path_ctx video_ctx;
+    struct vec game_ids;  /* int */
 };
 
 static void
-on_games_selected(VhAppGameBrowser* game_browser, int* game_ids, int count, gpointer user_pointer)
+selection_destroy(void* user)
+{
+    struct selection* selection = user;
+    vec_deinit(&selection->game_ids);
+    path_deinit(&selection->video_ctx.file_path);
+    mem_free(selection);
+}
+
+/* Runs on the db worker */
+static int
+prepare_selection(struct db_interface* dbi, struct db* db, void* user)
+{
+    struct selection* selection = user;
+    struct on_video_path_ctx* video_ctx = &selection->video_ctx;
+    struct motion_dict* motions;
+    int ret;
+
+    /*
+     * Plugins look up the motions and labels of the selected games. Loading
+     * the dictionary here means that their motion_dict_acquire() on the main
+     * thread only has to check its revision. It stays cached once released.
+     */
+    if ((motions = motion_dict_acquire(dbi, db)) != NULL)
+        motion_dict_release(motions);
+
+    /* Videos are only opened for a single selection */
+    if (vec_count(&selection->game_ids) != 1)
+        return 0;
+
+    video_ctx->dbi = dbi;
+    video_ctx->db = db;
+    ret = dbi->game.get_videos(db, *(int*)vec_front(&selection->game_ids), on_game_video, video_ctx);
+    if (ret <= 0)
+    {
+        path_clear(&video_ctx->file_path);
+        return ret;
+    }
+
+    /* Writing while get_videos() is still reading could fail if the main
+     * thread's connection wrote in the meantime */
+    if (video_ctx->update_path_hint)
+        dbi->video.set_path_hint(db,
+            path_basename_view(&video_ctx->file_path),
+            path_dirname_view(&video_ctx->file_path));
+
+    return ret;
+}
+
+static void
+select_games(struct app_activate_ctx* ctx, const int* game_ids, int count, struct path* video_path)
 {
     int reuse_video = 0;
-    struct app_activate_ctx* ctx = user_pointer;
-    struct on_video_path_ctx video_ctx = {
-        ctx->dbi,
-        ctx->db
-    };
-    path_init(&video_ctx.file_path);
 
     /*
-     * If this is a single selection, try to find the video associate with this
-     * game ID. It's pretty common that multiple games are recorded in a single
-     * video, so we try to avoid re-opening the same video if possible, because
-     * it takes quite a bit of time.
+     * It's pretty common that multiple games are recorded in a single video,
+     * so we try to avoid re-opening the same video if possible, because it
+     * takes quite a bit of time.
      */
-    if (count == 1)
-        if (ctx->dbi->game.get_videos(ctx->db, game_ids[0], on_game_video, &video_ctx) > 0)
-            if (str_equal(path_view(ctx->current_video_file), path_view(video_ctx.file_path)))
-                reuse_video = 1;
+    if (video_path->str.len && str_equal(path_view(ctx->current_video_file), path_view(*video_path)))
+        reuse_video = 1;
 
     /* Close all open video files */
     if (!reuse_video)
@@ -347,7 +405,7 @@ on_games_selected(VhAppGameBrowser* game_browser, int* game_ids, int count, gpoi
         VEC_FOR_EACH(&ctx->plugins, struct plugin, plugin)
             struct plugin_interface* i = plugin->lib.i;
             if (i->replays)
-                i->replays->select(plugin->ctx, game_ids, count);
+                i->replays->select(plugin->ctx, (int*)game_ids, count);
         VEC_END_EACH
     }
 
@@ -357,9 +415,9 @@ on_games_selected(VhAppGameBrowser* game_browser, int* game_ids, int count, gpoi
             continue;
 
         /* Open video file and update current video path */
-        if (!reuse_video && video_ctx.file_path.str.len)
-            if (i->video->open_file(plugin->ctx, video_ctx.file_path.str.data) == 0)
-                path_set_take(&ctx->current_video_file, &video_ctx.file_path);
+        if (!reuse_video && video_path->str.len)
+            if (i->video->open_file(plugin->ctx, video_path->str.data) == 0)
+                path_set_take(&ctx->current_video_file, video_path);
 
         /* Seek to beginning */
         if (i->video->is_open(plugin->ctx))
@@ -373,8 +431,63 @@ on_games_selected(VhAppGameBrowser* game_browser, int* game_ids, int count, gpoi
             i->video->clear(plugin->ctx);
         }
     VEC_END_EACH
+}
+
+static void
+on_selection_prepared(int result, void* user)
+{
+    struct selection* selection = user;
+    struct app_activate_ctx* ctx = selection->ctx;
+
+    ctx->selection_request = 0;
+    select_games(ctx,
+        vec_data(&selection->game_ids),
+        (int)vec_count(&selection->game_ids),
+        &selection->video_ctx.file_path);
+}
+
+static void
+on_games_selected(VhAppGameBrowser* game_browser, int* game_ids, int count, gpointer user_pointer)
+{
+    struct app_activate_ctx* ctx = user_pointer;
+    struct selection* selection;
+    struct path no_video;
+    int i;
+
+    /* The previous selection is stale */
+    db_worker_cancel(ctx->worker, ctx->selection_request);
+    ctx->selection_request = 0;
 
-    path_deinit(&video_ctx.file_path);
+    /*
+     * Loading the motion dictionary and searching the video paths of a single
+     * selection touch the database and the disk, so they are done on the db
+     * worker before the plugins are told about the selection.
+     */
+    if ((selection = mem_alloc(sizeof *selection)) != NULL)
+    {
+        memset(selection, 0, sizeof *selection);
+        selection->ctx = ctx;
+        path_init(&selection->video_ctx.file_path);
+        vec_init(&selection->game_ids, sizeof(int));
+        for (i = 0; i != count; ++i)
+            if (vec_push(&selection->game_ids, &game_ids[i]) < 0)
+                break;
+
+        if (i == count)
+        {
+            ctx->selection_request = db_worker_submit(ctx->worker, DB_WORKER_HIGH,
+                prepare_selection, on_selection_prepared, selection, selection_destroy);
+            if (ctx->selection_request > 0)
+                return;
+            ctx->selection_request = 0;
+        }
+
+        selection_destroy(selection);
+    }
+
+    path_init(&no_video);
+    select_games(ctx, game_ids, count, &no_video);
+    path_deinit(&no_video);
 }
 
 static void
@@ -396,7 +509,7 @@ activate(GtkApplication* app, gpointer user_data)
     plugin_view = plugin_view_new(&ctx->plugins);
     property_panel = property_panel_new(&ctx->plugins);
 
-    game_browser = vhapp_game_browser_new(ctx->dbi, ctx->db);
+    game_browser = vhapp_game_browser_new(ctx->worker);
     g_signal_connect(game_browser, "games-selected", G_CALLBACK(on_games_selected), ctx);
 
     paned2 = gtk_paned_new(GTK_ORIENTATION_HORIZONTAL);
@@ -418,11 +531,11 @@ activate(GtkApplication* app, gpointer user_data)
     gtk_widget_set_visible(window, 1);
 
     /*open_plugin(GTK_NOTEBOOK(plugin_view), GTK_NOTEBOOK(property_panel),
-            &ctx->plugins, ctx->dbi, ctx->db, cstr_view("AI Tool"));*/
+            &ctx->plugins, ctx->dbi, ctx->db, ctx->worker, cstr_view("AI Tool"));*/
     open_plugin(GTK_NOTEBOOK(plugin_view), GTK_NOTEBOOK(property_panel),
-            &ctx->plugins, ctx->dbi, ctx->db, cstr_view("VOD Review"));
+            &ctx->plugins, ctx->dbi, ctx->db, ctx->worker, cstr_view("VOD Review"));
     open_plugin(GTK_NOTEBOOK(plugin_view), GTK_NOTEBOOK(property_panel),
-            &ctx->plugins, ctx->dbi, ctx->db, cstr_view("Search"));
+            &ctx->plugins, ctx->dbi, ctx->db, ctx->worker, cstr_view("Search"));
 }
 
 int main(int argc, char** argv)
@@ -441,7 +554,10 @@ int main(int argc, char** argv)
     struct db* db = dbi->open("vodhound.db");
     if (db == NULL)
         goto open_db_failed;
-    if (dbi->migrate_to(db, 1) != 0)
+    /* The db worker writes too, so writes on this connection may have to wait */
+    if (dbi->connection.enable_wal(db, DB_BUSY_TIMEOUT_MS) < 0)
+        goto enable_wal_failed;
+    if (dbi->migrate_to(db, 7) != 0)
         goto migrate_db_failed;
 
     if (reinit_db)
@@ -456,10 +572,16 @@ int main(int argc, char** argv)
         //import_reframed_path(dbi, db, "/home/thecomet/videos/ssbu/2023-11-11 - Smash Hammered #10/reframed");
     }
 
+    /* Queries the UI waits on run on a second connection */
+    ctx.worker = db_worker_start(dbi, "vodhound.db");
+    if (ctx.worker == NULL)
+        goto start_worker_failed;
+
     app = gtk_application_new("ch.thecomet.vodhound", G_APPLICATION_DEFAULT_FLAGS);
 
     ctx.dbi = dbi;
     ctx.db = db;
+    ctx.selection_request = 0;
     path_init(&ctx.current_video_file);
     vec_init(&ctx.plugins, sizeof(struct plugin));
 
@@ -467,20 +589,34 @@ int main(int argc, char** argv)
     status = g_application_run(G_APPLICATION(app), argc, argv);
     g_object_unref(app);
 
+    /*
+     * Plugins may still cancel requests while they are cleared. The worker is
+     * stopped before unloading them, because queued requests call into their
+     * code.
+     */
+    VEC_FOR_EACH(&ctx.plugins, struct plugin, plugin)
+        clear_plugin(plugin);
+    VEC_END_EACH
+    db_worker_stop(ctx.worker);
     VEC_FOR_EACH(&ctx.plugins, struct plugin, plugin)
         close_plugin(plugin);
     VEC_END_EACH
     vec_deinit(&ctx.plugins);
     path_deinit(&ctx.current_video_file);
 
+    /* Only available if vh was built with VH_DB_PROFILING */
+    if (dbi->dump_stats)
+        dbi->dump_stats(db);
     dbi->close(db);
     vh_deinit();
     vh_threadlocal_deinit();
 
     return status;
 
-migrate_db_failed : dbi->close(db);
-open_db_failed    : vh_deinit();
-vh_init_failed    : vh_threadlocal_deinit();
-vh_init_tl_failed : return -1;
+start_worker_failed :
+migrate_db_failed   :
+enable_wal_failed   : dbi->close(db);
+open_db_failed      : vh_deinit();
+vh_init_failed      : vh_threadlocal_deinit();
+vh_init_tl_failed   : return -1;
 }
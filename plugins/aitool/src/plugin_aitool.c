@@ -1,10 +1,12 @@
 #include "aitool/db.h"
 
 #include "vh/db.h"
+#include "vh/db_worker.h"
 #include "vh/frame_data.h"
 #include "vh/fs.h"
 #include "vh/log.h"
 #include "vh/mem.h"
+#include "vh/motion_dict.h"
 #include "vh/plugin.h"
 #include "vh/plugin_loader.h"
 
@@ -228,10 +230,17 @@ struct plugin_ctx
     GTypeModule* type_module;
     struct db_interface* dbi;
     struct db* db;
+    struct db_worker_interface* dbwi;
+    struct db_worker* dbw;
 
+    /* Only used on the db worker once it's opened */
     struct aidb_interface* aidbi;
     struct aidb* aidb;
 
+    /* Outstanding db worker requests, or 0 */
+    int select_request;
+    int labels_request;
+
     int64_t game_offset;
     int game_id;
     int video_id;
@@ -239,6 +248,7 @@ struct plugin_ctx
     int fighter_ids[8];
 
     struct frame_data fdata;
+    struct motion_dict* motions;  /* Acquired when a replay is selected, or NULL */
 
     /* These are loaded from the video player plugin */
     struct plugin_lib video_plugin;
@@ -256,7 +266,8 @@ static int on_scan_plugin(struct plugin_lib lib, void* user)
     if (cstr_equal(cstr_view("FFmpeg Video Player"), lib.i->info->name))
     {
         ctx->video_plugin = lib;
-        ctx->video_ctx = ctx->video_plugin.i->create(ctx->type_module, ctx->dbi, ctx->db);
+        ctx->video_ctx = ctx->video_plugin.i->create(
+            ctx->type_module, ctx->dbi, ctx->db, ctx->dbwi, ctx->dbw);
         if (ctx->video_ctx == NULL)
         {
             log_err("Failed to load FFmpeg video player plugin!\n");
@@ -270,13 +281,18 @@ static int on_scan_plugin(struct plugin_lib lib, void* user)
 
 static int aidb_init_refs = 0;
 static struct plugin_ctx*
-create(GTypeModule* type_module, struct db_interface* dbi, struct db* db)
+create(
+        GTypeModule* type_module,
+        struct db_interface* dbi, struct db* db,
+        struct db_worker_interface* dbwi, struct db_worker* dbw)
 {
     struct plugin_ctx* ctx = mem_alloc(sizeof(struct plugin_ctx));
 
     ctx->type_module = type_module;
     ctx->dbi = dbi;
     ctx->db = db;
+    ctx->dbwi = dbwi;
+    ctx->dbw = dbw;
 
     if (aidb_init_refs++ == 0)
         if (aidb_init() < 0)
@@ -293,7 +309,13 @@ create(GTypeModule* type_module, struct db_interface* dbi, struct db* db)
     if (ctx->aidbi->migrate_to(ctx->aidb, 1) < 0)
         goto migrate_aidb_failed;
 
+    ctx->select_request = 0;
+    ctx->labels_request = 0;
+    ctx->game_id = -1;
+    ctx->fighter_idx = 0;
+
     frame_data_init(&ctx->fdata);
+    ctx->motions = NULL;
 
     ctx->video_plugin.handle = NULL;
     ctx->video_ctx = NULL;
@@ -315,9 +337,15 @@ init_aidb_failed:
     return NULL;
 }
 
+/*
+ * The application stops the db worker before destroying plugins, so all
+ * label writes are done and no request can touch aidb anymore.
+ */
 static void
 destroy(GTypeModule* type_module, struct plugin_ctx* ctx)
 {
+    if (ctx->motions)
+        motion_dict_release(ctx->motions);
     frame_data_deinit(&ctx->fdata);
 
     ctx->video_plugin.i->destroy(type_module, ctx->video_ctx);
@@ -600,20 +628,56 @@ drag_update(GtkGestureDrag* gesture, double x, double y, struct plugin_ctx* ctx)
     gtk_gl_area_queue_render(GTK_GL_AREA(ctx->center.video_canvas));
 }
 
+/* Runs on the db worker */
+struct label_write
+{
+    struct aidb_interface* aidbi;
+    struct aidb* aidb;
+    int game_id;
+    int video_id;
+    int fighter_id;
+    int64_t video_offset;
+    uint64_t hash40;
+    struct rect rect;
+    unsigned remove : 1;
+};
+
+static int
+write_label(struct db_interface* dbi, struct db* db, void* user)
+{
+    struct label_write* w = user;
+    if (w->remove)
+        return w->aidbi->label.remove(w->aidb,
+            w->game_id, w->video_id, w->fighter_id, w->video_offset);
+    return w->aidbi->label.add_or_update(w->aidb,
+        w->game_id, w->video_id, w->fighter_id, w->video_offset, w->hash40,
+        w->rect.center.x, w->rect.center.y, w->rect.dims.x, w->rect.dims.y);
+}
+
 static void
 drag_end(GtkGestureDrag* gesture, double x, double y, struct plugin_ctx* ctx)
 {
     struct video_player_interface* vi = ctx->video_plugin.i->video;
     int64_t video_offset = vi->offset(ctx->video_ctx, 1, 60);
     struct center* c = &ctx->center;
+    struct label_write* w;
 
+    if (c->drag_rect == NULL)
+        return;
     drag_update_rect(x, y, ctx);
 
+    w = mem_alloc(sizeof *w);
+    w->aidbi = ctx->aidbi;
+    w->aidb = ctx->aidb;
+    w->game_id = ctx->game_id;
+    w->video_id = ctx->video_id;
+    w->fighter_id = ctx->fighter_ids[ctx->fighter_idx];
+    w->video_offset = video_offset;
+    w->rect = *c->drag_rect;
+
     if (c->drag_rect->dims.x < 10 || c->drag_rect->dims.y < 10)
     {
-        ctx->aidbi->label.remove(ctx->aidb, ctx->game_id, ctx->video_id,
-            ctx->fighter_ids[ctx->fighter_idx], video_offset);
-
+        w->remove = 1;
         vec_erase_index(&ctx->gfx.rects,
             vec_find(&ctx->gfx.rects, c->drag_rect));
     }
@@ -621,22 +685,19 @@ drag_end(GtkGestureDrag* gesture, double x, double y, struct plugin_ctx* ctx)
     {
         const uint64_t* motions = ctx->fdata.motion[ctx->fighter_idx];
         int frame = video_offset - ctx->game_offset;
-
-        ctx->aidbi->label.add_or_update(ctx->aidb, ctx->game_id, ctx->video_id,
-            ctx->fighter_ids[ctx->fighter_idx], video_offset, motions[frame],
-            c->drag_rect->center.x, c->drag_rect->center.y,
-            c->drag_rect->dims.x, c->drag_rect->dims.y);
+        w->remove = 0;
+        w->hash40 = motions[frame];
     }
+    c->drag_rect = NULL;
 
-    gtk_gl_area_queue_render(GTK_GL_AREA(c->video_canvas));
-}
+    /*
+     * Same priority as the reads, so that labels are always read back after
+     * they were written. Writes are never cancelled.
+     */
+    if (ctx->dbwi->submit(ctx->dbw, DB_WORKER_HIGH, write_label, NULL, w, mem_free) < 0)
+        mem_free(w);
 
-static int
-on_motion_string(const char* string, void* user_data)
-{
-    GtkLabel* label = GTK_LABEL(user_data);
-    gtk_label_set_text(label, string);
-    return 1;
+    gtk_gl_area_queue_render(GTK_GL_AREA(c->video_canvas));
 }
 
 static void
@@ -644,10 +705,19 @@ update_pane_frame_data(struct plugin_ctx* ctx)
 {
     struct video_player_interface* vi = ctx->video_plugin.i->video;
     void* vctx = ctx->video_ctx;
-    const uint64_t* motions = ctx->fdata.motion[ctx->fighter_idx];
+    const uint64_t* motions;
     int frame = vi->offset(vctx, 1, 60) - ctx->game_offset;
+    const char* string;
 
-    if (ctx->dbi->motion.string(ctx->db, motions[frame], on_motion_string, ctx->pane.string) != 1)
+    /* Frame data arrives after the replay was selected */
+    if (ctx->fighter_idx >= ctx->fdata.fighter_count || frame < 0 || frame >= ctx->fdata.frame_count)
+        return;
+
+    motions = ctx->fdata.motion[ctx->fighter_idx];
+    string = ctx->motions ? motion_dict_string(ctx->motions, motions[frame]) : NULL;
+    if (string)
+        gtk_label_set_text(ctx->pane.string, string);
+    else
     {
         char buf[sizeof("0x1122334455667788")];
         sprintf(buf, "0x%" PRIx64, motions[frame]);
@@ -655,50 +725,133 @@ update_pane_frame_data(struct plugin_ctx* ctx)
     }
 }
 
-struct on_label_data_ctx
+struct label_range
 {
-    struct vec* rects;
+    struct plugin_ctx* ctx;  /* Only used on the main thread */
+    struct aidb_interface* aidbi;
+    struct aidb* aidb;
+    int game_id;
+    int video_id;
+    int fighter_id;
     int64_t video_offset;
+    struct vec rects;
 };
 
+static void
+label_range_destroy(void* user)
+{
+    struct label_range* range = user;
+    vec_deinit(&range->rects);
+    mem_free(range);
+}
+
 static int
 on_label_data(int64_t video_offset, uint64_t hash40, int cx, int cy, int w, int h, void* user)
 {
-    struct on_label_data_ctx* ctx = user;
-    struct rect* r = vec_emplace(ctx->rects);
+    struct label_range* range = user;
+    struct rect* r = vec_emplace(&range->rects);
+    if (r == NULL)
+        return -1;
     r->center.x = cx;
     r->center.y = cy;
     r->dims.x = w;
     r->dims.y = h;
     r->color =
-        video_offset > ctx->video_offset ? RECT_COLOR_NEXT :
-        video_offset < ctx->video_offset ? RECT_COLOR_PREV :
+        video_offset > range->video_offset ? RECT_COLOR_NEXT :
+        video_offset < range->video_offset ? RECT_COLOR_PREV :
         RECT_COLOR_CURRENT;
     return 0;
 }
 
+/* Runs on the db worker */
+static int
+load_label_range(struct db_interface* dbi, struct db* db, void* user)
+{
+    struct label_range* range = user;
+    return range->aidbi->label.get_range(
+        range->aidb, range->game_id, range->video_id, range->fighter_id,
+        range->video_offset - 10, range->video_offset + 10,
+        on_label_data, range);
+}
+
 static void
-update_rects_for_frame(struct plugin_ctx* ctx)
+on_label_range_loaded(int result, void* user)
 {
-    struct video_player_interface* vi = ctx->video_plugin.i->video;
-    void* vctx = ctx->video_ctx;
-    const uint64_t* motions = ctx->fdata.motion[ctx->fighter_idx];
-    int64_t video_offset = vi->offset(vctx, 1, 60);
+    struct label_range* range = user;
+    struct plugin_ctx* ctx = range->ctx;
 
-    struct on_label_data_ctx label_data_ctx = {
-        &ctx->gfx.rects,
-        video_offset
-    };
+    ctx->labels_request = 0;
+    if (result < 0)
+        return;
 
+    /* A rectangle that is being dragged points into the old list */
+    ctx->center.drag_rect = NULL;
     vec_clear(&ctx->gfx.rects);
-    ctx->aidbi->label.get_range(
-        ctx->aidb, ctx->game_id, ctx->video_id, ctx->fighter_ids[ctx->fighter_idx],
-        video_offset - 10, video_offset + 10,
-        on_label_data, &label_data_ctx);
+    VEC_FOR_EACH(&range->rects, struct rect, r)
+        vec_push(&ctx->gfx.rects, r);
+    VEC_END_EACH
 
     gtk_gl_area_queue_render(GTK_GL_AREA(ctx->center.video_canvas));
 }
 
+static void
+update_rects_for_frame(struct plugin_ctx* ctx)
+{
+    struct video_player_interface* vi = ctx->video_plugin.i->video;
+    struct label_range* range;
+
+    /* The labels of the previous frame are no longer needed */
+    ctx->dbwi->cancel(ctx->dbw, ctx->labels_request);
+    ctx->labels_request = 0;
+
+    if (ctx->game_id < 0 || ctx->fighter_idx >= ctx->fdata.fighter_count)
+        return;
+
+    range = mem_alloc(sizeof *range);
+    range->ctx = ctx;
+    range->aidbi = ctx->aidbi;
+    range->aidb = ctx->aidb;
+    range->game_id = ctx->game_id;
+    range->video_id = ctx->video_id;
+    range->fighter_id = ctx->fighter_ids[ctx->fighter_idx];
+    range->video_offset = vi->offset(ctx->video_ctx, 1, 60);
+    vec_init(&range->rects, sizeof(struct rect));
+
+    ctx->labels_request = ctx->dbwi->submit(ctx->dbw, DB_WORKER_HIGH,
+        load_label_range, on_label_range_loaded, range, label_range_destroy);
+    if (ctx->labels_request < 0)
+    {
+        ctx->labels_request = 0;
+        label_range_destroy(range);
+    }
+}
+
+struct frame_offset_write
+{
+    int game_id;
+    int video_id;
+    int64_t frame_offset;
+};
+
+/* Runs on the db worker */
+static int
+write_frame_offset(struct db_interface* dbi, struct db* db, void* user)
+{
+    struct frame_offset_write* w = user;
+    return dbi->game.set_frame_offset(db, w->game_id, w->video_id, w->frame_offset);
+}
+
+static void
+save_game_offset(struct plugin_ctx* ctx)
+{
+    struct frame_offset_write* w = mem_alloc(sizeof *w);
+    w->game_id = ctx->game_id;
+    w->video_id = ctx->video_id;
+    w->frame_offset = ctx->game_offset;
+    if (ctx->dbwi->submit(ctx->dbw, DB_WORKER_HIGH, write_frame_offset, NULL, w, mem_free) < 0)
+        mem_free(w);
+}
+
 static gboolean
 shortcut_prev_frame(GtkWidget* widget, GVariant* unused, gpointer user_pointer)
 {
@@ -730,7 +883,7 @@ shortcut_prev_frame_adj(GtkWidget* widget, GVariant* unused, gpointer user_point
     ctx->game_offset--;
     vi->seek(vctx, ctx->game_offset + offset, 1, 60);
 
-    ctx->dbi->game.set_frame_offset(ctx->db, ctx->game_id, ctx->video_id, ctx->game_offset);
+    save_game_offset(ctx);
     update_pane_frame_data(ctx);
     update_rects_for_frame(ctx);
 
@@ -748,7 +901,7 @@ shortcut_next_frame_adj(GtkWidget* widget, GVariant* unused, gpointer user_point
     ctx->game_offset++;
     vi->seek(vctx, ctx->game_offset + offset, 1, 60);
 
-    ctx->dbi->game.set_frame_offset(ctx->db, ctx->game_id, ctx->video_id, ctx->game_offset);
+    save_game_offset(ctx);
     update_pane_frame_data(ctx);
     update_rects_for_frame(ctx);
 
@@ -943,7 +1096,10 @@ static void on_fighter_changed(GtkComboBox* self, gpointer user_data)
 {
     struct plugin_ctx* ctx = user_data;
     ctx->fighter_idx = gtk_combo_box_get_active(self);
+    if (ctx->fighter_idx < 0)
+        ctx->fighter_idx = 0;
     update_pane_frame_data(ctx);
+    update_rects_for_frame(ctx);
 }
 
 static GtkWidget* ui_pane_create(struct plugin_ctx* ctx)
@@ -995,42 +1151,159 @@ static struct ui_pane_interface ui_pane = {
     ui_pane_destroy
 };
 
+struct fighter_name
+{
+    int fighter_id;
+    char name[64];
+};
+
+struct selection
+{
+    struct plugin_ctx* ctx;  /* Only used on the main thread */
+    int game_id;
+    int video_id;
+    int64_t game_offset;
+    struct frame_data fdata;
+    struct motion_dict* motions;
+    struct vec fighters;  /* struct fighter_name */
+};
+
+static void
+selection_destroy(void* user)
+{
+    struct selection* selection = user;
+    vec_deinit(&selection->fighters);
+    if (selection->motions)
+        motion_dict_release(selection->motions);
+    frame_data_deinit(&selection->fdata);
+    mem_free(selection);
+}
+
 static int on_game_video(int video_id, const char* file_name, const char* path_hint, int64_t frame_offset, void* user)
 {
-    struct plugin_ctx* ctx = user;
-    ctx->video_id = video_id;
-    ctx->game_offset = frame_offset;
+    struct selection* selection = user;
+    selection->video_id = video_id;
+    selection->game_offset = frame_offset;
     return 1;
 }
 
 static int on_game_player_and_fighter(const char* player, int fighter_id, const char* fighter, void* user)
 {
-    struct plugin_ctx* ctx = user;
-    char buf[64];
-    snprintf(buf, 64, "%s (%s)", player, fighter);
-    gtk_combo_box_text_append_text(ctx->pane.fighter, buf);
+    struct selection* selection = user;
+    struct fighter_name* name;
+
+    /* There are only as many fighter IDs as the combo box can show */
+    if (vec_count(&selection->fighters) == 8)
+        return 1;
 
-    ctx->fighter_ids[ctx->fighter_idx++] = fighter_id;
+    name = vec_emplace(&selection->fighters);
+    if (name == NULL)
+        return -1;
+    name->fighter_id = fighter_id;
+    snprintf(name->name, sizeof(name->name), "%s (%s)", player, fighter);
 
     return 0;
 }
 
-static void replay_select(struct plugin_ctx* ctx, const int* game_ids, int count)
+/* Runs on the db worker */
+static int
+load_selection(struct db_interface* dbi, struct db* db, void* user)
 {
+    struct selection* selection = user;
+
     /* Figure out where in the video the game starts. We use this to seek correctly */
-    ctx->game_offset = 0;  /* default */
-    ctx->video_id = -1;
-    ctx->game_id = game_ids[0];
-    ctx->dbi->game.get_videos(ctx->db, game_ids[0], on_game_video, ctx);
+    if (dbi->game.get_videos(db, selection->game_id, on_game_video, selection) < 0)
+        return -1;
+
+    /* Games without frame data can still be labelled */
+    frame_data_load(&selection->fdata, selection->game_id);
+
+    /* Motion names are looked up on every frame, so they are kept in memory */
+    selection->motions = motion_dict_acquire(dbi, db);
+
+    if (dbi->game.get_player_and_fighter_names(db, selection->game_id, on_game_player_and_fighter, selection) < 0)
+        return -1;
+
+    return 0;
+}
 
-    frame_data_load(&ctx->fdata, game_ids[0]);
+static void
+on_selection_loaded(int result, void* user)
+{
+    struct selection* selection = user;
+    struct plugin_ctx* ctx = selection->ctx;
+    struct video_player_interface* vi = ctx->video_plugin.i->video;
+    int i;
 
+    ctx->select_request = 0;
+    if (result < 0)
+        return;
+
+    ctx->game_id = selection->game_id;
+    ctx->video_id = selection->video_id;
+    ctx->game_offset = selection->game_offset;
+
+    frame_data_deinit(&ctx->fdata);
+    ctx->fdata = selection->fdata;
+    frame_data_init(&selection->fdata);
+
+    if (ctx->motions)
+        motion_dict_release(ctx->motions);
+    ctx->motions = selection->motions;
+    selection->motions = NULL;
+
+    for (i = 0; i != (int)vec_count(&selection->fighters); ++i)
+    {
+        const struct fighter_name* name = vec_get(&selection->fighters, i);
+        ctx->fighter_ids[i] = name->fighter_id;
+        gtk_combo_box_text_append_text(ctx->pane.fighter, name->name);
+    }
+
+    /*
+     * The application seeked to the start of the game before the game's
+     * offset into the video was known.
+     */
+    if (vi->is_open(ctx->video_ctx))
+        vi->seek(ctx->video_ctx, ctx->game_offset, 1, 60);
+
+    /* Selects the first fighter, which updates the pane and the labels */
     ctx->fighter_idx = 0;
-    ctx->dbi->game.get_player_and_fighter_names(ctx->db, game_ids[0], on_game_player_and_fighter, ctx);
     gtk_combo_box_set_active(GTK_COMBO_BOX(ctx->pane.fighter), 0);
 }
+
+static void replay_select(struct plugin_ctx* ctx, const int* game_ids, int count)
+{
+    struct selection* selection;
+
+    ctx->dbwi->cancel(ctx->dbw, ctx->select_request);
+    ctx->select_request = 0;
+
+    selection = mem_alloc(sizeof *selection);
+    selection->ctx = ctx;
+    selection->game_id = game_ids[0];
+    selection->video_id = -1;
+    selection->game_offset = 0;  /* default */
+    frame_data_init(&selection->fdata);
+    selection->motions = NULL;
+    vec_init(&selection->fighters, sizeof(struct fighter_name));
+
+    ctx->select_request = ctx->dbwi->submit(ctx->dbw, DB_WORKER_HIGH,
+        load_selection, on_selection_loaded, selection, selection_destroy);
+    if (ctx->select_request < 0)
+    {
+        ctx->select_request = 0;
+        selection_destroy(selection);
+    }
+}
 static void replay_clear(struct plugin_ctx* ctx)
 {
+    ctx->dbwi->cancel(ctx->dbw, ctx->select_request);
+    ctx->dbwi->cancel(ctx->dbw, ctx->labels_request);
+    ctx->select_request = 0;
+    ctx->labels_request = 0;
+
+    ctx->game_id = -1;
+    ctx->fighter_idx = 0;
     gtk_combo_box_text_remove_all(ctx->pane.fighter);
     frame_data_clear(&ctx->fdata);
 }
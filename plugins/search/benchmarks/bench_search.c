@@ -0,0 +1,363 @@
+#include "search/asm.h"
+#include "search/ast.h"
+#include "search/ast_post.h"
+#include "search/bitnfa.h"
+#include "search/dfa.h"
+#include "search/explain.h"
+#include "search/nfa.h"
+#include "search/parser.h"
+#include "search/query_cache.h"
+#include "search/symbol.h"
+
+#include "vh/hash40.h"
+#include "vh/init.h"
+#include "vh/mem.h"
+#include "vh/time.h"
+#include "vh/vec.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+/*
+ * Measures how long each stage of compiling a query takes and how many
+ * symbols per second every engine searches. Each query runs on two streams:
+ * A "zipf" stream where a few common motions make up most of the symbols,
+ * like in real replays, and a "uniform" stream of mostly unrelated motions
+ * where matches are rare and the prefilter can skip most of the stream.
+ *
+ * Usage: search-benchmarks [query...]
+ * Without arguments, a built-in set of queries is used.
+ */
+
+#define STREAM_LENGTH       200000
+#define UNIFORM_MOTIONS     1024
+#define MIN_SCAN_US         200000  /* Repeat each scan for at least this long */
+
+/* Roughly ordered from most to least common */
+static const char* motion_names[] = {
+    "wait_1", "run", "dash", "jump_f", "fall", "landing_light", "attack_air_n",
+    "landing_air_n", "turn_dash", "guard_on", "guard_off", "jump_b",
+    "jump_aerial_f", "attack_air_f", "landing_air_f", "attack_air_b",
+    "landing_air_b", "escape_air", "special_hi", "special_n", "special_s",
+    "special_lw", "attack_11", "attack_dash", "attack_s3_s", "attack_hi3",
+    "attack_lw3", "catch", "catch_dash", "throw_f", "throw_b", "throw_hi",
+    "throw_lw", "escape_f", "escape_b", "cliff_catch", "cliff_wait",
+    "cliff_jump_quick_1", "cliff_attack_quick", "attack_air_hi",
+    "attack_air_lw", "attack_s4_s", "attack_hi4", "attack_lw4", "damage_hi_1",
+    "damage_air_1", "squat", "pass", "walk_fast",
+};
+
+#define MOTION_COUNT ((int)(sizeof(motion_names) / sizeof(*motion_names)))
+
+static const char* default_queries[] = {
+    /* Realistic */
+    "attack_air_n -> attack_air_f",
+    "jump_f -> attack_air_n -> landing_air_n",
+    "cliff_catch -> (cliff_jump_quick_1 | escape_f | cliff_attack_quick)",
+    "dash -> (attack_dash | catch_dash)",
+    "(attack_air_n | attack_air_f | attack_air_b)+ -> landing_light",
+    "guard_on -> guard_off -> (attack_air_n | special_hi)",
+    /* Synthetic */
+    ". -> . -> . -> special_hi",
+    "(jump_f | jump_b)* -> (attack_air_n | attack_air_f){2,4}",
+    "((dash | run) -> .){2,5} -> catch",
+    "(. -> .)+ -> throw_f",
+    NULL
+};
+
+struct stream
+{
+    const char* name;
+    union symbol* symbols;
+    int count;
+};
+
+struct engines
+{
+    struct compiled_query query;  /* What a search uses, with the prefilter */
+    struct dfa_table dfa;
+    struct asm_dfa assembly;
+    struct bitnfa bitnfa;
+    uint64_t bitnfa_us;  /* Compile times of the separately compiled engines */
+    uint64_t dfa_us;
+    uint64_t asm_us;
+};
+
+typedef int (*scan_func)(struct vec* ranges, const struct engines* engines, const union symbol* symbols, struct range window);
+
+static uint32_t
+rng_next(uint32_t* state)
+{
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 8) & 0xFFFFFF;
+}
+
+static void
+make_zipf_stream(union symbol* symbols, int count, uint32_t seed)
+{
+    double weights[MOTION_COUNT];
+    double total = 0.0;
+    int i, m;
+
+    for (m = 0; m != MOTION_COUNT; ++m)
+        total += weights[m] = 1.0 / (m + 1);
+
+    for (i = 0; i != count; ++i)
+    {
+        double r = (double)rng_next(&seed) / 0x1000000 * total;
+        for (m = 0; m != MOTION_COUNT - 1; ++m)
+            if ((r -= weights[m]) < 0.0)
+                break;
+        symbols[i] = symbol_make(hash40_cstr(motion_names[m]));
+    }
+}
+
+static void
+make_uniform_stream(union symbol* symbols, int count, uint32_t seed)
+{
+    int i;
+    for (i = 0; i != count; ++i)
+    {
+        uint32_t r = rng_next(&seed) % (UNIFORM_MOTIONS + MOTION_COUNT);
+        symbols[i] = r < MOTION_COUNT ?
+            symbol_make(hash40_cstr(motion_names[r])) :
+            symbol_make(0x100000 + r);
+    }
+}
+
+static int
+scan_dfa(struct vec* ranges, const struct engines* engines, const union symbol* symbols, struct range window)
+{
+    if (dfa_find_all(ranges, &engines->dfa, symbols, window) < 0)
+        return -1;
+    return (int)vec_count(ranges);
+}
+
+static int
+scan_asm(struct vec* ranges, const struct engines* engines, const union symbol* symbols, struct range window)
+{
+    if (asm_find_all(ranges, &engines->assembly, symbols, window) < 0)
+        return -1;
+    return (int)vec_count(ranges);
+}
+
+static int
+scan_bitnfa(struct vec* ranges, const struct engines* engines, const union symbol* symbols, struct range window)
+{
+    if (bitnfa_find_all(ranges, &engines->bitnfa, symbols, window) < 0)
+        return -1;
+    return (int)vec_count(ranges);
+}
+
+static int
+scan_search(struct vec* ranges, const struct engines* engines, const union symbol* symbols, struct range window)
+{
+    struct scan_profile profile;
+    return explain_scan(&profile, &engines->query, symbols, window, 0);
+}
+
+/*
+ * Runs the scan repeatedly until at least MIN_SCAN_US have passed.
+ * \return Returns millions of symbols per second, or negative on error.
+ */
+static double
+measure(scan_func scan, const struct engines* engines, const struct stream* stream, int* matches)
+{
+    struct vec ranges;
+    struct range window = { 0, stream->count };
+    uint64_t start = time_get_us();
+    uint64_t elapsed;
+    int runs = 0;
+
+    vec_init(&ranges, sizeof(struct range));
+    do
+    {
+        vec_clear(&ranges);
+        *matches = scan(&ranges, engines, stream->symbols, window);
+        if (*matches < 0)
+            break;
+        runs++;
+        elapsed = time_get_us() - start;
+    } while (elapsed < MIN_SCAN_US);
+    vec_deinit(&ranges);
+
+    if (*matches < 0)
+        return -1.0;
+    return (double)stream->count * runs / (double)(elapsed ? elapsed : 1);
+}
+
+static int
+engines_compile(struct engines* engines, struct parser* parser, const char* text)
+{
+    struct nfa_graph nfa;
+    struct query_stats* stats = &engines->query.stats;
+    uint64_t t = time_get_us();
+
+    if (parser_parse(parser, text, &engines->query.ast) < 0)
+        goto parse_failed;
+    stats->stage_us[QUERY_STAGE_PARSE] = time_get_us() - t;
+
+    t = time_get_us();
+    ast_post_hash40_remaining_labels(&engines->query.ast);
+    stats->stage_us[QUERY_STAGE_LABELS] = time_get_us() - t;
+
+    if (compiled_query_build(&engines->query, 0) < 0)
+        goto build_failed;
+
+    /* Every engine is compiled separately so they can be compared */
+    nfa_init(&nfa);
+    if (nfa_compile(&nfa, &engines->query.ast) < 0)
+        goto nfa_compile_failed;
+    t = time_get_us();
+    if (bitnfa_from_nfa(&engines->bitnfa, &nfa) < 0)
+        goto engine_compile_failed;
+    engines->bitnfa_us = time_get_us() - t;
+    t = time_get_us();
+    if (dfa_from_nfa(&engines->dfa, &nfa) < 0)
+        goto engine_compile_failed;
+    engines->dfa_us = time_get_us() - t;
+    t = time_get_us();
+    if (asm_compile(&engines->assembly, &engines->dfa) < 0)
+        goto engine_compile_failed;
+    engines->asm_us = time_get_us() - t;
+    nfa_deinit(&nfa);
+
+    return 0;
+
+    engine_compile_failed : nfa_deinit(&nfa);
+    nfa_compile_failed    :
+    build_failed          :
+    parse_failed          : return -1;
+}
+
+static void
+print_compile_stats(const struct query_stats* stats, const struct engines* engines)
+{
+    printf("  compile: parse %" PRIu64 "us, labels %" PRIu64 "us, prefilter %" PRIu64 "us, nfa %" PRIu64 "us",
+        stats->stage_us[QUERY_STAGE_PARSE], stats->stage_us[QUERY_STAGE_LABELS],
+        stats->stage_us[QUERY_STAGE_PREFILTER], stats->stage_us[QUERY_STAGE_NFA]);
+    if (bitnfa_is_compiled(&engines->query.bitnfa))
+        printf(", bitnfa %" PRIu64 "us (%d positions)\n",
+            stats->stage_us[QUERY_STAGE_BITNFA], stats->bitnfa_positions);
+    else
+        printf(", dfa %" PRIu64 "us (%d states), asm %" PRIu64 "us (%d bytes)\n",
+            stats->stage_us[QUERY_STAGE_DFA], stats->dfa_states,
+            stats->stage_us[QUERY_STAGE_ASM], stats->asm_size);
+
+    /* Both engines are always compiled to compare them, see prefer_bitnfa() */
+    printf("  engines: bitnfa %" PRIu64 "us (%d positions), dfa %" PRIu64 "us (%d states), asm %" PRIu64 "us\n",
+        engines->bitnfa_us, engines->bitnfa.positions,
+        engines->dfa_us, engines->dfa.tt.rows, engines->asm_us);
+}
+
+static int
+bench_query(struct parser* parser, const char* text, const struct stream* streams, int stream_count)
+{
+    static const struct {
+        const char* name;
+        scan_func scan;
+    } scans[] = {
+        { "dfa", scan_dfa },
+        { "asm", scan_asm },
+        { "bitnfa", scan_bitnfa },
+        { "search", scan_search }
+    };
+    struct engines engines;
+    int s, i, result = -1;
+
+    compiled_query_init(&engines.query);
+    dfa_init(&engines.dfa);
+    asm_init(&engines.assembly);
+    bitnfa_init(&engines.bitnfa);
+
+    printf("%s\n", text);
+    if (engines_compile(&engines, parser, text) < 0)
+    {
+        printf("  failed to compile\n");
+        goto compile_failed;
+    }
+    print_compile_stats(&engines.query.stats, &engines);
+
+    for (s = 0; s != stream_count; ++s)
+    {
+        int expected_matches = -1;
+        printf("  %-8s", streams[s].name);
+        for (i = 0; i != (int)(sizeof(scans) / sizeof(*scans)); ++i)
+        {
+            int matches;
+            double msps = measure(scans[i].scan, &engines, &streams[s], &matches);
+            if (msps < 0.0)
+            {
+                printf("\n  %s failed\n", scans[i].name);
+                goto scan_failed;
+            }
+            printf("  %s %7.1f Msym/s", scans[i].name, msps);
+
+            /* The engines must agree, otherwise the numbers are meaningless */
+            if (expected_matches < 0)
+                expected_matches = matches;
+            else if (matches != expected_matches)
+                printf(" (%d matches, expected %d!)", matches, expected_matches);
+        }
+        printf("  (%d matches)\n", expected_matches);
+    }
+
+    result = 0;
+
+    scan_failed    :
+    compile_failed : bitnfa_deinit(&engines.bitnfa);
+                     asm_deinit(&engines.assembly);
+                     dfa_deinit(&engines.dfa);
+                     compiled_query_deinit(&engines.query);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    struct parser parser;
+    struct stream streams[2];
+    int i, result = -1;
+
+    if (vh_threadlocal_init() != 0)
+        goto vh_init_tl_failed;
+    if (vh_init() != 0)
+        goto vh_init_failed;
+    if (parser_init(&parser) < 0)
+        goto parser_init_failed;
+
+    streams[0].name = "zipf";
+    streams[1].name = "uniform";
+    streams[0].symbols = NULL;
+    streams[1].symbols = NULL;
+    for (i = 0; i != 2; ++i)
+    {
+        streams[i].count = STREAM_LENGTH;
+        streams[i].symbols = mem_alloc(sizeof(union symbol) * STREAM_LENGTH);
+        if (streams[i].symbols == NULL)
+            goto alloc_streams_failed;
+    }
+    make_zipf_stream(streams[0].symbols, streams[0].count, 42);
+    make_uniform_stream(streams[1].symbols, streams[1].count, 42);
+
+    result = 0;
+    if (argc > 1)
+    {
+        for (i = 1; i != argc; ++i)
+            if (bench_query(&parser, argv[i], streams, 2) < 0)
+                result = -1;
+    }
+    else
+    {
+        for (i = 0; default_queries[i]; ++i)
+            if (bench_query(&parser, default_queries[i], streams, 2) < 0)
+                result = -1;
+    }
+
+    alloc_streams_failed : for (i = 0; i != 2; ++i)
+                               if (streams[i].symbols)
+                                   mem_free(streams[i].symbols);
+                           parser_deinit(&parser);
+    parser_init_failed   : vh_deinit();
+    vh_init_failed       : vh_threadlocal_deinit();
+    vh_init_tl_failed    : return result == 0 ? 0 : 1;
+}
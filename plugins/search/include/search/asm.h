@@ -17,7 +17,8 @@ typedef union state (*asm_func)(union state state, uint64_t symbol);
 struct asm_dfa
 {
     asm_func next_state;
-    int size;
+    int size;       /* Bytes allocated for the code */
+    int code_size;  /* Bytes of generated code */
 };
 
 /*!
@@ -45,7 +46,7 @@ int
 asm_compile(struct asm_dfa* assembly, const struct dfa_table* dfa);
 
 static inline int
-asm_is_compiled(struct asm_dfa* assembly)
+asm_is_compiled(const struct asm_dfa* assembly)
     { return assembly->next_state != (void*)0; }
 
 /*!
@@ -59,6 +60,14 @@ asm_is_compiled(struct asm_dfa* assembly)
 struct range
 asm_find_first(const struct asm_dfa* assembly, const union symbol* symbols, struct range window);
 
+/*!
+ * \brief Same as asm_find_first(), but only matches starting before
+ * "start_end" are found. The matches themselves can extend to the end of the
+ * window, so searching a window in several parts gives the same results.
+ */
+struct range
+asm_find_first_before(const struct asm_dfa* assembly, const union symbol* symbols, struct range window, int start_end);
+
 /*!
  * \brief Finds all matches using a compiled expression.
  * \param[in] assembly A compiled expression from asm_compile().
@@ -41,7 +41,8 @@ enum ast_ctx_flags {
     AST_CTX_FH      = (1 << 14),
     AST_CTX_DJ      = (1 << 15),
     AST_CTX_FS      = (1 << 16),
-    AST_CTX_IDJ     = (1 << 17)
+    AST_CTX_IDJ     = (1 << 17),
+    AST_CTX_OP      = (1 << 18)
 };
 
 struct ast_location
@@ -159,6 +160,12 @@ int ast_timing(struct ast* ast, int rel_to, int child, int start, int end, const
 int ast_damage(struct ast* ast, int child, float from, float to, const struct YYLTYPE* loc);
 
 int ast_duplicate(struct ast* ast, int node);
+/*
+ * Replaces the contents of "dst" with the nodes and labels of "src". The
+ * motions that labels were merged from during label resolution are not
+ * copied.
+ */
+int ast_copy(struct ast* dst, const struct ast* src);
 
 #if defined(EXPORT_DOT)
 int ast_export_dot(const struct ast* ast, const char* file_name);
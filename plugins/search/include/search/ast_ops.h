@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -15,8 +17,22 @@ void ast_replace_into(struct ast* ast, int node, int target);
 int ast_find_parent(struct ast* ast, int node);
 /* Returns true if "node" is found in the subtree starting (and including) node "root" */
 int ast_is_in_subtree_of(struct ast* ast, int node, int root);
-int ast_trees_equal(struct ast* a1, int n1, struct ast* a2, int n2);
+int ast_trees_equal(const struct ast* a1, int n1, const struct ast* a2, int n2);
+/*
+ * Hashes the subtree starting at "node". Trees that compare equal with
+ * ast_trees_equal() have the same hash, regardless of where their nodes are
+ * stored or how the original query text was formatted.
+ */
+uint64_t ast_hash(const struct ast* ast, int node);
+/* Returns true if any part of the subtree is a step of the opponent ("op" qualifier) */
+int ast_references_opponent(const struct ast* ast, int node);
 int ast_node_preceeds(struct ast* ast, int n1, int n2);
+/*
+ * Rewrites the tree in place so that queries that only differ in how they
+ * are grouped compare equal, e.g. "a->(b->c)" and "(a->b)->c". Node indices
+ * stay valid.
+ */
+void ast_normalize(struct ast* ast);
 
 #if defined(__cplusplus)
 }
@@ -5,12 +5,13 @@ extern "C" {
 #endif
 
 struct ast;
-struct db;
-struct db_interface;
+struct label_map;
 
 /*
  * Tries to replace all AST_LABEL nodes with AST_MOTION nodes. Labels are first
- * matched with user-defined labels by querying the db's motion_labels table.
+ * matched with user-defined labels from the db's motion_labels table. The
+ * labels must have been resolved into "labels" beforehand with
+ * label_map_resolve_ast(), this function does not access the database.
  * This can cause the AST to create more nodes, since user-defined labels can
  * match multiple different motions.
  *
@@ -22,9 +23,12 @@ struct db_interface;
  *
  * Nodes that were not found can be converted separately without checking the
  * db with the function ast_post_hash40_remaining_labels().
+ *
+ * Labels of the opponent's steps ("op" qualifier) are resolved for
+ * "opponent_id" instead of "fighter_id".
  */
 int
-ast_post_labels_to_motions(struct ast* ast, struct db_interface* dbi, struct db* db, int fighter_id);
+ast_post_labels_to_motions(struct ast* ast, const struct label_map* labels, int fighter_id, int opponent_id);
 void
 ast_post_hash40_remaining_labels(struct ast* ast);
 
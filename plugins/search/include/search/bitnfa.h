@@ -0,0 +1,145 @@
+#pragma once
+
+#include "search/range.h"
+#include "vh/vec.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct ast;
+struct nfa_graph;
+union symbol;
+
+/*!
+ * Up to this many NFA positions the state set fits into a single machine
+ * word and the fast path is used.
+ */
+#define BITNFA_WORD_BITS 64
+
+/*!
+ * A match of an approximate search. "distance" is the number of symbols that
+ * had to be inserted, deleted or substituted for the expression to match,
+ * or -1 if there was no match.
+ */
+struct fuzzy_range
+{
+    struct range range;
+    int distance;
+};
+
+/*!
+ * Bit-parallel simulation of the position (Glushkov) automaton produced by
+ * nfa_compile(). Every NFA node is assigned one bit in the state set, so a
+ * step through the automaton is a handful of AND/OR operations instead of a
+ * table lookup. Unlike the DFA, building this structure is linear in the
+ * number of positions, which makes it the better choice for expressions
+ * where subset construction blows up (e.g. bounded wildcard repetitions).
+ */
+struct bitnfa
+{
+    struct vec tf;      /* struct matcher, one per column, wildcard is last */
+    uint64_t* first;    /* [words] - positions reachable from the entry node */
+    uint64_t* accept;   /* [words] - positions that are accept conditions */
+    uint64_t* match;    /* [cols][words] - positions enabled by each column */
+    uint64_t* follow;   /* [chunks][256] if words == 1, else [positions][words] */
+    int positions;
+    int words;
+};
+
+/*!
+ * \brief Initializes the structure. Call this before doing anything else.
+ */
+void
+bitnfa_init(struct bitnfa* bitnfa);
+
+/*!
+ * \brief Frees all memory if necessary. You must call bitnfa_init() again
+ * if you want to re-use the structure.
+ */
+void
+bitnfa_deinit(struct bitnfa* bitnfa);
+
+/*!
+ * \brief Builds the bit-parallel automaton from an NFA.
+ * \param[in] bitnfa Structure that has been initialized with bitnfa_init().
+ * If the structure is already holding an automaton, it will be freed first.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+bitnfa_from_nfa(struct bitnfa* bitnfa, const struct nfa_graph* nfa);
+
+/*!
+ * \brief Compiles an AST into a bit-parallel automaton. This skips subset
+ * construction entirely.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+bitnfa_compile(struct bitnfa* bitnfa, const struct ast* ast);
+
+static inline int
+bitnfa_is_compiled(const struct bitnfa* bitnfa)
+    { return bitnfa->positions > 0; }
+
+/*!
+ * \brief Finds the first match.
+ * \param[in] bitnfa A compiled expression from bitnfa_compile().
+ * \param[in] symbols Array of symbols to search on.
+ * \param[in] window Start and end indices into "symbols" to run the search on.
+ * \return Returns a range into "symbols" matching the compiled expression. If
+ * no match is found, then range.start == range.end.
+ */
+struct range
+bitnfa_find_first(const struct bitnfa* bitnfa, const union symbol* symbols, struct range window);
+
+/*!
+ * \brief Same as bitnfa_find_first(), but only matches starting before
+ * "start_end" are found. The matches themselves can extend to the end of the
+ * window.
+ */
+struct range
+bitnfa_find_first_before(const struct bitnfa* bitnfa, const union symbol* symbols, struct range window, int start_end);
+
+/*!
+ * \brief Finds all matches.
+ * \param[in] bitnfa A compiled expression from bitnfa_compile().
+ * \param[in] symbols Array of symbols to search on.
+ * \param[in] window Start and end indices into "symbols" to run the search on.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+bitnfa_find_all(struct vec* ranges, const struct bitnfa* bitnfa, const union symbol* symbols, struct range window);
+
+/*!
+ * \brief Finds the first match that is at most "max_edits" insertions,
+ * deletions or substitutions of symbols away from the expression.
+ * \param[in] bitnfa A compiled expression from bitnfa_compile().
+ * \param[in] symbols Array of symbols to search on.
+ * \param[in] window Start and end indices into "symbols" to run the search on.
+ * \param[in] max_edits Maximum edit distance. With 0 the results are the same
+ * as bitnfa_find_first().
+ * \return Returns the match with the fewest edits at the leftmost start. If
+ * no match is found, then distance is -1 and range.start == range.end.
+ */
+struct fuzzy_range
+bitnfa_find_first_fuzzy(const struct bitnfa* bitnfa, const union symbol* symbols, struct range window, int max_edits);
+
+/*!
+ * \brief Same as bitnfa_find_first_fuzzy(), but the leftmost start has to be
+ * before "start_end".
+ */
+struct fuzzy_range
+bitnfa_find_first_fuzzy_before(const struct bitnfa* bitnfa, const union symbol* symbols, struct range window, int start_end, int max_edits);
+
+/*!
+ * \brief Finds all approximate matches, see bitnfa_find_first_fuzzy().
+ * \param[out] ranges Vector of struct fuzzy_range.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+bitnfa_find_all_fuzzy(struct vec* ranges, const struct bitnfa* bitnfa, const union symbol* symbols, struct range window, int max_edits);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "search/range.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct ast;
+struct compiled_query;
+struct label_map;
+struct str;
+union symbol;
+
+enum scan_method
+{
+    SCAN_FULL,       /* Every symbol of the stream was searched */
+    SCAN_PREFILTER,  /* Only windows around a required motion were searched */
+    SCAN_FM_INDEX,   /* Only ranges located in the FM-index were searched */
+    SCAN_STORED      /* Matches were loaded from the database, nothing was searched */
+};
+
+/*!
+ * Counters collected while scanning the stream of one fighter. Dividing
+ * "window_symbols" by "symbols" gives the fraction of the stream the
+ * prefilter (or FM-index) let through.
+ */
+struct scan_profile
+{
+    enum scan_method method;
+    int symbols;         /* Symbols in the stream */
+    int windows;         /* Candidate windows that were searched */
+    int window_symbols;  /* Symbols inside candidate windows */
+    int matches;
+    uint64_t scan_us;
+};
+
+void
+scan_profile_init(struct scan_profile* profile);
+
+/*!
+ * \brief Appends the AST as an indented tree, one node per line. Motions
+ * that came from a user-defined label are annotated with the label.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+explain_ast(struct str* report, const struct ast* ast);
+
+/*!
+ * \brief Appends the motions every label of the AST resolves to. The AST must
+ * have been parsed, but its labels must not have been converted to motions
+ * yet. Labels of the opponent's steps are looked up for "opponent_id".
+ * \param[in] labels Labels that were resolved with label_map_resolve_ast().
+ * If NULL, labels are taken as the names of motions.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+explain_labels(struct str* report, const struct ast* ast, const struct label_map* labels, int fighter_id, int opponent_id);
+
+/*!
+ * \brief Appends the normalized AST, the prefilter, the engine that was
+ * chosen, the sizes of the automata and the time each compilation stage took.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+explain_compiled_query(struct str* report, const struct compiled_query* query);
+
+/*!
+ * \brief Appends one line summarizing the scan of a stream.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+explain_scan_profile(struct str* report, const struct scan_profile* profile);
+
+/*!
+ * \brief Searches a window of symbols the same way a search does, i.e.
+ * through the prefilter unless the search is approximate, and counts what
+ * happened.
+ * \return Returns the number of matches, or negative on error.
+ */
+int
+explain_scan(struct scan_profile* profile, const struct compiled_query* query, const union symbol* symbols, struct range window, int max_edits);
+
+/*!
+ * \brief Parses and compiles a query for a fighter without running a search,
+ * and appends everything explain_labels() and explain_compiled_query() report.
+ * This doesn't access the database or any UI, so it can be used from tests
+ * and tools.
+ * \param[in] labels See explain_labels().
+ * \return Returns 0 on success. If the query fails to compile, the report
+ * says which stage failed and -1 is returned.
+ */
+int
+explain_query(struct str* report, const char* text, const struct label_map* labels, int fighter_id, int opponent_id, int max_edits);
+
+#if defined(__cplusplus)
+}
+#endif
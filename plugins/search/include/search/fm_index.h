@@ -0,0 +1,170 @@
+#pragma once
+
+#include "search/range.h"
+#include "vh/hm.h"
+#include "vh/vec.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+union symbol;
+
+/*
+ * Every FM_INDEX_SAMPLE_RATE'th position of the text is stored, so locating
+ * an occurrence takes at most this many LF-mapping steps.
+ */
+#define FM_INDEX_SAMPLE_RATE 32
+
+/*!
+ * Rank directory over a plain bit array. "ranks" holds the number of set bits
+ * before each word.
+ */
+struct fm_bitvector
+{
+    struct vec words;  /* uint64_t */
+    struct vec ranks;  /* uint32_t */
+};
+
+/*! A document is the own symbol stream of one fighter in one game */
+struct fm_doc
+{
+    uint64_t stamp;  /* Frame data stamp of the game when it was added */
+    int game_id;
+    int fighter_idx;
+    int start;   /* Offset of the first symbol in the corpus */
+    int length;
+};
+
+struct fm_match
+{
+    int game_id;
+    int fighter_idx;
+    int start;   /* Index of the first symbol in the fighter's own stream */
+};
+
+/*!
+ * Compressed full-text index over the motions of many symbol streams. The
+ * streams are concatenated into a single text, separated by a character that
+ * never appears in a pattern, so occurrences can't span two streams.
+ *
+ * The Burrows-Wheeler transform of the text is stored in a wavelet matrix.
+ * Counting the occurrences of a motion sequence takes one backward search
+ * step per motion, each costing O(log(alphabet)) rank queries, regardless of
+ * how many games are indexed. Locating an occurrence additionally walks the
+ * LF-mapping to the nearest sampled suffix array entry.
+ *
+ * Only motions are indexed, state flags are ignored.
+ *
+ * The corpus the index was built from is kept (and saved) as well, so new
+ * games can be added later without reloading the frame data of the entire
+ * library.
+ */
+struct fm_index
+{
+    struct vec corpus;    /* uint32_t - characters of all documents, each followed by a separator */
+    struct vec docs;      /* struct fm_doc, ordered by start */
+    struct vec alphabet;  /* uint64_t - motion of each character, see fm_index.c */
+    struct hm char_ids;   /* uint64_t motion -> uint32_t character */
+
+    /* Built from the corpus by fm_index_build() */
+    struct vec counts;    /* int - number of characters in the text smaller than each character */
+    struct vec zeros;     /* int - number of zeros on each level of the wavelet matrix */
+    struct vec ones;      /* uint32_t - number of set bits before each level */
+    struct vec samples;   /* int - text position of each sampled row */
+    struct fm_bitvector levels;   /* All levels of the wavelet matrix back to back */
+    struct fm_bitvector sampled;  /* Rows whose text position is stored in "samples" */
+    int length;  /* Characters in the text, including separators and the terminator */
+    int level_count;
+    unsigned is_built : 1;
+};
+
+int
+fm_index_init(struct fm_index* fmi);
+
+void
+fm_index_deinit(struct fm_index* fmi);
+
+/*!
+ * \brief Removes all documents.
+ */
+void
+fm_index_clear(struct fm_index* fmi);
+
+/*!
+ * \brief Appends the motions of a symbol stream to the corpus. The index has
+ * to be rebuilt with fm_index_build() before it can be searched again.
+ * \param[in] stamp Stored with the document, see frame_data_stamp().
+ * \return Returns 0 on success or negative on error.
+ */
+int
+fm_index_add(struct fm_index* fmi, int game_id, uint64_t stamp, int fighter_idx, const union symbol* symbols, struct range range);
+
+/*!
+ * \brief Appends all documents of another index to the corpus. The index has
+ * to be rebuilt with fm_index_build() before it can be searched again.
+ * \return Returns 0 on success or negative on error, in which case the corpus
+ * is unchanged.
+ */
+int
+fm_index_append(struct fm_index* fmi, const struct fm_index* other);
+
+/*!
+ * \brief Removes every stream of the game from the corpus. If any were
+ * removed, the index has to be rebuilt with fm_index_build().
+ * \return Returns the number of streams that were removed.
+ */
+int
+fm_index_remove_game(struct fm_index* fmi, int game_id);
+
+/*! \brief Returns true if any stream of the game was added to the corpus */
+int
+fm_index_has_game(const struct fm_index* fmi, int game_id);
+
+/*!
+ * \brief (Re)builds the index from the corpus.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+fm_index_build(struct fm_index* fmi);
+
+static inline int
+fm_index_is_built(const struct fm_index* fmi)
+    { return fmi->is_built; }
+
+/*!
+ * \brief Returns the number of occurrences of the motions of "pattern" in
+ * all documents, or 0 if the index isn't built.
+ */
+int
+fm_index_count(const struct fm_index* fmi, const union symbol* pattern, int length);
+
+/*!
+ * \brief Finds all occurrences of the motions of "pattern".
+ * \param[out] matches Vector of struct fm_match. Matches are appended ordered
+ * by game, fighter and start.
+ * \return Returns the number of matches or negative on error.
+ */
+int
+fm_index_locate(struct vec* matches, const struct fm_index* fmi, const union symbol* pattern, int length);
+
+/*!
+ * \brief Saves the corpus and the built index. The index must be built.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+fm_index_save(const struct fm_index* fmi, const char* file_name);
+
+/*!
+ * \brief Replaces the contents of the index with what was previously saved
+ * with fm_index_save().
+ * \return Returns 0 on success or negative on error, in which case the index
+ * is left empty.
+ */
+int
+fm_index_load(struct fm_index* fmi, const char* file_name);
+
+#if defined(__cplusplus)
+}
+#endif
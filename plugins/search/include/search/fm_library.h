@@ -0,0 +1,126 @@
+#pragma once
+
+#include "search/fm_index.h"
+#include "search/range.h"
+#include "vh/hm.h"
+#include "vh/vec.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+union symbol;
+
+/*
+ * Segments are merged until they hold this many characters. Building an
+ * index needs about 28 bytes per character.
+ */
+#define FM_LIBRARY_SEGMENT_MAX (1 << 22)
+
+/*!
+ * FM-index over the symbol streams of every game in the library. Rebuilding a
+ * single index each time a game is imported would cost more the larger the
+ * library gets, so games are added to a new, small segment instead. When the
+ * newest segment grows to half the size of the one before it, the two are
+ * merged, so the number of segments stays logarithmic in the size of the
+ * library and each character is only rebuilt a logarithmic number of times.
+ *
+ * Each game remembers the frame data stamp it was added with. A game whose
+ * frame data changed since is removed from its segment and added again.
+ *
+ * Each segment is saved to its own file, "<file_name>.<segment>", and only
+ * segments that changed are written.
+ */
+struct fm_library
+{
+    struct vec segments;  /* struct fm_index */
+    struct vec dirty;     /* char - 1 if the segment changed since it was saved */
+    struct hm games;      /* int game_id -> struct fm_library_game */
+};
+
+struct fm_library_game
+{
+    uint64_t stamp;
+    int segment;
+    int is_new;  /* Added since the last build */
+};
+
+int
+fm_library_init(struct fm_library* lib);
+
+void
+fm_library_deinit(struct fm_library* lib);
+
+void
+fm_library_clear(struct fm_library* lib);
+
+/*!
+ * \brief Adds the motions of a symbol stream to the newest segment. All
+ * streams of a game have to be added before the next fm_library_build().
+ * Streams the game was added with before that are removed first. The library
+ * has to be rebuilt before the game can be searched.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+fm_library_add(struct fm_library* lib, int game_id, uint64_t stamp, int fighter_idx, const union symbol* symbols, struct range range);
+
+/*! \brief Removes every stream of the game */
+void
+fm_library_remove_game(struct fm_library* lib, int game_id);
+
+/*!
+ * \brief Returns true if the game was added with this stamp and the segment
+ * it was added to is built, i.e. every occurrence in the game is counted and
+ * located.
+ */
+int
+fm_library_has_game(const struct fm_library* lib, int game_id, uint64_t stamp);
+
+static inline int
+fm_library_game_count(const struct fm_library* lib)
+    { return (int)hm_count(&lib->games); }
+
+/*!
+ * \brief Merges segments that became too small and builds the ones that
+ * changed.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+fm_library_build(struct fm_library* lib);
+
+/*! \brief Returns the number of occurrences in all built segments */
+int
+fm_library_count(const struct fm_library* lib, const union symbol* pattern, int length);
+
+/*!
+ * \brief Finds all occurrences in all built segments.
+ * \param[out] matches Vector of struct fm_match. Matches are appended ordered
+ * by game, fighter and start.
+ * \return Returns the number of matches or negative on error.
+ */
+int
+fm_library_locate(struct vec* matches, const struct fm_library* lib, const union symbol* pattern, int length);
+
+/*!
+ * \brief Saves the segments that changed since they were saved or loaded, and
+ * removes the files of segments that no longer exist. Every segment must be
+ * built.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+fm_library_save(struct fm_library* lib, const char* file_name);
+
+/*!
+ * \brief Replaces the contents of the library with the segments that were
+ * previously saved with fm_library_save(). Succeeds with an empty library if
+ * nothing was saved yet.
+ * \return Returns 0 on success or negative on error, in which case the library
+ * is left empty.
+ */
+int
+fm_library_load(struct fm_library* lib, const char* file_name);
+
+#if defined(__cplusplus)
+}
+#endif
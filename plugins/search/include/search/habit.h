@@ -0,0 +1,91 @@
+#pragma once
+
+#include "search/range.h"
+#include "vh/hm.h"
+#include "vh/vec.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct search_index;
+
+#define HABIT_MIN_LENGTH  2
+#define HABIT_MAX_LENGTH  6
+#define HABIT_MAX_SAMPLES 3
+
+enum habit_event
+{
+    HABIT_AFTER_ANYTHING,
+    HABIT_AFTER_LANDING,
+    HABIT_AFTER_LEDGE_GRAB,
+    HABIT_AFTER_SHIELD_DROP,
+    HABIT_AFTER_HIT,
+
+    HABIT_EVENT_COUNT
+};
+
+struct habit_sample
+{
+    int game_id;
+    int fighter_idx;
+    struct range frames;
+};
+
+/*!
+ * A sequence of motions a fighter went through right after an event, and how
+ * often it happened.
+ */
+struct habit
+{
+    uint64_t motions[HABIT_MAX_LENGTH];
+    int length;
+    int count;
+    int sample_count;
+    struct habit_sample samples[HABIT_MAX_SAMPLES];
+};
+
+/*!
+ * Counts the motion sequences of length HABIT_MIN_LENGTH to HABIT_MAX_LENGTH
+ * that immediately follow an event in a fighter's own symbol stream. Streams
+ * of any number of games can be added one after another, only the counts are
+ * kept.
+ */
+struct habit_miner
+{
+    struct hm habits;  /* struct habit_key -> struct habit */
+    enum habit_event event;
+    int events;  /* Number of times the event happened in all added streams */
+};
+
+int
+habit_miner_init(struct habit_miner* miner, enum habit_event event);
+
+void
+habit_miner_deinit(struct habit_miner* miner);
+
+/*!
+ * \brief Counts the sequences after every event in the fighter's own stream.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+habit_miner_add(struct habit_miner* miner, const struct search_index* index, int game_id, int fighter_idx);
+
+/*!
+ * \brief Returns the most frequent sequences, most frequent first. Sequences
+ * that only ever happened as the start of a longer sequence are left out,
+ * because the longer one says more.
+ * \param[out] habits Vector of struct habit. At most "max_count" habits are
+ * appended.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+habit_miner_rank(const struct habit_miner* miner, struct vec* habits, int max_count);
+
+const char*
+habit_event_name(enum habit_event event);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "search/range.h"
+#include "search/symbol.h"
+#include "vh/hm.h"
+#include "vh/str.h"
+#include "vh/vec.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+ * Hits are grouped by one of the attributes of the fighter that was searched.
+ */
+enum hit_group
+{
+    HIT_GROUP_PLAYER,    /* Person who played the fighter */
+    HIT_GROUP_OPPONENT,  /* Fighter of the opponent, i.e. the matchup */
+    HIT_GROUP_STAGE,
+
+    HIT_GROUP_COUNT
+};
+
+/*! Percent histograms use the same steps as the damage column of symbols */
+#define HIT_STATS_PERCENT_STEP    SYMBOL_DAMAGE_STEP
+#define HIT_STATS_PERCENT_BUCKETS SYMBOL_DAMAGE_BUCKETS
+
+/*! One fighter of one game that was searched, whether it had hits or not */
+struct hit_stream
+{
+    int game_id;
+    int fighter_idx;
+    int fighter_id;
+    int groups[HIT_GROUP_COUNT];  /* Person ID, opponent's fighter ID, stage ID */
+};
+
+struct hit
+{
+    int stream;           /* Index into hit_stats->streams */
+    struct range frames;
+    float percent;        /* Opponent's damage when the match started */
+};
+
+/*!
+ * Matches of one query across many games, along with what is needed to group
+ * them. The hits are kept, so they can be grouped differently without
+ * searching again.
+ */
+struct hit_stats
+{
+    struct vec streams;    /* struct hit_stream */
+    struct vec hits;       /* struct hit */
+    struct hm names;       /* struct hit_name_key -> struct strlist_str */
+    struct strlist strings;
+};
+
+struct hit_stats_row
+{
+    int group_id;
+    int games;            /* Streams of the group that were searched */
+    int games_with_hits;
+    int hits;
+    int histogram[HIT_STATS_PERCENT_BUCKETS];
+};
+
+int
+hit_stats_init(struct hit_stats* stats);
+
+void
+hit_stats_deinit(struct hit_stats* stats);
+
+void
+hit_stats_clear(struct hit_stats* stats);
+
+/*!
+ * \brief Adds a fighter that is going to be searched.
+ * \return Returns the index of the stream, or negative on error.
+ */
+int
+hit_stats_add_stream(struct hit_stats* stats, const struct hit_stream* stream);
+
+int
+hit_stats_add_hit(struct hit_stats* stats, int stream, struct range frames, float percent);
+
+/*!
+ * \brief Sets the name a group ID is displayed and exported with. Setting
+ * the name of an ID again has no effect.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+hit_stats_set_name(struct hit_stats* stats, enum hit_group group, int group_id, struct str_view name);
+
+/*! \brief Returns the name of a group ID, or an empty string if it has none */
+struct str_view
+hit_stats_name(const struct hit_stats* stats, enum hit_group group, int group_id);
+
+/*!
+ * \brief Counts the hits and searched games per group.
+ * \param[out] rows Vector of struct hit_stats_row. Rows are appended, most
+ * hits first.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+hit_stats_aggregate(const struct hit_stats* stats, enum hit_group group, struct vec* rows);
+
+/*!
+ * \brief Appends the rows as CSV, with a header and one column per percent
+ * bucket. Names are quoted.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+hit_stats_to_csv(const struct hit_stats* stats, enum hit_group group, const struct vec* rows, struct str* csv);
+
+const char*
+hit_group_name(enum hit_group group);
+
+#if defined(__cplusplus)
+}
+#endif
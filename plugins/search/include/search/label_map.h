@@ -0,0 +1,107 @@
+#pragma once
+
+#include "vh/hm.h"
+#include "vh/str.h"
+#include "vh/vec.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct ast;
+struct db;
+struct db_interface;
+struct motion_dict;
+
+enum label_kind
+{
+    LABEL_UNKNOWN,      /* No motion found, the label is invalid */
+    LABEL_USER_DEFINED, /* One or more motions from the motion_labels table */
+    LABEL_HASH40        /* The label is the name of a motion in the motions table */
+};
+
+struct label_entry
+{
+    enum label_kind kind;
+    int first;          /* Index into label_map->motions */
+    int count;
+};
+
+/*!
+ * Cache of label to motion resolutions, per fighter. Labels are resolved
+ * through the process-wide motion dictionary (see vh/motion_dict.h). The map
+ * remembers the revision of the dictionary it was filled from, and is cleared
+ * by label_map_resolve_ast() when the motion labels were edited.
+ */
+struct label_map
+{
+    struct hm entries;      /* struct label_key -> struct label_entry */
+    struct vec motions;     /* uint64_t */
+    uint64_t revision;      /* Revision of the motion dictionary, 0 if empty */
+};
+
+int
+label_map_init(struct label_map* map);
+
+void
+label_map_deinit(struct label_map* map);
+
+void
+label_map_clear(struct label_map* map);
+
+/*!
+ * \brief Resolves a label to the motions it stands for.
+ * \param[out] entry Receives a pointer to the cached resolution. Use
+ * label_map_motions() to get the motions. The pointer is invalidated by the
+ * next call to label_map_resolve() or label_map_clear().
+ * \return Returns 0 on success or negative on error.
+ * An unknown label is not an error, entry->kind is set to LABEL_UNKNOWN.
+ */
+int
+label_map_resolve(
+    struct label_map* map,
+    const struct motion_dict* dict,
+    int fighter_id, struct str_view label,
+    const struct label_entry** entry);
+
+/*!
+ * \brief Resolves all labels found in the AST. Afterwards, the AST can be
+ * converted with ast_post_labels_to_motions() without accessing the database,
+ * for example on a worker thread. If the motion labels were edited since the
+ * map was last filled, the map is cleared first, so compare "revision"
+ * before and after to find out whether earlier resolutions are stale.
+ * \return Returns 0 on success or negative if a database query failed.
+ */
+int
+label_map_resolve_ast(
+    struct label_map* map,
+    struct db_interface* dbi, struct db* db,
+    int fighter_id, const struct ast* ast);
+
+/*!
+ * \brief Same as label_map_resolve_ast(), but with a dictionary the caller
+ * acquired. Doesn't access the database, so it can be called while holding
+ * a lock.
+ */
+int
+label_map_resolve_ast_dict(
+    struct label_map* map,
+    const struct motion_dict* dict,
+    int fighter_id, const struct ast* ast);
+
+/*!
+ * \brief Looks up a label that was previously resolved.
+ * \return Returns the cached resolution, or NULL if the label was never
+ * resolved for this fighter.
+ */
+const struct label_entry*
+label_map_find(const struct label_map* map, int fighter_id, struct str_view label);
+
+static inline const uint64_t*
+label_map_motions(const struct label_map* map, const struct label_entry* entry)
+    { return (const uint64_t*)vec_get(&map->motions, entry->first); }
+
+#if defined(__cplusplus)
+}
+#endif
@@ -2,6 +2,8 @@
 
 #include "search/symbol.h"
 
+struct vec;
+
 struct matcher
 {
     union symbol symbol;
@@ -21,6 +23,27 @@ matches_motion(const struct matcher* m)
     return m->mask.motionl != 0;
 }
 
+/*!
+ * \brief Returns true if both matchers accept exactly the same symbols.
+ */
+static inline int
+matchers_equal(const struct matcher* a, const struct matcher* b)
+{
+    return a->mask.u64 == b->mask.u64 &&
+        (a->symbol.u64 & a->mask.u64) == (b->symbol.u64 & b->mask.u64);
+}
+
+/*!
+ * \brief Returns true if every symbol accepted by "specific" is also accepted
+ * by "general".
+ */
+static inline int
+matcher_subsumes(const struct matcher* general, const struct matcher* specific)
+{
+    return (general->mask.u64 & ~specific->mask.u64) == 0 &&
+        (general->symbol.u64 & general->mask.u64) == (specific->symbol.u64 & general->mask.u64);
+}
+
 static inline struct matcher
 match_none(void)
 {
@@ -39,7 +62,7 @@ match_motion(uint64_t motion, char is_inverted)
     m.mask.u64 = 0;
     m.symbol.u64 = 0;
     m.mask.motionl = 0xFFFFFFFF;
-    m.mask.motionh = 0xFF;
+    m.mask.motionh = 0x7F;
     m.symbol.motionl = motion & 0xFFFFFFFF;
     m.symbol.motionh = motion >> 32;
     m.is_accept = 0;
@@ -47,6 +70,18 @@ match_motion(uint64_t motion, char is_inverted)
     return m;
 }
 
+/*!
+ * \brief Additionally requires the bits in "mask" of a symbol to be equal to
+ * the bits in "symbol". Used for context qualifiers such as "hit" or "rising".
+ */
+static inline struct matcher
+match_qualify(struct matcher m, union symbol symbol, union symbol mask)
+{
+    m.mask.u64 |= mask.u64;
+    m.symbol.u64 |= symbol.u64 & mask.u64;
+    return m;
+}
+
 static inline struct matcher
 match_wildcard(void)
 {
@@ -57,3 +92,21 @@ match_wildcard(void)
     m.is_inverted = 0;
     return m;
 }
+
+/*!
+ * \brief Completes and orders the columns of a transition table.
+ *
+ * A symbol is always consumed by the first column it matches. With context
+ * qualifiers, columns can overlap, e.g. "nair" and "nair(hit)". So that the
+ * first matching column is also the most specific one, the intersection of
+ * every pair of overlapping columns is added, and columns are sorted so that
+ * a column always comes before all columns that subsume it. The wildcard
+ * ends up last.
+ *
+ * Callers must then add the transitions of every column to all of the
+ * columns it subsumes, see matcher_subsumes().
+ * \param[in,out] tf Vector of unique struct matcher.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+match_build_columns(struct vec* tf);
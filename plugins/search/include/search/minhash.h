@@ -0,0 +1,73 @@
+#pragma once
+
+#include "search/range.h"
+#include "vh/vec.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+union symbol;
+
+/*
+ * Sequences are compared by the set of motion n-grams they contain. The
+ * MinHash signature estimates the Jaccard similarity of two such sets, and
+ * is split into bands for locality sensitive hashing: two windows with
+ * similarity "s" share at least one band bucket with probability
+ * 1 - (1 - s^ROWS)^BANDS.
+ */
+#define MINHASH_NGRAM   3
+#define MINHASH_BANDS   16
+#define MINHASH_ROWS    4
+#define MINHASH_HASHES  (MINHASH_BANDS * MINHASH_ROWS)
+
+/* Games are indexed in overlapping windows of this many symbols */
+#define MINHASH_WINDOW  24
+#define MINHASH_STRIDE  8
+
+struct minhash
+{
+    uint32_t h[MINHASH_HASHES];
+};
+
+struct minhash_window
+{
+    struct range symbols;
+    uint64_t bands[MINHASH_BANDS];
+};
+
+/*!
+ * \brief Computes the signature of the motions in a range of symbols. Only the
+ * motions are used, state flags don't contribute. Ranges shorter than an
+ * n-gram are hashed as a single n-gram.
+ */
+void
+minhash_compute(struct minhash* mh, const union symbol* symbols, struct range range);
+
+/*!
+ * \brief Hashes each band of the signature into a bucket. The buckets are
+ * stable and can be stored.
+ */
+void
+minhash_bands(uint64_t* bands, const struct minhash* mh);
+
+/*!
+ * \brief Returns the number of equal hashes of two signatures. Dividing by
+ * MINHASH_HASHES estimates the Jaccard similarity.
+ */
+int
+minhash_similarity(const struct minhash* a, const struct minhash* b);
+
+/*!
+ * \brief Splits a range of symbols into overlapping windows and computes the
+ * band buckets of each.
+ * \param[out] windows Vector of struct minhash_window.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+minhash_windows(struct vec* windows, const union symbol* symbols, struct range range);
+
+#if defined(__cplusplus)
+}
+#endif
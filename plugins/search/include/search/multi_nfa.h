@@ -0,0 +1,87 @@
+#pragma once
+
+#include "search/range.h"
+#include "vh/vec.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct nfa_graph;
+union symbol;
+
+/*!
+ * A match reported by multi_nfa_find_all(). "query" is the index of the NFA
+ * in the array passed to multi_nfa_compile().
+ */
+struct query_range
+{
+    struct range range;
+    int query;
+};
+
+/*!
+ * Runs many expressions at once. The position automata of all queries are
+ * merged into one bit-parallel automaton where every accepting position
+ * carries the ID of the query it belongs to. A single scan over the symbols
+ * then produces the matches of every query.
+ *
+ * Each query keeps the exact semantics it would have if it were compiled on
+ * its own, i.e. the results are identical to calling dfa_find_all() once per
+ * query.
+ */
+struct multi_nfa
+{
+    struct vec queries;     /* struct multi_nfa_query */
+    uint64_t* first;        /* [words] */
+    uint64_t* accept;       /* [words] */
+    uint64_t* follow;       /* [positions][words] */
+    int* position_query;    /* [positions] - query ID of each position */
+    int positions;
+    int words;
+};
+
+/*!
+ * \brief Initializes the structure. Call this before doing anything else.
+ */
+void
+multi_nfa_init(struct multi_nfa* multi);
+
+/*!
+ * \brief Frees all memory if necessary. You must call multi_nfa_init()
+ * again if you want to re-use the structure.
+ */
+void
+multi_nfa_deinit(struct multi_nfa* multi);
+
+/*!
+ * \brief Merges the NFAs of all queries into a single automaton.
+ * \param[in] multi Structure that has been initialized with multi_nfa_init().
+ * If the structure is already holding an automaton, it will be freed first.
+ * \param[in] nfas Array of compiled NFAs, one per query.
+ * \param[in] count Number of NFAs.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+multi_nfa_compile(struct multi_nfa* multi, const struct nfa_graph* nfas, int count);
+
+static inline int
+multi_nfa_query_count(const struct multi_nfa* multi)
+    { return (int)vec_count(&multi->queries); }
+
+/*!
+ * \brief Finds all matches of all queries in a single pass.
+ * \param[out] results Vector of struct query_range. Matches are appended in
+ * order of their start index.
+ * \param[in] multi A compiled set of queries from multi_nfa_compile().
+ * \param[in] symbols Array of symbols to search on.
+ * \param[in] window Start and end indices into "symbols" to run the search on.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+multi_nfa_find_all(struct vec* results, const struct multi_nfa* multi, const union symbol* symbols, struct range window);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -28,6 +28,18 @@ nfa_init(struct nfa_graph* nfa)
 void
 nfa_deinit(struct nfa_graph* nfa);
 
+/*!
+ * \brief Checks that every damage and timing predicate in the AST can be
+ * matched exactly with the bits of union symbol. Predicates that would only
+ * match approximately are rejected with an error message.
+ * \return Returns 0 if the AST can be compiled, -1 otherwise.
+ */
+int
+nfa_check_ast(const struct ast* ast);
+
+/*!
+ * \brief Compiles the AST into an NFA. Fails if nfa_check_ast() fails.
+ */
 int
 nfa_compile(struct nfa_graph* nfa, const struct ast* ast);
 
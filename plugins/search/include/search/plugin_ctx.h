@@ -0,0 +1,202 @@
+#pragma once
+
+#include "search/ast.h"
+#include "search/bitnfa.h"
+#include "search/fm_library.h"
+#include "search/label_map.h"
+#include "search/parser.h"
+#include "search/plugin_habits.h"
+#include "search/plugin_stats.h"
+#include "search/plugin_tags.h"
+#include "search/query_cache.h"
+#include "search/search_index.h"
+#include "search/search_request.h"
+
+#include "vh/frame_data.h"
+#include "vh/str.h"
+#include "vh/thread.h"
+#include "vh/vec.h"
+
+#include <gtk/gtk.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct db;
+struct db_interface;
+struct motion_dict;
+
+/*
+ * State shared by the files of the search plugin. plugin_search.c owns the
+ * worker and the search itself, and each feature built on top of it (similar
+ * situations, habits, statistics, tags) lives in its own file.
+ *
+ * Searches run on a worker thread. The main thread parses the query, then
+ * the application's db worker resolves its labels and loads stored results
+ * before the search worker gets the request. Loading frame data, building the
+ * index, compiling and scanning happen on the search worker, which
+ * exclusively owns struct search.
+ *
+ * Every change to the input increments a generation counter. The worker
+ * compares its request's generation against it while scanning and aborts as
+ * soon as the request becomes stale. Results are sent back to the main thread
+ * in batches, and batches of stale generations are dropped.
+ */
+#define SEARCH_MAX_EDITS 5
+
+struct search
+{
+    struct query_cache cache;
+    struct frame_data fdata;
+    struct search_index index;
+    struct fm_library fm;   /* Streams of every game, extended as games are tagged */
+    struct str fm_file_name;  /* Set before the worker starts */
+    uint64_t labels_revision;  /* Motion labels the cached queries were compiled with */
+    int game_id;     /* Game loaded into fdata and index, or -1 */
+    int target_idx;  /* Target the index was built for */
+};
+
+struct plugin_ctx
+{
+    struct db_interface* dbi;
+    struct db* db;
+    struct db_worker_interface* dbwi;
+    struct db_worker* dbw;
+
+    /* Main thread only */
+    struct parser parser;
+    struct ast ast;
+    struct vec fighter_ids;  /* int */
+    int game_id;
+    int target_idx;
+    int max_edits;
+    int needs_buckets;
+    int explain;
+    guint debounce_source;
+    int prepare_request;  /* db worker request preparing the next search, or 0 */
+    GtkWidget* entry;
+    GtkWidget* opponent;
+    GtkWidget* max_edits_spin;
+    GtkWidget* explain_check;
+    GtkWidget* status;
+    GtkWidget* explain_label;
+    GtkWidget* explain_scroll;
+    GtkWidget* results;
+    GtkWidget* similar;
+    GtkWidget* habit_player;
+    GtkWidget* habit_event;
+    GtkWidget* habit_scope;
+    GtkWidget* habits;
+    GtkWidget* stats_group;
+    GtkWidget* stats_list;
+    GtkWidget* tag_name;
+    struct hit_stats stats;  /* Hits of the most recent statistics run */
+    struct vec person_ids;  /* int - person ID of each fighter in the game */
+    int habit_fighter_id;   /* Labels of mined habits are shown for this fighter */
+    struct vec result_bands;  /* uint64_t - MINHASH_BANDS buckets of each result */
+    int result_count;
+    guint tag_source;
+
+    /* Worker thread only */
+    struct search search;
+    struct thread worker;
+
+    /* Shared, protected by mutex */
+    struct mutex mutex;
+    struct cond cond;
+    struct label_map labels;
+    struct search_request request;
+    struct habit_request habit_request;
+    struct stats_request stats_request;
+    struct tag_request tag_request;
+    struct vec pending_batches;  /* guint - idle sources that haven't run yet */
+    unsigned request_pending : 1;
+    unsigned habit_pending : 1;
+    unsigned stats_pending : 1;
+    unsigned tag_pending : 1;
+    unsigned tag_running : 1;  /* Set until the main thread stored the tags of the request */
+    unsigned request_stop : 1;
+
+    /* Only accessed with g_atomic_int_*() */
+    gint generation;
+    gint habit_generation;
+    gint stats_generation;
+};
+
+/*!
+ * \brief Returns the query compiled for a fighter. Compilation only happens
+ * the first time a query is seen for a fighter. Called from the worker
+ * thread.
+ * \return Returns NULL if the query fails to parse or compile.
+ */
+struct compiled_query*
+search_compile(struct plugin_ctx* ctx, const struct search_request* req, int fighter_id, int opponent_id);
+
+/*!
+ * \brief Returns the first match of the query in the window. Approximate
+ * if "max_edits" is greater than 0.
+ */
+struct fuzzy_range
+search_find_first(const struct compiled_query* query, const union symbol* symbols, struct range window, int max_edits);
+
+/*! \brief Same as search_find_first(), but the match has to start before "start_end" */
+struct fuzzy_range
+search_find_first_before(const struct compiled_query* query, const union symbol* symbols, struct range window, int start_end, int max_edits);
+
+/*!
+ * \brief Returns 1 and appends the motions to "pattern" if the expression
+ * is a plain sequence of motions without wildcards, alternatives, repetitions
+ * or qualifiers. Returns 0 if it isn't, or negative on error.
+ */
+int
+literal_pattern(const struct ast* ast, int n, struct vec* pattern);
+
+/*! \brief Returns -1 if the game is missing player information for the fighter */
+int
+request_fighter_id(const struct search_request* req, int fighter_idx);
+
+/*! \brief Shows a message below the search box */
+void
+status_set(struct plugin_ctx* ctx, const char* text);
+
+/*! \brief Returns the text of the search box */
+const char*
+search_text(struct plugin_ctx* ctx);
+
+/*!
+ * \brief Invalidates the running search and all results that are in flight,
+ * and searches the current game for "text".
+ */
+void
+search_restart(struct plugin_ctx* ctx, const char* text);
+
+/*!
+ * \brief Converts the labels of a parsed query to motions. The labels of
+ * every fighter were resolved into the label map beforehand.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+resolve_labels(struct plugin_ctx* ctx, struct ast* ast, int fighter_id, int opponent_id);
+
+/*!
+ * \brief Runs "func" on the main thread, which takes ownership of "data".
+ * Called from the worker thread. The callback must call pending_remove()
+ * with the ID that was stored in "source_id". Sources that haven't run yet
+ * are removed when the plugin is destroyed.
+ * \return Returns 0 on success or negative on error. "data" is destroyed on
+ * error.
+ */
+int
+pending_post(struct plugin_ctx* ctx, GSourceFunc func, void* data, GDestroyNotify destroy, guint* source_id);
+
+void
+pending_remove(struct plugin_ctx* ctx, guint source_id);
+
+/*! \brief Formats a motion as its label, or as its hash40 value if it has none */
+void
+format_motion(struct str* label, const struct motion_dict* dict, int fighter_id, uint64_t motion);
+
+#if defined(__cplusplus)
+}
+#endif
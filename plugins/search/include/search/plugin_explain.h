@@ -0,0 +1,59 @@
+#pragma once
+
+#include <gtk/gtk.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct explain_batch;
+struct plugin_ctx;
+struct scan_profile;
+struct search_request;
+
+/*!
+ * \brief Starts the report of a search. Called from the worker thread once
+ * the game of the request is loaded.
+ * \param[in] loaded Set if the game had to be loaded and indexed for this
+ * search, which took "load_us".
+ * \return Returns NULL on error.
+ */
+struct explain_batch*
+explain_batch_create(struct plugin_ctx* ctx, const struct search_request* req, int loaded, uint64_t load_us);
+
+void
+explain_batch_destroy(struct explain_batch* batch);
+
+/*!
+ * \brief Reports how the query was compiled for a fighter and what scanning
+ * their stream did.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+explain_batch_add_fighter(struct explain_batch* batch, const struct search_request* req, int fighter_idx, const struct scan_profile* profile);
+
+/*!
+ * \brief Finishes the report with the total time of the search and sends it
+ * to the main thread. Takes ownership of the batch.
+ */
+void
+explain_batch_post(struct explain_batch* batch, uint64_t total_us);
+
+/*! \brief Creates the check button that turns reports on and off */
+GtkWidget*
+explain_check_create(struct plugin_ctx* ctx);
+
+/*! \brief Creates the view that shows the report of the current search */
+GtkWidget*
+explain_view_create(struct plugin_ctx* ctx);
+
+void
+explain_view_clear(struct plugin_ctx* ctx);
+
+void
+explain_ui_destroy(struct plugin_ctx* ctx);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "search/habit.h"
+#include "vh/vec.h"
+
+#include <gtk/gtk.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct plugin_ctx;
+
+/*
+ * Habits are mined over many games, so the frame data of each game has to be
+ * loaded. Like searches, this happens on the worker. The main thread looks
+ * up which games and fighters match the filters beforehand.
+ */
+struct habit_stream
+{
+    int game_id;
+    int fighter_idx;
+};
+
+struct habit_request
+{
+    struct vec streams;  /* struct habit_stream, ordered by game */
+    enum habit_event event;
+    int generation;
+};
+
+void
+habit_request_init(struct habit_request* req);
+
+void
+habit_request_deinit(struct habit_request* req);
+
+/*!
+ * \brief Mines the habits of the requested streams and sends the most
+ * frequent ones to the main thread. Called from the worker thread.
+ */
+void
+habit_execute(struct plugin_ctx* ctx, const struct habit_request* req);
+
+/*!
+ * \brief Creates the controls for choosing a player and what to mine, and
+ * the list of their habits.
+ */
+GtkWidget*
+habits_ui_create(struct plugin_ctx* ctx);
+
+void
+habits_ui_destroy(struct plugin_ctx* ctx);
+
+void
+habit_player_list_reset(struct plugin_ctx* ctx);
+
+/*! \brief Adds a player of the current game, in the order of the fighters */
+void
+habit_player_list_append(struct plugin_ctx* ctx, const char* player, const char* fighter);
+
+void
+habit_player_list_select_first(struct plugin_ctx* ctx);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <gtk/gtk.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct plugin_ctx;
+struct search_index;
+
+/*!
+ * \brief Creates the list of situations from other games that are similar to
+ * the activated result.
+ */
+GtkWidget*
+similar_ui_create(struct plugin_ctx* ctx);
+
+void
+similar_ui_destroy(struct plugin_ctx* ctx);
+
+/*!
+ * \brief Lists the windows of other games that share LSH buckets with a
+ * result.
+ * \param[in] bands The MINHASH_BANDS buckets of the result.
+ */
+void
+similar_find(struct plugin_ctx* ctx, const uint64_t* bands);
+
+/*!
+ * \brief Adds a game to the similarity index. Called from the worker thread.
+ * The buckets of every window of the game are computed from the index, and
+ * the main thread stores them.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+similar_post_buckets(struct plugin_ctx* ctx, const struct search_index* index, int game_id);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "search/hit_stats.h"
+#include "search/search_request.h"
+
+#include <gtk/gtk.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct plugin_ctx;
+
+/*
+ * Statistics run the query on every game in the library. The main thread
+ * looks up all fighters and what they are grouped by, and the worker searches
+ * them and adds the hits. The main thread keeps the hits, so they can be
+ * grouped differently without searching again.
+ */
+struct stats_request
+{
+    struct search_request query;  /* Only text, ast_hash and is_joint are used */
+    struct hit_stats stats;       /* Streams ordered by game */
+    int generation;
+};
+
+int
+stats_request_init(struct stats_request* req);
+
+void
+stats_request_deinit(struct stats_request* req);
+
+/*!
+ * \brief Searches every stream of the request and sends the hits to the main
+ * thread. Called from the worker thread.
+ */
+void
+stats_execute(struct plugin_ctx* ctx, struct stats_request* req);
+
+/*!
+ * \brief Creates the controls for searching all games and the list of hits,
+ * grouped by player, matchup or stage.
+ */
+GtkWidget*
+stats_ui_create(struct plugin_ctx* ctx);
+
+void
+stats_ui_destroy(struct plugin_ctx* ctx);
+
+#if defined(__cplusplus)
+}
+#endif
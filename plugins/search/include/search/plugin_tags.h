@@ -0,0 +1,79 @@
+#pragma once
+
+#include "search/search_request.h"
+#include "vh/hash.h"
+#include "vh/vec.h"
+
+#include <gtk/gtk.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct plugin_ctx;
+
+/*
+ * Saved queries that are marked as tags run on every game of the library,
+ * and the number of matches is stored per game. Importing a replay only
+ * queues the game. The main thread hands a few queued games at a time to the
+ * worker, which tags them when it has nothing else to do. The worker stops
+ * early when it runs out of time or another request comes in, and the games
+ * it didn't get to are handed over again later.
+ *
+ * The worker also adds the games it loads to the library-wide FM-index (see
+ * fm_library.h), so queued games are handed over even if there are no tag
+ * queries.
+ */
+struct tag_query
+{
+    struct search_request query;  /* Only text, ast_hash, is_joint, max_edits and labels_revision are used */
+    int query_id;
+};
+
+struct tag_game
+{
+    int game_id;
+    int first_fighter;  /* Index into fighter_ids */
+    int fighter_count;
+};
+
+struct tag_request
+{
+    struct vec games;        /* struct tag_game */
+    struct vec fighter_ids;  /* int - fighter IDs of all games, back to back */
+    struct vec queries;      /* struct tag_query */
+    hash32 queries_hash;     /* Identifies the tag queries as they were in the database */
+};
+
+void
+tag_request_init(struct tag_request* req);
+
+void
+tag_request_deinit(struct tag_request* req);
+
+/*!
+ * \brief Counts the matches of every tag query in the requested games, adds
+ * them to the FM-index, and sends the counts to the main thread to be stored.
+ * Called from the worker thread when it has nothing else to do. Gives way to
+ * other requests early.
+ */
+void
+tag_execute(struct plugin_ctx* ctx, const struct tag_request* req);
+
+/*! \brief Periodically submits games that were queued since, e.g. by importing replays */
+void
+tag_poll_start(struct plugin_ctx* ctx);
+
+void
+tag_poll_stop(struct plugin_ctx* ctx);
+
+/*! \brief Creates the controls for saving the current query as a tag */
+GtkWidget*
+tags_ui_create(struct plugin_ctx* ctx);
+
+void
+tags_ui_destroy(struct plugin_ctx* ctx);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "search/range.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct ast;
+union symbol;
+
+enum prefilter_isa
+{
+    PREFILTER_SCALAR,
+    PREFILTER_SSE2,
+    PREFILTER_AVX2
+};
+
+typedef int (*prefilter_find_func)(const union symbol* symbols, int start, int end, uint64_t motion, uint64_t mask);
+
+/*!
+ * Many expressions contain a motion that every match must include. Instead
+ * of running the automaton from every symbol in the window, the prefilter
+ * scans for occurrences of that motion using SIMD compares, and only the
+ * windows around each occurrence need to be searched.
+ *
+ * "before" and "after" are the maximum number of symbols a match can
+ * contain before and after the literal. They are -1 if unbounded.
+ */
+struct prefilter
+{
+    prefilter_find_func find;
+    uint64_t motion;
+    uint64_t mask;
+    int before;
+    int after;
+    unsigned is_active : 1;
+};
+
+/*!
+ * \brief Initializes an inactive prefilter and selects the best SIMD
+ * implementation supported by the CPU.
+ */
+void
+prefilter_init(struct prefilter* pf);
+
+/*!
+ * \brief Extracts a required literal motion from the AST. If the expression
+ * has no such motion, the prefilter remains inactive and
+ * prefilter_next_window() will return the entire window.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+prefilter_from_ast(struct prefilter* pf, const struct ast* ast);
+
+static inline int
+prefilter_is_active(const struct prefilter* pf)
+    { return pf->is_active; }
+
+/*!
+ * \brief Returns the best instruction set supported by the current CPU.
+ */
+enum prefilter_isa
+prefilter_best_isa(void);
+
+/*!
+ * \brief Forces a specific implementation. Mostly useful for testing.
+ * \return Returns 0 on success or negative if the CPU does not support it.
+ */
+int
+prefilter_set_isa(struct prefilter* pf, enum prefilter_isa isa);
+
+/*!
+ * \brief Returns the index of the next symbol in the window that contains
+ * the literal motion, or window.end if there is none.
+ */
+static inline int
+prefilter_find_next(const struct prefilter* pf, const union symbol* symbols, struct range window)
+    { return pf->find(symbols, window.start, window.end, pf->motion, pf->mask); }
+
+/*!
+ * \brief Finds the next range of symbols that may contain matches. Windows
+ * around neighbouring literal occurrences are merged, so running
+ * dfa_find_all() (or equivalent) on each returned window produces exactly
+ * the same results as running it on the entire window.
+ *
+ * Typical usage:
+ * \code
+ *   for (;;) {
+ *       struct range w = prefilter_next_window(pf, symbols, window);
+ *       if (w.start == w.end) break;
+ *       dfa_find_all(&ranges, dfa, symbols, w);
+ *       window.start = w.end;
+ *   }
+ * \endcode
+ * \return If no further matches are possible, an empty range is returned.
+ */
+struct range
+prefilter_next_window(const struct prefilter* pf, const union symbol* symbols, struct range window);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "search/asm.h"
+#include "search/ast.h"
+#include "search/bitnfa.h"
+#include "search/prefilter.h"
+#include "vh/vec.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+enum query_stage
+{
+    QUERY_STAGE_PARSE,
+    QUERY_STAGE_LABELS,
+    QUERY_STAGE_PREFILTER,
+    QUERY_STAGE_NFA,
+    QUERY_STAGE_BITNFA,
+    QUERY_STAGE_DFA,
+    QUERY_STAGE_ASM,
+
+    QUERY_STAGE_COUNT
+};
+
+/*!
+ * What compilation produced and how long each stage took. Stages that were
+ * skipped take 0 microseconds and the sizes of engines that weren't built
+ * are 0.
+ */
+struct query_stats
+{
+    uint64_t stage_us[QUERY_STAGE_COUNT];
+    int ast_nodes;
+    int nfa_states;
+    int dfa_states;
+    int bitnfa_positions;
+    int asm_size;
+};
+
+/*!
+ * Everything needed to run a query on the symbols of one fighter. Usually only
+ * one of the two engines is compiled. Approximate searches additionally need
+ * the bit-parallel NFA. Queries with steps of the opponent run on the
+ * fighter's joint stream.
+ */
+struct compiled_query
+{
+    struct ast ast;
+    struct asm_dfa assembly;
+    struct bitnfa bitnfa;
+    struct prefilter prefilter;
+    struct query_stats stats;
+};
+
+int
+compiled_query_init(struct compiled_query* query);
+
+void
+compiled_query_deinit(struct compiled_query* query);
+
+/*!
+ * \brief Compiles the AST of the query, which must not have any labels left,
+ * into the prefilter and one of the two engines. Approximate searches always
+ * use the bit-parallel NFA. The time and the result of each stage are
+ * recorded in query->stats.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+compiled_query_build(struct compiled_query* query, int max_edits);
+
+static inline int
+compiled_query_is_compiled(struct compiled_query* query)
+    { return asm_is_compiled(&query->assembly) || bitnfa_is_compiled(&query->bitnfa); }
+
+/*!
+ * Holds compiled queries so that typing a previous query again, or running
+ * the same query on many games, does not need to recompile anything. Because
+ * labels resolve to different motions depending on the fighter, entries are
+ * keyed by the normalized AST together with the fighter ID. Lookups compare
+ * the hash of the AST (see ast_hash()) first, and only compare the trees
+ * themselves if the hashes are equal. Expressions with steps of the opponent
+ * additionally depend on the opponent's fighter ID, for all others it is -1.
+ * When full, the least recently used entry is evicted.
+ */
+struct query_cache
+{
+    struct vec entries;  /* struct query_cache_entry */
+    int capacity;
+    unsigned clock;
+};
+
+#define QUERY_CACHE_DEFAULT_CAPACITY 32
+
+/*!
+ * Increment whenever a change to compilation or the engines can change which
+ * ranges a query matches. Stored search results of older versions are
+ * ignored.
+ */
+#define SEARCH_ENGINE_VERSION 1
+
+void
+query_cache_init(struct query_cache* cache, int capacity);
+
+void
+query_cache_deinit(struct query_cache* cache);
+
+/*!
+ * \brief Removes all entries. Must be called if any of the inputs to
+ * compilation change, e.g. when motion labels are edited.
+ */
+void
+query_cache_clear(struct query_cache* cache);
+
+/*!
+ * \brief Looks up a compiled query and marks it as recently used.
+ * \param[in] ast_hash ast_hash() of the root of "ast".
+ * \param[in] ast The normalized query, before labels were resolved.
+ * \return Returns the entry, or NULL if it is not in the cache.
+ */
+struct compiled_query*
+query_cache_find(struct query_cache* cache, uint64_t ast_hash, const struct ast* ast, int fighter_id, int opponent_id);
+
+/*!
+ * \brief Adds a new, empty entry to the cache. Evicts the least recently used
+ * entry if the cache is full. The caller is expected to compile the query into
+ * the returned entry, or to remove it again with query_cache_erase() if
+ * compilation fails.
+ * \param[in] ast_hash ast_hash() of the root of "ast".
+ * \param[in] ast The parsed query, before labels were resolved. The entry
+ * keeps a copy of it.
+ * \note Pointers to previously returned entries are invalidated.
+ * \return Returns the new entry, or NULL on error.
+ */
+struct compiled_query*
+query_cache_insert(struct query_cache* cache, uint64_t ast_hash, const struct ast* ast, int fighter_id, int opponent_id);
+
+void
+query_cache_erase(struct query_cache* cache, struct compiled_query* query);
+
+static inline int
+query_cache_count(const struct query_cache* cache)
+    { return (int)vec_count(&cache->entries); }
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "vh/vec.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct db;
+struct db_interface;
+struct fuzzy_range;
+
+/*!
+ * Identifies the matches of one query on one fighter of a game. The query is
+ * identified by ast_hash() of the parsed (not label resolved) expression, so
+ * whitespace and other differences in spelling don't matter.
+ */
+struct result_key
+{
+    uint64_t query_hash;
+    int game_id;
+    int fighter_idx;
+    int target_idx;  /* Fighter everybody is matched against, or -1 */
+    int max_edits;
+};
+
+/*!
+ * \brief Loads matches that were stored by a previous search.
+ * The set is only used if it was created from the same frame data and with
+ * the same symbolizer (SEARCH_INDEX_VERSION) and engines
+ * (SEARCH_ENGINE_VERSION). Sets of queries that use labels are removed by the
+ * database whenever the motion labels change.
+ * \param[out] matches Vector of struct fuzzy_range. Matches are appended.
+ * \return Returns 1 if a valid set was found, 0 if the fighter has to be
+ * scanned, or negative on error.
+ */
+int
+result_store_load(
+    struct db_interface* dbi, struct db* db,
+    const struct result_key* key, uint64_t frame_data_stamp,
+    struct vec* matches);
+
+/*!
+ * \brief Replaces the stored matches of a fighter. An empty set is stored as
+ * well, so that fighters without matches aren't scanned again either.
+ * \note The caller should wrap the sets of a game in a transaction.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+result_store_save(
+    struct db_interface* dbi, struct db* db,
+    const struct result_key* key, uint64_t frame_data_stamp, int uses_labels,
+    const struct fuzzy_range* matches, int count);
+
+#if defined(__cplusplus)
+}
+#endif
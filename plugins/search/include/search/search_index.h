@@ -1,48 +1,128 @@
 #pragma once
 
+#include "search/prefilter.h"
 #include "search/range.h"
 #include "search/symbol.h"
 #include "vh/vec.h"
 
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
 union symbol;
 struct frame_data;
 
+/*!
+ * Increment whenever the symbols built from frame data change, e.g. when a
+ * new field is taken into account. Stored search results of older versions
+ * are ignored.
+ */
+#define SEARCH_INDEX_VERSION 1
+
+typedef int (*search_index_find_runs_func)(int* starts, const uint64_t* motion, int frame_count);
+
+/*!
+ * Holds two symbol streams per fighter. The fighter's own stream only
+ * contains its own motions, and the op_* flags describe the fighter's
+ * opponent. The joint stream additionally interleaves the opponent's motions
+ * (marked with "is_op") in the order they started, and is used by expressions
+ * that contain steps of the opponent.
+ */
 struct search_index
 {
     struct vec fighters;  /* struct fighter_index */
+    search_index_find_runs_func find_runs;
 };
 
+/*!
+ * \brief Initializes an empty index and selects the best SIMD implementation
+ * supported by the CPU.
+ */
 void
 search_index_init(struct search_index* index);
 
 void
 search_index_deinit(struct search_index* index);
 
+/*!
+ * \brief Builds the symbol streams of all fighters.
+ * The streams of different fighters are built on separate threads. The
+ * result does not depend on the number of threads or the instruction set.
+ * \param[in] target Index of the fighter that everybody else is matched
+ * against, or -1 to pair up fighters automatically. This only makes a
+ * difference in games with more than two fighters, e.g. 2v2.
+ * \return Returns 0 on success or negative on error.
+ */
 int
-search_index_build(struct search_index* index, const struct frame_data* fdata);
+search_index_build(struct search_index* index, const struct frame_data* fdata, int target);
+
+/*!
+ * \brief Forces a specific implementation for finding where motions change.
+ * Mostly useful for testing.
+ * \return Returns 0 on success or negative if the CPU does not support it.
+ */
+int
+search_index_set_isa(struct search_index* index, enum prefilter_isa isa);
 
 void
 search_index_clear(struct search_index* index);
 
 static inline int
-search_index_has_data(struct search_index* index)
+search_index_has_data(const struct search_index* index)
     { return vec_count(&index->fighters) > 0; }
 
 static inline int
-search_index_fighter_count(struct search_index* index)
+search_index_fighter_count(const struct search_index* index)
     { return vec_count(&index->fighters); }
 
+/*! \brief Returns the index of the fighter that "fighter_idx" is matched against */
+int
+search_index_opponent(const struct search_index* index, int fighter_idx);
+
 int
-search_index_symbol_count(struct search_index* index, int fighter_idx);
+search_index_symbol_count(const struct search_index* index, int fighter_idx);
 
 const union symbol*
 search_index_symbols(const struct search_index* index, int fighter_idx);
 
 static inline struct range
-search_index_range(struct search_index* index, int fighter_idx)
+search_index_range(const struct search_index* index, int fighter_idx)
 {
     struct range r;
     r.start = 0;
     r.end = search_index_symbol_count(index, fighter_idx);
     return r;
 }
+
+int
+search_index_joint_symbol_count(const struct search_index* index, int fighter_idx);
+
+const union symbol*
+search_index_joint_symbols(const struct search_index* index, int fighter_idx);
+
+static inline struct range
+search_index_joint_range(const struct search_index* index, int fighter_idx)
+{
+    struct range r;
+    r.start = 0;
+    r.end = search_index_joint_symbol_count(index, fighter_idx);
+    return r;
+}
+
+/*!
+ * \brief Returns the index of the symbol in the fighter's own stream that is
+ * active on the specified frame.
+ */
+int
+search_index_find_frame(const struct search_index* index, int fighter_idx, int frame);
+
+/*!
+ * \brief Converts a range of symbols of the fighter's own stream into the
+ * range of frames they span.
+ */
+struct range
+search_index_frames(const struct search_index* index, int fighter_idx, struct range symbols);
+
+#if defined(__cplusplus)
+}
+#endif
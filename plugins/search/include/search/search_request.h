@@ -0,0 +1,54 @@
+#pragma once
+
+#include "search/ast.h"
+#include "vh/str.h"
+#include "vh/vec.h"
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*!
+ * A query the main thread hands to the search worker. The query is parsed
+ * and normalized once, and the db worker resolved its labels for every
+ * fighter it is compiled for, so the search worker never parses "text".
+ */
+struct search_request
+{
+    struct str text;
+    struct ast ast;  /* Normalized, labels are not resolved */
+    struct vec fighter_ids;  /* int - fighter ID of each fighter in the game */
+    struct vec stored;         /* struct fuzzy_range - matches of all fighters, back to back */
+    struct vec stored_counts;  /* int - number of stored matches of each fighter */
+    uint64_t ast_hash;  /* ast_hash() of "ast" */
+    uint64_t frame_data_stamp;  /* 0 if the game has no frame data */
+    uint64_t labels_revision;   /* Motion labels the query was resolved with */
+    int game_id;
+    int target_idx;  /* Fighter everybody is matched against, or -1 */
+    int max_edits;   /* Approximate search if greater than 0 */
+    int generation;
+    unsigned is_joint : 1;  /* The query has steps of the opponent */
+    unsigned needs_buckets : 1;  /* The game is missing from the similarity index */
+    unsigned explain : 1;  /* Report how the query was compiled and scanned */
+    unsigned is_stored : 1;  /* The matches of every fighter were loaded from the database */
+    unsigned uses_labels : 1;
+};
+
+int
+search_request_init(struct search_request* req);
+
+void
+search_request_deinit(struct search_request* req);
+
+/*!
+ * \brief Sets the query of the request to a copy of the parsed query, and
+ * normalizes it. Also fills in everything derived from the query.
+ * \return Returns 0 on success or negative on error.
+ */
+int
+search_request_set_ast(struct search_request* req, const struct ast* ast);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -2,13 +2,28 @@
 
 #include <stdint.h>
 
+/*!
+ * Numeric columns are quantized into a few bits so that range predicates can
+ * be matched with the same mask compare as everything else. Damage is stored
+ * in steps of 10%, the last step covering everything above 150%. Predicates
+ * compare whole percent, so "30%-69%" covers damage from 30.0 up to 69.9.
+ * Ranges that don't line up with the steps are rejected, see nfa_check_ast().
+ */
+#define SYMBOL_DAMAGE_STEP      10.f
+#define SYMBOL_DAMAGE_BUCKETS   16
+#define SYMBOL_DAMAGE_MAX       999  /* Upper bound of open-ended ranges, e.g. ">=100%" */
+#define SYMBOL_FRAMES_BUCKETS   16
+
 union symbol
 {
     uint64_t u64;
     struct {
-        /* hash40 value, 5 bytes */
+        /* hash40 value, 5 bytes. The top byte is the length of the motion's
+         * name, which never needs the highest bit */
         unsigned motionl        : 32;
-        unsigned motionh        : 8;
+        unsigned motionh        : 7;
+        /* Set on the opponent's symbols in joint streams, see search_index */
+        unsigned is_op          : 1;
         /* Various flags that cannot be detected from regex alone */
         unsigned me_dead        : 1;
         unsigned me_hitlag      : 1;
@@ -17,46 +32,46 @@ union symbol
         unsigned me_rising      : 1;
         unsigned me_falling     : 1;
         unsigned me_buried      : 1;
-        unsigned me_phantom     : 1;
+        unsigned me_clank       : 1;
+        unsigned me_crossup     : 1;
+        unsigned me_fastfall    : 1;
         /* same but for opponent */
         unsigned op_dead        : 1;
         unsigned op_hitlag      : 1;
         unsigned op_hitstun     : 1;
         unsigned op_shieldlag   : 1;
-        unsigned op_rising      : 1;
-        unsigned op_falling     : 1;
         unsigned op_buried      : 1;
-        unsigned op_phantom     : 1;
+        /* Both fighters connected on the same frame */
+        unsigned trade          : 1;
+        /* Opponent's damage when the motion started, see symbol_damage_bucket() */
+        unsigned op_damage      : 4;
+        /* Frames since the previous motion started, see symbol_frames_bucket() */
+        unsigned prev_frames    : 4;
     };
 };
 
 static inline union symbol
-symbol_make(
-    uint64_t motion,
-    char me_dead, char me_hitlag, char me_hitstun, char me_shieldlag, char me_rising, char me_falling, char me_buried, char me_phantom,
-    char op_dead, char op_hitlag, char op_hitstun, char op_shieldlag, char op_rising, char op_falling, char op_buried, char op_phantom)
+symbol_make(uint64_t motion)
 {
     union symbol s;
+    s.u64 = 0;
     s.motionl = (motion & 0xFFFFFFFF);
     s.motionh = (motion >> 32);
+    return s;
+}
 
-    s.me_dead      = (me_dead != 0);
-    s.me_hitlag    = (me_hitlag != 0);
-    s.me_hitstun   = (me_hitstun != 0);
-    s.me_shieldlag = (me_shieldlag != 0);
-    s.me_rising    = (me_rising != 0);
-    s.me_falling   = (me_falling != 0);
-    s.me_buried    = (me_buried != 0);
-    s.me_phantom   = (me_phantom != 0);
-
-    s.op_dead      = (op_dead != 0);
-    s.op_hitlag    = (op_hitlag != 0);
-    s.op_hitstun   = (op_hitstun != 0);
-    s.op_shieldlag = (op_shieldlag != 0);
-    s.op_rising    = (op_rising != 0);
-    s.op_falling   = (op_falling != 0);
-    s.op_buried    = (op_buried != 0);
-    s.op_phantom   = (op_phantom != 0);
+static inline int
+symbol_damage_bucket(float damage)
+{
+    int bucket = damage > 0.f ? (int)(damage / SYMBOL_DAMAGE_STEP) : 0;
+    return bucket < SYMBOL_DAMAGE_BUCKETS ? bucket : SYMBOL_DAMAGE_BUCKETS - 1;
+}
 
-    return s;
+/*! The last bucket holds every distance of 15 frames or more */
+static inline int
+symbol_frames_bucket(int frames)
+{
+    if (frames < 0)
+        return 0;
+    return frames < SYMBOL_FRAMES_BUCKETS ? frames : SYMBOL_FRAMES_BUCKETS - 1;
 }
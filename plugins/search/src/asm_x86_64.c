@@ -6,6 +6,7 @@
 #include "vh/vec.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #if defined(_WIN32)
 #   define WIN32_LEAN_AND_MEAN
@@ -36,6 +37,7 @@ alloc_page_rw(int size)
     void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (mem == MAP_FAILED)
         return NULL;
+    return mem;
 #endif
 }
 static void
@@ -64,6 +66,7 @@ asm_init(struct asm_dfa* assembly)
 {
     assembly->next_state = NULL;
     assembly->size = 0;
+    assembly->code_size = 0;
 }
 
 void
@@ -174,12 +177,12 @@ static int MOV_r32_r32(struct vec* code, uint8_t dst, uint8_t src)
 /* 1000 1011 00xx x100 ssyy yzzz, xxx=dst, yyy=offset, zzz=base, ss=scale */
 static int MOVSX_r32_dword_ptr_base_offset_scale(struct vec* code, uint8_t dst, uint8_t base, uint8_t offset, uint8_t scale)
     { return write_asm(code, 3, 0x8B, 0x04 | (dst << 3), (scale << 6) | (offset << 3) | base); }
-/* 0000 1111 1011 1111 00xx x100 ssyy yzzz, xxx=dst, yyy=offset, zzz=base, ss=scale */
-static int MOVSX_r32_word_ptr_base_offset_scale(struct vec* code, uint8_t dst, uint8_t base, uint8_t offset, uint8_t scale)
-    { return write_asm(code, 4, 0x0F, 0xBF, 0x04 | (dst << 3), (scale << 6) | (offset << 3) | base); }
-/* 0000 1111 1011 1110 00xx x100 ssyy yzzz, xxx=dst, yyy=offset, zzz=base, ss=scale */
-static int MOVSX_r32_byte_ptr_base_offset_scale(struct vec* code, uint8_t dst, uint8_t base, uint8_t offset, uint8_t scale)
-    { return write_asm(code, 4, 0x0F, 0xBE, 0x04 | (dst << 3), (scale << 6) | (offset << 3) | base); }
+/* 0000 1111 1011 0111 00xx x100 ssyy yzzz, xxx=dst, yyy=offset, zzz=base, ss=scale */
+static int MOVZX_r32_word_ptr_base_offset_scale(struct vec* code, uint8_t dst, uint8_t base, uint8_t offset, uint8_t scale)
+    { return write_asm(code, 4, 0x0F, 0xB7, 0x04 | (dst << 3), (scale << 6) | (offset << 3) | base); }
+/* 0000 1111 1011 0110 00xx x100 ssyy yzzz, xxx=dst, yyy=offset, zzz=base, ss=scale */
+static int MOVZX_r32_byte_ptr_base_offset_scale(struct vec* code, uint8_t dst, uint8_t base, uint8_t offset, uint8_t scale)
+    { return write_asm(code, 4, 0x0F, 0xB6, 0x04 | (dst << 3), (scale << 6) | (offset << 3) | base); }
 static int AND_r64_r64(struct vec* code, uint8_t dst, uint8_t src)
     { return write_asm(code, 3, 0x48, 0x21, 0xC0 | (src << 3) | dst); }
 static int AND_r64_i32_sign_extend(struct vec* code, uint8_t reg, uint32_t value)
@@ -226,6 +229,10 @@ assemble_transition_lookup_table(struct vec* code, const struct dfa_table* dfa,
 #endif
 
     /*
+     * The lookup tables store states as unsigned bytes or words, which have
+     * to be zero-extended. States with an index of 32 or more would otherwise
+     * be sign-extended into invalid states.
+     *
      * Make sure to pop RBX again before generating the next instructions,
      * because otherwise the offset to the lookup table for the LEA instruction
      * will differ on Windows.
@@ -236,13 +243,13 @@ assemble_transition_lookup_table(struct vec* code, const struct dfa_table* dfa,
 
     if (dfa->tt.rows < TT_ROWS_8BIT_THRESHOLD)
     {
-        LEA_r64_RSP_plus_i32(code, RAX(), 5);  /* MOVSX (4) + RET (1) */
-        MOVSX_r32_byte_ptr_base_offset_scale(code, EAX(), RAX(), current_state_reg, SCALE1());
+        LEA_r64_RSP_plus_i32(code, RAX(), 5);  /* MOVZX (4) + RET (1) */
+        MOVZX_r32_byte_ptr_base_offset_scale(code, EAX(), RAX(), current_state_reg, SCALE1());
     }
     else if (dfa->tt.rows < TT_ROWS_16BIT_THRESHOLD)
     {
-        LEA_r64_RSP_plus_i32(code, RAX(), 5);  /* MOVSX (4) + RET (1) */
-        MOVSX_r32_word_ptr_base_offset_scale(code, EAX(), RAX(), current_state_reg, SCALE2());
+        LEA_r64_RSP_plus_i32(code, RAX(), 5);  /* MOVZX (4) + RET (1) */
+        MOVZX_r32_word_ptr_base_offset_scale(code, EAX(), RAX(), current_state_reg, SCALE2());
     }
     else
     {
@@ -270,7 +277,7 @@ assemble_transition_lookup_table(struct vec* code, const struct dfa_table* dfa,
 int
 asm_compile(struct asm_dfa* assembly, const struct dfa_table* dfa)
 {
-    int c;
+    int c, code_size;
     int page_size = get_page_size();
     int have_wildcard = 0;
     struct vec code;
@@ -377,6 +384,7 @@ asm_compile(struct asm_dfa* assembly, const struct dfa_table* dfa)
     void* mem = alloc_page_rw(page_size);
     memcpy(mem, vec_data(&code), vec_count(&code));
     protect_rx(mem, page_size);
+    code_size = (int)vec_count(&code);
 
     vec_deinit(&jump_offsets);
     vec_deinit(&code);
@@ -384,6 +392,7 @@ asm_compile(struct asm_dfa* assembly, const struct dfa_table* dfa)
     asm_deinit(assembly);
     assembly->next_state = (asm_func)mem;
     assembly->size = page_size;
+    assembly->code_size = code_size;
 
     return 0;
 
@@ -427,16 +436,23 @@ asm_run(const struct asm_dfa* assembly, const union symbol* symbols, struct rang
 struct range
 asm_find_first(const struct asm_dfa* assembly, const union symbol* symbols, struct range window)
 {
-    for (; window.start != window.end; ++window.start)
+    return asm_find_first_before(assembly, symbols, window, window.end);
+}
+
+struct range
+asm_find_first_before(const struct asm_dfa* assembly, const union symbol* symbols, struct range window, int start_end)
+{
+    for (; window.start != start_end; ++window.start)
     {
         int end = asm_run(assembly, symbols, window);
         if (end > window.start)
         {
             window.end = end;
-            break;
+            return window;
         }
     }
 
+    window.end = window.start;
     return window;
 }
 
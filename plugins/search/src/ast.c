@@ -175,6 +175,34 @@ int ast_duplicate(struct ast* ast, int node)
     return dup;
 }
 
+int ast_copy(struct ast* dst, const struct ast* src)
+{
+    int n;
+
+    ast_clear(dst);
+    if (dst->node_capacity < src->node_count)
+    {
+        union ast_node* new_nodes = mem_realloc(dst->nodes, sizeof(union ast_node) * src->node_count);
+        if (new_nodes == NULL)
+            return -1;
+        dst->nodes = new_nodes;
+        dst->node_capacity = src->node_count;
+    }
+    memcpy(dst->nodes, src->nodes, sizeof(union ast_node) * src->node_count);
+    dst->node_count = src->node_count;
+
+    /* Labels refer to strings in the AST's own list */
+    for (n = 0; n != src->node_count; ++n)
+        if (src->nodes[n].info.type == AST_LABEL)
+        {
+            if (strlist_add(&dst->labels, strlist_to_view(&src->labels, src->nodes[n].label.label)) < 0)
+                return -1;
+            dst->nodes[n].label.label = strlist_last(&dst->labels);
+        }
+
+    return 0;
+}
+
 static void write_nodes(const struct ast* ast, int n, FILE* fp)
 {
     switch (ast->nodes[n].info.type)
@@ -235,6 +263,7 @@ static void write_nodes(const struct ast* ast, int n, FILE* fp)
             APPEND(DJ)
             APPEND(FS)
             APPEND(IDJ)
+            APPEND(OP)
             fprintf(fp, "\"];\n");
 
             #undef APPEND
@@ -1,8 +1,11 @@
 #include "search/ast.h"
 #include "search/ast_ops.h"
 
+#include "vh/hash40.h"
 #include "vh/log.h"
 
+#include <string.h>
+
 void ast_set_root(struct ast* ast, int node)
 {
     ast_swap_node_idxs(ast, 0, node);
@@ -129,7 +132,7 @@ int ast_is_in_subtree_of(struct ast* ast, int node, int root)
     return 0;
 }
 
-int ast_trees_equal(struct ast* a1, int n1, struct ast* a2, int n2)
+int ast_trees_equal(const struct ast* a1, int n1, const struct ast* a2, int n2)
 {
     if (a1->nodes[n1].info.type != a2->nodes[n2].info.type)
         return 0;
@@ -204,6 +207,76 @@ int ast_trees_equal(struct ast* a1, int n1, struct ast* a2, int n2)
     return 1;
 }
 
+static uint64_t
+hash_combine(uint64_t h, uint64_t value)
+{
+    /* 64-bit variant of boost::hash_combine */
+    return h ^ (value + 0x9e3779b97f4a7c15ull + (h << 12) + (h >> 4));
+}
+
+static uint64_t
+hash_float(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof bits);
+    return bits;
+}
+
+uint64_t ast_hash(const struct ast* ast, int n)
+{
+    /* Must consider the same values as ast_trees_equal() */
+    const union ast_node* node = &ast->nodes[n];
+    uint64_t h = hash_combine(0, node->info.type + 1);
+
+    switch (node->info.type)
+    {
+        case AST_STATEMENT: break;
+        case AST_REPETITION:
+            h = hash_combine(h, (uint64_t)node->repetition.min_reps);
+            h = hash_combine(h, (uint64_t)node->repetition.max_reps);
+            break;
+        case AST_UNION: break;
+        case AST_INVERSION: break;
+        case AST_CONTEXT:
+            h = hash_combine(h, (uint64_t)node->context.flags);
+            break;
+        case AST_LABEL:
+            h = hash_combine(h, hash40_str(strlist_to_view(&ast->labels, node->label.label)));
+            break;
+        case AST_MOTION:
+            h = hash_combine(h, node->motion.motion);
+            break;
+        case AST_TIMING:
+            h = hash_combine(h, (uint64_t)node->timing.start);
+            h = hash_combine(h, (uint64_t)node->timing.end);
+            h = hash_combine(h, ast_hash(ast, node->timing.rel_to_ref));
+            break;
+        case AST_DAMAGE:
+            h = hash_combine(h, hash_float(node->damage.from));
+            h = hash_combine(h, hash_float(node->damage.to));
+            break;
+        case AST_WILDCARD: break;
+    }
+
+    /* Distinguish missing children from the left and right side */
+    h = hash_combine(h, node->base.left >= 0 ? ast_hash(ast, node->base.left) : 1);
+    h = hash_combine(h, node->base.right >= 0 ? ast_hash(ast, node->base.right) : 2);
+
+    return h;
+}
+
+int ast_references_opponent(const struct ast* ast, int n)
+{
+    const union ast_node* node = &ast->nodes[n];
+    if (node->info.type == AST_CONTEXT && (node->context.flags & AST_CTX_OP))
+        return 1;
+    if (node->base.left >= 0 && ast_references_opponent(ast, node->base.left))
+        return 1;
+    if (node->base.right >= 0 && ast_references_opponent(ast, node->base.right))
+        return 1;
+    return 0;
+}
+
 int ast_node_preceeds(struct ast* ast, int n1, int n2)
 {
     while (1)
@@ -222,3 +295,43 @@ int ast_node_preceeds(struct ast* ast, int n1, int n2)
                 return 0;
     }
 }
+
+/*
+ * Sequences and alternatives are associative, so "(a->b)->c" and
+ * "a->(b->c)" match the same. Chains of the same type are rotated to lean
+ * left, which is how the parser builds them without parentheses. Rotating
+ * reuses the nodes in place, so no index into the tree changes, and only the
+ * inner node of a chain, which nothing refers to, represents something new.
+ */
+static void normalize_chain(struct ast* ast, int n)
+{
+    union ast_node* node = &ast->nodes[n];
+    enum ast_type type = node->info.type;
+
+    if (type == AST_STATEMENT || type == AST_UNION)
+        while (ast->nodes[node->base.right].info.type == type)
+        {
+            int inner = node->base.right;
+            int a = node->base.left;
+            int b = ast->nodes[inner].base.left;
+            int c = ast->nodes[inner].base.right;
+
+            ast->nodes[inner].base.left = a;
+            ast->nodes[inner].base.right = b;
+            ast->nodes[inner].info.loc.begin = ast->nodes[a].info.loc.begin;
+            ast->nodes[inner].info.loc.end = ast->nodes[b].info.loc.end;
+            node->base.left = inner;
+            node->base.right = c;
+        }
+
+    if (node->base.left >= 0)
+        normalize_chain(ast, node->base.left);
+    if (node->base.right >= 0)
+        normalize_chain(ast, node->base.right);
+}
+
+void ast_normalize(struct ast* ast)
+{
+    if (ast->node_count > 0)
+        normalize_chain(ast, 0);
+}
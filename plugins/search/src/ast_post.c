@@ -1,8 +1,8 @@
 #include "search/ast.h"
 #include "search/ast_ops.h"
 #include "search/ast_post.h"
+#include "search/label_map.h"
 
-#include "vh/db.h"
 #include "vh/hash40.h"
 #include "vh/hm.h"
 #include "vh/log.h"
@@ -10,44 +10,8 @@
 #include "vh/str.h"
 #include "vh/vec.h"
 
-struct on_motion_ctx
-{
-    struct ast* ast;
-    int node;
-    int replace_node;
-    int row_count;
-};
-
-static int on_motion(uint64_t hash40, void* user_data)
-{
-    struct on_motion_ctx* ctx = user_data;
-    struct strlist_str* hm_label;
-    struct YYLTYPE* loc = (struct YYLTYPE*)&ctx->ast->nodes[ctx->node].info.loc;
-    int n = ast_motion(ctx->ast, hash40, loc);
-    if (n < 0)
-        return -1;
-
-    ctx->replace_node = ctx->replace_node == -1 ? n :
-        ast_union(ctx->ast, ctx->replace_node, n, loc);
-    if (ctx->replace_node < 0)
-        return -1;
-
-    switch (hm_insert(&ctx->ast->merged_labels, &hash40, (void**)&hm_label))
-    {
-        case 1  : *hm_label = ctx->ast->nodes[ctx->node].label.label;
-        case 0  : break;
-        default : return -1;
-    }
-
-    ctx->row_count++;
-    return 0;
-}
-
 static int
-try_patch_user_defined(
-    struct ast* ast, int node,
-    struct db_interface* dbi, struct db* db, int fighter_id,
-    struct str_view label)
+patch_user_defined(struct ast* ast, int node, const uint64_t* motions, int count)
 {
     /*
      * If the label is a user-defined label, for example "nair", then it
@@ -56,70 +20,91 @@ try_patch_user_defined(
      * "(attack_air_n|landing_air_n)+". This will match all patterns of
      * "nair".
      */
-    struct on_motion_ctx ctx = { ast, node, -1, 0 };
-    if (dbi->motion_label.to_motions(db, fighter_id, label, on_motion, &ctx) < 0)
-        return -1;
+    /* Creating nodes can reallocate the node array, so copy the location */
+    struct ast_location location = ast->nodes[node].info.loc;
+    struct YYLTYPE* loc = (struct YYLTYPE*)&location;
+    int i, replace_node = -1;
+
+    for (i = 0; i != count; ++i)
+    {
+        struct strlist_str* hm_label;
+        int n = ast_motion(ast, motions[i], loc);
+        if (n < 0)
+            return -1;
+
+        replace_node = replace_node == -1 ? n :
+            ast_union(ast, replace_node, n, loc);
+        if (replace_node < 0)
+            return -1;
 
-    if (ctx.row_count == 0)
-        return 0;
+        switch (hm_insert(&ast->merged_labels, &motions[i], (void**)&hm_label))
+        {
+            case 1  : *hm_label = ast->nodes[node].label.label;
+            case 0  : break;
+            default : return -1;
+        }
+    }
 
     /* Only need repetition if there is more than 1 label */
-    if (ctx.row_count > 1)
+    if (count > 1)
     {
-        ctx.replace_node = ast_repetition(ast, ctx.replace_node, 1, -1, (struct YYLTYPE*)&ast->nodes[node].info.loc);
-        if (ctx.replace_node < 0)
+        replace_node = ast_repetition(ast, replace_node, 1, -1, loc);
+        if (replace_node < 0)
             return -1;
     }
 
-    ast_collapse_into(ast, ctx.replace_node, node);
-    return 1;
+    ast_collapse_into(ast, replace_node, node);
+    return 0;
 }
 
+/* Returns true if the node is a step of the opponent, i.e. it has an "op" qualifier */
 static int
-try_patch_existing_hash40(
-    struct ast* ast, int node,
-    struct db_interface* dbi, struct db* db,
-    struct str_view label)
+is_opponent_step(struct ast* ast, int n)
 {
-    /* Maybe the label hashes to a known value. */
-    uint64_t motion = hash40_str(label);
-    switch (dbi->motion.exists(db, motion))
-    {
-        case 1  : break;
-        case 0  : return 0;
-        default : return -1;
-    }
-
-    /* It exists, so replace the label node with a motion node */
-    ast->nodes[node].info.type = AST_MOTION;
-    ast->nodes[node].motion.motion = motion;
-    return 1;
+    for (; n >= 0; n = ast_find_parent(ast, n))
+        if (ast->nodes[n].info.type == AST_CONTEXT && (ast->nodes[n].context.flags & AST_CTX_OP))
+            return 1;
+    return 0;
 }
 
 int
-ast_post_labels_to_motions(struct ast* ast, struct db_interface* dbi, struct db* db, int fighter_id)
+ast_post_labels_to_motions(struct ast* ast, const struct label_map* labels, int fighter_id, int opponent_id)
 {
     int n;
 
     for (n = 0; n != ast->node_count; ++n)
     {
+        const struct label_entry* entry;
         struct str_view label;
+        int id;
         if (ast->nodes[n].info.type != AST_LABEL)
             continue;
         label = strlist_to_view(&ast->labels, ast->nodes[n].label.label);
 
-        switch (try_patch_user_defined(ast, n, dbi, db, fighter_id, label))
+        /* The opponent's steps use the opponent's labels */
+        id = is_opponent_step(ast, n) ? opponent_id : fighter_id;
+        entry = label_map_find(labels, id, label);
+        if (entry == NULL)
         {
-            case 1  : continue;
-            case 0  : break;
-            default : return -1;
+            log_err("Label '%.*s' was not resolved for fighter %d\n", label.len, label.data, id);
+            return -1;
         }
 
-        switch (try_patch_existing_hash40(ast, n, dbi, db, label))
+        switch (entry->kind)
         {
-            case 1  : continue;
-            case 0  : break;
-            default : return -1;
+            case LABEL_USER_DEFINED:
+                if (patch_user_defined(ast, n, label_map_motions(labels, entry), entry->count) < 0)
+                    return -1;
+                continue;
+
+            case LABEL_HASH40:
+                /* It exists, so replace the label node with a motion node */
+                ast->nodes[n].info.type = AST_MOTION;
+                ast->nodes[n].motion.motion = label_map_motions(labels, entry)[0];
+                continue;
+
+            case LABEL_UNKNOWN:
+                break;
         }
 
         /* Was unable to find a label that matches a motion value. Error out */
@@ -197,12 +182,6 @@ create_dj_ast(struct ast* ast, const struct YYLTYPE* loc)
     return ast_union(ast, jump_aerial_f, jump_aerial_b, loc);
 }
 
-static int
-create_fs_ast(struct ast* ast, const struct YYLTYPE* loc)
-{
-    return -1;
-}
-
 static int
 create_idj_ast(struct ast* ast, const struct YYLTYPE* loc)
 {
@@ -267,8 +246,7 @@ ast_post_jump_qualifiers(struct ast* ast)
         { AST_CTX_FH, create_fh_ast },
         { AST_CTX_SH, create_sh_ast },
         { AST_CTX_DJ, create_dj_ast },
-        { AST_CTX_IDJ, create_idj_ast },
-        { AST_CTX_FS, create_fs_ast }
+        { AST_CTX_IDJ, create_idj_ast }
     };
 
     for (n = 0; n != ast->node_count; ++n)
@@ -293,6 +271,15 @@ ast_post_jump_qualifiers(struct ast* ast)
              * wasn't the only flag.
              */
             ast->nodes[n].context.flags &= ~jumps[j].flag;
+
+            /* The jump belongs to the same fighter as the qualified step */
+            if (ast->nodes[n].context.flags & AST_CTX_OP)
+            {
+                jump = ast_context(ast, jump, AST_CTX_OP, loc);
+                if (jump < 0)
+                    return -1;
+            }
+
             if (ast->nodes[n].context.flags == 0)
             {
                 int stmt = ast_statement(ast, jump, ast->nodes[n].context.child, loc);
@@ -556,10 +543,7 @@ ast_post_validate_params(struct ast* ast)
                     AST_CTX_SH |
                     AST_CTX_FH |
                     AST_CTX_DJ |
-                    AST_CTX_FS |
-                    AST_CTX_IDJ |
-                    AST_CTX_KILL |
-                    AST_CTX_DIE;
+                    AST_CTX_IDJ;
                 if (ast->nodes[n].context.flags & invalid_flags)
                 {
                     log_err("Invalid flags set in context qualifiers! Should not happen\n");
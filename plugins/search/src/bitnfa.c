@@ -0,0 +1,655 @@
+#include "search/ast.h"
+#include "search/bitnfa.h"
+#include "search/match.h"
+#include "search/nfa.h"
+
+#include "vh/mem.h"
+
+#include <string.h>
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+static int
+ctz64(uint64_t x)
+{
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return (int)idx;
+}
+#else
+#   define ctz64(x) __builtin_ctzll(x)
+#endif
+
+/*
+ * The follow set of each position is precomputed for every possible byte of
+ * the state set. Computing the next state set then only requires one table
+ * lookup per 8 positions instead of iterating over all active positions.
+ */
+#define CHUNK_BITS 8
+#define CHUNK_SIZE (1 << CHUNK_BITS)
+
+static int
+do_match(const struct matcher* m, union symbol s)
+{
+    return (m->symbol.u64 & m->mask.u64) == (s.u64 & m->mask.u64);
+}
+
+static void
+set_bit(uint64_t* set, int bit)
+{
+    set[bit / BITNFA_WORD_BITS] |= (uint64_t)1 << (bit % BITNFA_WORD_BITS);
+}
+
+void
+bitnfa_init(struct bitnfa* bitnfa)
+{
+    vec_init(&bitnfa->tf, sizeof(struct matcher));
+    bitnfa->first = NULL;
+    bitnfa->accept = NULL;
+    bitnfa->match = NULL;
+    bitnfa->follow = NULL;
+    bitnfa->positions = 0;
+    bitnfa->words = 0;
+}
+
+void
+bitnfa_deinit(struct bitnfa* bitnfa)
+{
+    /* All bit sets share a single allocation */
+    if (bitnfa->first)
+        mem_free(bitnfa->first);
+    vec_deinit(&bitnfa->tf);
+}
+
+static int
+find_column(const struct vec* tf, const struct matcher* m)
+{
+    int c;
+    for (c = 0; c != (int)vec_count(tf); ++c)
+        if (matchers_equal(vec_get(tf, c), m))
+            return c;
+    return -1;
+}
+
+int
+bitnfa_from_nfa(struct bitnfa* bitnfa, const struct nfa_graph* nfa)
+{
+    struct vec tf;
+    uint64_t* data;
+    uint64_t* first;
+    uint64_t* accept;
+    uint64_t* match;
+    uint64_t* follow;
+    int n, c, w, cols, words, positions, follow_size;
+    int wildcard_col = -1;
+
+    positions = nfa->node_count - 1;  /* Node 0 is the entry node */
+    if (positions <= 0)
+        return -1;
+    words = (positions + BITNFA_WORD_BITS - 1) / BITNFA_WORD_BITS;
+
+    /*
+     * Columns are built in the same order as the DFA's transition table, so
+     * that a symbol is matched by the same column in both implementations.
+     * See nfa_table_from_graph() in dfa.c.
+     */
+    vec_init(&tf, sizeof(struct matcher));
+    for (n = 1; n != nfa->node_count; ++n)
+        if (find_column(&tf, &nfa->nodes[n].matcher) < 0)
+            if (vec_push(&tf, &nfa->nodes[n].matcher) < 0)
+                goto build_tf_failed;
+    if (match_build_columns(&tf) < 0)
+        goto build_tf_failed;
+    cols = vec_count(&tf);
+    if (matches_wildcard(vec_back(&tf)))
+        wildcard_col = cols - 1;
+
+    follow_size = words == 1 ?
+        ((positions + CHUNK_BITS - 1) / CHUNK_BITS) * CHUNK_SIZE :
+        positions * words;
+    data = mem_alloc(sizeof(uint64_t) * (words * (2 + cols) + follow_size));
+    if (data == NULL)
+        goto alloc_failed;
+    memset(data, 0, sizeof(uint64_t) * (words * (2 + cols) + follow_size));
+    first = data;
+    accept = first + words;
+    match = accept + words;
+    follow = match + words * cols;
+
+    /* Bit "n-1" represents NFA node "n" */
+    for (n = 1; n != nfa->node_count; ++n)
+    {
+        const struct matcher* m = &nfa->nodes[n].matcher;
+        if (m->is_accept && !m->is_inverted)
+            set_bit(accept, n - 1);
+        set_bit(match + words * find_column(&tf, m), n - 1);
+    }
+    VEC_FOR_EACH(&nfa->nodes[0].next, int, next)
+        set_bit(first, *next - 1);
+    VEC_END_EACH
+
+    /*
+     * A symbol is consumed by the most specific column it matches, which
+     * therefore has to enable the positions of all columns subsuming it. See
+     * nfa_table_bias_subsumed() in dfa.c
+     */
+    for (c = 0; c != cols; ++c)
+    {
+        int g;
+        const struct matcher* m = vec_get(&tf, c);
+        if (m->is_inverted)
+            continue;
+        for (g = 0; g != cols; ++g)
+        {
+            const struct matcher* general = vec_get(&tf, g);
+            if (g == c || general->is_inverted || matches_wildcard(general))
+                continue;
+            if (matcher_subsumes(general, m))
+                for (w = 0; w != words; ++w)
+                    match[c * words + w] |= match[g * words + w];
+        }
+    }
+
+    /*
+     * When the DFA is built, every state with an outgoing wildcard transition
+     * also receives the same transition on all other non-inverted columns,
+     * because the wildcard column is only evaluated if no other column
+     * matches. Do the same here. See nfa_table_bias_wildcards() in dfa.c
+     */
+    if (wildcard_col >= 0)
+        for (c = 0; c != wildcard_col; ++c)
+        {
+            const struct matcher* m = vec_get(&tf, c);
+            if (m->is_inverted)
+                continue;
+            for (w = 0; w != words; ++w)
+                match[c * words + w] |= match[wildcard_col * words + w];
+        }
+
+    if (words == 1)
+    {
+        int chunk, byte;
+        for (chunk = 0; chunk * CHUNK_BITS < positions; ++chunk)
+        {
+            uint64_t* table = follow + chunk * CHUNK_SIZE;
+            for (byte = 1; byte != CHUNK_SIZE; ++byte)
+            {
+                int bit = 0;
+                while (!(byte & (1 << bit)))
+                    bit++;
+
+                /* Reuse the entry without the lowest bit, then add this position */
+                table[byte] = table[byte & (byte - 1)];
+                n = chunk * CHUNK_BITS + bit + 1;
+                if (n >= nfa->node_count)
+                    continue;
+                VEC_FOR_EACH(&nfa->nodes[n].next, int, next)
+                    table[byte] |= (uint64_t)1 << (*next - 1);
+                VEC_END_EACH
+            }
+        }
+    }
+    else
+    {
+        for (n = 1; n != nfa->node_count; ++n)
+            VEC_FOR_EACH(&nfa->nodes[n].next, int, next)
+                set_bit(follow + (n - 1) * words, *next - 1);
+            VEC_END_EACH
+    }
+
+    bitnfa_deinit(bitnfa);
+    vec_steal_vector(&bitnfa->tf, &tf);
+    bitnfa->first = first;
+    bitnfa->accept = accept;
+    bitnfa->match = match;
+    bitnfa->follow = follow;
+    bitnfa->positions = positions;
+    bitnfa->words = words;
+
+    return 0;
+
+alloc_failed:
+build_tf_failed:
+    vec_deinit(&tf);
+    return -1;
+}
+
+int
+bitnfa_compile(struct bitnfa* bitnfa, const struct ast* ast)
+{
+    /*
+     * nfa_compile() already produces a position automaton: Every node holds
+     * exactly one matcher and its outgoing edges form the follow set.
+     */
+    struct nfa_graph nfa;
+    nfa_init(&nfa);
+    if (nfa_compile(&nfa, ast) < 0)
+        goto nfa_compile_failed;
+    if (bitnfa_from_nfa(bitnfa, &nfa) < 0)
+        goto bitnfa_failed;
+    nfa_deinit(&nfa);
+    return 0;
+
+    bitnfa_failed      : nfa_deinit(&nfa);
+    nfa_compile_failed : return -1;
+}
+
+static int
+lookup_column(const struct bitnfa* bitnfa, union symbol s)
+{
+    int c;
+    for (c = 0; c != (int)vec_count(&bitnfa->tf); ++c)
+        if (do_match(vec_get(&bitnfa->tf, c), s))
+            return c;
+    return -1;
+}
+
+static int
+bitnfa_run_single(const struct bitnfa* bitnfa, const union symbol* symbols, struct range r)
+{
+    int idx, chunk, c;
+    int last_accept_idx = r.start;
+    uint64_t state = bitnfa->first[0];
+    uint64_t accept = bitnfa->accept[0];
+    int chunks = (bitnfa->positions + CHUNK_BITS - 1) / CHUNK_BITS;
+
+    for (idx = r.start; idx != r.end; idx++)
+    {
+        if ((c = lookup_column(bitnfa, symbols[idx])) < 0)
+            break;
+
+        /* Only keep the positions that can consume this symbol */
+        state &= bitnfa->match[c];
+        if (state == 0)
+            break;
+        if (state & accept)
+            last_accept_idx = idx + 1;
+
+        /* Advance all active positions at once */
+        {
+            uint64_t next = 0;
+            const uint64_t* table = bitnfa->follow;
+            for (chunk = 0; chunk != chunks; ++chunk, table += CHUNK_SIZE)
+                next |= table[(state >> (chunk * CHUNK_BITS)) & (CHUNK_SIZE - 1)];
+            state = next;
+        }
+    }
+
+    return last_accept_idx;
+}
+
+static int
+bitnfa_run_multi(const struct bitnfa* bitnfa, const union symbol* symbols, struct range r, uint64_t* state, uint64_t* next)
+{
+    int idx, c, w;
+    int last_accept_idx = r.start;
+    int words = bitnfa->words;
+
+    memcpy(state, bitnfa->first, sizeof(uint64_t) * words);
+    for (idx = r.start; idx != r.end; idx++)
+    {
+        uint64_t active = 0;
+        uint64_t accepted = 0;
+        const uint64_t* match;
+
+        if ((c = lookup_column(bitnfa, symbols[idx])) < 0)
+            break;
+
+        match = bitnfa->match + c * words;
+        for (w = 0; w != words; ++w)
+        {
+            state[w] &= match[w];
+            active |= state[w];
+            accepted |= state[w] & bitnfa->accept[w];
+        }
+        if (active == 0)
+            break;
+        if (accepted)
+            last_accept_idx = idx + 1;
+
+        memset(next, 0, sizeof(uint64_t) * words);
+        for (w = 0; w != words; ++w)
+        {
+            uint64_t bits = state[w];
+            while (bits)
+            {
+                int i;
+                const uint64_t* follow = bitnfa->follow + (w * BITNFA_WORD_BITS + ctz64(bits)) * words;
+                for (i = 0; i != words; ++i)
+                    next[i] |= follow[i];
+                bits &= bits - 1;
+            }
+        }
+        memcpy(state, next, sizeof(uint64_t) * words);
+    }
+
+    return last_accept_idx;
+}
+
+/*
+ * Returns the index one past the longest match starting at r.start, or
+ * r.start if there is no match. Same semantics as dfa_run().
+ */
+static int
+bitnfa_run(const struct bitnfa* bitnfa, const union symbol* symbols, struct range r, uint64_t* scratch)
+{
+    if (bitnfa->words == 1)
+        return bitnfa_run_single(bitnfa, symbols, r);
+    return bitnfa_run_multi(bitnfa, symbols, r, scratch, scratch + bitnfa->words);
+}
+
+static uint64_t*
+alloc_scratch(const struct bitnfa* bitnfa)
+{
+    if (bitnfa->words == 1)
+        return NULL;
+    return mem_alloc(sizeof(uint64_t) * bitnfa->words * 2);
+}
+
+static void
+free_scratch(uint64_t* scratch)
+{
+    if (scratch)
+        mem_free(scratch);
+}
+
+struct range
+bitnfa_find_first(const struct bitnfa* bitnfa, const union symbol* symbols, struct range window)
+{
+    return bitnfa_find_first_before(bitnfa, symbols, window, window.end);
+}
+
+struct range
+bitnfa_find_first_before(const struct bitnfa* bitnfa, const union symbol* symbols, struct range window, int start_end)
+{
+    uint64_t* scratch;
+
+    if (!bitnfa_is_compiled(bitnfa))
+    {
+        window.end = window.start;
+        return window;
+    }
+
+    scratch = alloc_scratch(bitnfa);
+    if (bitnfa->words > 1 && scratch == NULL)
+    {
+        window.end = window.start;
+        return window;
+    }
+
+    for (; window.start != start_end; ++window.start)
+    {
+        int end = bitnfa_run(bitnfa, symbols, window, scratch);
+        if (end > window.start)
+        {
+            free_scratch(scratch);
+            window.end = end;
+            return window;
+        }
+    }
+
+    free_scratch(scratch);
+    window.end = window.start;
+    return window;
+}
+
+int
+bitnfa_find_all(struct vec* ranges, const struct bitnfa* bitnfa, const union symbol* symbols, struct range window)
+{
+    uint64_t* scratch;
+
+    if (!bitnfa_is_compiled(bitnfa))
+        return 0;
+
+    scratch = alloc_scratch(bitnfa);
+    if (bitnfa->words > 1 && scratch == NULL)
+        return -1;
+
+    for (; window.start != window.end; ++window.start)
+    {
+        int end = bitnfa_run(bitnfa, symbols, window, scratch);
+        if (end > window.start)
+        {
+            struct range* r = vec_emplace(ranges);
+            if (r == NULL)
+                goto fail;
+            r->start = window.start;
+            r->end = end;
+            window.start = end - 1;
+        }
+    }
+
+    free_scratch(scratch);
+    return 0;
+
+fail:
+    free_scratch(scratch);
+    return -1;
+}
+
+/* Computes the positions that follow any of the positions in "state" */
+static void
+follow_set(const struct bitnfa* bitnfa, const uint64_t* state, uint64_t* next)
+{
+    int w, words = bitnfa->words;
+
+    if (words == 1)
+    {
+        int chunk;
+        int chunks = (bitnfa->positions + CHUNK_BITS - 1) / CHUNK_BITS;
+        const uint64_t* table = bitnfa->follow;
+        next[0] = 0;
+        for (chunk = 0; chunk != chunks; ++chunk, table += CHUNK_SIZE)
+            next[0] |= table[(state[0] >> (chunk * CHUNK_BITS)) & (CHUNK_SIZE - 1)];
+        return;
+    }
+
+    memset(next, 0, sizeof(uint64_t) * words);
+    for (w = 0; w != words; ++w)
+    {
+        uint64_t bits = state[w];
+        while (bits)
+        {
+            int i;
+            const uint64_t* follow = bitnfa->follow + (w * BITNFA_WORD_BITS + ctz64(bits)) * words;
+            for (i = 0; i != words; ++i)
+                next[i] |= follow[i];
+            bits &= bits - 1;
+        }
+    }
+}
+
+/*
+ * Wu-Manber style simulation with one state set per number of edits. Row "j"
+ * holds the positions that can consume the next symbol with at most "j" edits
+ * so far, so every row is a superset of the previous one:
+ *
+ *   match:        follow(row[j] & match[c])
+ *   substitution: follow(row[j-1])
+ *   insertion:    row[j-1]           (the symbol is skipped)
+ *   deletion:     follow(new[j-1])   (a position is skipped)
+ *
+ * Insertions are not allowed before the first symbol, a match starting with
+ * an extra symbol is the same match starting one symbol later.
+ *
+ * Returns the end of the match with the fewest edits, preferring the longest
+ * match among equal ones. "end" is r.start if there is no match.
+ */
+static struct fuzzy_range
+bitnfa_run_fuzzy(const struct bitnfa* bitnfa, const union symbol* symbols, struct range r, int max_edits, uint64_t* scratch)
+{
+    struct fuzzy_range best;
+    int words = bitnfa->words;
+    uint64_t* rows = scratch;
+    uint64_t* next = rows + words * (max_edits + 1);
+    uint64_t* consumed = next + words * (max_edits + 1);
+    uint64_t* tmp = consumed + words;
+    int idx, j, w, c;
+
+    best.range.start = r.start;
+    best.range.end = r.start;
+    best.distance = -1;
+
+    memcpy(rows, bitnfa->first, sizeof(uint64_t) * words);
+    for (j = 1; j <= max_edits; ++j)
+    {
+        uint64_t* row = rows + j * words;
+        follow_set(bitnfa, row - words, row);
+        for (w = 0; w != words; ++w)
+            row[w] |= row[w - words];
+    }
+
+    for (idx = r.start; idx != r.end; ++idx)
+    {
+        uint64_t active = 0;
+        const uint64_t* match;
+
+        c = lookup_column(bitnfa, symbols[idx]);
+        match = c >= 0 ? bitnfa->match + c * words : NULL;
+
+        for (j = 0; j <= max_edits; ++j)
+        {
+            const uint64_t* row = rows + j * words;
+            uint64_t* new_row = next + j * words;
+            uint64_t accepted = 0;
+
+            for (w = 0; w != words; ++w)
+            {
+                consumed[w] = match ? row[w] & match[w] : 0;
+                if (j > 0)
+                    consumed[w] |= row[w - words];
+                accepted |= consumed[w] & bitnfa->accept[w];
+            }
+            follow_set(bitnfa, consumed, new_row);
+
+            if (j > 0)
+            {
+                /* Deleting an accepting position completes the match too */
+                follow_set(bitnfa, new_row - words, tmp);
+                for (w = 0; w != words; ++w)
+                {
+                    if (idx > r.start)
+                        new_row[w] |= row[w - words];
+                    new_row[w] |= new_row[w - words] | tmp[w];
+                    accepted |= new_row[w - words] & bitnfa->accept[w];
+                }
+            }
+
+            if (accepted && (best.distance < 0 || j <= best.distance))
+            {
+                best.range.end = idx + 1;
+                best.distance = j;
+
+                /* Rows with more edits can't produce a better match anymore */
+                max_edits = j;
+                break;
+            }
+        }
+
+        memcpy(rows, next, sizeof(uint64_t) * words * (max_edits + 1));
+        for (w = 0; w != words; ++w)
+            active |= rows[max_edits * words + w];
+        if (active == 0)
+            break;
+    }
+
+    return best;
+}
+
+/*
+ * Finds the leftmost start with a match. A match with leading edits may just
+ * be a worse copy of a match starting a few symbols later. Each leading edit
+ * costs one, so only the next "distance" starts can do better.
+ */
+static struct fuzzy_range
+bitnfa_find_first_fuzzy_scratch(const struct bitnfa* bitnfa, const union symbol* symbols, struct range window, int start_end, int max_edits, uint64_t* scratch)
+{
+    struct fuzzy_range best;
+    best.range.start = best.range.end = window.start;
+    best.distance = -1;
+
+    for (; window.start != start_end; ++window.start)
+    {
+        int start, last;
+        best = bitnfa_run_fuzzy(bitnfa, symbols, window, max_edits, scratch);
+        if (best.distance < 0)
+            continue;
+
+        last = window.start + best.distance;
+        for (start = window.start + 1; start <= last && start < best.range.end; ++start)
+        {
+            struct fuzzy_range other;
+            window.start = start;
+            other = bitnfa_run_fuzzy(bitnfa, symbols, window, best.distance - 1, scratch);
+            if (other.distance >= 0)
+                best = other;
+            if (best.distance == 0)
+                break;
+        }
+        return best;
+    }
+
+    best.range.start = best.range.end = start_end;
+    return best;
+}
+
+struct fuzzy_range
+bitnfa_find_first_fuzzy(const struct bitnfa* bitnfa, const union symbol* symbols, struct range window, int max_edits)
+{
+    return bitnfa_find_first_fuzzy_before(bitnfa, symbols, window, window.end, max_edits);
+}
+
+struct fuzzy_range
+bitnfa_find_first_fuzzy_before(const struct bitnfa* bitnfa, const union symbol* symbols, struct range window, int start_end, int max_edits)
+{
+    struct fuzzy_range result;
+    uint64_t* scratch;
+
+    result.range.start = result.range.end = window.start;
+    result.distance = -1;
+    if (!bitnfa_is_compiled(bitnfa) || max_edits < 0)
+        return result;
+
+    scratch = mem_alloc(sizeof(uint64_t) * bitnfa->words * (2 * max_edits + 4));
+    if (scratch == NULL)
+        return result;
+
+    result = bitnfa_find_first_fuzzy_scratch(bitnfa, symbols, window, start_end, max_edits, scratch);
+
+    mem_free(scratch);
+    return result;
+}
+
+int
+bitnfa_find_all_fuzzy(struct vec* ranges, const struct bitnfa* bitnfa, const union symbol* symbols, struct range window, int max_edits)
+{
+    uint64_t* scratch;
+
+    if (!bitnfa_is_compiled(bitnfa) || max_edits < 0)
+        return 0;
+
+    scratch = mem_alloc(sizeof(uint64_t) * bitnfa->words * (2 * max_edits + 4));
+    if (scratch == NULL)
+        return -1;
+
+    while (window.start != window.end)
+    {
+        struct fuzzy_range* r;
+        struct fuzzy_range match = bitnfa_find_first_fuzzy_scratch(bitnfa, symbols, window, window.end, max_edits, scratch);
+        if (match.distance < 0)
+            break;
+
+        r = vec_emplace(ranges);
+        if (r == NULL)
+            goto fail;
+        *r = match;
+        window.start = match.range.end;
+    }
+
+    mem_free(scratch);
+    return 0;
+
+fail:
+    mem_free(scratch);
+    return -1;
+}
@@ -348,7 +348,13 @@ static void
 dfa_remove_duplicates(struct table* dfa_tt, struct vec* tf)
 {
     int r1, r2, c, r;
-    for (r1 = 0; r1 < dfa_tt->rows; ++r1)
+
+    /*
+     * Row 0 is never merged with another row. Transitions into state 0 are
+     * interpreted as the trap state, so redirecting references from a
+     * duplicate row to row 0 would halt the machine instead.
+     */
+    for (r1 = 1; r1 < dfa_tt->rows; ++r1)
         for (r2 = r1 + 1; r2 < dfa_tt->rows; ++r2)
         {
             for (c = 0; c != dfa_tt->cols; ++c)
@@ -392,7 +398,9 @@ match_hm_hash(const void* data, int len)
     const struct matcher* m = data;
     hash32 a = (hash32)((m->symbol.u64 & m->mask.u64) >> 32UL);
     hash32 b = (hash32)((m->symbol.u64 & m->mask.u64) & 0xFFFFFFFF);
-    return hash32_combine(a, b);
+    hash32 c = (hash32)(m->mask.u64 >> 32UL);
+    hash32 d = (hash32)(m->mask.u64 & 0xFFFFFFFF);
+    return hash32_combine(hash32_combine(a, b), hash32_combine(c, d));
 }
 
 static int
@@ -402,7 +410,7 @@ match_hm_compare(const void* adata, const void* bdata, int size)
     const struct matcher* a = adata;
     const struct matcher* b = bdata;
     /* hashmap expects this to behave like memcmp() */
-    return !((a->symbol.u64 & a->mask.u64) == (b->symbol.u64 & b->mask.u64));
+    return !matchers_equal(a, b);
 }
 
 static int
@@ -451,33 +459,20 @@ nfa_table_from_graph(struct table* nfa_tt, struct vec* tf, const struct nfa_grap
     }
 
     /*
-     * Put the wildcard matcher (if it exists) as the last column. This
-     * will cause the wildcard to be evaluated/executed last.
+     * Overlapping columns are resolved by adding their intersections. This
+     * also moves the wildcard matcher (if it exists) to the last column,
+     * which will cause the wildcard to be evaluated/executed last.
      */
-    HM_FOR_EACH(&unique_tf, struct matcher, int, matcher1, col1)
-        if (matches_wildcard(matcher1))
-            HM_FOR_EACH(&unique_tf, struct matcher, int, matcher2, col2)
-                if (*col2 == hm_count(&unique_tf) - 1)
-                {
-                    struct matcher tmp_matcher;
-
-                    /* swap values in hashmap */
-                    int tmp = *col1;
-                    *col1 = *col2;
-                    *col2 = tmp;
-
-                    /* swap entries in transition function vector */
-                    matcher1 = vec_get(tf, *col1);
-                    matcher2 = vec_get(tf, *col2);
-                    tmp_matcher = *matcher1;
-                    *matcher1 = *matcher2;
-                    *matcher2 = tmp_matcher;
-
-                    goto wildcard_swapped_to_end;
-                }
-            HM_END_EACH
-    HM_END_EACH
-wildcard_swapped_to_end:;
+    if (match_build_columns(tf) < 0)
+        goto build_tfs_failed;
+    hm_clear(&unique_tf);
+    for (c = 0; c != (int)vec_count(tf); ++c)
+    {
+        int* tf_idx;
+        if (hm_insert(&unique_tf, vec_get(tf, c), (void**)&tf_idx) != 1)
+            goto build_tfs_failed;
+        *tf_idx = c;
+    }
 
     /*
      * The transition table stores a list of states per cell. A "state" encodes
@@ -503,14 +498,63 @@ wildcard_swapped_to_end:;
                 goto build_nfa_table_failed;
         VEC_END_EACH
 
+    hm_deinit(&unique_tf);
     return 0;
 
     build_nfa_table_failed    :
+        for (r = 0; r != nfa_tt->rows; ++r)
+            for (c = 0; c != nfa_tt->cols; ++c)
+                vec_deinit(table_get(nfa_tt, r, c));
+        table_deinit(nfa_tt);
     init_nfa_table_failed     :
-    build_tfs_failed          : hm_deinit(&unique_tf);
+    build_tfs_failed          : vec_deinit(tf);
+                                hm_deinit(&unique_tf);
     init_nfa_unique_tf_failed : return -1;
 }
 
+static int
+nfa_table_bias_subsumed(struct table* nfa_tt, const struct vec* nfa_tf)
+{
+    int r, c, g;
+
+    /*
+     * Same idea as with wildcards (see below), but for columns that are more
+     * general than others without being a wildcard. Consider "nair->nair(hit)"
+     * and the input "nair nair(hit)". The second symbol is consumed by the
+     * column "nair(hit)", because it comes first, so this column also needs
+     * the transitions of the column "nair".
+     *
+     * match_build_columns() has already made sure that the first column a
+     * symbol matches is subsumed by every other column the symbol matches.
+     */
+    for (r = 0; r != nfa_tt->rows; ++r)
+        for (c = 0; c != nfa_tt->cols; ++c)
+        {
+            struct vec* next_states = table_get(nfa_tt, r, c);
+            const struct matcher* m = vec_get(nfa_tf, c);
+            if (m->is_inverted)
+                continue;
+
+            for (g = 0; g != nfa_tt->cols; ++g)
+            {
+                const struct vec* general_states = table_get(nfa_tt, r, g);
+                const struct matcher* general = vec_get(nfa_tf, g);
+                if (g == c || general->is_inverted || matches_wildcard(general))
+                    continue;
+                if (!matcher_subsumes(general, m))
+                    continue;
+
+                VEC_FOR_EACH(general_states, union state, state)
+                    if (vec_find(next_states, state) == vec_count(next_states))
+                        if (vec_push(next_states, state) < 0)
+                            return -1;
+                VEC_END_EACH
+            }
+        }
+
+    return 0;
+}
+
 static int
 nfa_table_bias_wildcards(struct table* nfa_tt, const struct vec* nfa_tf)
 {
@@ -591,8 +635,11 @@ dfa_from_nfa(struct dfa_table* dfa, struct nfa_graph* nfa)
     vec_init(&dfa->tf, dfa->tf.element_size);
     table_init(&dfa->tt, dfa->tt.element_size);
 
-    nfa_table_from_graph(&nfa_tt, &tf, nfa);
+    if (nfa_table_from_graph(&nfa_tt, &tf, nfa) < 0)
+        goto init_nfa_table_failed;
     nfa_export_table(&nfa_tt, &tf, "nfa.txt");
+    if (nfa_table_bias_subsumed(&nfa_tt, &tf) < 0)
+        goto bias_failed;
     nfa_table_bias_wildcards(&nfa_tt, &tf);
     nfa_export_table(&nfa_tt, &tf, "nfa_wc.txt");
 
@@ -720,16 +767,14 @@ build_dfa_table_failed:
 init_dfa_table_failed:
     hm_deinit(&dfa_unique_states);
 init_dfa_unique_states_failed:
+bias_failed:
 build_nfa_table_failed:
     for (r = 0; r != nfa_tt.rows; ++r)
         for (c = 0; c != nfa_tt.cols; ++c)
             vec_deinit(table_get(&nfa_tt, r, c));
     table_deinit(&nfa_tt);
+    vec_deinit(&tf);
 init_nfa_table_failed:
-build_tfs_failed:
-    vec_deinit(&dfa_tf);
-    hm_deinit(&nfa_unique_tf);
-init_nfa_unique_tf_failed:
     return return_code;
 }
 
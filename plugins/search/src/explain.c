@@ -0,0 +1,412 @@
+#include "search/ast.h"
+#include "search/ast_post.h"
+#include "search/explain.h"
+#include "search/label_map.h"
+#include "search/parser.h"
+#include "search/query_cache.h"
+#include "search/symbol.h"
+
+#include "vh/hash40.h"
+#include "vh/str.h"
+#include "vh/time.h"
+#include "vh/vec.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+static const char* stage_names[QUERY_STAGE_COUNT] = {
+    "parse", "labels", "prefilter", "nfa", "bitnfa", "dfa", "jit"
+};
+
+static const char* scan_method_names[] = {
+    "full scan", "prefilter", "FM-index", "stored results"
+};
+
+/* str_fmt() replaces the contents of the string, reports are appended to */
+static int
+append_fmt(struct str* report, const char* fmt, ...)
+{
+    char buf[256];
+    va_list va;
+    va_start(va, fmt);
+    vsnprintf(buf, sizeof buf, fmt, va);
+    va_end(va);
+    return cstr_append(report, buf);
+}
+
+static double
+us_to_ms(uint64_t us)
+{
+    return (double)us / 1000.0;
+}
+
+void
+scan_profile_init(struct scan_profile* profile)
+{
+    profile->method = SCAN_FULL;
+    profile->symbols = 0;
+    profile->windows = 0;
+    profile->window_symbols = 0;
+    profile->matches = 0;
+    profile->scan_us = 0;
+}
+
+static int
+append_context_flags(struct str* report, enum ast_ctx_flags flags)
+{
+    static const char* names[] = {
+        "os", "oos", "hit", "whiff", "clank", "trade", "crossup", "kill", "die",
+        "bury", "buried", "rising", "falling", "sh", "fh", "dj", "fs", "idj", "op"
+    };
+    int i;
+    for (i = 0; i != (int)(sizeof(names) / sizeof(*names)); ++i)
+        if (flags & (1 << i))
+            if (append_fmt(report, " %s", names[i]) < 0)
+                return -1;
+    return 0;
+}
+
+static int
+append_node(struct str* report, const struct ast* ast, int n, int depth)
+{
+    const union ast_node* node = &ast->nodes[n];
+    int result;
+
+    if (append_fmt(report, "%*s", depth * 2 + 2, "") < 0)
+        return -1;
+
+    switch (node->info.type)
+    {
+        case AST_STATEMENT:
+            result = cstr_append(report, "->");
+            break;
+        case AST_REPETITION:
+            result = node->repetition.max_reps < 0 ?
+                append_fmt(report, "repeat %d or more", node->repetition.min_reps) :
+                append_fmt(report, "repeat %d-%d", node->repetition.min_reps, node->repetition.max_reps);
+            break;
+        case AST_UNION:
+            result = cstr_append(report, "|");
+            break;
+        case AST_INVERSION:
+            result = cstr_append(report, "!");
+            break;
+        case AST_WILDCARD:
+            result = cstr_append(report, ".");
+            break;
+        case AST_LABEL: {
+            struct str_view label = strlist_to_view(&ast->labels, node->label.label);
+            result = append_fmt(report, "label %.*s", label.len, label.data);
+        } break;
+        case AST_MOTION: {
+            const struct strlist_str* label = hm_find(&ast->merged_labels, &node->motion.motion);
+            result = append_fmt(report, "motion 0x%" PRIx64, node->motion.motion);
+            if (result == 0 && label)
+            {
+                struct str_view view = strlist_to_view(&ast->labels, *label);
+                result = append_fmt(report, " (%.*s)", view.len, view.data);
+            }
+        } break;
+        case AST_CONTEXT:
+            result = cstr_append(report, "context");
+            if (result == 0)
+                result = append_context_flags(report, node->context.flags);
+            break;
+        case AST_TIMING:
+            result = node->timing.end < 0 ?
+                append_fmt(report, "timing f%d", node->timing.start) :
+                append_fmt(report, "timing f%d-%d", node->timing.start, node->timing.end);
+            break;
+        case AST_DAMAGE:
+            result = append_fmt(report, "damage %.1f%%-%.1f%%", node->damage.from, node->damage.to);
+            break;
+        default:
+            result = cstr_append(report, "?");
+            break;
+    }
+    if (result < 0 || cstr_append(report, "\n") < 0)
+        return -1;
+
+    if (node->base.left >= 0 && append_node(report, ast, node->base.left, depth + 1) < 0)
+        return -1;
+    if (node->base.right >= 0 && append_node(report, ast, node->base.right, depth + 1) < 0)
+        return -1;
+
+    return 0;
+}
+
+int
+explain_ast(struct str* report, const struct ast* ast)
+{
+    if (append_fmt(report, "AST (%d nodes):\n", ast->node_count) < 0)
+        return -1;
+    if (ast->node_count == 0)
+        return cstr_append(report, "  (empty)\n");
+    return append_node(report, ast, 0, 0);
+}
+
+struct label_use
+{
+    struct strlist_str label;
+    int is_op;
+};
+
+/* Labels below an "op" qualifier belong to the opponent */
+static int
+collect_labels(const struct ast* ast, int n, int is_op, struct vec* uses)
+{
+    const union ast_node* node = &ast->nodes[n];
+    if (node->info.type == AST_CONTEXT && (node->context.flags & AST_CTX_OP))
+        is_op = 1;
+
+    if (node->info.type == AST_LABEL)
+    {
+        struct str_view label = strlist_to_view(&ast->labels, node->label.label);
+        struct label_use* use;
+        VEC_FOR_EACH(uses, const struct label_use, other)
+            if (other->is_op == is_op && str_equal(label, strlist_to_view(&ast->labels, other->label)))
+                return 0;
+        VEC_END_EACH
+        use = vec_emplace(uses);
+        if (use == NULL)
+            return -1;
+        use->label = node->label.label;
+        use->is_op = is_op;
+        return 0;
+    }
+
+    if (node->base.left >= 0 && collect_labels(ast, node->base.left, is_op, uses) < 0)
+        return -1;
+    if (node->base.right >= 0 && collect_labels(ast, node->base.right, is_op, uses) < 0)
+        return -1;
+    return 0;
+}
+
+static int
+append_label_use(struct str* report, const struct ast* ast, const struct label_use* use,
+        const struct label_map* labels, int fighter_id, int opponent_id)
+{
+    struct str_view label = strlist_to_view(&ast->labels, use->label);
+    const struct label_entry* entry;
+    const uint64_t* motions;
+    int i, id = use->is_op ? opponent_id : fighter_id;
+
+    if (append_fmt(report, "  %s%.*s -> ", use->is_op ? "op " : "", label.len, label.data) < 0)
+        return -1;
+    if (labels == NULL)
+        return append_fmt(report, "0x%" PRIx64 " (motion name)\n", hash40_str(label));
+
+    entry = label_map_find(labels, id, label);
+    if (entry == NULL)
+        return append_fmt(report, "not resolved for fighter %d\n", id);
+
+    switch (entry->kind)
+    {
+        case LABEL_USER_DEFINED:
+            motions = label_map_motions(labels, entry);
+            for (i = 0; i != entry->count; ++i)
+                if (append_fmt(report, i == 0 ? "0x%" PRIx64 : ", 0x%" PRIx64, motions[i]) < 0)
+                    return -1;
+            return append_fmt(report, " (user-defined, %d motion%s)\n", entry->count, entry->count == 1 ? "" : "s");
+        case LABEL_HASH40:
+            return append_fmt(report, "0x%" PRIx64 " (motion name)\n", label_map_motions(labels, entry)[0]);
+        case LABEL_UNKNOWN:
+            break;
+    }
+    return cstr_append(report, "unknown label\n");
+}
+
+int
+explain_labels(struct str* report, const struct ast* ast, const struct label_map* labels, int fighter_id, int opponent_id)
+{
+    struct vec uses;
+    int result = -1;
+
+    vec_init(&uses, sizeof(struct label_use));
+    if (ast->node_count > 0 && collect_labels(ast, 0, 0, &uses) < 0)
+        goto fail;
+
+    if (cstr_append(report, "Labels:\n") < 0)
+        goto fail;
+    if (vec_count(&uses) == 0 && cstr_append(report, "  (none)\n") < 0)
+        goto fail;
+    VEC_FOR_EACH(&uses, const struct label_use, use)
+        if (append_label_use(report, ast, use, labels, fighter_id, opponent_id) < 0)
+            goto fail;
+    VEC_END_EACH
+    result = 0;
+
+fail:
+    vec_deinit(&uses);
+    return result;
+}
+
+int
+explain_compiled_query(struct str* report, const struct compiled_query* query)
+{
+    const struct query_stats* stats = &query->stats;
+    const struct prefilter* pf = &query->prefilter;
+    uint64_t total_us = 0;
+    int stage;
+
+    if (explain_ast(report, &query->ast) < 0)
+        return -1;
+
+    if (prefilter_is_active(pf))
+    {
+        union symbol s;
+        s.u64 = pf->motion;
+        if (append_fmt(report, "Prefilter: motion 0x%" PRIx64, ((uint64_t)s.motionh << 32) | s.motionl) < 0)
+            return -1;
+        if ((pf->before < 0 ? cstr_append(report, ", any number of symbols before") :
+                append_fmt(report, ", up to %d symbols before", pf->before)) < 0)
+            return -1;
+        if ((pf->after < 0 ? cstr_append(report, ", any number after\n") :
+                append_fmt(report, ", up to %d after\n", pf->after)) < 0)
+            return -1;
+    }
+    else if (cstr_append(report, "Prefilter: none, every symbol is searched\n") < 0)
+        return -1;
+
+    if (append_fmt(report, "NFA: %d states\n", stats->nfa_states) < 0)
+        return -1;
+    if (asm_is_compiled(&query->assembly))
+    {
+        if (append_fmt(report, "Engine: JIT compiled DFA, %d states, %d bytes of code\n",
+                stats->dfa_states, stats->asm_size) < 0)
+            return -1;
+    }
+    if (bitnfa_is_compiled(&query->bitnfa))
+    {
+        if (append_fmt(report, "Engine: bit-parallel NFA, %d positions\n", stats->bitnfa_positions) < 0)
+            return -1;
+    }
+
+    if (cstr_append(report, "Compile time:") < 0)
+        return -1;
+    for (stage = 0; stage != QUERY_STAGE_COUNT; ++stage)
+    {
+        if (stats->stage_us[stage] == 0)
+            continue;
+        if (append_fmt(report, "%s %s %.3f ms", total_us ? "," : "",
+                stage_names[stage], us_to_ms(stats->stage_us[stage])) < 0)
+            return -1;
+        total_us += stats->stage_us[stage];
+    }
+    return append_fmt(report, " (total %.3f ms)\n", us_to_ms(total_us));
+}
+
+int
+explain_scan_profile(struct str* report, const struct scan_profile* profile)
+{
+    double percent = profile->symbols > 0 ?
+        100.0 * profile->window_symbols / profile->symbols : 0.0;
+    return append_fmt(report, "Scan (%s): %d of %d symbols in %d windows (%.1f%%), %d matches, %.3f ms\n",
+        scan_method_names[profile->method], profile->window_symbols, profile->symbols,
+        profile->windows, percent, profile->matches, us_to_ms(profile->scan_us));
+}
+
+static struct fuzzy_range
+find_first(const struct compiled_query* query, const union symbol* symbols, struct range window, int max_edits)
+{
+    struct fuzzy_range match;
+    if (max_edits > 0)
+        return bitnfa_find_first_fuzzy(&query->bitnfa, symbols, window, max_edits);
+
+    match.range = asm_is_compiled(&query->assembly) ?
+        asm_find_first(&query->assembly, symbols, window) :
+        bitnfa_find_first(&query->bitnfa, symbols, window);
+    match.distance = 0;
+    return match;
+}
+
+int
+explain_scan(struct scan_profile* profile, const struct compiled_query* query, const union symbol* symbols, struct range window, int max_edits)
+{
+    uint64_t t = time_get_us();
+
+    scan_profile_init(profile);
+    profile->symbols = window.end - window.start;
+    if (max_edits <= 0 && prefilter_is_active(&query->prefilter))
+        profile->method = SCAN_PREFILTER;
+
+    for (;;)
+    {
+        struct range candidate = max_edits > 0 ? window :
+            prefilter_next_window(&query->prefilter, symbols, window);
+        struct range remaining = candidate;
+        if (candidate.start == candidate.end)
+            break;
+        profile->windows++;
+        profile->window_symbols += candidate.end - candidate.start;
+
+        while (remaining.start != remaining.end)
+        {
+            struct fuzzy_range match = find_first(query, symbols, remaining, max_edits);
+            if (match.range.start == match.range.end)
+                break;
+            profile->matches++;
+            remaining.start = match.range.end;
+        }
+
+        window.start = candidate.end;
+    }
+
+    profile->scan_us = time_get_us() - t;
+    return profile->matches;
+}
+
+int
+explain_query(struct str* report, const char* text, const struct label_map* labels, int fighter_id, int opponent_id, int max_edits)
+{
+    struct parser parser;
+    struct compiled_query query;
+    uint64_t t;
+    int result = -1;
+
+    if (parser_init(&parser) < 0)
+        goto parser_init_failed;
+    if (compiled_query_init(&query) < 0)
+        goto query_init_failed;
+
+    if (append_fmt(report, "Query: %s\n", text) < 0)
+        goto fail;
+
+    t = time_get_us();
+    if (parser_parse(&parser, text, &query.ast) < 0)
+    {
+        cstr_append(report, "Failed to parse the query\n");
+        goto fail;
+    }
+    query.stats.stage_us[QUERY_STAGE_PARSE] = time_get_us() - t;
+
+    if (explain_labels(report, &query.ast, labels, fighter_id, opponent_id) < 0)
+        goto fail;
+
+    t = time_get_us();
+    if (labels == NULL)
+        ast_post_hash40_remaining_labels(&query.ast);
+    else if (ast_post_labels_to_motions(&query.ast, labels, fighter_id, opponent_id) < 0)
+    {
+        cstr_append(report, "Failed to convert labels to motions\n");
+        goto fail;
+    }
+    query.stats.stage_us[QUERY_STAGE_LABELS] = time_get_us() - t;
+
+    if (compiled_query_build(&query, max_edits) < 0)
+    {
+        cstr_append(report, "Failed to compile the query\n");
+        goto fail;
+    }
+    if (explain_compiled_query(report, &query) < 0)
+        goto fail;
+    result = 0;
+
+fail:
+    compiled_query_deinit(&query);
+query_init_failed:
+    parser_deinit(&parser);
+parser_init_failed:
+    return result;
+}
@@ -0,0 +1,827 @@
+#include "search/fm_index.h"
+#include "search/symbol.h"
+
+#include "vh/log.h"
+#include "vh/mem.h"
+#include "vh/mfile.h"
+#include "vh/mstream.h"
+#include "vh/utf8.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#   define popcount64(x) ((int)__popcnt64(x))
+#else
+#   define popcount64(x) __builtin_popcountll(x)
+#endif
+
+/*
+ * Character 0 terminates the text and only appears once, at the end.
+ * Character 1 separates documents. Motions are numbered from 2 in the order
+ * they were first added, so the alphabet never needs to be renumbered when
+ * new games are added.
+ */
+#define CHAR_TERMINATOR  0
+#define CHAR_SEPARATOR   1
+#define CHAR_FIRST       2
+
+/* ------------------------------------------------------------------------- */
+static void
+bitvector_init(struct fm_bitvector* bv)
+{
+    vec_init(&bv->words, sizeof(uint64_t));
+    vec_init(&bv->ranks, sizeof(uint32_t));
+}
+
+static void
+bitvector_deinit(struct fm_bitvector* bv)
+{
+    vec_deinit(&bv->ranks);
+    vec_deinit(&bv->words);
+}
+
+/* One extra word allows rank queries at position "bits" */
+static int
+bitvector_resize(struct fm_bitvector* bv, uint64_t bits)
+{
+    vec_size words = (vec_size)(bits / 64 + 1);
+    if (vec_resize(&bv->words, words) < 0)
+        return -1;
+    if (vec_resize(&bv->ranks, words) < 0)
+        return -1;
+    memset(vec_data(&bv->words), 0, sizeof(uint64_t) * words);
+    return 0;
+}
+
+static void
+bitvector_set(struct fm_bitvector* bv, uint64_t i)
+{
+    uint64_t* words = vec_data(&bv->words);
+    words[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static int
+bitvector_get(const struct fm_bitvector* bv, uint64_t i)
+{
+    const uint64_t* words = vec_data(&bv->words);
+    return (words[i / 64] >> (i % 64)) & 1;
+}
+
+static void
+bitvector_update_ranks(struct fm_bitvector* bv)
+{
+    const uint64_t* words = vec_data(&bv->words);
+    uint32_t* ranks = vec_data(&bv->ranks);
+    uint32_t total = 0;
+    vec_size w;
+    for (w = 0; w != vec_count(&bv->words); ++w)
+    {
+        ranks[w] = total;
+        total += (uint32_t)popcount64(words[w]);
+    }
+}
+
+/* Returns the number of set bits in [0, i) */
+static uint32_t
+bitvector_rank1(const struct fm_bitvector* bv, uint64_t i)
+{
+    const uint64_t* words = vec_data(&bv->words);
+    const uint32_t* ranks = vec_data(&bv->ranks);
+    uint64_t mask = ((uint64_t)1 << (i % 64)) - 1;
+    return ranks[i / 64] + (uint32_t)popcount64(words[i / 64] & mask);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Number of set bits before row "i" on a level of the wavelet matrix */
+static int
+level_rank1(const struct fm_index* fmi, int level, int i)
+{
+    uint64_t base = (uint64_t)level * (uint64_t)fmi->length;
+    return (int)(bitvector_rank1(&fmi->levels, base + (uint64_t)i)
+        - *(const uint32_t*)vec_get(&fmi->ones, level));
+}
+
+/* Returns the number of occurrences of character "c" in the BWT before row "i" */
+static int
+wm_rank(const struct fm_index* fmi, uint32_t c, int i)
+{
+    const int* zeros = vec_data(&fmi->zeros);
+    int level, start = 0, end = i;
+    for (level = 0; level != fmi->level_count; ++level)
+    {
+        if ((c >> (fmi->level_count - level - 1)) & 1)
+        {
+            start = zeros[level] + level_rank1(fmi, level, start);
+            end = zeros[level] + level_rank1(fmi, level, end);
+        }
+        else
+        {
+            start -= level_rank1(fmi, level, start);
+            end -= level_rank1(fmi, level, end);
+        }
+    }
+    return end - start;
+}
+
+/* Returns the character of the BWT at row "i" */
+static uint32_t
+wm_access(const struct fm_index* fmi, int i)
+{
+    const int* zeros = vec_data(&fmi->zeros);
+    uint32_t c = 0;
+    int level;
+    for (level = 0; level != fmi->level_count; ++level)
+    {
+        uint64_t base = (uint64_t)level * (uint64_t)fmi->length;
+        int ones = level_rank1(fmi, level, i);
+        if (bitvector_get(&fmi->levels, base + (uint64_t)i))
+        {
+            c = (c << 1) | 1;
+            i = zeros[level] + ones;
+        }
+        else
+        {
+            c = c << 1;
+            i -= ones;
+        }
+    }
+    return c;
+}
+
+/* ------------------------------------------------------------------------- */
+static uint64_t
+symbol_motion(union symbol s)
+{
+    return ((uint64_t)s.motionh << 32) | s.motionl;
+}
+
+static void
+clear_built(struct fm_index* fmi)
+{
+    vec_clear(&fmi->counts);
+    vec_clear(&fmi->zeros);
+    vec_clear(&fmi->ones);
+    vec_clear(&fmi->samples);
+    vec_clear(&fmi->levels.words);
+    vec_clear(&fmi->levels.ranks);
+    vec_clear(&fmi->sampled.words);
+    vec_clear(&fmi->sampled.ranks);
+    fmi->length = 0;
+    fmi->level_count = 0;
+    fmi->is_built = 0;
+}
+
+int
+fm_index_init(struct fm_index* fmi)
+{
+    if (hm_init(&fmi->char_ids, sizeof(uint64_t), sizeof(uint32_t)) < 0)
+        return -1;
+    vec_init(&fmi->corpus, sizeof(uint32_t));
+    vec_init(&fmi->docs, sizeof(struct fm_doc));
+    vec_init(&fmi->alphabet, sizeof(uint64_t));
+    vec_init(&fmi->counts, sizeof(int));
+    vec_init(&fmi->zeros, sizeof(int));
+    vec_init(&fmi->ones, sizeof(uint32_t));
+    vec_init(&fmi->samples, sizeof(int));
+    bitvector_init(&fmi->levels);
+    bitvector_init(&fmi->sampled);
+    fmi->length = 0;
+    fmi->level_count = 0;
+    fmi->is_built = 0;
+    return 0;
+}
+
+void
+fm_index_deinit(struct fm_index* fmi)
+{
+    bitvector_deinit(&fmi->sampled);
+    bitvector_deinit(&fmi->levels);
+    vec_deinit(&fmi->samples);
+    vec_deinit(&fmi->ones);
+    vec_deinit(&fmi->zeros);
+    vec_deinit(&fmi->counts);
+    vec_deinit(&fmi->alphabet);
+    vec_deinit(&fmi->docs);
+    vec_deinit(&fmi->corpus);
+    hm_deinit(&fmi->char_ids);
+}
+
+void
+fm_index_clear(struct fm_index* fmi)
+{
+    clear_built(fmi);
+    vec_clear(&fmi->corpus);
+    vec_clear(&fmi->docs);
+    vec_clear(&fmi->alphabet);
+    hm_clear(&fmi->char_ids);
+}
+
+/* Returns the character of the motion, and adds it to the alphabet if it is new */
+static int
+char_id(struct fm_index* fmi, uint64_t motion, uint32_t* c)
+{
+    uint32_t* id = hm_find(&fmi->char_ids, &motion);
+    if (id == NULL)
+    {
+        if (vec_push(&fmi->alphabet, &motion) < 0)
+            return -1;
+        if (hm_insert(&fmi->char_ids, &motion, (void**)&id) != 1)
+        {
+            vec_pop(&fmi->alphabet);
+            return -1;
+        }
+        *id = CHAR_FIRST + (uint32_t)vec_count(&fmi->alphabet) - 1;
+    }
+    *c = *id;
+    return 0;
+}
+
+/* Terminates the characters that were appended since "start" as a document */
+static int
+push_doc(struct fm_index* fmi, int game_id, uint64_t stamp, int fighter_idx, vec_size start)
+{
+    struct fm_doc* doc;
+    uint32_t separator = CHAR_SEPARATOR;
+    int length = (int)(vec_count(&fmi->corpus) - start);
+
+    if (vec_push(&fmi->corpus, &separator) < 0)
+        return -1;
+    doc = vec_emplace(&fmi->docs);
+    if (doc == NULL)
+        return -1;
+    doc->stamp = stamp;
+    doc->game_id = game_id;
+    doc->fighter_idx = fighter_idx;
+    doc->start = (int)start;
+    doc->length = length;
+
+    return 0;
+}
+
+int
+fm_index_add(struct fm_index* fmi, int game_id, uint64_t stamp, int fighter_idx, const union symbol* symbols, struct range range)
+{
+    vec_size corpus_count = vec_count(&fmi->corpus);
+    int i;
+
+    for (i = range.start; i != range.end; ++i)
+    {
+        uint32_t c;
+        if (char_id(fmi, symbol_motion(symbols[i]), &c) < 0)
+            goto fail;
+        if (vec_push(&fmi->corpus, &c) < 0)
+            goto fail;
+    }
+    if (push_doc(fmi, game_id, stamp, fighter_idx, corpus_count) < 0)
+        goto fail;
+
+    clear_built(fmi);
+    return 0;
+
+fail:
+    /* Motions added to the alphabet are harmless, they just aren't used yet */
+    vec_resize(&fmi->corpus, corpus_count);
+    return -1;
+}
+
+int
+fm_index_append(struct fm_index* fmi, const struct fm_index* other)
+{
+    struct vec map;  /* uint32_t - character in this index of each motion of "other" */
+    const uint32_t* text = vec_data(&other->corpus);
+    vec_size corpus_count = vec_count(&fmi->corpus);
+    vec_size doc_count = vec_count(&fmi->docs);
+
+    vec_init(&map, sizeof(uint32_t));
+    VEC_FOR_EACH(&other->alphabet, const uint64_t, motion)
+        uint32_t c;
+        if (char_id(fmi, *motion, &c) < 0 || vec_push(&map, &c) < 0)
+            goto fail;
+    VEC_END_EACH
+
+    VEC_FOR_EACH(&other->docs, const struct fm_doc, doc)
+        vec_size start = vec_count(&fmi->corpus);
+        int i;
+        for (i = doc->start; i != doc->start + doc->length; ++i)
+            if (vec_push(&fmi->corpus, vec_get(&map, text[i] - CHAR_FIRST)) < 0)
+                goto fail;
+        if (push_doc(fmi, doc->game_id, doc->stamp, doc->fighter_idx, start) < 0)
+            goto fail;
+    VEC_END_EACH
+
+    vec_deinit(&map);
+    clear_built(fmi);
+    return 0;
+
+fail:
+    vec_resize(&fmi->docs, doc_count);
+    vec_resize(&fmi->corpus, corpus_count);
+    vec_deinit(&map);
+    return -1;
+}
+
+int
+fm_index_remove_game(struct fm_index* fmi, int game_id)
+{
+    uint32_t* corpus = vec_data(&fmi->corpus);
+    struct fm_doc* docs = vec_data(&fmi->docs);
+    int i, kept = 0, end = 0;
+    int removed = 0;
+
+    /* Documents are ordered by start, so the corpus can be compacted in place */
+    for (i = 0; i != (int)vec_count(&fmi->docs); ++i)
+    {
+        struct fm_doc doc = docs[i];
+        if (doc.game_id == game_id)
+        {
+            removed++;
+            continue;
+        }
+        memmove(corpus + end, corpus + doc.start, sizeof(uint32_t) * ((size_t)doc.length + 1));
+        doc.start = end;
+        docs[kept++] = doc;
+        end += doc.length + 1;
+    }
+
+    if (removed == 0)
+        return 0;
+    vec_resize(&fmi->corpus, (vec_size)end);
+    vec_resize(&fmi->docs, (vec_size)kept);
+    clear_built(fmi);
+    return removed;
+}
+
+int
+fm_index_has_game(const struct fm_index* fmi, int game_id)
+{
+    VEC_FOR_EACH(&fmi->docs, const struct fm_doc, doc)
+        if (doc->game_id == game_id)
+            return 1;
+    VEC_END_EACH
+    return 0;
+}
+
+/*
+ * Prefix doubling with radix sort. After the round with step "k", suffixes
+ * are sorted by their first 2k characters. The terminator is unique, so all
+ * suffixes are distinct and every round strictly refines the order until
+ * each suffix has its own rank.
+ */
+static int
+build_suffix_array(int* sa, const uint32_t* text, int n, int sigma)
+{
+    int* rank;
+    int* tmp;
+    int* cnt;
+    int i, k, classes;
+    int cnt_size = n > sigma ? n : sigma;
+
+    rank = mem_alloc(sizeof(int) * ((size_t)n * 2 + (size_t)cnt_size));
+    if (rank == NULL)
+        return -1;
+    tmp = rank + n;
+    cnt = tmp + n;
+
+    memset(cnt, 0, sizeof(int) * (size_t)sigma);
+    for (i = 0; i != n; ++i)
+        cnt[text[i]]++;
+    for (i = 1; i != sigma; ++i)
+        cnt[i] += cnt[i - 1];
+    for (i = n - 1; i >= 0; --i)
+        sa[--cnt[text[i]]] = i;
+    for (i = 0; i != n; ++i)
+        rank[i] = (int)text[i];
+    classes = sigma;
+
+    for (k = 1; k < n; k *= 2)
+    {
+        int* swap;
+        int p = 0;
+
+        /* Order by the second half. Suffixes shorter than k sort first */
+        for (i = n - k; i != n; ++i)
+            tmp[p++] = i;
+        for (i = 0; i != n; ++i)
+            if (sa[i] >= k)
+                tmp[p++] = sa[i] - k;
+
+        /* Stable sort by the first half */
+        memset(cnt, 0, sizeof(int) * (size_t)classes);
+        for (i = 0; i != n; ++i)
+            cnt[rank[i]]++;
+        for (i = 1; i != classes; ++i)
+            cnt[i] += cnt[i - 1];
+        for (i = n - 1; i >= 0; --i)
+            sa[--cnt[rank[tmp[i]]]] = tmp[i];
+
+        tmp[sa[0]] = 0;
+        classes = 1;
+        for (i = 1; i != n; ++i)
+        {
+            int a = sa[i - 1], b = sa[i];
+            int a2 = a + k < n ? rank[a + k] : -1;
+            int b2 = b + k < n ? rank[b + k] : -1;
+            if (rank[a] != rank[b] || a2 != b2)
+                classes++;
+            tmp[b] = classes - 1;
+        }
+        swap = rank; rank = tmp; tmp = swap;
+        if (classes == n)
+            break;
+    }
+
+    /* "rank" may point to either half of the allocation */
+    mem_free(rank < tmp ? rank : tmp);
+    return 0;
+}
+
+int
+fm_index_build(struct fm_index* fmi)
+{
+    uint32_t* text;
+    uint32_t* bwt;
+    uint32_t* next;
+    int* sa;
+    int* counts;
+    int i, level, n, sigma, level_count;
+
+    clear_built(fmi);
+
+    n = (int)vec_count(&fmi->corpus) + 1;
+    sigma = CHAR_FIRST + (int)vec_count(&fmi->alphabet);
+    for (level_count = 1; ((uint32_t)(sigma - 1) >> level_count) != 0; ++level_count) {}
+
+    text = mem_alloc(sizeof(uint32_t) * (size_t)n * 3);
+    if (text == NULL)
+        goto alloc_text_failed;
+    bwt = text + n;
+    next = bwt + n;
+    sa = mem_alloc(sizeof(int) * (size_t)n);
+    if (sa == NULL)
+        goto alloc_sa_failed;
+
+    if (n > 1)
+        memcpy(text, vec_data(&fmi->corpus), sizeof(uint32_t) * (size_t)(n - 1));
+    text[n - 1] = CHAR_TERMINATOR;
+    if (build_suffix_array(sa, text, n, sigma) < 0)
+        goto build_sa_failed;
+
+    for (i = 0; i != n; ++i)
+        bwt[i] = sa[i] > 0 ? text[sa[i] - 1] : text[n - 1];
+
+    /* C[c] is the row of the first suffix that starts with "c" */
+    if (vec_resize(&fmi->counts, (vec_size)sigma + 1) < 0)
+        goto fail;
+    counts = vec_data(&fmi->counts);
+    memset(counts, 0, sizeof(int) * ((size_t)sigma + 1));
+    for (i = 0; i != n; ++i)
+        counts[text[i] + 1]++;
+    for (i = 1; i <= sigma; ++i)
+        counts[i] += counts[i - 1];
+
+    /*
+     * Wavelet matrix: each level stores one bit of every character, starting
+     * with the most significant one. Characters are then stably partitioned
+     * by that bit for the next level.
+     */
+    if (bitvector_resize(&fmi->levels, (uint64_t)n * (uint64_t)level_count) < 0)
+        goto fail;
+    if (vec_resize(&fmi->zeros, (vec_size)level_count) < 0)
+        goto fail;
+    if (vec_resize(&fmi->ones, (vec_size)level_count) < 0)
+        goto fail;
+    for (level = 0; level != level_count; ++level)
+    {
+        uint64_t base = (uint64_t)level * (uint64_t)n;
+        int shift = level_count - level - 1;
+        int z = 0, o;
+        uint32_t* swap;
+
+        for (i = 0; i != n; ++i)
+            if ((bwt[i] >> shift) & 1)
+                bitvector_set(&fmi->levels, base + (uint64_t)i);
+            else
+                next[z++] = bwt[i];
+        o = z;
+        for (i = 0; i != n; ++i)
+            if ((bwt[i] >> shift) & 1)
+                next[o++] = bwt[i];
+
+        *(int*)vec_get(&fmi->zeros, level) = z;
+        swap = bwt; bwt = next; next = swap;
+    }
+    bitvector_update_ranks(&fmi->levels);
+    for (level = 0; level != level_count; ++level)
+        *(uint32_t*)vec_get(&fmi->ones, level) =
+            bitvector_rank1(&fmi->levels, (uint64_t)level * (uint64_t)n);
+
+    if (bitvector_resize(&fmi->sampled, (uint64_t)n) < 0)
+        goto fail;
+    for (i = 0; i != n; ++i)
+        if (sa[i] % FM_INDEX_SAMPLE_RATE == 0)
+        {
+            bitvector_set(&fmi->sampled, (uint64_t)i);
+            if (vec_push(&fmi->samples, &sa[i]) < 0)
+                goto fail;
+        }
+    bitvector_update_ranks(&fmi->sampled);
+
+    fmi->length = n;
+    fmi->level_count = level_count;
+    fmi->is_built = 1;
+
+    mem_free(sa);
+    /* The partitions were swapped, "text" is still the start of the allocation */
+    mem_free(text);
+    return 0;
+
+fail:
+    clear_built(fmi);
+build_sa_failed:
+    mem_free(sa);
+alloc_sa_failed:
+    mem_free(text);
+alloc_text_failed:
+    return -1;
+}
+
+/*
+ * Narrows the range of rows [*sp, *ep) to the suffixes that start with the
+ * pattern, one motion at a time from the back.
+ */
+static int
+backward_search(const struct fm_index* fmi, const union symbol* pattern, int length, int* sp, int* ep)
+{
+    const int* counts = vec_data(&fmi->counts);
+    int i;
+
+    *sp = 0;
+    *ep = fmi->length;
+    if (!fmi->is_built || length <= 0)
+        return 0;
+
+    for (i = length - 1; i >= 0 && *sp < *ep; --i)
+    {
+        uint64_t motion = symbol_motion(pattern[i]);
+        const uint32_t* c = hm_find(&fmi->char_ids, &motion);
+        if (c == NULL)
+            return 0;
+        *sp = counts[*c] + wm_rank(fmi, *c, *sp);
+        *ep = counts[*c] + wm_rank(fmi, *c, *ep);
+    }
+
+    return *ep > *sp ? *ep - *sp : 0;
+}
+
+/* Returns the text position of the suffix at the row */
+static int
+row_position(const struct fm_index* fmi, int row)
+{
+    const int* counts = vec_data(&fmi->counts);
+    const int* samples = vec_data(&fmi->samples);
+    int steps = 0;
+
+    /* Text position 0 is always sampled, so this never walks past the start */
+    while (!bitvector_get(&fmi->sampled, (uint64_t)row))
+    {
+        uint32_t c = wm_access(fmi, row);
+        row = counts[c] + wm_rank(fmi, c, row);
+        steps++;
+    }
+
+    return samples[bitvector_rank1(&fmi->sampled, (uint64_t)row)] + steps;
+}
+
+static const struct fm_doc*
+find_doc(const struct fm_index* fmi, int pos)
+{
+    const struct fm_doc* docs = vec_data(&fmi->docs);
+    int lo = 0, hi = (int)vec_count(&fmi->docs);
+    while (hi - lo > 1)
+    {
+        int mid = (lo + hi) / 2;
+        if (docs[mid].start <= pos)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return &docs[lo];
+}
+
+static int
+match_cmp(const void* a, const void* b)
+{
+    const struct fm_match* m1 = a;
+    const struct fm_match* m2 = b;
+    if (m1->game_id != m2->game_id)
+        return m1->game_id < m2->game_id ? -1 : 1;
+    if (m1->fighter_idx != m2->fighter_idx)
+        return m1->fighter_idx < m2->fighter_idx ? -1 : 1;
+    return m1->start - m2->start;
+}
+
+int
+fm_index_count(const struct fm_index* fmi, const union symbol* pattern, int length)
+{
+    int sp, ep;
+    return backward_search(fmi, pattern, length, &sp, &ep);
+}
+
+int
+fm_index_locate(struct vec* matches, const struct fm_index* fmi, const union symbol* pattern, int length)
+{
+    vec_size first = vec_count(matches);
+    int sp, ep, row;
+
+    int count = backward_search(fmi, pattern, length, &sp, &ep);
+    if (count == 0)
+        return 0;
+    if (vec_resize(matches, first + (vec_size)count) < 0)
+        return -1;
+
+    for (row = sp; row != ep; ++row)
+    {
+        struct fm_match* m = vec_get(matches, first + (vec_size)(row - sp));
+        int pos = row_position(fmi, row);
+        const struct fm_doc* doc = find_doc(fmi, pos);
+        m->game_id = doc->game_id;
+        m->fighter_idx = doc->fighter_idx;
+        m->start = pos - doc->start;
+    }
+
+    qsort(vec_get(matches, first), (size_t)count, sizeof(struct fm_match), match_cmp);
+    return count;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+write_vec(FILE* fp, const struct vec* v)
+{
+    uint32_t count = (uint32_t)vec_count(v);
+    fwrite(&count, sizeof(count), 1, fp);
+    if (count)
+        fwrite(vec_data(v), v->element_size, count, fp);
+}
+
+static int
+read_vec(struct mstream* ms, struct vec* v)
+{
+    uint32_t count = mstream_read_lu32(ms);
+    if ((uint64_t)count * v->element_size > (uint64_t)mstream_bytes_left(ms))
+        return -1;
+    if (vec_resize(v, count) < 0)
+        return -1;
+    if (count)
+        memcpy(vec_data(v), mstream_read(ms, (int)(count * v->element_size)), count * v->element_size);
+    return 0;
+}
+
+int
+fm_index_save(const struct fm_index* fmi, const char* file_name)
+{
+    FILE* fp;
+    char magic[4] = {'F', 'M', 'I', 'X'};
+    uint8_t major = 2;
+    uint8_t minor = 0;
+    uint16_t pad = 0;
+    uint32_t length = (uint32_t)fmi->length;
+    uint32_t level_count = (uint32_t)fmi->level_count;
+
+    if (!fmi->is_built)
+        return -1;
+
+    fp = fopen_utf8_wb(file_name, (int)strlen(file_name));
+    if (fp == NULL)
+        return -1;
+
+    fwrite(magic, 1, 4, fp);
+    fwrite(&major, 1, 1, fp);
+    fwrite(&minor, 1, 1, fp);
+    fwrite(&pad, 2, 1, fp);
+    fwrite(&length, sizeof(length), 1, fp);
+    fwrite(&level_count, sizeof(level_count), 1, fp);
+
+    write_vec(fp, &fmi->corpus);
+    write_vec(fp, &fmi->docs);
+    write_vec(fp, &fmi->alphabet);
+    write_vec(fp, &fmi->counts);
+    write_vec(fp, &fmi->zeros);
+    write_vec(fp, &fmi->ones);
+    write_vec(fp, &fmi->samples);
+    write_vec(fp, &fmi->levels.words);
+    write_vec(fp, &fmi->levels.ranks);
+    write_vec(fp, &fmi->sampled.words);
+    write_vec(fp, &fmi->sampled.ranks);
+
+    if (ferror(fp))
+    {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int
+docs_are_valid(const struct fm_index* fmi)
+{
+    const uint32_t* corpus = vec_data(&fmi->corpus);
+    uint32_t sigma = CHAR_FIRST + (uint32_t)vec_count(&fmi->alphabet);
+    int i, end = 0;
+
+    VEC_FOR_EACH(&fmi->docs, const struct fm_doc, doc)
+        if (doc->start != end || doc->length < 0 ||
+            doc->length >= (int)vec_count(&fmi->corpus) - doc->start)
+            return 0;
+        for (i = doc->start; i != doc->start + doc->length; ++i)
+            if (corpus[i] < CHAR_FIRST || corpus[i] >= sigma)
+                return 0;
+        if (corpus[i] != CHAR_SEPARATOR)
+            return 0;
+        end = i + 1;
+    VEC_END_EACH
+
+    return end == (int)vec_count(&fmi->corpus);
+}
+
+int
+fm_index_load(struct fm_index* fmi, const char* file_name)
+{
+    struct mfile mf;
+    struct mstream ms;
+    uint8_t major, minor;
+    uint32_t c;
+
+    fm_index_clear(fmi);
+
+    if (mfile_map_read(&mf, file_name) < 0)
+        goto map_file_failed;
+    ms = mstream_from_mfile(&mf);
+
+    if (mstream_bytes_left(&ms) < 16 || memcmp(mstream_read(&ms, 4), "FMIX", 4))
+        goto wrong_magic;
+    major = mstream_read_u8(&ms);
+    minor = mstream_read_u8(&ms);
+    if (major != 2 || minor != 0)
+        goto wrong_version;
+    mstream_read_lu16(&ms);  /* padding */
+
+    fmi->length = (int)mstream_read_lu32(&ms);
+    fmi->level_count = (int)mstream_read_lu32(&ms);
+
+    if (read_vec(&ms, &fmi->corpus) < 0 ||
+        read_vec(&ms, &fmi->docs) < 0 ||
+        read_vec(&ms, &fmi->alphabet) < 0 ||
+        read_vec(&ms, &fmi->counts) < 0 ||
+        read_vec(&ms, &fmi->zeros) < 0 ||
+        read_vec(&ms, &fmi->ones) < 0 ||
+        read_vec(&ms, &fmi->samples) < 0 ||
+        read_vec(&ms, &fmi->levels.words) < 0 ||
+        read_vec(&ms, &fmi->levels.ranks) < 0 ||
+        read_vec(&ms, &fmi->sampled.words) < 0 ||
+        read_vec(&ms, &fmi->sampled.ranks) < 0)
+    {
+        goto corrupt;
+    }
+
+    /* Sanity check sizes so that a damaged file can't cause out of bounds reads */
+    if (fmi->length != (int)vec_count(&fmi->corpus) + 1 ||
+        fmi->level_count != (int)vec_count(&fmi->zeros) ||
+        fmi->level_count != (int)vec_count(&fmi->ones) ||
+        vec_count(&fmi->counts) != CHAR_FIRST + vec_count(&fmi->alphabet) + 1 ||
+        vec_count(&fmi->levels.words) != (vec_size)((uint64_t)fmi->length * (uint64_t)fmi->level_count / 64 + 1) ||
+        vec_count(&fmi->levels.ranks) != vec_count(&fmi->levels.words) ||
+        vec_count(&fmi->sampled.words) != (vec_size)(fmi->length / 64 + 1) ||
+        vec_count(&fmi->sampled.ranks) != vec_count(&fmi->sampled.words))
+    {
+        goto corrupt;
+    }
+
+    /* Documents are appended to other indices, so they have to cover the corpus exactly */
+    if (!docs_are_valid(fmi))
+        goto corrupt;
+
+    for (c = 0; c != vec_count(&fmi->alphabet); ++c)
+    {
+        uint32_t* id;
+        if (hm_insert(&fmi->char_ids, vec_get(&fmi->alphabet, c), (void**)&id) != 1)
+            goto corrupt;
+        *id = CHAR_FIRST + c;
+    }
+
+    fmi->is_built = 1;
+    mfile_unmap(&mf);
+    return 0;
+
+corrupt:
+    log_err("FM-index file '%s' is corrupt\n", file_name);
+wrong_version:
+wrong_magic:
+    mfile_unmap(&mf);
+map_file_failed:
+    fm_index_clear(fmi);
+    return -1;
+}
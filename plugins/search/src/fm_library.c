@@ -0,0 +1,324 @@
+#include "search/fm_library.h"
+
+#include "vh/fs.h"
+#include "vh/log.h"
+#include "vh/str.h"
+
+#include <stdlib.h>
+
+/* ------------------------------------------------------------------------- */
+static struct fm_index*
+segment(const struct fm_library* lib, int i)
+{
+    return vec_get(&lib->segments, i);
+}
+
+static void
+mark_dirty(struct fm_library* lib, int i)
+{
+    *(char*)vec_get(&lib->dirty, i) = 1;
+}
+
+static struct fm_index*
+push_segment(struct fm_library* lib)
+{
+    struct fm_index* fmi;
+    char dirty = 1;
+
+    if (vec_push(&lib->dirty, &dirty) < 0)
+        goto push_dirty_failed;
+    fmi = vec_emplace(&lib->segments);
+    if (fmi == NULL)
+        goto emplace_failed;
+    if (fm_index_init(fmi) < 0)
+        goto init_failed;
+
+    return fmi;
+
+    init_failed       : vec_pop(&lib->segments);
+    emplace_failed    : vec_pop(&lib->dirty);
+    push_dirty_failed : return NULL;
+}
+
+static void
+erase_segment(struct fm_library* lib, int i)
+{
+    fm_index_deinit(segment(lib, i));
+    vec_erase_index(&lib->segments, i);
+    vec_erase_index(&lib->dirty, i);
+
+    /* Segments are saved by their position, so every file after it changes */
+    for (; i != (int)vec_count(&lib->segments); ++i)
+        mark_dirty(lib, i);
+}
+
+/* Points every game to the segment it's in, after segments moved */
+static int
+update_games(struct fm_library* lib, int check_duplicates)
+{
+    int i;
+    hm_clear(&lib->games);
+    for (i = 0; i != (int)vec_count(&lib->segments); ++i)
+        VEC_FOR_EACH(&segment(lib, i)->docs, const struct fm_doc, doc)
+            struct fm_library_game* game;
+            switch (hm_insert(&lib->games, &doc->game_id, (void**)&game))
+            {
+                case 1:
+                    game->stamp = doc->stamp;
+                    game->segment = i;
+                    game->is_new = 0;
+                    break;
+                case 0:
+                    /* Streams of the same game are added together */
+                    if (check_duplicates && (game->segment != i || game->stamp != doc->stamp))
+                        return -1;
+                    break;
+                default:
+                    return -1;
+            }
+        VEC_END_EACH
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+int
+fm_library_init(struct fm_library* lib)
+{
+    if (hm_init(&lib->games, sizeof(int), sizeof(struct fm_library_game)) < 0)
+        return -1;
+    vec_init(&lib->segments, sizeof(struct fm_index));
+    vec_init(&lib->dirty, sizeof(char));
+    return 0;
+}
+
+void
+fm_library_deinit(struct fm_library* lib)
+{
+    fm_library_clear(lib);
+    vec_deinit(&lib->dirty);
+    vec_deinit(&lib->segments);
+    hm_deinit(&lib->games);
+}
+
+void
+fm_library_clear(struct fm_library* lib)
+{
+    VEC_FOR_EACH(&lib->segments, struct fm_index, fmi)
+        fm_index_deinit(fmi);
+    VEC_END_EACH
+    vec_clear(&lib->segments);
+    vec_clear(&lib->dirty);
+    hm_clear(&lib->games);
+}
+
+int
+fm_library_add(struct fm_library* lib, int game_id, uint64_t stamp, int fighter_idx, const union symbol* symbols, struct range range)
+{
+    struct fm_library_game* game = hm_find(&lib->games, &game_id);
+    int last = (int)vec_count(&lib->segments) - 1;
+
+    /* Only streams added since the last build belong to the same version of the game */
+    if (game && !(game->is_new && game->stamp == stamp))
+    {
+        fm_library_remove_game(lib, game_id);
+        game = NULL;
+    }
+
+    if (game == NULL)
+    {
+        /* Games added since the last build share a new segment */
+        if (last < 0 || fm_index_is_built(segment(lib, last)))
+        {
+            if (push_segment(lib) == NULL)
+                return -1;
+            last++;
+        }
+        if (hm_insert(&lib->games, &game_id, (void**)&game) != 1)
+            return -1;
+        game->stamp = stamp;
+        game->segment = last;
+        game->is_new = 1;
+    }
+
+    mark_dirty(lib, game->segment);
+    return fm_index_add(segment(lib, game->segment), game_id, stamp, fighter_idx, symbols, range);
+}
+
+void
+fm_library_remove_game(struct fm_library* lib, int game_id)
+{
+    struct fm_library_game* game = hm_find(&lib->games, &game_id);
+    if (game == NULL)
+        return;
+    fm_index_remove_game(segment(lib, game->segment), game_id);
+    mark_dirty(lib, game->segment);
+    hm_erase(&lib->games, &game_id);
+}
+
+int
+fm_library_has_game(const struct fm_library* lib, int game_id, uint64_t stamp)
+{
+    const struct fm_library_game* game = hm_find(&lib->games, &game_id);
+    return game && game->stamp == stamp && fm_index_is_built(segment(lib, game->segment));
+}
+
+int
+fm_library_build(struct fm_library* lib)
+{
+    int i;
+
+    /* Segments that lost all of their games are dropped */
+    for (i = (int)vec_count(&lib->segments) - 1; i >= 0; --i)
+        if (vec_count(&segment(lib, i)->docs) == 0)
+            erase_segment(lib, i);
+
+    /* Merge the newest segment into the previous one until sizes halve again */
+    while (vec_count(&lib->segments) > 1)
+    {
+        int last = (int)vec_count(&lib->segments) - 1;
+        struct fm_index* prev = segment(lib, last - 1);
+        struct fm_index* newest = segment(lib, last);
+        vec_size prev_length = vec_count(&prev->corpus);
+        vec_size newest_length = vec_count(&newest->corpus);
+
+        if (newest_length * 2 < prev_length ||
+            prev_length + newest_length > FM_LIBRARY_SEGMENT_MAX)
+            break;
+        if (fm_index_append(prev, newest) < 0)
+            return -1;
+        mark_dirty(lib, last - 1);
+        erase_segment(lib, last);
+    }
+
+    if (update_games(lib, 0) < 0)
+        return -1;
+
+    for (i = 0; i != (int)vec_count(&lib->segments); ++i)
+        if (!fm_index_is_built(segment(lib, i)))
+            if (fm_index_build(segment(lib, i)) < 0)
+                return -1;
+
+    return 0;
+}
+
+int
+fm_library_count(const struct fm_library* lib, const union symbol* pattern, int length)
+{
+    int count = 0;
+    VEC_FOR_EACH(&lib->segments, const struct fm_index, fmi)
+        count += fm_index_count(fmi, pattern, length);
+    VEC_END_EACH
+    return count;
+}
+
+static int
+match_cmp(const void* a, const void* b)
+{
+    const struct fm_match* m1 = a;
+    const struct fm_match* m2 = b;
+    if (m1->game_id != m2->game_id)
+        return m1->game_id < m2->game_id ? -1 : 1;
+    if (m1->fighter_idx != m2->fighter_idx)
+        return m1->fighter_idx < m2->fighter_idx ? -1 : 1;
+    return m1->start - m2->start;
+}
+
+int
+fm_library_locate(struct vec* matches, const struct fm_library* lib, const union symbol* pattern, int length)
+{
+    vec_size first = vec_count(matches);
+    int count = 0;
+
+    VEC_FOR_EACH(&lib->segments, const struct fm_index, fmi)
+        int found = fm_index_locate(matches, fmi, pattern, length);
+        if (found < 0)
+        {
+            vec_resize(matches, first);
+            return -1;
+        }
+        count += found;
+    VEC_END_EACH
+
+    /* Each segment is sorted on its own, but a game can move between segments */
+    if (vec_count(&lib->segments) > 1 && count > 1)
+        qsort(vec_get(matches, first), (size_t)count, sizeof(struct fm_match), match_cmp);
+    return count;
+}
+
+/* ------------------------------------------------------------------------- */
+int
+fm_library_save(struct fm_library* lib, const char* file_name)
+{
+    struct str segment_file;
+    int i, result = -1;
+
+    str_init(&segment_file);
+
+    for (i = 0; i != (int)vec_count(&lib->segments); ++i)
+    {
+        if (!*(char*)vec_get(&lib->dirty, i))
+            continue;
+        if (str_fmt(&segment_file, "%s.%d", file_name, i) < 0)
+            goto out;
+        if (fm_index_save(segment(lib, i), segment_file.data) < 0)
+            goto out;
+        *(char*)vec_get(&lib->dirty, i) = 0;
+    }
+
+    /* Files of segments that were merged would be loaded again otherwise */
+    for (;; ++i)
+    {
+        if (str_fmt(&segment_file, "%s.%d", file_name, i) < 0)
+            goto out;
+        if (!fs_file_exists(segment_file.data))
+            break;
+        if (fs_remove_file(segment_file.data) < 0)
+            goto out;
+    }
+    result = 0;
+
+out:
+    str_deinit(&segment_file);
+    return result;
+}
+
+int
+fm_library_load(struct fm_library* lib, const char* file_name)
+{
+    struct str segment_file;
+    int i;
+
+    fm_library_clear(lib);
+    str_init(&segment_file);
+
+    for (i = 0;; ++i)
+    {
+        struct fm_index* fmi;
+        if (str_fmt(&segment_file, "%s.%d", file_name, i) < 0)
+            goto fail;
+        if (!fs_file_exists(segment_file.data))
+            break;
+        fmi = push_segment(lib);
+        if (fmi == NULL)
+            goto fail;
+        if (fm_index_load(fmi, segment_file.data) < 0)
+            goto fail;
+        *(char*)vec_get(&lib->dirty, i) = 0;
+    }
+
+    /* Each game can only be in one segment, the files are from different saves otherwise */
+    if (update_games(lib, 1) < 0)
+    {
+        log_err("FM-index segments '%s.*' don't belong together\n", file_name);
+        goto fail;
+    }
+
+    str_deinit(&segment_file);
+    return 0;
+
+fail:
+    str_deinit(&segment_file);
+    fm_library_clear(lib);
+    return -1;
+}
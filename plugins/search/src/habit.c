@@ -0,0 +1,219 @@
+#include "search/habit.h"
+#include "search/search_index.h"
+#include "search/symbol.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct habit_key
+{
+    uint64_t motions[HABIT_MAX_LENGTH];
+    int length;
+    int _padding;
+};
+
+/* hash40("landing_light") = 0xdd934faa1 */
+/* hash40("landing_heavy") = 0xdc81fdc09 */
+/* hash40("landing_air_n") = 0xd562c06c5 */
+/* hash40("landing_air_f") = 0xd58f78ef7 */
+/* hash40("landing_air_b") = 0xd5f9a4aee */
+/* hash40("landing_air_hi") = 0xe5b6e8bce */
+/* hash40("landing_air_lw") = 0xec50d73a9 */
+/* hash40("landing_fall") = 0xc68fda1b5 */
+/* hash40("landing_fall_special") = 0x1447a7e8cc */
+static const uint64_t landing_motions[] = {
+    0xdd934faa1ul, 0xdc81fdc09ul, 0xd562c06c5ul, 0xd58f78ef7ul, 0xd5f9a4aeeul,
+    0xe5b6e8bceul, 0xec50d73a9ul, 0xc68fda1b5ul, 0x1447a7e8ccul
+};
+
+static int
+is_landing_motion(uint64_t motion)
+{
+    int i;
+    for (i = 0; i != (int)(sizeof(landing_motions) / sizeof(*landing_motions)); ++i)
+        if (motion == landing_motions[i])
+            return 1;
+    return 0;
+}
+
+static uint64_t
+symbol_motion(union symbol s)
+{
+    return ((uint64_t)s.motionh << 32) | s.motionl;
+}
+
+/*
+ * Returns true if the event happens on the symbol at "idx". The sequence
+ * starts with the symbol after it.
+ */
+static int
+is_event(enum habit_event event, const union symbol* symbols, int idx, int end)
+{
+    uint64_t motion = symbol_motion(symbols[idx]);
+    switch (event)
+    {
+        case HABIT_AFTER_ANYTHING    : return 1;
+        case HABIT_AFTER_LANDING     : return is_landing_motion(motion);
+        /* hash40("cliff_catch") = 0xb99d9746c */
+        case HABIT_AFTER_LEDGE_GRAB  : return motion == 0xb99d9746cul;
+        /* hash40("guard_off") = 0x97ab1c684 */
+        case HABIT_AFTER_SHIELD_DROP : return motion == 0x97ab1c684ul;
+        /* The last symbol of hitstun, so the sequence is what the fighter did to get out */
+        case HABIT_AFTER_HIT         :
+            return symbols[idx].me_hitstun && (idx + 1 == end || !symbols[idx + 1].me_hitstun);
+        case HABIT_EVENT_COUNT       : break;
+    }
+    return 0;
+}
+
+int
+habit_miner_init(struct habit_miner* miner, enum habit_event event)
+{
+    if (hm_init(&miner->habits, sizeof(struct habit_key), sizeof(struct habit)) < 0)
+        return -1;
+    miner->event = event;
+    miner->events = 0;
+    return 0;
+}
+
+void
+habit_miner_deinit(struct habit_miner* miner)
+{
+    hm_deinit(&miner->habits);
+}
+
+int
+habit_miner_add(struct habit_miner* miner, const struct search_index* index, int game_id, int fighter_idx)
+{
+    const union symbol* symbols = search_index_symbols(index, fighter_idx);
+    int end = search_index_symbol_count(index, fighter_idx);
+    int idx, length;
+
+    for (idx = 0; idx != end; ++idx)
+    {
+        struct habit_key key;
+        if (!is_event(miner->event, symbols, idx, end))
+            continue;
+        miner->events++;
+
+        /* Every prefix of the sequence is counted too, it extends the key by one motion at a time */
+        memset(&key, 0, sizeof key);
+        for (length = 1; length <= HABIT_MAX_LENGTH && idx + length < end; ++length)
+        {
+            struct habit* h;
+            key.motions[length - 1] = symbol_motion(symbols[idx + length]);
+            key.length = length;
+            if (length < HABIT_MIN_LENGTH)
+                continue;
+
+            switch (hm_insert(&miner->habits, &key, (void**)&h))
+            {
+                case 1:
+                    memcpy(h->motions, key.motions, sizeof(h->motions));
+                    h->length = length;
+                    h->count = 0;
+                    h->sample_count = 0;
+                    break;
+                case 0: break;
+                default: return -1;
+            }
+
+            h->count++;
+            if (h->sample_count < HABIT_MAX_SAMPLES)
+            {
+                struct habit_sample* s = &h->samples[h->sample_count++];
+                struct range r;
+                r.start = idx + 1;
+                r.end = idx + 1 + length;
+                s->game_id = game_id;
+                s->fighter_idx = fighter_idx;
+                s->frames = search_index_frames(index, fighter_idx, r);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int
+habit_cmp(const void* a, const void* b)
+{
+    const struct habit* h1 = a;
+    const struct habit* h2 = b;
+    if (h1->count != h2->count)
+        return h2->count - h1->count;
+    return h2->length - h1->length;
+}
+
+int
+habit_miner_rank(const struct habit_miner* miner, struct vec* habits, int max_count)
+{
+    struct hm absorbed;
+    struct vec sorted;
+    int ret = -1;
+
+    if (hm_init(&absorbed, sizeof(struct habit_key), sizeof(char)) < 0)
+        goto init_absorbed_failed;
+    vec_init(&sorted, sizeof(struct habit));
+
+    /*
+     * Sequences start right after an event, so a sequence only has one
+     * prefix. If the prefix never happened without continuing the same way,
+     * both have the same count and the prefix is redundant.
+     */
+    HM_FOR_EACH(&miner->habits, struct habit_key, struct habit, key, h)
+        struct habit_key prefix;
+        const struct habit* p;
+        char* value;
+        if (h->length <= HABIT_MIN_LENGTH)
+            continue;
+        prefix = *key;
+        prefix.motions[h->length - 1] = 0;
+        prefix.length = h->length - 1;
+        p = hm_find(&miner->habits, &prefix);
+        if (p == NULL || p->count != h->count)
+            continue;
+        if (hm_insert(&absorbed, &prefix, (void**)&value) < 0)
+            goto fail;
+    HM_END_EACH
+
+    HM_FOR_EACH(&miner->habits, struct habit_key, struct habit, key, h)
+        if (hm_find(&absorbed, key) != NULL)
+            continue;
+        if (vec_push(&sorted, h) < 0)
+            goto fail;
+    HM_END_EACH
+
+    if (vec_count(&sorted) > 0)
+        qsort(vec_data(&sorted), vec_count(&sorted), sizeof(struct habit), habit_cmp);
+
+    VEC_FOR_EACH(&sorted, const struct habit, h)
+        if (max_count-- <= 0)
+            break;
+        if (vec_push(habits, h) < 0)
+            goto fail;
+    VEC_END_EACH
+
+    ret = 0;
+
+fail:
+    vec_deinit(&sorted);
+    hm_deinit(&absorbed);
+init_absorbed_failed:
+    return ret;
+}
+
+const char*
+habit_event_name(enum habit_event event)
+{
+    switch (event)
+    {
+        case HABIT_AFTER_ANYTHING    : return "Anything";
+        case HABIT_AFTER_LANDING     : return "After landing";
+        case HABIT_AFTER_LEDGE_GRAB  : return "After ledge grab";
+        case HABIT_AFTER_SHIELD_DROP : return "After shield drop";
+        case HABIT_AFTER_HIT         : return "After getting hit";
+        case HABIT_EVENT_COUNT       : break;
+    }
+    return "";
+}
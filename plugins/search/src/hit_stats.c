@@ -0,0 +1,252 @@
+#include "search/hit_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct hit_name_key
+{
+    int group;
+    int group_id;
+};
+
+int
+hit_stats_init(struct hit_stats* stats)
+{
+    if (hm_init(&stats->names, sizeof(struct hit_name_key), sizeof(int)) < 0)
+        return -1;
+    vec_init(&stats->streams, sizeof(struct hit_stream));
+    vec_init(&stats->hits, sizeof(struct hit));
+    strlist_init(&stats->strings);
+    return 0;
+}
+
+void
+hit_stats_deinit(struct hit_stats* stats)
+{
+    strlist_deinit(&stats->strings);
+    vec_deinit(&stats->hits);
+    vec_deinit(&stats->streams);
+    hm_deinit(&stats->names);
+}
+
+void
+hit_stats_clear(struct hit_stats* stats)
+{
+    strlist_clear(&stats->strings);
+    vec_clear(&stats->hits);
+    vec_clear(&stats->streams);
+    hm_clear(&stats->names);
+}
+
+int
+hit_stats_add_stream(struct hit_stats* stats, const struct hit_stream* stream)
+{
+    if (vec_push(&stats->streams, stream) < 0)
+        return -1;
+    return (int)vec_count(&stats->streams) - 1;
+}
+
+int
+hit_stats_add_hit(struct hit_stats* stats, int stream, struct range frames, float percent)
+{
+    struct hit* hit = vec_emplace(&stats->hits);
+    if (hit == NULL)
+        return -1;
+    hit->stream = stream;
+    hit->frames = frames;
+    hit->percent = percent;
+    return 0;
+}
+
+int
+hit_stats_set_name(struct hit_stats* stats, enum hit_group group, int group_id, struct str_view name)
+{
+    struct hit_name_key key;
+    int* idx;
+
+    key.group = group;
+    key.group_id = group_id;
+    switch (hm_insert(&stats->names, &key, (void**)&idx))
+    {
+        case 1:
+            if (strlist_add(&stats->strings, name) < 0)
+            {
+                hm_erase(&stats->names, &key);
+                return -1;
+            }
+            *idx = (int)strlist_count(&stats->strings) - 1;
+            return 0;
+        case 0: return 0;
+        default: return -1;
+    }
+}
+
+struct str_view
+hit_stats_name(const struct hit_stats* stats, enum hit_group group, int group_id)
+{
+    struct hit_name_key key;
+    const int* idx;
+
+    key.group = group;
+    key.group_id = group_id;
+    idx = hm_find(&stats->names, &key);
+    if (idx == NULL)
+        return cstr_view("");
+    return strlist_to_view(&stats->strings, strlist_get(&stats->strings, *idx));
+}
+
+static int
+row_cmp(const void* a, const void* b)
+{
+    const struct hit_stats_row* r1 = a;
+    const struct hit_stats_row* r2 = b;
+    if (r1->hits != r2->hits)
+        return r2->hits - r1->hits;
+    return r1->group_id < r2->group_id ? -1 : r1->group_id > r2->group_id;
+}
+
+/*
+ * Rows are looked up by group ID while counting. Every stream is visited once
+ * and every hit once, so re-grouping doesn't depend on the number of groups.
+ */
+int
+hit_stats_aggregate(const struct hit_stats* stats, enum hit_group group, struct vec* rows)
+{
+    struct hm row_idxs;  /* int group_id -> int index into "rows" */
+    struct vec stream_hits;  /* int - number of hits of each stream */
+    vec_size first = vec_count(rows);
+    int* idx;
+    int i;
+
+    if (hm_init(&row_idxs, sizeof(int), sizeof(int)) < 0)
+        goto init_row_idxs_failed;
+    vec_init(&stream_hits, sizeof(int));
+    if (vec_resize(&stream_hits, vec_count(&stats->streams)) < 0)
+        goto fail;
+    for (i = 0; i != (int)vec_count(&stream_hits); ++i)
+        *(int*)vec_get(&stream_hits, i) = 0;
+
+    VEC_FOR_EACH(&stats->streams, const struct hit_stream, stream)
+        int group_id = stream->groups[group];
+        struct hit_stats_row* row;
+        switch (hm_insert(&row_idxs, &group_id, (void**)&idx))
+        {
+            case 1:
+                *idx = (int)(vec_count(rows) - first);
+                row = vec_emplace(rows);
+                if (row == NULL)
+                    goto fail;
+                memset(row, 0, sizeof *row);
+                row->group_id = group_id;
+                break;
+            case 0:
+                row = vec_get(rows, first + *idx);
+                break;
+            default:
+                goto fail;
+        }
+        row->games++;
+    VEC_END_EACH
+
+    VEC_FOR_EACH(&stats->hits, const struct hit, hit)
+        const struct hit_stream* stream = vec_get(&stats->streams, hit->stream);
+        struct hit_stats_row* row;
+        int* count = vec_get(&stream_hits, hit->stream);
+
+        idx = hm_find(&row_idxs, &stream->groups[group]);
+        row = vec_get(rows, first + *idx);
+        row->hits++;
+        row->histogram[symbol_damage_bucket(hit->percent)]++;
+        if ((*count)++ == 0)
+            row->games_with_hits++;
+    VEC_END_EACH
+
+    if (vec_count(rows) > first)
+        qsort(vec_get(rows, first), vec_count(rows) - first, sizeof(struct hit_stats_row), row_cmp);
+
+    vec_deinit(&stream_hits);
+    hm_deinit(&row_idxs);
+    return 0;
+
+fail:
+    vec_resize(rows, first);
+    vec_deinit(&stream_hits);
+    hm_deinit(&row_idxs);
+init_row_idxs_failed:
+    return -1;
+}
+
+static int
+append_quoted(struct str* csv, struct str_view name)
+{
+    int i;
+    if (cstr_append(csv, "\"") < 0)
+        return -1;
+    for (i = 0; i != name.len; ++i)
+    {
+        struct str_view c;
+        c.data = &name.data[i];
+        c.len = 1;
+        if (name.data[i] == '"' && cstr_append(csv, "\"") < 0)
+            return -1;
+        if (str_append(csv, c) < 0)
+            return -1;
+    }
+    return cstr_append(csv, "\"");
+}
+
+int
+hit_stats_to_csv(const struct hit_stats* stats, enum hit_group group, const struct vec* rows, struct str* csv)
+{
+    char buf[64];
+    int b;
+
+    if (cstr_append(csv, hit_group_name(group)) < 0 ||
+        cstr_append(csv, ",games,games_with_hits,hits,hits_per_game") < 0)
+        return -1;
+    for (b = 0; b != HIT_STATS_PERCENT_BUCKETS; ++b)
+    {
+        if (b == HIT_STATS_PERCENT_BUCKETS - 1)
+            snprintf(buf, sizeof buf, ",%d%%+", (int)(b * HIT_STATS_PERCENT_STEP));
+        else
+            snprintf(buf, sizeof buf, ",%d-%d%%",
+                (int)(b * HIT_STATS_PERCENT_STEP), (int)((b + 1) * HIT_STATS_PERCENT_STEP) - 1);
+        if (cstr_append(csv, buf) < 0)
+            return -1;
+    }
+    if (cstr_append(csv, "\n") < 0)
+        return -1;
+
+    VEC_FOR_EACH(rows, const struct hit_stats_row, row)
+        if (append_quoted(csv, hit_stats_name(stats, group, row->group_id)) < 0)
+            return -1;
+        snprintf(buf, sizeof buf, ",%d,%d,%d,%.3f", row->games, row->games_with_hits, row->hits,
+            row->games ? (double)row->hits / row->games : 0.0);
+        if (cstr_append(csv, buf) < 0)
+            return -1;
+        for (b = 0; b != HIT_STATS_PERCENT_BUCKETS; ++b)
+        {
+            snprintf(buf, sizeof buf, ",%d", row->histogram[b]);
+            if (cstr_append(csv, buf) < 0)
+                return -1;
+        }
+        if (cstr_append(csv, "\n") < 0)
+            return -1;
+    VEC_END_EACH
+
+    return 0;
+}
+
+const char*
+hit_group_name(enum hit_group group)
+{
+    switch (group)
+    {
+        case HIT_GROUP_PLAYER: return "player";
+        case HIT_GROUP_OPPONENT: return "opponent";
+        case HIT_GROUP_STAGE: return "stage";
+        case HIT_GROUP_COUNT: break;
+    }
+    return "";
+}
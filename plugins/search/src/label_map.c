@@ -0,0 +1,168 @@
+#include "search/ast.h"
+#include "search/label_map.h"
+
+#include "vh/hash40.h"
+#include "vh/motion_dict.h"
+
+/*
+ * Labels are keyed by their hash40 value, which includes the length of the
+ * string. Collisions between the handful of labels a fighter has are not a
+ * practical concern.
+ */
+struct label_key
+{
+    uint64_t label;
+    uint64_t fighter_id;
+};
+
+int
+label_map_init(struct label_map* map)
+{
+    if (hm_init(&map->entries, sizeof(struct label_key), sizeof(struct label_entry)) < 0)
+        return -1;
+    vec_init(&map->motions, sizeof(uint64_t));
+    map->revision = 0;
+    return 0;
+}
+
+void
+label_map_deinit(struct label_map* map)
+{
+    vec_deinit(&map->motions);
+    hm_deinit(&map->entries);
+}
+
+void
+label_map_clear(struct label_map* map)
+{
+    vec_clear(&map->motions);
+    hm_clear(&map->entries);
+}
+
+static int
+resolve_from_dict(
+    struct label_map* map, struct label_entry* entry,
+    const struct motion_dict* dict,
+    int fighter_id, struct str_view label)
+{
+    const uint64_t* motions;
+    uint64_t motion;
+    int i, count;
+
+    /*
+     * If the label is a user-defined label, for example "nair", then it
+     * may map to more than 1 motion value, for example, "attack_air_n"
+     * and "landing_air_n".
+     */
+    entry->first = vec_count(&map->motions);
+    count = motion_dict_label_motions(dict, fighter_id, label, &motions);
+    for (i = 0; i != count; ++i)
+        if (vec_push(&map->motions, &motions[i]) < 0)
+            return -1;
+    entry->count = count;
+    if (entry->count > 0)
+    {
+        entry->kind = LABEL_USER_DEFINED;
+        return 0;
+    }
+
+    /* Maybe the label hashes to a known value. */
+    motion = hash40_str(label);
+    if (motion_dict_string(dict, motion) == NULL)
+    {
+        entry->kind = LABEL_UNKNOWN;
+        return 0;
+    }
+
+    if (vec_push(&map->motions, &motion) < 0)
+        return -1;
+    entry->kind = LABEL_HASH40;
+    entry->count = 1;
+    return 0;
+}
+
+int
+label_map_resolve(
+    struct label_map* map,
+    const struct motion_dict* dict,
+    int fighter_id, struct str_view label,
+    const struct label_entry** entry)
+{
+    struct label_entry* e;
+    struct label_key key;
+    key.label = hash40_str(label);
+    key.fighter_id = (uint64_t)fighter_id;
+
+    switch (hm_insert(&map->entries, &key, (void**)&e))
+    {
+        case 1  : break;
+        case 0  : *entry = e; return 0;
+        default : return -1;
+    }
+
+    if (resolve_from_dict(map, e, dict, fighter_id, label) < 0)
+    {
+        /* Don't leave a half-resolved entry behind */
+        vec_resize(&map->motions, e->first);
+        hm_erase(&map->entries, &key);
+        return -1;
+    }
+
+    *entry = e;
+    return 0;
+}
+
+int
+label_map_resolve_ast(
+    struct label_map* map,
+    struct db_interface* dbi, struct db* db,
+    int fighter_id, const struct ast* ast)
+{
+    int result;
+    struct motion_dict* dict = motion_dict_acquire(dbi, db);
+    if (dict == NULL)
+        return -1;
+
+    result = label_map_resolve_ast_dict(map, dict, fighter_id, ast);
+    motion_dict_release(dict);
+    return result;
+}
+
+int
+label_map_resolve_ast_dict(
+    struct label_map* map,
+    const struct motion_dict* dict,
+    int fighter_id, const struct ast* ast)
+{
+    int n;
+
+    /* Everything resolved so far is out of date if the labels were edited */
+    if (map->revision != motion_dict_revision(dict))
+    {
+        label_map_clear(map);
+        map->revision = motion_dict_revision(dict);
+    }
+
+    for (n = 0; n != ast->node_count; ++n)
+    {
+        const struct label_entry* entry;
+        if (ast->nodes[n].info.type != AST_LABEL)
+            continue;
+        if (label_map_resolve(map, dict, fighter_id,
+                strlist_to_view(&ast->labels, ast->nodes[n].label.label), &entry) < 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+const struct label_entry*
+label_map_find(const struct label_map* map, int fighter_id, struct str_view label)
+{
+    struct label_key key;
+    key.label = hash40_str(label);
+    key.fighter_id = (uint64_t)fighter_id;
+    return hm_find(&map->entries, &key);
+}
@@ -1 +1,73 @@
 #include "search/match.h"
+
+#include "vh/vec.h"
+
+static int
+popcount64(uint64_t x)
+{
+    int count = 0;
+    for (; x; x &= x - 1)
+        count++;
+    return count;
+}
+
+static int
+find_column(const struct vec* tf, const struct matcher* m)
+{
+    int c;
+    for (c = 0; c != (int)vec_count(tf); ++c)
+        if (matchers_equal(vec_get(tf, c), m))
+            return c;
+    return -1;
+}
+
+int
+match_build_columns(struct vec* tf)
+{
+    int i, j;
+
+    /*
+     * Columns added here are also intersected with all previous columns as
+     * the loop progresses, so the set ends up being closed.
+     */
+    for (i = 1; i < (int)vec_count(tf); ++i)
+        for (j = 0; j != i; ++j)
+        {
+            struct matcher m;
+            const struct matcher* a = vec_get(tf, i);
+            const struct matcher* b = vec_get(tf, j);
+            uint64_t common = a->mask.u64 & b->mask.u64;
+
+            if (a->is_inverted || b->is_inverted)
+                continue;
+            if ((a->symbol.u64 & common) != (b->symbol.u64 & common))
+                continue;  /* Disjoint */
+
+            m = match_qualify(*a, b->symbol, b->mask);
+            m.is_accept = 0;
+            if (find_column(tf, &m) < 0)
+                if (vec_push(tf, &m) < 0)
+                    return -1;
+        }
+
+    /*
+     * A column only subsumes columns with more mask bits. Sorting by the
+     * number of mask bits is stable, so the order of the remaining columns
+     * is preserved.
+     */
+    for (i = 1; i < (int)vec_count(tf); ++i)
+    {
+        struct matcher m = *(struct matcher*)vec_get(tf, i);
+        int bits = popcount64(m.mask.u64);
+        for (j = i; j > 0; --j)
+        {
+            struct matcher* prev = vec_get(tf, j - 1);
+            if (popcount64(prev->mask.u64) >= bits)
+                break;
+            *(struct matcher*)vec_get(tf, j) = *prev;
+        }
+        *(struct matcher*)vec_get(tf, j) = m;
+    }
+
+    return 0;
+}
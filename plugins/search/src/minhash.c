@@ -0,0 +1,119 @@
+#include "search/minhash.h"
+#include "search/symbol.h"
+
+#include <stddef.h>
+
+/* See https://prng.di.unimi.it/splitmix64.c */
+static uint64_t
+mix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static uint64_t
+motion_of(union symbol s)
+{
+    return ((uint64_t)s.motionh << 32) | s.motionl;
+}
+
+/* Hash of the n-gram ending at "idx", clamped to the start of the range */
+static uint64_t
+ngram_hash(const union symbol* symbols, int start, int idx)
+{
+    uint64_t h = 0;
+    int i = idx - MINHASH_NGRAM + 1;
+    for (i = i < start ? start : i; i <= idx; ++i)
+        h = mix64(h ^ motion_of(symbols[i]));
+    return h;
+}
+
+/*
+ * Instead of MINHASH_HASHES independent hash functions, every hash is derived
+ * from the n-gram hash with a different seed.
+ */
+static void
+minhash_add(struct minhash* mh, uint64_t ngram)
+{
+    int i;
+    for (i = 0; i != MINHASH_HASHES; ++i)
+    {
+        uint32_t h = (uint32_t)mix64(ngram ^ ((uint64_t)i * 0xD6E8FEB86659FD93ull));
+        if (mh->h[i] > h)
+            mh->h[i] = h;
+    }
+}
+
+static void
+minhash_reset(struct minhash* mh)
+{
+    int i;
+    for (i = 0; i != MINHASH_HASHES; ++i)
+        mh->h[i] = UINT32_MAX;
+}
+
+void
+minhash_compute(struct minhash* mh, const union symbol* symbols, struct range range)
+{
+    int idx;
+
+    minhash_reset(mh);
+    if (range.end - range.start < MINHASH_NGRAM)
+    {
+        if (range.end > range.start)
+            minhash_add(mh, ngram_hash(symbols, range.start, range.end - 1));
+        return;
+    }
+
+    for (idx = range.start + MINHASH_NGRAM - 1; idx < range.end; ++idx)
+        minhash_add(mh, ngram_hash(symbols, range.start, idx));
+}
+
+void
+minhash_bands(uint64_t* bands, const struct minhash* mh)
+{
+    int b, r;
+    for (b = 0; b != MINHASH_BANDS; ++b)
+    {
+        /* Mix in the band index so equal rows in different bands don't collide */
+        uint64_t h = (uint64_t)b;
+        for (r = 0; r != MINHASH_ROWS; ++r)
+            h = mix64(h ^ mh->h[b * MINHASH_ROWS + r]);
+        bands[b] = h;
+    }
+}
+
+int
+minhash_similarity(const struct minhash* a, const struct minhash* b)
+{
+    int i, equal = 0;
+    for (i = 0; i != MINHASH_HASHES; ++i)
+        equal += a->h[i] == b->h[i];
+    return equal;
+}
+
+int
+minhash_windows(struct vec* windows, const union symbol* symbols, struct range range)
+{
+    struct minhash mh;
+    int start;
+
+    for (start = range.start; start < range.end; start += MINHASH_STRIDE)
+    {
+        struct minhash_window* w = vec_emplace(windows);
+        if (w == NULL)
+            return -1;
+        w->symbols.start = start;
+        w->symbols.end = start + MINHASH_WINDOW < range.end ? start + MINHASH_WINDOW : range.end;
+        minhash_compute(&mh, symbols, w->symbols);
+        minhash_bands(w->bands, &mh);
+
+        /* The last window already covers the rest of the range */
+        if (w->symbols.end == range.end)
+            break;
+    }
+
+    return 0;
+}
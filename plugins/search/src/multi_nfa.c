@@ -0,0 +1,568 @@
+#include "search/bitnfa.h"
+#include "search/match.h"
+#include "search/multi_nfa.h"
+#include "search/nfa.h"
+
+#include "vh/hm.h"
+#include "vh/mem.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+static int
+ctz64(uint64_t x)
+{
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return (int)idx;
+}
+#else
+#   define ctz64(x) __builtin_ctzll(x)
+#endif
+
+/*
+ * Every query keeps its own bit-parallel automaton. It is not used for
+ * scanning, but its columns and match sets (including the wildcard bias)
+ * define which of the query's positions a symbol enables. The positions of
+ * query "q" occupy bits [offset, offset + engine.positions) of the merged
+ * state set.
+ */
+struct multi_nfa_query
+{
+    struct bitnfa engine;
+    uint64_t* first;    /* [words] - first set of this query only */
+    int offset;
+};
+
+static void
+set_bit(uint64_t* set, int bit)
+{
+    set[bit / BITNFA_WORD_BITS] |= (uint64_t)1 << (bit % BITNFA_WORD_BITS);
+}
+
+static int
+test_bit(const uint64_t* set, int bit)
+{
+    return (set[bit / BITNFA_WORD_BITS] >> (bit % BITNFA_WORD_BITS)) & 1;
+}
+
+static void
+free_queries(struct vec* queries)
+{
+    VEC_FOR_EACH(queries, struct multi_nfa_query, q)
+        bitnfa_deinit(&q->engine);
+    VEC_END_EACH
+    vec_deinit(queries);
+}
+
+void
+multi_nfa_init(struct multi_nfa* multi)
+{
+    vec_init(&multi->queries, sizeof(struct multi_nfa_query));
+    multi->first = NULL;
+    multi->accept = NULL;
+    multi->follow = NULL;
+    multi->position_query = NULL;
+    multi->positions = 0;
+    multi->words = 0;
+}
+
+void
+multi_nfa_deinit(struct multi_nfa* multi)
+{
+    /* All bit sets share a single allocation */
+    if (multi->first)
+        mem_free(multi->first);
+    if (multi->position_query)
+        mem_free(multi->position_query);
+    free_queries(&multi->queries);
+}
+
+int
+multi_nfa_compile(struct multi_nfa* multi, const struct nfa_graph* nfas, int count)
+{
+    struct vec queries;
+    uint64_t* data;
+    int* position_query;
+    int i, n, words, positions, size;
+
+    if (count <= 0)
+        return -1;
+
+    vec_init(&queries, sizeof(struct multi_nfa_query));
+    positions = 0;
+    for (i = 0; i != count; ++i)
+    {
+        struct multi_nfa_query* q = vec_emplace(&queries);
+        if (q == NULL)
+            goto build_queries_failed;
+        bitnfa_init(&q->engine);
+        q->offset = positions;
+        if (bitnfa_from_nfa(&q->engine, &nfas[i]) < 0)
+            goto build_queries_failed;
+        positions += q->engine.positions;
+    }
+    words = (positions + BITNFA_WORD_BITS - 1) / BITNFA_WORD_BITS;
+
+    /* first, accept, first of each query, follow */
+    size = words * (2 + count) + positions * words;
+    data = mem_alloc(sizeof(uint64_t) * size);
+    if (data == NULL)
+        goto alloc_data_failed;
+    memset(data, 0, sizeof(uint64_t) * size);
+    position_query = mem_alloc(sizeof(int) * positions);
+    if (position_query == NULL)
+        goto alloc_position_query_failed;
+
+    for (i = 0; i != count; ++i)
+    {
+        const struct nfa_graph* nfa = &nfas[i];
+        struct multi_nfa_query* q = vec_get(&queries, i);
+        uint64_t* accept = data + words;
+        uint64_t* follow = data + words * (2 + count);
+
+        q->first = data + words * (2 + i);
+        VEC_FOR_EACH(&nfa->nodes[0].next, int, next)
+            set_bit(q->first, q->offset + *next - 1);
+        VEC_END_EACH
+
+        /* Bit "offset+n-1" represents NFA node "n" of query "i" */
+        for (n = 1; n != nfa->node_count; ++n)
+        {
+            const struct matcher* m = &nfa->nodes[n].matcher;
+            int bit = q->offset + n - 1;
+            position_query[bit] = i;
+            if (m->is_accept && !m->is_inverted)
+                set_bit(accept, bit);
+            VEC_FOR_EACH(&nfa->nodes[n].next, int, next)
+                set_bit(follow + bit * words, q->offset + *next - 1);
+            VEC_END_EACH
+        }
+
+        for (n = 0; n != words; ++n)
+            data[n] |= q->first[n];
+    }
+
+    multi_nfa_deinit(multi);
+    vec_steal_vector(&multi->queries, &queries);
+    multi->first = data;
+    multi->accept = data + words;
+    multi->follow = data + words * (2 + count);
+    multi->position_query = position_query;
+    multi->positions = positions;
+    multi->words = words;
+
+    return 0;
+
+alloc_position_query_failed:
+    mem_free(data);
+alloc_data_failed:
+build_queries_failed:
+    free_queries(&queries);
+    return -1;
+}
+
+static int
+do_match(const struct matcher* m, union symbol s)
+{
+    return (m->symbol.u64 & m->mask.u64) == (s.u64 & m->mask.u64);
+}
+
+/*
+ * Computes the set of positions (of all queries) that can consume the symbol.
+ * Each query looks up the column it would use if it were run on its own, so
+ * different queries may disagree on which column a symbol belongs to.
+ */
+static void
+compute_match_set(uint64_t* set, const struct multi_nfa* multi, union symbol s)
+{
+    int c, p;
+    memset(set, 0, sizeof(uint64_t) * multi->words);
+    VEC_FOR_EACH(&multi->queries, const struct multi_nfa_query, q)
+        const struct bitnfa* engine = &q->engine;
+        const uint64_t* match;
+        for (c = 0; c != (int)vec_count(&engine->tf); ++c)
+            if (do_match(vec_get(&engine->tf, c), s))
+                break;
+        if (c == (int)vec_count(&engine->tf))
+            continue;
+
+        match = engine->match + c * engine->words;
+        for (p = 0; p != engine->positions; ++p)
+            if (test_bit(match, p))
+                set_bit(set, q->offset + p);
+    VEC_END_EACH
+}
+
+/*
+ * Symbols of a game repeat a lot, so instead of looking up the column of
+ * every query for every symbol, each distinct symbol is assigned a class
+ * whose match set is computed once.
+ */
+static int
+classify_symbols(
+        struct vec* classes,
+        struct vec* match_sets,
+        const struct multi_nfa* multi,
+        const union symbol* symbols,
+        struct range window)
+{
+    struct hm class_ids;
+    int idx;
+
+    if (hm_init(&class_ids, sizeof(uint64_t), sizeof(int)) < 0)
+        return -1;
+    if (vec_resize(classes, window.end - window.start) < 0)
+        goto fail;
+
+    for (idx = window.start; idx != window.end; ++idx)
+    {
+        int* class_id;
+        switch (hm_insert(&class_ids, &symbols[idx].u64, (void**)&class_id))
+        {
+            case 1: {
+                int count = vec_count(match_sets) / multi->words;
+                if (vec_resize(match_sets, (count + 1) * multi->words) < 0)
+                    goto fail;
+                compute_match_set(vec_get(match_sets, count * multi->words), multi, symbols[idx]);
+                *class_id = count;
+            } break;
+            case 0: break;
+            default: goto fail;
+        }
+        *(int*)vec_get(classes, idx - window.start) = *class_id;
+    }
+
+    hm_deinit(&class_ids);
+    return 0;
+
+fail:
+    hm_deinit(&class_ids);
+    return -1;
+}
+
+/*
+ * The scan keeps a single set of active positions for all queries. Every
+ * active position also remembers the index at which its thread started.
+ * Threads of a query that reach the same position at the same index have the
+ * same future, so only the one that started first is kept. This is enough to
+ * find the leftmost start of each query, and its longest end.
+ *
+ * A query's match is pending until all threads that started at or before it
+ * have died, because one of them could still turn into a match further to
+ * the left, or a longer one. Threads starting inside a pending match can't
+ * be reported and are dropped as soon as the match is known.
+ */
+struct multi_state
+{
+    uint64_t* active;   /* [words] */
+    uint64_t* next;     /* [words] */
+    int* starts;        /* [positions] - start index of each active position */
+    int* next_starts;   /* [positions] */
+};
+
+struct pending_match
+{
+    int start;          /* -1 if there is no pending match */
+    int end;
+    int rescan;         /* A later match was found before this one was final */
+};
+
+struct multi_scan
+{
+    const struct multi_nfa* multi;
+    struct vec classes;     /* int */
+    struct vec match_sets;  /* uint64_t[words] per class */
+    struct pending_match* pending;  /* [query count] */
+    struct multi_state state;
+    struct multi_state rescan;
+    struct vec* results;
+};
+
+static void
+state_clear(struct multi_state* st, int words)
+{
+    memset(st->active, 0, sizeof(uint64_t) * words);
+}
+
+/* Starts a new thread of the query at "idx" on every first position that isn't taken */
+static void
+start_threads(struct multi_state* st, const struct multi_nfa_query* query, int idx)
+{
+    int p;
+    for (p = query->offset; p != query->offset + query->engine.positions; ++p)
+        if (test_bit(query->first, p) && !test_bit(st->active, p))
+        {
+            set_bit(st->active, p);
+            st->starts[p] = idx;
+        }
+}
+
+/* Removes the threads of the query that started in (lo, hi) */
+static void
+drop_threads(struct multi_state* st, const struct multi_nfa_query* query, int lo, int hi)
+{
+    int p;
+    for (p = query->offset; p != query->offset + query->engine.positions; ++p)
+        if (test_bit(st->active, p) && st->starts[p] > lo && st->starts[p] < hi)
+            st->active[p / BITNFA_WORD_BITS] &= ~((uint64_t)1 << (p % BITNFA_WORD_BITS));
+}
+
+static int
+has_thread_until(const struct multi_state* st, const struct multi_nfa_query* query, int start)
+{
+    int p;
+    for (p = query->offset; p != query->offset + query->engine.positions; ++p)
+        if (test_bit(st->active, p) && st->starts[p] <= start)
+            return 1;
+    return 0;
+}
+
+static void
+on_accept(struct multi_scan* scan, struct multi_state* st, int q, int start, int end)
+{
+    struct pending_match* m = &scan->pending[q];
+    if (m->start < 0 || start < m->start)
+    {
+        m->start = start;
+        m->end = end;
+        m->rescan = 0;
+    }
+    else if (start == m->start)
+    {
+        m->end = end;
+        m->rescan = 0;
+    }
+    else
+    {
+        /* Either a thread that was dropped at this index, or the start of a
+         * match that is only valid if the pending one doesn't grow */
+        if (start >= m->end)
+            m->rescan = 1;
+        return;
+    }
+
+    drop_threads(st, vec_get(&scan->multi->queries, q), m->start, m->end);
+}
+
+/* Consumes the symbol at "idx" with the threads of queries [q_first, q_last) */
+static void
+step(struct multi_scan* scan, struct multi_state* st, int idx, int window_start, int q_first, int q_last)
+{
+    const struct multi_nfa* multi = scan->multi;
+    const uint64_t* match = (const uint64_t*)vec_get(&scan->match_sets,
+        *(int*)vec_get(&scan->classes, idx - window_start) * multi->words);
+    uint64_t* tmp;
+    int* tmp_starts;
+    int q, w, i;
+
+    /* Nothing that starts inside a pending match can be reported */
+    for (q = q_first; q != q_last; ++q)
+        if (scan->pending[q].start < 0 || idx >= scan->pending[q].end)
+            start_threads(st, vec_get(&multi->queries, q), idx);
+
+    for (w = 0; w != multi->words; ++w)
+    {
+        uint64_t accepted;
+        st->active[w] &= match[w];
+
+        /* Accepting positions tell us which queries matched */
+        accepted = st->active[w] & multi->accept[w];
+        while (accepted)
+        {
+            int p = w * BITNFA_WORD_BITS + ctz64(accepted);
+            on_accept(scan, st, multi->position_query[p], st->starts[p], idx + 1);
+            accepted &= accepted - 1;
+        }
+    }
+
+    memset(st->next, 0, sizeof(uint64_t) * multi->words);
+    for (w = 0; w != multi->words; ++w)
+    {
+        uint64_t bits = st->active[w];
+        while (bits)
+        {
+            int p = w * BITNFA_WORD_BITS + ctz64(bits);
+            int start = st->starts[p];
+            const uint64_t* follow = multi->follow + p * multi->words;
+            for (i = 0; i != multi->words; ++i)
+            {
+                uint64_t f = follow[i];
+                while (f)
+                {
+                    int n = i * BITNFA_WORD_BITS + ctz64(f);
+                    if (!test_bit(st->next, n))
+                    {
+                        set_bit(st->next, n);
+                        st->next_starts[n] = start;
+                    }
+                    else if (st->next_starts[n] > start)
+                        st->next_starts[n] = start;
+                    f &= f - 1;
+                }
+            }
+            bits &= bits - 1;
+        }
+    }
+
+    tmp = st->active; st->active = st->next; st->next = tmp;
+    tmp_starts = st->starts; st->starts = st->next_starts; st->next_starts = tmp_starts;
+}
+
+/*
+ * Reports the pending match of the query once nothing can change it anymore.
+ * If another match was found while it was pending, the threads that were
+ * dropped in favor of older ones are missing, so the query has to be run
+ * again from the end of the match.
+ * \return Returns the index to rescan from, 0 if there's nothing to rescan,
+ * or -1 on error.
+ */
+static int
+finish(struct multi_scan* scan, const struct multi_state* st, int q, int at_end)
+{
+    struct pending_match* m = &scan->pending[q];
+    struct query_range* r;
+
+    if (m->start < 0)
+        return 0;
+    if (!at_end && has_thread_until(st, vec_get(&scan->multi->queries, q), m->start))
+        return 0;
+
+    r = vec_emplace(scan->results);
+    if (r == NULL)
+        return -1;
+    r->range.start = m->start;
+    r->range.end = m->end;
+    r->query = q;
+
+    m->start = -1;
+    return m->rescan ? m->end : 0;
+}
+
+/* Runs a single query over [from, to] and replaces its threads in the scan state */
+static int
+rescan_query(struct multi_scan* scan, int q, int from, int to, int window_start)
+{
+    const struct multi_nfa_query* query = vec_get(&scan->multi->queries, q);
+    struct multi_state* st = &scan->rescan;
+    int idx, p;
+
+    state_clear(st, scan->multi->words);
+    for (idx = from; idx <= to; ++idx)
+    {
+        int rescan_from;
+        step(scan, st, idx, window_start, q, q + 1);
+        rescan_from = finish(scan, st, q, 0);
+        if (rescan_from < 0)
+            return -1;
+        if (rescan_from > 0)
+        {
+            state_clear(st, scan->multi->words);
+            idx = rescan_from - 1;
+        }
+    }
+
+    for (p = query->offset; p != query->offset + query->engine.positions; ++p)
+    {
+        scan->state.active[p / BITNFA_WORD_BITS] &= ~((uint64_t)1 << (p % BITNFA_WORD_BITS));
+        if (test_bit(st->active, p))
+        {
+            set_bit(scan->state.active, p);
+            scan->state.starts[p] = st->starts[p];
+        }
+    }
+
+    return 0;
+}
+
+static int
+query_range_cmp(const void* a, const void* b)
+{
+    const struct query_range* r1 = a;
+    const struct query_range* r2 = b;
+    if (r1->range.start != r2->range.start)
+        return r1->range.start < r2->range.start ? -1 : 1;
+    return r1->query - r2->query;
+}
+
+int
+multi_nfa_find_all(struct vec* results, const struct multi_nfa* multi, const union symbol* symbols, struct range window)
+{
+    struct multi_scan scan;
+    void* scratch;
+    int idx, q, count, words, first_result;
+    int ret = -1;
+
+    if (multi->positions == 0 || window.start == window.end)
+        return 0;
+
+    count = multi_nfa_query_count(multi);
+    words = multi->words;
+    scan.multi = multi;
+    scan.results = results;
+    vec_init(&scan.classes, sizeof(int));
+    vec_init(&scan.match_sets, sizeof(uint64_t));
+    if (classify_symbols(&scan.classes, &scan.match_sets, multi, symbols, window) < 0)
+        goto classify_failed;
+
+    /* Two states with two bit sets and two start arrays each, then the pending matches */
+    scratch = mem_alloc(sizeof(uint64_t) * words * 4 + sizeof(int) * multi->positions * 4 + sizeof(struct pending_match) * count);
+    if (scratch == NULL)
+        goto alloc_scratch_failed;
+    scan.state.active = scratch;
+    scan.state.next = scan.state.active + words;
+    scan.rescan.active = scan.state.next + words;
+    scan.rescan.next = scan.rescan.active + words;
+    scan.state.starts = (int*)(scan.rescan.next + words);
+    scan.state.next_starts = scan.state.starts + multi->positions;
+    scan.rescan.starts = scan.state.next_starts + multi->positions;
+    scan.rescan.next_starts = scan.rescan.starts + multi->positions;
+    scan.pending = (struct pending_match*)(scan.rescan.next_starts + multi->positions);
+    state_clear(&scan.state, words);
+    for (q = 0; q != count; ++q)
+        scan.pending[q].start = -1;
+
+    first_result = vec_count(results);
+    for (idx = window.start; idx != window.end; ++idx)
+    {
+        step(&scan, &scan.state, idx, window.start, 0, count);
+        for (q = 0; q != count; ++q)
+        {
+            int rescan_from = finish(&scan, &scan.state, q, 0);
+            if (rescan_from < 0)
+                goto fail;
+            if (rescan_from > 0 && rescan_query(&scan, q, rescan_from, idx, window.start) < 0)
+                goto fail;
+        }
+    }
+
+    /* Threads that are still active at the end of the window can't grow anymore */
+    for (q = 0; q != count; ++q)
+        for (;;)
+        {
+            int rescan_from = finish(&scan, &scan.state, q, 1);
+            if (rescan_from < 0)
+                goto fail;
+            if (rescan_from == 0)
+                break;
+            if (rescan_query(&scan, q, rescan_from, window.end - 1, window.start) < 0)
+                goto fail;
+        }
+
+    /* Queries report their matches when they become final, which isn't in order */
+    if ((int)vec_count(results) > first_result)
+        qsort(vec_get(results, first_result), vec_count(results) - first_result,
+            sizeof(struct query_range), query_range_cmp);
+
+    ret = 0;
+
+fail:
+    mem_free(scratch);
+alloc_scratch_failed:
+classify_failed:
+    vec_deinit(&scan.match_sets);
+    vec_deinit(&scan.classes);
+    return ret;
+}
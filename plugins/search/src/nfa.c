@@ -1,4 +1,5 @@
 #include "search/ast.h"
+#include "search/ast_ops.h"
 #include "search/nfa.h"
 
 #include "vh/hash40.h"
@@ -9,6 +10,7 @@
 
 #include <stdio.h>
 #include <inttypes.h>
+#include <math.h>
 
 #define max(a, b) ((a) < (b) ? (b) : (a))
 
@@ -61,6 +63,7 @@ node_duplicate(int node_idx, struct vec* nodes, struct hm* index_map)
     struct nfa_node* node;
     struct nfa_node* new_node;
     int* hm_value;
+    int i, new_idx;
 
     switch (hm_insert(index_map, &node_idx, (void**)&hm_value))
     {
@@ -69,19 +72,27 @@ node_duplicate(int node_idx, struct vec* nodes, struct hm* index_map)
         default: return -1;
     }
 
-    node = vec_get(nodes, node_idx);
+    /*
+     * Inserting nodes may reallocate the vector, so pointers into it are
+     * looked up again after every insertion.
+     */
+    new_idx = vec_count(nodes);
     new_node = vec_emplace(nodes);
     if (new_node == NULL)
         return -1;
+    node = vec_get(nodes, node_idx);
     vec_init(&new_node->next, sizeof(int));
     if (vec_push_vec(&new_node->next, &node->next) < 0)
         return -1;
     new_node->matcher = node->matcher;
 
-    VEC_FOR_EACH(&node->next, int, conn)
-        if (node_duplicate(*conn, nodes, index_map) < 0)
-            return 1;
-    VEC_END_EACH
+    for (i = 0; i != (int)vec_count(&new_node->next); ++i)
+    {
+        int conn = *(int*)vec_get(&new_node->next, i);
+        if (node_duplicate(conn, nodes, index_map) < 0)
+            return -1;
+        new_node = vec_get(nodes, new_idx);
+    }
 
     return 0;
 }
@@ -124,6 +135,474 @@ fail:
     return -1;
 }
 
+/*
+ * Context qualifiers constrain the flags of a symbol in addition to its
+ * motion. Flags of the same group are alternatives, e.g. "rising|falling nair"
+ * matches either a rising or a falling nair. Flags of different groups must
+ * all be satisfied, e.g. "rising nair hit".
+ *
+ * The qualifier stack holds one vector of alternatives per context node. The
+ * top of the stack combines the alternatives of all context nodes above the
+ * node currently being compiled, and every alternative becomes a separate NFA
+ * node.
+ */
+struct qualifier
+{
+    union symbol symbol;
+    union symbol mask;
+};
+
+static const enum ast_ctx_flags qualifier_groups[] = {
+    AST_CTX_OS | AST_CTX_HIT | AST_CTX_WHIFF | AST_CTX_CLANK | AST_CTX_TRADE,
+    AST_CTX_RISING | AST_CTX_FALLING | AST_CTX_FS,
+    AST_CTX_KILL | AST_CTX_DIE,
+    AST_CTX_BURY | AST_CTX_BURIED,
+    AST_CTX_CROSSUP
+};
+
+static struct qualifier
+qualifier_from_flag(enum ast_ctx_flags flag)
+{
+    struct qualifier q;
+    q.symbol.u64 = 0;
+    q.mask.u64 = 0;
+    switch (flag)
+    {
+        case AST_CTX_OS      : q.mask.op_shieldlag = 1; q.symbol.op_shieldlag = 1; break;
+        case AST_CTX_HIT     : q.mask.op_hitlag = 1;    q.symbol.op_hitlag = 1; break;
+        case AST_CTX_CLANK   : q.mask.me_clank = 1;     q.symbol.me_clank = 1; break;
+        case AST_CTX_TRADE   : q.mask.trade = 1;        q.symbol.trade = 1; break;
+        case AST_CTX_CROSSUP : q.mask.me_crossup = 1;   q.symbol.me_crossup = 1; break;
+        case AST_CTX_KILL    : q.mask.op_dead = 1;      q.symbol.op_dead = 1; break;
+        case AST_CTX_DIE     : q.mask.me_dead = 1;      q.symbol.me_dead = 1; break;
+        case AST_CTX_BURY    : q.mask.op_buried = 1;    q.symbol.op_buried = 1; break;
+        case AST_CTX_BURIED  : q.mask.me_buried = 1;    q.symbol.me_buried = 1; break;
+        case AST_CTX_RISING  : q.mask.me_rising = 1;    q.symbol.me_rising = 1; break;
+        case AST_CTX_FALLING : q.mask.me_falling = 1;   q.symbol.me_falling = 1; break;
+        case AST_CTX_FS      : q.mask.me_fastfall = 1;  q.symbol.me_fastfall = 1; break;
+
+        /* A move whiffed if it didn't connect with anything */
+        case AST_CTX_WHIFF:
+            q.mask.op_hitlag = 1;
+            q.mask.op_shieldlag = 1;
+            q.mask.me_clank = 1;
+            break;
+
+        default: break;
+    }
+    return q;
+}
+
+static int
+qualifiers_combine(struct qualifier* out, const struct qualifier* a, const struct qualifier* b)
+{
+    uint64_t common = a->mask.u64 & b->mask.u64;
+    if ((a->symbol.u64 & common) != (b->symbol.u64 & common))
+        return -1;
+    out->symbol.u64 = a->symbol.u64 | b->symbol.u64;
+    out->mask.u64 = a->mask.u64 | b->mask.u64;
+    return 0;
+}
+
+/*
+ * Multiplies out the alternatives of "alts" with "options". The result
+ * replaces the contents of "alts". Alternatives that contradict each other
+ * are dropped.
+ */
+static int
+qualifiers_expand(struct vec* alts, const struct vec* options)
+{
+    struct vec result;
+
+    vec_init(&result, sizeof(struct qualifier));
+    VEC_FOR_EACH(alts, const struct qualifier, alt)
+        VEC_FOR_EACH(options, const struct qualifier, option)
+            struct qualifier q;
+            if (qualifiers_combine(&q, alt, option) < 0)
+                continue;
+            if (vec_push(&result, &q) < 0)
+                goto fail;
+        VEC_END_EACH
+    VEC_END_EACH
+
+    vec_steal_vector(alts, &result);
+    return 0;
+
+fail:
+    vec_deinit(&result);
+    return -1;
+}
+
+static struct qualifier
+qualifier_damage(int value, int mask)
+{
+    struct qualifier q;
+    q.symbol.u64 = 0;
+    q.mask.u64 = 0;
+    q.symbol.op_damage = value;
+    q.mask.op_damage = mask;
+    return q;
+}
+
+static struct qualifier
+qualifier_frames(int value, int mask)
+{
+    struct qualifier q;
+    q.symbol.u64 = 0;
+    q.mask.u64 = 0;
+    q.symbol.prev_frames = value;
+    q.mask.prev_frames = mask;
+    return q;
+}
+
+/*
+ * Splits the range of buckets [lo, hi] into aligned power-of-two blocks,
+ * each of which can be matched with a single mask. A range of a 4-bit field
+ * never needs more than 6 blocks.
+ */
+static int
+push_range_qualifiers(struct vec* options, int lo, int hi, int buckets, struct qualifier (*make)(int value, int mask))
+{
+    while (lo <= hi)
+    {
+        struct qualifier q;
+        int size = 1;
+        while ((lo & (size * 2 - 1)) == 0 && lo + size * 2 - 1 <= hi && size * 2 <= buckets)
+            size *= 2;
+
+        q = make(lo, (buckets - 1) & ~(size - 1));
+        if (vec_push(options, &q) < 0)
+            return -1;
+        lo += size;
+    }
+
+    return 0;
+}
+
+/*
+ * Pushes a new level onto the qualifier stack, starting out with the
+ * alternatives of the parent level.
+ */
+static struct vec*
+qualifier_push(struct vec* qstack)
+{
+    struct vec* alts;
+
+    if ((alts = vec_emplace(qstack)) == NULL)
+        return NULL;
+    vec_init(alts, sizeof(struct qualifier));
+
+    if (vec_count(qstack) > 1)
+    {
+        if (vec_push_vec(alts, vec_get_back(qstack, 2)) < 0)
+            return NULL;
+    }
+    else
+    {
+        struct qualifier* q = vec_emplace(alts);
+        if (q == NULL)
+            return NULL;
+        q->symbol.u64 = 0;
+        q->mask.u64 = 0;
+    }
+
+    return alts;
+}
+
+static int
+qualifier_push_context(struct vec* qstack, enum ast_ctx_flags flags)
+{
+    struct vec options;
+    struct vec* alts;
+    int g, bit;
+
+    if ((alts = qualifier_push(qstack)) == NULL)
+        return -1;
+
+    /* Everything below an "op" qualifier is a step of the opponent */
+    if (flags & AST_CTX_OP)
+        VEC_FOR_EACH(alts, struct qualifier, q)
+            q->symbol.is_op = 1;
+            q->mask.is_op = 1;
+        VEC_END_EACH
+
+    vec_init(&options, sizeof(struct qualifier));
+    for (g = 0; g != sizeof(qualifier_groups) / sizeof(*qualifier_groups); ++g)
+    {
+        vec_clear(&options);
+        for (bit = 0; bit != 32; ++bit)
+        {
+            struct qualifier q;
+            enum ast_ctx_flags flag = (enum ast_ctx_flags)(1 << bit);
+            if (!(flags & qualifier_groups[g] & flag))
+                continue;
+            q = qualifier_from_flag(flag);
+            if (vec_push(&options, &q) < 0)
+                goto fail;
+        }
+
+        if (vec_count(&options) > 0)
+            if (qualifiers_expand(alts, &options) < 0)
+                goto fail;
+    }
+    vec_deinit(&options);
+
+    if (vec_count(alts) == 0)
+    {
+        log_err("Failed to compile AST: Context qualifiers contradict each other\n");
+        return -1;
+    }
+
+    return 0;
+
+fail:
+    vec_deinit(&options);
+    return -1;
+}
+
+/* Damage ranges in whole percent, see symbol.h */
+static int damage_lower(float from) { return from > 0.f ? (int)ceilf(from) : 0; }
+static int damage_upper(float to)   { return (int)floorf(to); }
+
+/*
+ * Only ranges that start and end on a bucket boundary can be matched exactly.
+ * The last bucket holds everything above it, so a range reaching into it has
+ * to be open-ended.
+ */
+static int
+damage_range_is_exact(float from, float to)
+{
+    int step = (int)SYMBOL_DAMAGE_STEP;
+    int last = step * (SYMBOL_DAMAGE_BUCKETS - 1);
+    int lo = damage_lower(from);
+    int hi = damage_upper(to);
+
+    if (lo % step != 0 || lo > last)
+        return 0;
+    if (hi >= SYMBOL_DAMAGE_MAX)
+        return 1;
+    return (hi + 1) % step == 0 && hi < last;
+}
+
+int
+nfa_check_ast(const struct ast* ast)
+{
+    int n;
+    for (n = 0; n != ast->node_count; ++n)
+        switch (ast->nodes[n].info.type)
+        {
+            case AST_DAMAGE:
+                if (!damage_range_is_exact(ast->nodes[n].damage.from, ast->nodes[n].damage.to))
+                {
+                    log_err("Damage range %.1f%%-%.1f%% is not supported. Ranges must line up with steps of %d%%, e.g. \">=100%%\" or \"30%%-69%%\"\n",
+                        ast->nodes[n].damage.from, ast->nodes[n].damage.to, (int)SYMBOL_DAMAGE_STEP);
+                    return -1;
+                }
+                break;
+
+            case AST_TIMING:
+                /* Symbols only know how many frames passed since the previous symbol */
+                if (ast->nodes[n].timing.rel_to >= 0)
+                {
+                    log_err("Timing relative to a statement other than the previous one is not supported\n");
+                    return -1;
+                }
+                if (ast->nodes[n].timing.start < 0 || ast->nodes[n].timing.end > SYMBOL_FRAMES_BUCKETS - 2)
+                {
+                    log_err("Timing f%d-%d is not supported. Timings can be at most f%d\n",
+                        ast->nodes[n].timing.start, ast->nodes[n].timing.end, SYMBOL_FRAMES_BUCKETS - 2);
+                    return -1;
+                }
+                break;
+
+            default: break;
+        }
+
+    return 0;
+}
+
+/*
+ * A chain of damage nodes is a union of damage ranges, e.g. "0xa >30% <20%".
+ * Returns the first node in the chain that is not a damage node.
+ */
+static int
+qualifier_push_damage(struct vec* qstack, const struct ast* ast, int n)
+{
+    struct vec options;
+    struct vec* alts;
+
+    if ((alts = qualifier_push(qstack)) == NULL)
+        return -1;
+
+    vec_init(&options, sizeof(struct qualifier));
+    for (; ast->nodes[n].info.type == AST_DAMAGE; n = ast->nodes[n].damage.child)
+    {
+        if (push_range_qualifiers(&options,
+                symbol_damage_bucket((float)damage_lower(ast->nodes[n].damage.from)),
+                symbol_damage_bucket((float)damage_upper(ast->nodes[n].damage.to)),
+                SYMBOL_DAMAGE_BUCKETS, qualifier_damage) < 0)
+        {
+            goto fail;
+        }
+    }
+
+    if (qualifiers_expand(alts, &options) < 0)
+        goto fail;
+    vec_deinit(&options);
+
+    if (vec_count(alts) == 0)
+    {
+        log_err("Failed to compile AST: Damage ranges contradict each other\n");
+        return -1;
+    }
+
+    return n;
+
+fail:
+    vec_deinit(&options);
+    return -1;
+}
+
+static void
+qualifier_pop(struct vec* qstack)
+{
+    vec_deinit(vec_pop(qstack));
+}
+
+/*
+ * Adds one NFA node per qualifier alternative to a new fragment. Without any
+ * qualifiers this is a single node.
+ */
+static int
+push_qualified_matcher(struct vec* nodes, struct vec* fstack, const struct vec* qstack, struct matcher m)
+{
+    const struct vec* alts = vec_count(qstack) ? vec_back(qstack) : NULL;
+    int i, count = alts ? (int)vec_count(alts) : 1;
+    struct fragment* f = vec_emplace(fstack);
+    if (f == NULL)
+        return -1;
+    fragment_init(f);
+
+    for (i = 0; i != count; ++i)
+    {
+        struct nfa_node* node;
+        int idx = vec_count(nodes);
+        if (vec_push(&f->in, &idx) < 0) return -1;
+        if (vec_push(&f->out, &idx) < 0) return -1;
+
+        if ((node = vec_emplace(nodes)) == NULL) return -1;
+        vec_init(&node->next, sizeof(int));
+        node->matcher = m;
+        if (alts)
+        {
+            const struct qualifier* q = vec_get(alts, i);
+            node->matcher = match_qualify(m, q->symbol, q->mask);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Timing only constrains how a fragment is entered. Every entry node is
+ * cloned once per option, and the clones replace the fragment's inputs. The
+ * original nodes are kept for transitions from within the fragment, so that
+ * edges leading back into it (e.g. loops) stay unconstrained.
+ */
+static int
+qualify_fragment_entry(struct vec* nodes, struct fragment* f, const struct vec* options)
+{
+    struct vec in;
+    vec_init(&in, sizeof(int));
+
+    VEC_FOR_EACH(&f->in, int, idx)
+        int is_out = vec_find(&f->out, idx) != vec_count(&f->out);
+        VEC_FOR_EACH(options, const struct qualifier, option)
+            struct qualifier existing, q;
+            struct nfa_node* node;
+            const struct nfa_node* orig;
+            int clone = vec_count(nodes);
+
+            if ((node = vec_emplace(nodes)) == NULL)
+                goto fail;
+            orig = vec_get(nodes, *idx);
+            vec_init(&node->next, sizeof(int));
+            node->matcher = orig->matcher;
+            if (vec_push_vec(&node->next, &orig->next) < 0)
+                goto fail;
+
+            existing.symbol = orig->matcher.symbol;
+            existing.mask = orig->matcher.mask;
+            if (qualifiers_combine(&q, &existing, option) < 0)
+                continue;  /* The clone is unreachable */
+            node->matcher = match_qualify(orig->matcher, q.symbol, q.mask);
+
+            if (vec_push(&in, &clone) < 0)
+                goto fail;
+            if (is_out && vec_push(&f->out, &clone) < 0)
+                goto fail;
+        VEC_END_EACH
+    VEC_END_EACH
+
+    vec_steal_vector(&f->in, &in);
+    return 0;
+
+fail:
+    vec_deinit(&in);
+    return -1;
+}
+
+/*
+ * In a joint stream the symbols of both fighters are interleaved, so any
+ * number of symbols of the other fighter can come between two steps of an
+ * expression. Every transition into a node gets an alternative path through
+ * a node that loops on the symbols of the fighter the target node does not
+ * belong to. A node needs at most one such loop per fighter.
+ */
+static int
+interleave_fighters(struct vec* nodes)
+{
+    int n, e, count = vec_count(nodes);
+    for (n = 1; n != count; ++n)
+    {
+        int skip[2] = { -1, -1 };
+        int edges = vec_count(&((struct nfa_node*)vec_get(nodes, n))->next);
+        for (e = 0; e != edges; ++e)
+        {
+            struct nfa_node* node = vec_get(nodes, n);
+            int target = *(int*)vec_get(&node->next, e);
+            const struct matcher* m = &((struct nfa_node*)vec_get(nodes, target))->matcher;
+            int fighter = m->symbol.is_op;
+
+            /* Doesn't belong to either fighter, e.g. the wildcard of an inversion */
+            if (!m->mask.is_op)
+                continue;
+
+            if (skip[fighter] < 0)
+            {
+                struct nfa_node* loop;
+                skip[fighter] = vec_count(nodes);
+                if ((loop = vec_emplace(nodes)) == NULL)
+                    return -1;
+                vec_init(&loop->next, sizeof(int));
+                loop->matcher = match_none();
+                loop->matcher.mask.is_op = 1;
+                loop->matcher.symbol.is_op = !fighter;
+                if (vec_push(&loop->next, &skip[fighter]) < 0)
+                    return -1;
+                node = vec_get(nodes, n);
+            }
+
+            if (vec_push(&node->next, &skip[fighter]) < 0)
+                return -1;
+            if (vec_push(&((struct nfa_node*)vec_get(nodes, skip[fighter]))->next, &target) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
 static int
 nfa_compile_recurse(
     const struct ast* ast,
@@ -431,21 +910,8 @@ nfa_compile_recurse(
         } break;
 
         case AST_WILDCARD: {
-            int in, out;
-            struct nfa_node* node;
-            struct fragment* f = vec_emplace(fstack);
-            if (f == NULL)
+            if (push_qualified_matcher(nodes, fstack, qstack, match_wildcard()) < 0)
                 return -1;
-            fragment_init(f);
-
-            in = vec_count(nodes);
-            out = vec_count(nodes);
-            if (vec_push(&f->in, &in) < 0) return -1;
-            if (vec_push(&f->out, &out) < 0) return -1;
-
-            if ((node = vec_emplace(nodes)) == NULL) return -1;
-            vec_init(&node->next, sizeof(int));
-            node->matcher = match_wildcard();
         } break;
 
         case AST_LABEL: {
@@ -454,31 +920,41 @@ nfa_compile_recurse(
         } break;
 
         case AST_MOTION: {
-            struct nfa_node* node;
-            struct fragment* f;
-            int in, out;
-
-            f = vec_emplace(fstack);
-            if (f == NULL)
+            struct matcher m = match_motion(ast->nodes[n].motion.motion, is_inverted);
+            if (push_qualified_matcher(nodes, fstack, qstack, m) < 0)
                 return -1;
-            fragment_init(f);
-
-            in = vec_count(nodes);
-            out = vec_count(nodes);
-            if (vec_push(&f->in, &in) < 0) return -1;
-            if (vec_push(&f->out, &out) < 0) return -1;
-
-            if ((node = vec_emplace(nodes)) == NULL) return -1;
-            vec_init(&node->next, sizeof(int));
-            node->matcher = match_motion(ast->nodes[n].motion.motion, is_inverted);
         } break;
 
         case AST_CONTEXT: {
+            if (qualifier_push_context(qstack, ast->nodes[n].context.flags) < 0) return -1;
             if (nfa_compile_recurse(ast, ast->nodes[n].context.child, nodes, fstack, qstack, is_inverted) < 0) return -1;
+            qualifier_pop(qstack);
         } break;
 
         case AST_TIMING: {
+            struct vec options;
+            int result;
+
             if (nfa_compile_recurse(ast, ast->nodes[n].timing.child, nodes, fstack, qstack, is_inverted) < 0) return -1;
+
+            /* nfa_check_ast() made sure the timing is relative to the previous statement */
+            vec_init(&options, sizeof(struct qualifier));
+            result = push_range_qualifiers(&options,
+                symbol_frames_bucket(ast->nodes[n].timing.start),
+                symbol_frames_bucket(ast->nodes[n].timing.end),
+                SYMBOL_FRAMES_BUCKETS, qualifier_frames);
+            if (result == 0)
+                result = qualify_fragment_entry(nodes, vec_back(fstack), &options);
+            vec_deinit(&options);
+            if (result < 0)
+                return -1;
+        } break;
+
+        case AST_DAMAGE: {
+            int child = qualifier_push_damage(qstack, ast, n);
+            if (child < 0) return -1;
+            if (nfa_compile_recurse(ast, child, nodes, fstack, qstack, is_inverted) < 0) return -1;
+            qualifier_pop(qstack);
         } break;
     }
 
@@ -493,11 +969,15 @@ nfa_compile(struct nfa_graph* nfa, const struct ast* ast)
     struct vec nodes;
     struct nfa_node* entry_node;
     struct fragment* final_fragment;
+    int is_joint = ast->node_count > 0 && ast_references_opponent(ast, 0);
     int ret = -1;
 
+    if (nfa_check_ast(ast) < 0)
+        return -1;
+
     vec_init(&nodes, sizeof(struct nfa_node));
     vec_init(&fragment_stack, sizeof(struct fragment));
-    vec_init(&qualifier_stack, sizeof(uint8_t));
+    vec_init(&qualifier_stack, sizeof(struct vec));
 
     /*
      * The "entry" node is a special node that is not evaluated, but merely
@@ -511,6 +991,18 @@ nfa_compile(struct nfa_graph* nfa, const struct ast* ast)
     vec_init(&entry_node->next, sizeof(int));
     entry_node->matcher = match_none();
 
+    /*
+     * Expressions that reference the opponent run on the joint stream. Steps
+     * without an "op" qualifier must only match our own symbols.
+     */
+    if (is_joint)
+    {
+        struct vec* alts = qualifier_push(&qualifier_stack);
+        if (alts == NULL)
+            goto out;
+        ((struct qualifier*)vec_front(alts))->mask.is_op = 1;
+    }
+
     if (nfa_compile_recurse(ast, 0, &nodes, &fragment_stack, &qualifier_stack, 0) != 0)
         goto out;
 
@@ -535,6 +1027,9 @@ nfa_compile(struct nfa_graph* nfa, const struct ast* ast)
                 }
     VEC_END_EACH
 
+    if (is_joint && interleave_fighters(&nodes) < 0)
+        goto out;
+
     /*
      * Patch in start nodes into the "entry node" we created earlier
      */
@@ -556,6 +1051,9 @@ nfa_compile(struct nfa_graph* nfa, const struct ast* ast)
     ret = 0;
 
 out:
+    VEC_FOR_EACH(&qualifier_stack, struct vec, alts)
+        vec_deinit(alts);
+    VEC_END_EACH
     vec_deinit(&qualifier_stack);
     VEC_FOR_EACH(&fragment_stack, struct fragment, f)
         fragment_deinit(f);
@@ -139,7 +139,7 @@ qual_label
   ;
 timing
   : TIMING '-' NUM ',' stmt label       { $$ = ast_timing(ast, $5, $6, $1, $3, &@$); }
-  | TIMING '-' NUM label                { $$ = ast_timing(ast, $1, $4, $1, $3, &@$); }
+  | TIMING '-' NUM label                { $$ = ast_timing(ast, -1, $4, $1, $3, &@$); }
   | TIMING ',' stmt label               { $$ = ast_timing(ast, $3, $4, $1, -1, &@$); }
   | TIMING label                        { $$ = ast_timing(ast, -1, $2, $1, -1, &@$); }
   | label                               { $$ = $1; }
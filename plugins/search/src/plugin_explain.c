@@ -0,0 +1,186 @@
+#include "search/ast.h"
+#include "search/explain.h"
+#include "search/parser.h"
+#include "search/plugin_ctx.h"
+#include "search/plugin_explain.h"
+#include "search/query_cache.h"
+#include "search/search_index.h"
+
+#include "vh/mem.h"
+#include "vh/str.h"
+
+#include <gtk/gtk.h>
+
+#include <stdio.h>
+
+/*
+ * When explaining is enabled, the worker sends back a report of how the
+ * query was compiled for each fighter and what scanning the streams did.
+ */
+struct explain_batch
+{
+    struct plugin_ctx* ctx;
+    struct str text;
+    int generation;
+    guint source_id;
+};
+
+void
+explain_batch_destroy(struct explain_batch* batch)
+{
+    str_deinit(&batch->text);
+    mem_free(batch);
+}
+
+static gboolean
+on_explain_batch(gpointer user_data)
+{
+    struct explain_batch* batch = user_data;
+    struct plugin_ctx* ctx = batch->ctx;
+
+    pending_remove(ctx, batch->source_id);
+
+    if (batch->generation != g_atomic_int_get(&ctx->generation))
+        return G_SOURCE_REMOVE;
+
+    str_terminate(&batch->text);
+    if (ctx->explain_label)
+        gtk_label_set_text(GTK_LABEL(ctx->explain_label), batch->text.data);
+
+    return G_SOURCE_REMOVE;
+}
+
+struct explain_batch*
+explain_batch_create(struct plugin_ctx* ctx, const struct search_request* req, int loaded, uint64_t load_us)
+{
+    char buf[128];
+    struct explain_batch* batch = mem_alloc(sizeof(struct explain_batch));
+    if (batch == NULL)
+        return NULL;
+
+    batch->ctx = ctx;
+    batch->generation = req->generation;
+    batch->source_id = 0;
+    str_init(&batch->text);
+
+    if (loaded)
+        snprintf(buf, sizeof buf, "\nGame %d: loaded and indexed in %.3f ms\n",
+            req->game_id, (double)load_us / 1000.0);
+    else
+        snprintf(buf, sizeof buf, "\nGame %d: already loaded\n", req->game_id);
+    if (cstr_append(&batch->text, "Query: ") < 0 ||
+        str_append(&batch->text, str_view(req->text)) < 0 ||
+        cstr_append(&batch->text, buf) < 0)
+    {
+        explain_batch_destroy(batch);
+        return NULL;
+    }
+
+    return batch;
+}
+
+/*
+ * The scan compiled the query, so it is taken from the cache. Compiling
+ * converts labels to motions in place, so the labels are reported from a
+ * fresh parse of the text.
+ */
+int
+explain_batch_add_fighter(struct explain_batch* batch, const struct search_request* req, int fighter_idx, const struct scan_profile* profile)
+{
+    struct plugin_ctx* ctx = batch->ctx;
+    struct str* report = &batch->text;
+    struct compiled_query* query;
+    struct ast ast;
+    char buf[64];
+    int result;
+    int fighter_id = request_fighter_id(req, fighter_idx);
+    int opponent_id = request_fighter_id(req, search_index_opponent(&ctx->search.index, fighter_idx));
+
+    query = search_compile(ctx, req, fighter_id, opponent_id);
+    if (query == NULL)
+        return -1;
+
+    snprintf(buf, sizeof buf, "\nFighter %d:\n", fighter_idx + 1);
+    if (cstr_append(report, buf) < 0)
+        return -1;
+
+    if (ast_init(&ast) < 0)
+        return -1;
+    result = ast_copy(&ast, &req->ast);
+    if (result == 0)
+    {
+        mutex_lock(ctx->mutex);
+            result = explain_labels(report, &ast, &ctx->labels, fighter_id, opponent_id);
+        mutex_unlock(ctx->mutex);
+    }
+    ast_deinit(&ast);
+    if (result < 0)
+        return -1;
+
+    if (explain_compiled_query(report, query) < 0)
+        return -1;
+    return explain_scan_profile(report, profile);
+}
+
+void
+explain_batch_post(struct explain_batch* batch, uint64_t total_us)
+{
+    char buf[64];
+    snprintf(buf, sizeof buf, "\nTotal: %.3f ms\n", (double)total_us / 1000.0);
+    if (cstr_append(&batch->text, buf) < 0)
+    {
+        explain_batch_destroy(batch);
+        return;
+    }
+    pending_post(batch->ctx, on_explain_batch, batch,
+        (GDestroyNotify)explain_batch_destroy, &batch->source_id);
+}
+
+/*
+ * Reports how the query was compiled for each fighter, and where the time of
+ * the search went.
+ */
+static void
+on_explain_toggled(GtkCheckButton* self, struct plugin_ctx* ctx)
+{
+    ctx->explain = gtk_check_button_get_active(self);
+    if (ctx->explain_scroll)
+        gtk_widget_set_visible(ctx->explain_scroll, ctx->explain);
+    search_restart(ctx, search_text(ctx));
+}
+
+GtkWidget*
+explain_check_create(struct plugin_ctx* ctx)
+{
+    ctx->explain_check = gtk_check_button_new_with_label("Explain");
+    g_signal_connect(ctx->explain_check, "toggled", G_CALLBACK(on_explain_toggled), ctx);
+    return ctx->explain_check;
+}
+
+GtkWidget*
+explain_view_create(struct plugin_ctx* ctx)
+{
+    ctx->explain_label = gtk_label_new("");
+    gtk_label_set_xalign(GTK_LABEL(ctx->explain_label), 0);
+    gtk_label_set_selectable(GTK_LABEL(ctx->explain_label), TRUE);
+    ctx->explain_scroll = gtk_scrolled_window_new();
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(ctx->explain_scroll), ctx->explain_label);
+    gtk_widget_set_vexpand(ctx->explain_scroll, TRUE);
+    gtk_widget_set_visible(ctx->explain_scroll, ctx->explain);
+    return ctx->explain_scroll;
+}
+
+void
+explain_view_clear(struct plugin_ctx* ctx)
+{
+    if (ctx->explain_label)
+        gtk_label_set_text(GTK_LABEL(ctx->explain_label), "");
+}
+
+void
+explain_ui_destroy(struct plugin_ctx* ctx)
+{
+    ctx->explain_check = NULL;
+    ctx->explain_label = NULL;
+    ctx->explain_scroll = NULL;
+}
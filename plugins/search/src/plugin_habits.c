@@ -0,0 +1,342 @@
+#include "search/habit.h"
+#include "search/plugin_ctx.h"
+#include "search/plugin_habits.h"
+#include "search/search_index.h"
+
+#include "vh/db.h"
+#include "vh/frame_data.h"
+#include "vh/log.h"
+#include "vh/mem.h"
+#include "vh/motion_dict.h"
+#include "vh/str.h"
+
+#include <gtk/gtk.h>
+
+#include <stdio.h>
+
+#define HABIT_TOP_K 20
+
+struct habit_batch
+{
+    struct plugin_ctx* ctx;
+    struct vec habits;  /* struct habit */
+    int generation;
+    int games;
+    int events;
+    guint source_id;
+};
+
+void
+habit_request_init(struct habit_request* req)
+{
+    vec_init(&req->streams, sizeof(struct habit_stream));
+    req->event = HABIT_AFTER_ANYTHING;
+    req->generation = 0;
+}
+
+void
+habit_request_deinit(struct habit_request* req)
+{
+    vec_deinit(&req->streams);
+}
+
+static void
+habit_batch_destroy(struct habit_batch* batch)
+{
+    vec_deinit(&batch->habits);
+    mem_free(batch);
+}
+
+static void
+habits_clear(struct plugin_ctx* ctx)
+{
+    GtkWidget* child;
+    if (ctx->habits == NULL)
+        return;
+    while ((child = gtk_widget_get_first_child(ctx->habits)) != NULL)
+        gtk_list_box_remove(GTK_LIST_BOX(ctx->habits), child);
+}
+
+static void
+habits_append(struct plugin_ctx* ctx, const char* text)
+{
+    GtkWidget* row;
+    if (ctx->habits == NULL)
+        return;
+    row = gtk_label_new(text);
+    gtk_label_set_xalign(GTK_LABEL(row), 0);
+    gtk_list_box_append(GTK_LIST_BOX(ctx->habits), row);
+}
+
+static gboolean
+on_habit_batch(gpointer user_data)
+{
+    struct habit_batch* batch = user_data;
+    struct plugin_ctx* ctx = batch->ctx;
+    struct motion_dict* dict;
+    struct str text, label;
+    char buf[128];
+    int m;
+
+    pending_remove(ctx, batch->source_id);
+
+    if (batch->generation != g_atomic_int_get(&ctx->habit_generation))
+        return G_SOURCE_REMOVE;
+
+    dict = motion_dict_acquire(ctx->dbi, ctx->db);
+
+    str_init(&text);
+    str_init(&label);
+    habits_clear(ctx);
+
+    snprintf(buf, sizeof buf, "%d events in %d games", batch->events, batch->games);
+    habits_append(ctx, buf);
+
+    VEC_FOR_EACH(&batch->habits, const struct habit, h)
+        snprintf(buf, sizeof buf, "%dx (%d%%): ", h->count,
+            batch->events ? h->count * 100 / batch->events : 0);
+        cstr_set(&text, buf);
+        for (m = 0; m != h->length; ++m)
+        {
+            format_motion(&label, dict, ctx->habit_fighter_id, h->motions[m]);
+            if (m != 0)
+                cstr_append(&text, " -> ");
+            str_append(&text, str_view(label));
+        }
+        if (h->sample_count > 0)
+        {
+            snprintf(buf, sizeof buf, " (e.g. game %d, fighter %d, frames %d-%d)",
+                h->samples[0].game_id, h->samples[0].fighter_idx + 1,
+                h->samples[0].frames.start, h->samples[0].frames.end);
+            cstr_append(&text, buf);
+        }
+        str_terminate(&text);
+        habits_append(ctx, text.data);
+    VEC_END_EACH
+
+    str_deinit(&label);
+    str_deinit(&text);
+    if (dict)
+        motion_dict_release(dict);
+    return G_SOURCE_REMOVE;
+}
+
+static int
+habit_is_stale(struct plugin_ctx* ctx, const struct habit_request* req)
+{
+    return g_atomic_int_get(&ctx->habit_generation) != req->generation;
+}
+
+/*
+ * The streams are ordered by game, so every game is loaded once even if
+ * several of its fighters match. The game currently being searched is left
+ * alone, as are the index structures of the search.
+ */
+void
+habit_execute(struct plugin_ctx* ctx, const struct habit_request* req)
+{
+    struct frame_data fdata;
+    struct search_index index;
+    struct habit_miner miner;
+    struct habit_batch* batch;
+    int game_id = -1;
+    int loaded = 0;
+
+    if (habit_miner_init(&miner, req->event) < 0)
+        return;
+    frame_data_init(&fdata);
+    search_index_init(&index);
+
+    batch = mem_alloc(sizeof(struct habit_batch));
+    if (batch == NULL)
+        goto alloc_batch_failed;
+    batch->ctx = ctx;
+    batch->generation = req->generation;
+    batch->games = 0;
+    vec_init(&batch->habits, sizeof(struct habit));
+
+    VEC_FOR_EACH(&req->streams, const struct habit_stream, stream)
+        if (habit_is_stale(ctx, req))
+            goto cancelled;
+
+        if (stream->game_id != game_id)
+        {
+            game_id = stream->game_id;
+            search_index_clear(&index);
+            frame_data_clear(&fdata);
+            loaded = frame_data_load(&fdata, game_id) == 0 &&
+                search_index_build(&index, &fdata, -1) == 0;
+            if (loaded)
+                batch->games++;
+        }
+
+        if (!loaded || stream->fighter_idx >= search_index_fighter_count(&index))
+            continue;
+        if (habit_miner_add(&miner, &index, game_id, stream->fighter_idx) < 0)
+            goto fail;
+    VEC_END_EACH
+
+    if (habit_miner_rank(&miner, &batch->habits, HABIT_TOP_K) < 0)
+        goto fail;
+    batch->events = miner.events;
+    pending_post(ctx, on_habit_batch, batch,
+        (GDestroyNotify)habit_batch_destroy, &batch->source_id);
+    goto done;
+
+fail:
+    log_err("Failed to mine habits\n");
+cancelled:
+    habit_batch_destroy(batch);
+done:
+alloc_batch_failed:
+    search_index_deinit(&index);
+    frame_data_deinit(&fdata);
+    habit_miner_deinit(&miner);
+}
+
+static int
+on_habit_stream(int game_id, int fighter_idx, void* user_data)
+{
+    struct vec* streams = user_data;
+    struct habit_stream* stream = vec_emplace(streams);
+    if (stream == NULL)
+        return -1;
+    stream->game_id = game_id;
+    stream->fighter_idx = fighter_idx;
+    return 0;
+}
+
+enum habit_scope
+{
+    HABIT_SCOPE_PLAYER,
+    HABIT_SCOPE_FIGHTER,
+    HABIT_SCOPE_MATCHUP
+};
+
+/*
+ * Mines the habits of one of the players of the current game. Depending on
+ * the scope, only games where the player used the same fighter, or the same
+ * fighter against the same opposing fighter, are included.
+ */
+static void
+on_find_habits(GtkWidget* self, struct plugin_ctx* ctx)
+{
+    struct vec streams;
+    int fighter_idx = gtk_combo_box_get_active(GTK_COMBO_BOX(ctx->habit_player));
+    int event = gtk_combo_box_get_active(GTK_COMBO_BOX(ctx->habit_event));
+    int scope = gtk_combo_box_get_active(GTK_COMBO_BOX(ctx->habit_scope));
+    int person_id, fighter_id = -1, opponent_fighter_id = -1;
+
+    /* Invalidates results that are still being mined */
+    g_atomic_int_inc(&ctx->habit_generation);
+    habits_clear(ctx);
+
+    if (fighter_idx < 0 || fighter_idx >= (int)vec_count(&ctx->person_ids) ||
+        fighter_idx >= (int)vec_count(&ctx->fighter_ids))
+        return;
+    if (event < 0 || event >= HABIT_EVENT_COUNT)
+        event = HABIT_AFTER_ANYTHING;
+
+    person_id = *(int*)vec_get(&ctx->person_ids, fighter_idx);
+    ctx->habit_fighter_id = *(int*)vec_get(&ctx->fighter_ids, fighter_idx);
+    if (scope >= HABIT_SCOPE_FIGHTER)
+        fighter_id = ctx->habit_fighter_id;
+    /* The opposing fighter is only well defined in 1v1 */
+    if (scope >= HABIT_SCOPE_MATCHUP && vec_count(&ctx->fighter_ids) == 2)
+        opponent_fighter_id = *(int*)vec_get(&ctx->fighter_ids, 1 - fighter_idx);
+
+    vec_init(&streams, sizeof(struct habit_stream));
+    if (ctx->dbi->habit.find_streams(ctx->db, person_id, fighter_id, opponent_fighter_id, on_habit_stream, &streams) < 0)
+    {
+        vec_deinit(&streams);
+        habits_append(ctx, "Failed to look up games");
+        return;
+    }
+
+    habits_append(ctx, "Mining...");
+    mutex_lock(ctx->mutex);
+        vec_steal_vector(&ctx->habit_request.streams, &streams);
+        ctx->habit_request.event = (enum habit_event)event;
+        ctx->habit_request.generation = g_atomic_int_get(&ctx->habit_generation);
+        ctx->habit_pending = 1;
+        cond_signal(ctx->cond);
+    mutex_unlock(ctx->mutex);
+}
+
+void
+habit_player_list_reset(struct plugin_ctx* ctx)
+{
+    if (ctx->habit_player)
+        gtk_combo_box_text_remove_all(GTK_COMBO_BOX_TEXT(ctx->habit_player));
+}
+
+void
+habit_player_list_append(struct plugin_ctx* ctx, const char* player, const char* fighter)
+{
+    char buf[128];
+    if (ctx->habit_player == NULL)
+        return;
+    snprintf(buf, sizeof buf, "%s (%s)", player, fighter);
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(ctx->habit_player), buf);
+}
+
+void
+habit_player_list_select_first(struct plugin_ctx* ctx)
+{
+    if (ctx->habit_player)
+        gtk_combo_box_set_active(GTK_COMBO_BOX(ctx->habit_player), 0);
+}
+
+GtkWidget*
+habits_ui_create(struct plugin_ctx* ctx)
+{
+    GtkWidget* label;
+    GtkWidget* button;
+    GtkWidget* scroll;
+    GtkWidget* hbox;
+    GtkWidget* vbox;
+    int event;
+
+    ctx->habit_player = gtk_combo_box_text_new();
+    ctx->habit_event = gtk_combo_box_text_new();
+    for (event = 0; event != HABIT_EVENT_COUNT; ++event)
+        gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(ctx->habit_event), habit_event_name(event));
+    gtk_combo_box_set_active(GTK_COMBO_BOX(ctx->habit_event), 0);
+    ctx->habit_scope = gtk_combo_box_text_new();
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(ctx->habit_scope), "Any fighter");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(ctx->habit_scope), "Same fighter");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(ctx->habit_scope), "Same matchup");
+    gtk_combo_box_set_active(GTK_COMBO_BOX(ctx->habit_scope), 0);
+    button = gtk_button_new_with_label("Find habits");
+    g_signal_connect(button, "clicked", G_CALLBACK(on_find_habits), ctx);
+    hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
+    gtk_box_append(GTK_BOX(hbox), ctx->habit_player);
+    gtk_box_append(GTK_BOX(hbox), ctx->habit_event);
+    gtk_box_append(GTK_BOX(hbox), ctx->habit_scope);
+    gtk_box_append(GTK_BOX(hbox), button);
+
+    ctx->habits = gtk_list_box_new();
+    scroll = gtk_scrolled_window_new();
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scroll), ctx->habits);
+    gtk_widget_set_vexpand(scroll, TRUE);
+
+    label = gtk_label_new("Habits:");
+    gtk_label_set_xalign(GTK_LABEL(label), 0);
+
+    vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 8);
+    gtk_box_append(GTK_BOX(vbox), label);
+    gtk_box_append(GTK_BOX(vbox), hbox);
+    gtk_box_append(GTK_BOX(vbox), scroll);
+    gtk_widget_set_vexpand(vbox, TRUE);
+
+    return vbox;
+}
+
+void
+habits_ui_destroy(struct plugin_ctx* ctx)
+{
+    ctx->habit_player = NULL;
+    ctx->habit_event = NULL;
+    ctx->habit_scope = NULL;
+    ctx->habits = NULL;
+}
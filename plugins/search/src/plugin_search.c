@@ -1,23 +1,45 @@
 #include "search/asm.h"
 #include "search/ast.h"
+#include "search/ast_ops.h"
 #include "search/ast_post.h"
-#include "search/dfa.h"
-#include "search/search_index.h"
+#include "search/bitnfa.h"
+#include "search/explain.h"
+#include "search/fm_library.h"
+#include "search/hit_stats.h"
+#include "search/label_map.h"
+#include "search/minhash.h"
 #include "search/nfa.h"
+#include "search/search_index.h"
 #include "search/parser.h"
+#include "search/plugin_ctx.h"
+#include "search/plugin_explain.h"
+#include "search/plugin_habits.h"
+#include "search/plugin_similar.h"
+#include "search/plugin_stats.h"
+#include "search/plugin_tags.h"
+#include "search/prefilter.h"
+#include "search/query_cache.h"
+#include "search/result_store.h"
 
 #include "vh/db.h"
+#include "vh/db_worker.h"
 #include "vh/frame_data.h"
+#include "vh/fs.h"
 #include "vh/hm.h"
+#include "vh/init.h"
 #include "vh/log.h"
 #include "vh/mem.h"
+#include "vh/motion_dict.h"
 #include "vh/plugin.h"
 #include "vh/str.h"
+#include "vh/thread.h"
+#include "vh/time.h"
 
 #include <gtk/gtk.h>
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <inttypes.h>
 
 struct sequence
@@ -58,7 +80,7 @@ sequence_from_search_result(struct sequence* seq, const union symbol* symbols, s
             {
                 uint64_t motion2 = ((uint64_t)symbols[s2].motionh << 32) | symbols[s2].motionl;
                 struct strlist_str* label2 = hm_find(&ast->merged_labels, &motion2);
-                if (label2 && str_equal(
+                if (label2 && symbols[s2].is_op == symbols[s1].is_op && str_equal(
                     strlist_to_view(&ast->labels, *label1),
                     strlist_to_view(&ast->labels, *label2)))
                     s1++;
@@ -74,212 +96,1672 @@ sequence_from_search_result(struct sequence* seq, const union symbol* symbols, s
 #define SEQ_FOR_EACH(s, var) VEC_FOR_EACH(&(s)->idxs, int, seq_##var) int var = *seq_##var;
 #define SEQ_END_EACH VEC_END_EACH
 
-struct search
-{
-    struct parser parser;
-    struct ast ast;
-    struct asm_dfa assembly;
-    struct frame_data fdata;
-    struct search_index index;
+#define SEARCH_DEBOUNCE_MS 150
+#define SEARCH_BATCH_SIZE  64
+#define SEARCH_SCAN_CHUNK  1024  /* Symbols scanned between checks for a newer search */
 
-    int fighter_id;
+/* Library-wide index of literal motion sequences, saved next to the database */
+#define FM_INDEX_FILE_NAME "search.fmi"
+
+struct search_batch
+{
+    struct plugin_ctx* ctx;
+    struct vec ranges;     /* struct range */
+    struct vec distances;  /* int - edit distance of each range */
+    struct vec bands;      /* uint64_t - MINHASH_BANDS buckets of each range */
+    struct vec lengths;    /* int - number of motions in the sequence of each range */
+    struct vec motions;  /* uint64_t - sequences of all ranges, back to back */
+    struct vec owners;   /* char - 1 if the motion at the same index is the opponent's */
+    int generation;
     int fighter_idx;
+    int fighter_id;
+    int opponent_idx;
+    int opponent_id;
+    guint source_id;
+    unsigned is_joint : 1;
+    unsigned is_last : 1;
 };
 
-static void
+int
+search_request_init(struct search_request* req)
+{
+    if (ast_init(&req->ast) < 0)
+        return -1;
+    str_init(&req->text);
+    vec_init(&req->fighter_ids, sizeof(int));
+    vec_init(&req->stored, sizeof(struct fuzzy_range));
+    vec_init(&req->stored_counts, sizeof(int));
+    req->ast_hash = 0;
+    req->frame_data_stamp = 0;
+    req->labels_revision = 0;
+    req->game_id = -1;
+    req->target_idx = -1;
+    req->max_edits = 0;
+    req->generation = 0;
+    req->is_joint = 0;
+    req->needs_buckets = 0;
+    req->explain = 0;
+    req->is_stored = 0;
+    req->uses_labels = 0;
+    return 0;
+}
+
+void
+search_request_deinit(struct search_request* req)
+{
+    vec_deinit(&req->stored_counts);
+    vec_deinit(&req->stored);
+    vec_deinit(&req->fighter_ids);
+    str_deinit(&req->text);
+    ast_deinit(&req->ast);
+}
+
+static int
+ast_uses_labels(const struct ast* ast)
+{
+    int n;
+    for (n = 0; n != ast->node_count; ++n)
+        if (ast->nodes[n].info.type == AST_LABEL)
+            return 1;
+    return 0;
+}
+
+/*
+ * Queries that only differ in how they are grouped share the same hash, so
+ * they share compiled queries and stored results.
+ */
+int
+search_request_set_ast(struct search_request* req, const struct ast* ast)
+{
+    if (ast_copy(&req->ast, ast) < 0)
+        return -1;
+    ast_normalize(&req->ast);
+    req->ast_hash = ast_hash(&req->ast, 0);
+    req->is_joint = ast_references_opponent(&req->ast, 0);
+    req->uses_labels = ast_uses_labels(&req->ast);
+    return 0;
+}
+
+static int
 search_init(struct search* search)
 {
-    parser_init(&search->parser);
-    ast_init(&search->ast);
+    if (fm_library_init(&search->fm) < 0)
+        return -1;
+    str_init(&search->fm_file_name);
+    query_cache_init(&search->cache, QUERY_CACHE_DEFAULT_CAPACITY);
     frame_data_init(&search->fdata);
     search_index_init(&search->index);
-    asm_init(&search->assembly);
-
-    search->fighter_id = -1;
-    search->fighter_idx = -1;
+    search->labels_revision = 0;
+    search->game_id = -1;
+    search->target_idx = -1;
+    return 0;
 }
 
 static void
 search_deinit(struct search* search)
 {
-    asm_deinit(&search->assembly);
+    str_deinit(&search->fm_file_name);
+    fm_library_deinit(&search->fm);
     search_index_deinit(&search->index);
     frame_data_deinit(&search->fdata);
-    ast_deinit(&search->ast);
-    parser_deinit(&search->parser);
+    query_cache_deinit(&search->cache);
 }
 
 static int
-search_compile(struct search* search, const char* text, struct db_interface* dbi, struct db* db)
+search_is_stale(struct plugin_ctx* ctx, const struct search_request* req)
+{
+    return g_atomic_int_get(&ctx->generation) != req->generation;
+}
+
+int
+resolve_labels(struct plugin_ctx* ctx, struct ast* ast, int fighter_id, int opponent_id)
 {
-    struct nfa_graph nfa;
-    struct dfa_table dfa;
-    int fighter_id = 8;
+    int result;
+    mutex_lock(ctx->mutex);
+        result = ast_post_labels_to_motions(ast, &ctx->labels, fighter_id, opponent_id);
+    mutex_unlock(ctx->mutex);
+    return result;
+}
+
+static int
+compile_query(struct compiled_query* query, struct plugin_ctx* ctx, const struct search_request* req, int fighter_id, int opponent_id)
+{
+    uint64_t t = time_get_us();
+
+    /* Labels are resolved in place, so each entry needs its own copy of the AST */
+    if (ast_copy(&query->ast, &req->ast) < 0)
+        return -1;
+    if (resolve_labels(ctx, &query->ast, fighter_id, opponent_id) < 0)
+        return -1;
+    query->stats.stage_us[QUERY_STAGE_LABELS] = time_get_us() - t;
+    ast_export_dot(&query->ast, "ast.dot");
+
+    return compiled_query_build(query, req->max_edits);
+}
 
-    ast_clear(&search->ast);
+/*
+ * Returns the query compiled for the specified fighter. The request was parsed
+ * and normalized once when it was submitted, so this is only a lookup unless
+ * the query is seen for a fighter for the first time. Queries with steps of
+ * the opponent also depend on who the opponent is. Approximate searches are
+ * only supported by the bit-parallel NFA, so it is compiled from the cached
+ * AST if the query was previously compiled to a DFA.
+ */
+struct compiled_query*
+search_compile(struct plugin_ctx* ctx, const struct search_request* req, int fighter_id, int opponent_id)
+{
+    struct query_cache* cache = &ctx->search.cache;
+    struct compiled_query* query;
 
-    if (parser_parse(&search->parser, text, &search->ast) < 0)
-        goto parse_failed;
-    ast_export_dot(&search->ast, "ast.dot");
+    /* Cached queries may have been compiled with labels that were edited since */
+    if (ctx->search.labels_revision != req->labels_revision)
+    {
+        query_cache_clear(cache);
+        ctx->search.labels_revision = req->labels_revision;
+    }
 
-    if (ast_post_labels_to_motions(&search->ast, dbi, db, fighter_id) < 0)
-        goto patch_motions_failed;
-    ast_export_dot(&search->ast, "ast.dot");
+    if (!req->is_joint)
+        opponent_id = -1;
+    query = query_cache_find(cache, req->ast_hash, &req->ast, fighter_id, opponent_id);
+    if (query)
+    {
+        if (req->max_edits > 0 && !bitnfa_is_compiled(&query->bitnfa))
+        {
+            uint64_t t = time_get_us();
+            if (bitnfa_compile(&query->bitnfa, &query->ast) < 0)
+                return NULL;
+            query->stats.bitnfa_positions = query->bitnfa.positions;
+            query->stats.stage_us[QUERY_STAGE_BITNFA] = time_get_us() - t;
+        }
+        return query;
+    }
 
-    nfa_init(&nfa);
-    if (nfa_compile(&nfa, &search->ast))
-        goto nfa_compile_failed;
-    nfa_export_dot(&nfa, "nfa.dot");
+    query = query_cache_insert(cache, req->ast_hash, &req->ast, fighter_id, opponent_id);
+    if (query == NULL)
+        return NULL;
+    if (compile_query(query, ctx, req, fighter_id, opponent_id) < 0)
+    {
+        query_cache_erase(cache, query);
+        return NULL;
+    }
 
-    dfa_init(&dfa);
-    if (dfa_from_nfa(&dfa, &nfa))
-        goto dfa_compile_failed;
-    dfa_export_dot(&dfa, "dfa.dot");
+    return query;
+}
 
-    if (asm_compile(&search->assembly, &dfa))
-        goto assemble_failed;
+/*
+ * Finding matches one at a time gives the same results as running
+ * find_all() on the window, but allows the scan to be aborted between
+ * matches.
+ */
+struct fuzzy_range
+search_find_first(const struct compiled_query* query, const union symbol* symbols, struct range window, int max_edits)
+{
+    return search_find_first_before(query, symbols, window, window.end, max_edits);
+}
 
-    dfa_deinit(&dfa);
-    nfa_deinit(&nfa);
+struct fuzzy_range
+search_find_first_before(const struct compiled_query* query, const union symbol* symbols, struct range window, int start_end, int max_edits)
+{
+    struct fuzzy_range match;
+    if (max_edits > 0)
+        return bitnfa_find_first_fuzzy_before(&query->bitnfa, symbols, window, start_end, max_edits);
 
+    match.range = asm_is_compiled(&query->assembly) ?
+        asm_find_first_before(&query->assembly, symbols, window, start_end) :
+        bitnfa_find_first_before(&query->bitnfa, symbols, window, start_end);
+    match.distance = 0;
+    return match;
+}
+
+static struct search_batch*
+search_batch_create(
+        struct plugin_ctx* ctx,
+        const struct search_request* req,
+        int fighter_idx, int fighter_id,
+        int opponent_idx, int opponent_id)
+{
+    struct search_batch* batch = mem_alloc(sizeof(struct search_batch));
+    if (batch == NULL)
+        return NULL;
+
+    batch->ctx = ctx;
+    vec_init(&batch->ranges, sizeof(struct range));
+    vec_init(&batch->distances, sizeof(int));
+    vec_init(&batch->bands, sizeof(uint64_t));
+    vec_init(&batch->lengths, sizeof(int));
+    vec_init(&batch->motions, sizeof(uint64_t));
+    vec_init(&batch->owners, sizeof(char));
+    batch->generation = req->generation;
+    batch->fighter_idx = fighter_idx;
+    batch->fighter_id = fighter_id;
+    batch->opponent_idx = opponent_idx;
+    batch->opponent_id = opponent_id;
+    batch->source_id = 0;
+    batch->is_joint = req->is_joint;
+    batch->is_last = 0;
+
+    return batch;
+}
+
+static void
+search_batch_destroy(struct search_batch* batch)
+{
+    vec_deinit(&batch->owners);
+    vec_deinit(&batch->motions);
+    vec_deinit(&batch->lengths);
+    vec_deinit(&batch->bands);
+    vec_deinit(&batch->distances);
+    vec_deinit(&batch->ranges);
+    mem_free(batch);
+}
+
+static int
+search_batch_add(struct search_batch* batch, const union symbol* symbols, struct fuzzy_range match, const struct ast* ast)
+{
+    struct sequence seq;
+    struct minhash mh;
+    int length;
+
+    /* The symbols belong to the worker, so copy the motions over */
+    sequence_init(&seq);
+    if (sequence_from_search_result(&seq, symbols, match.range, ast) < 0)
+        goto fail;
+    SEQ_FOR_EACH(&seq, i)
+        uint64_t motion = ((uint64_t)symbols[i].motionh << 32) | symbols[i].motionl;
+        char is_op = symbols[i].is_op;
+        if (vec_push(&batch->motions, &motion) < 0)
+            goto fail;
+        if (vec_push(&batch->owners, &is_op) < 0)
+            goto fail;
+    SEQ_END_EACH
+
+    length = vec_count(&seq.idxs);
+    if (vec_push(&batch->lengths, &length) < 0)
+        goto fail;
+    if (vec_push(&batch->ranges, &match.range) < 0)
+        goto fail;
+    if (vec_push(&batch->distances, &match.distance) < 0)
+        goto fail;
+
+    /* Lets the user look for similar situations in other games */
+    if (vec_resize(&batch->bands, vec_count(&batch->bands) + MINHASH_BANDS) < 0)
+        goto fail;
+    minhash_compute(&mh, symbols, match.range);
+    minhash_bands(vec_get_back(&batch->bands, MINHASH_BANDS), &mh);
+
+    sequence_deinit(&seq);
     return 0;
 
-    assemble_failed      : dfa_deinit(&dfa);
-    dfa_compile_failed   : nfa_deinit(&nfa);
-    nfa_compile_failed   :
-    patch_motions_failed :
-    parse_failed         : return -1;
+fail:
+    sequence_deinit(&seq);
+    return -1;
 }
 
+/*
+ * Matches on a fighter's own stream only contain the fighter's motions. To
+ * report what both fighters were doing, the motions the opponent went through
+ * during the same frames are added to the most recent result.
+ */
 static int
-on_notation_label(const char* label, void* user_data)
+search_batch_add_opponent(struct search_batch* batch, const struct search_index* index, struct range range)
+{
+    const union symbol* symbols = search_index_symbols(index, batch->opponent_idx);
+    struct range frames;
+    int i, first, last;
+
+    if (search_index_symbol_count(index, batch->opponent_idx) == 0)
+        return 0;
+
+    frames = search_index_frames(index, batch->fighter_idx, range);
+    first = search_index_find_frame(index, batch->opponent_idx, frames.start);
+    last = search_index_find_frame(index, batch->opponent_idx, frames.end - 1);
+
+    for (i = first; i <= last; ++i)
+    {
+        uint64_t motion = ((uint64_t)symbols[i].motionh << 32) | symbols[i].motionl;
+        char is_op = 1;
+        if (vec_push(&batch->motions, &motion) < 0)
+            return -1;
+        if (vec_push(&batch->owners, &is_op) < 0)
+            return -1;
+    }
+    *(int*)vec_back(&batch->lengths) += last - first + 1;
+
+    return 0;
+}
+
+void
+format_motion(struct str* label, const struct motion_dict* dict, int fighter_id, uint64_t motion)
+{
+    int usage_id = 1;  /* hard coded for now to "NOTATION" */
+    const char* name = dict ? motion_dict_label(dict, fighter_id, motion, usage_id) : NULL;
+    str_clear(label);
+    if (name)
+        cstr_set(label, name);
+    else
+        str_fmt(label, "0x%" PRIx64, motion);
+}
+
+static void
+results_clear(struct plugin_ctx* ctx)
+{
+    GtkWidget* child;
+    ctx->result_count = 0;
+    vec_clear(&ctx->result_bands);
+    if (ctx->results == NULL)
+        return;
+    while ((child = gtk_widget_get_first_child(ctx->results)) != NULL)
+        gtk_list_box_remove(GTK_LIST_BOX(ctx->results), child);
+}
+
+void
+status_set(struct plugin_ctx* ctx, const char* text)
+{
+    if (ctx->status)
+        gtk_label_set_text(GTK_LABEL(ctx->status), text);
+}
+
+static void
+results_append(struct plugin_ctx* ctx, const struct search_batch* batch)
+{
+    struct str text, label;
+    struct motion_dict* dict = motion_dict_acquire(ctx->dbi, ctx->db);
+    const uint64_t* motion = vec_data(&batch->motions);
+    const char* owner = vec_data(&batch->owners);
+    int r, m;
+
+    str_init(&text);
+    str_init(&label);
+    for (r = 0; r != (int)vec_count(&batch->ranges); ++r)
+    {
+        const struct range* range = vec_get(&batch->ranges, r);
+        int distance = *(int*)vec_get(&batch->distances, r);
+        int length = *(int*)vec_get(&batch->lengths, r);
+
+        /*
+         * Results of joint queries list the motions of both fighters in the
+         * order they happened. Otherwise, the fighter's own motions are
+         * followed by what the opponent did in the meantime.
+         */
+        str_clear(&text);
+        str_fmt(&text, "Fighter %d vs %d, %d-%d: ",
+            batch->fighter_idx + 1, batch->opponent_idx + 1, range->start, range->end);
+        for (m = 0; m != length; ++m, ++motion, ++owner)
+        {
+            format_motion(&label, dict, *owner ? batch->opponent_id : batch->fighter_id, *motion);
+            if (m != 0)
+                cstr_append(&text, batch->is_joint || owner[0] == owner[-1] ? " -> " : " (vs ");
+            if (batch->is_joint && *owner)
+                cstr_append(&text, "op ");
+            str_append(&text, str_view(label));
+        }
+        if (!batch->is_joint && length > 0 && owner[-1])
+            cstr_append(&text, ")");
+        if (distance > 0)
+        {
+            char buf[32];
+            snprintf(buf, sizeof buf, " [%d edit%s]", distance, distance == 1 ? "" : "s");
+            cstr_append(&text, buf);
+        }
+        str_terminate(&text);
+
+        if (ctx->results)
+        {
+            GtkWidget* row = gtk_label_new(text.data);
+            gtk_label_set_xalign(GTK_LABEL(row), 0);
+            gtk_list_box_append(GTK_LIST_BOX(ctx->results), row);
+        }
+        ctx->result_count++;
+    }
+    str_deinit(&label);
+    str_deinit(&text);
+    if (dict)
+        motion_dict_release(dict);
+
+    /* Row N of the list uses buckets [N*MINHASH_BANDS, (N+1)*MINHASH_BANDS) */
+    if (vec_push_vec(&ctx->result_bands, &batch->bands) < 0)
+        log_err("Failed to store similarity buckets of results\n");
+}
+
+void
+pending_remove(struct plugin_ctx* ctx, guint source_id)
 {
-    struct str* str = user_data;
-    cstr_set(str, label);
+    vec_idx idx;
+    mutex_lock(ctx->mutex);
+        idx = vec_find(&ctx->pending_batches, &source_id);
+        if (idx < (vec_idx)vec_count(&ctx->pending_batches))
+            vec_erase_index(&ctx->pending_batches, idx);
+    mutex_unlock(ctx->mutex);
+}
+
+/*
+ * The mutex is held while adding the source so that the callback can't run
+ * before its ID is stored.
+ */
+int
+pending_post(struct plugin_ctx* ctx, GSourceFunc func, void* data, GDestroyNotify destroy, guint* source_id)
+{
+    mutex_lock(ctx->mutex);
+        *source_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, func, data, destroy);
+        if (vec_push(&ctx->pending_batches, source_id) < 0)
+        {
+            g_source_remove(*source_id);
+            mutex_unlock(ctx->mutex);
+            return -1;
+        }
+    mutex_unlock(ctx->mutex);
+
     return 0;
 }
 
+static gboolean
+on_search_batch(gpointer user_data)
+{
+    struct search_batch* batch = user_data;
+    struct plugin_ctx* ctx = batch->ctx;
+    struct str status;
+
+    pending_remove(ctx, batch->source_id);
+
+    if (batch->generation != g_atomic_int_get(&ctx->generation))
+        return G_SOURCE_REMOVE;
+
+    results_append(ctx, batch);
+
+    str_init(&status);
+    str_fmt(&status, batch->is_last ? "%d matches" : "Searching... %d matches", ctx->result_count);
+    str_terminate(&status);
+    status_set(ctx, status.data);
+    str_deinit(&status);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Called from the worker thread. Takes ownership of the batch */
+static int
+search_batch_post(struct search_batch* batch)
+{
+    return pending_post(batch->ctx, on_search_batch, batch,
+        (GDestroyNotify)search_batch_destroy, &batch->source_id);
+}
+
+/*
+ * The matches of a game are stored once every fighter was scanned, so that
+ * searching the game again with the same query doesn't have to scan. The
+ * main thread checks that they are still current, and the db worker writes
+ * them to the database.
+ */
+struct store_batch
+{
+    struct plugin_ctx* ctx;
+    struct vec matches;  /* struct fuzzy_range - matches of all fighters, back to back */
+    struct vec counts;   /* int - number of matches of each fighter */
+    uint64_t query_hash;
+    uint64_t frame_data_stamp;
+    int game_id;
+    int target_idx;
+    int max_edits;
+    int generation;
+    int uses_labels;
+    guint source_id;
+};
+
+static struct store_batch*
+store_batch_create(struct plugin_ctx* ctx, const struct search_request* req)
+{
+    struct store_batch* batch = mem_alloc(sizeof(struct store_batch));
+    if (batch == NULL)
+        return NULL;
+
+    batch->ctx = ctx;
+    vec_init(&batch->matches, sizeof(struct fuzzy_range));
+    vec_init(&batch->counts, sizeof(int));
+    batch->query_hash = req->ast_hash;
+    batch->frame_data_stamp = req->frame_data_stamp;
+    batch->game_id = req->game_id;
+    batch->target_idx = req->target_idx;
+    batch->max_edits = req->max_edits;
+    batch->generation = req->generation;
+    batch->uses_labels = req->uses_labels;
+    batch->source_id = 0;
+
+    return batch;
+}
+
 static void
-search_run(struct search* search, struct db_interface* dbi, struct db* db)
+store_batch_destroy(struct store_batch* batch)
+{
+    vec_deinit(&batch->counts);
+    vec_deinit(&batch->matches);
+    mem_free(batch);
+}
+
+/* Runs on the db worker */
+static int
+store_results(struct db_interface* dbi, struct db* db, void* user)
+{
+    struct store_batch* batch = user;
+    const struct fuzzy_range* matches = vec_data(&batch->matches);
+    struct result_key key;
+
+    key.query_hash = batch->query_hash;
+    key.game_id = batch->game_id;
+    key.target_idx = batch->target_idx;
+    key.max_edits = batch->max_edits;
+
+    if (dbi->transaction.begin(db) < 0)
+        goto fail;
+    for (key.fighter_idx = 0; key.fighter_idx != (int)vec_count(&batch->counts); ++key.fighter_idx)
+    {
+        int count = *(int*)vec_get(&batch->counts, key.fighter_idx);
+        if (result_store_save(dbi, db, &key, batch->frame_data_stamp, batch->uses_labels, matches, count) < 0)
+        {
+            dbi->transaction.rollback(db);
+            goto fail;
+        }
+        matches += count;
+    }
+    dbi->transaction.commit(db);
+    return 0;
+
+fail:
+    log_err("Failed to store search results of game %d\n", batch->game_id);
+    return -1;
+}
+
+static gboolean
+on_store_batch(gpointer user_data)
+{
+    struct store_batch* batch = user_data;
+    struct plugin_ctx* ctx = batch->ctx;
+    struct store_batch* store;
+
+    pending_remove(ctx, batch->source_id);
+
+    /* The labels may have changed since the matches were found */
+    if (batch->generation != g_atomic_int_get(&ctx->generation))
+        return G_SOURCE_REMOVE;
+
+    /* The source destroys the batch, so the db worker gets its own */
+    store = mem_alloc(sizeof(struct store_batch));
+    if (store == NULL)
+        return G_SOURCE_REMOVE;
+    *store = *batch;
+    vec_init(&batch->matches, sizeof(struct fuzzy_range));
+    vec_init(&batch->counts, sizeof(int));
+
+    if (ctx->dbwi->submit(ctx->dbw, DB_WORKER_LOW, store_results, NULL, store,
+            (void(*)(void*))store_batch_destroy) < 0)
+    {
+        store_batch_destroy(store);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Called from the worker thread. Takes ownership of the batch */
+static int
+store_batch_post(struct store_batch* batch)
 {
+    return pending_post(batch->ctx, on_store_batch, batch,
+        (GDestroyNotify)store_batch_destroy, &batch->source_id);
+}
+
+int
+literal_pattern(const struct ast* ast, int n, struct vec* pattern)
+{
+    const union ast_node* node = &ast->nodes[n];
+    switch (node->info.type)
+    {
+        case AST_MOTION: {
+            union symbol s = symbol_make(node->motion.motion);
+            return vec_push(pattern, &s) < 0 ? -1 : 1;
+        }
+        case AST_STATEMENT: {
+            int result = literal_pattern(ast, node->statement.child, pattern);
+            if (result <= 0)
+                return result;
+            return literal_pattern(ast, node->statement.next, pattern);
+        }
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Literal sequences are looked up in the library-wide FM-index instead of
+ * being searched for, if the game was indexed with its current frame data.
+ * Locating visits every occurrence in the library, so this is only worth it
+ * if there are fewer of those than symbols in the fighter's stream. The
+ * located ranges are used as candidate windows and the compiled query still
+ * confirms each match.
+ *
+ * Returns 1 if "located" holds every range that can match, 0 if the stream
+ * has to be scanned instead, or negative on error.
+ */
+static int
+search_locate_literal(struct plugin_ctx* ctx, const struct search_request* req, const struct ast* ast, int fighter_idx, struct vec* located)
+{
+    const struct fm_library* fm = &ctx->search.fm;
+    struct vec pattern;
+    struct vec matches;
+    int count, length, result;
+
+    if (req->is_joint || req->max_edits > 0 || ast->node_count == 0)
+        return 0;
+    if (req->frame_data_stamp == 0 || !fm_library_has_game(fm, req->game_id, req->frame_data_stamp))
+        return 0;
+
+    vec_init(&pattern, sizeof(union symbol));
+    vec_init(&matches, sizeof(struct fm_match));
+    result = literal_pattern(ast, 0, &pattern);
+    if (result <= 0)
+        goto out;
+
+    result = 0;
+    length = (int)vec_count(&pattern);
+    count = fm_library_count(fm, vec_data(&pattern), length);
+    if (count > search_index_symbol_count(&ctx->search.index, fighter_idx))
+        goto out;
+
+    result = -1;
+    if (fm_library_locate(&matches, fm, vec_data(&pattern), length) < 0)
+        goto out;
+    VEC_FOR_EACH(&matches, const struct fm_match, m)
+        struct range r;
+        if (m->game_id != req->game_id || m->fighter_idx != fighter_idx)
+            continue;
+        r.start = m->start;
+        r.end = m->start + length;
+        if (vec_push(located, &r) < 0)
+            goto out;
+    VEC_END_EACH
+    result = 1;
+
+out:
+    vec_deinit(&matches);
+    vec_deinit(&pattern);
+    return result;
+}
+
+/* Returns the next located range that doesn't overlap a previous match */
+static struct range
+next_located_window(const struct vec* located, int* next, struct range window)
+{
+    struct range empty = { 0, 0 };
+    while (*next < (int)vec_count(located))
+    {
+        const struct range* r = vec_get(located, (*next)++);
+        if (r->start >= window.start)
+            return *r;
+    }
+    return empty;
+}
+
+int
+request_fighter_id(const struct search_request* req, int fighter_idx)
+{
+    return fighter_idx >= 0 && fighter_idx < (int)vec_count(&req->fighter_ids) ?
+        *(int*)vec_get(&req->fighter_ids, fighter_idx) : -1;
+}
+
+/*
+ * Adds a match to the batch, and sends the batch to the UI once it is full.
+ * The batch is replaced with a new, empty one in that case.
+ */
+static int
+search_batch_add_match(
+        struct search_batch** batch,
+        const struct search_request* req,
+        const struct search_index* index,
+        const union symbol* symbols,
+        struct fuzzy_range match,
+        const struct ast* ast)
+{
+    struct search_batch* full = *batch;
+
+    if (search_batch_add(full, symbols, match, ast) < 0)
+        return -1;
+    if (!req->is_joint && search_batch_add_opponent(full, index, match.range) < 0)
+        return -1;
+
+    /* Stream results to the UI as they come in */
+    if (vec_count(&full->ranges) < SEARCH_BATCH_SIZE)
+        return 0;
+    *batch = search_batch_create(full->ctx, req,
+        full->fighter_idx, full->fighter_id, full->opponent_idx, full->opponent_id);
+    if (*batch == NULL)
+    {
+        *batch = full;
+        return -1;
+    }
+    return search_batch_post(full);
+}
+
+/* Returns the offset of the fighter's matches in req->stored */
+static int
+stored_matches_offset(const struct search_request* req, int fighter_idx)
+{
+    int i, offset = 0;
+    for (i = 0; i != fighter_idx; ++i)
+        offset += *(int*)vec_get(&req->stored_counts, i);
+    return offset;
+}
+
+/*
+ * Reports the matches of one fighter. If the matches were stored by a
+ * previous search, they are reported without scanning. Otherwise, the
+ * matches that were found are also appended to "found" (if not NULL), so that
+ * they can be stored.
+ */
+static int
+search_scan_fighter(struct plugin_ctx* ctx, const struct search_request* req, int fighter_idx, struct scan_profile* profile, struct vec* found)
+{
+    const struct search_index* index = &ctx->search.index;
     const union symbol* symbols;
+    struct compiled_query* query;
+    struct search_batch* batch;
     struct range window;
-    struct vec results;
-    struct sequence seq;
-    struct str label;
-    int i;
-    int fighter_id = 8;
-    int usage_id = 1;  /* hard coded for now to "NOTATION" */
+    struct vec located;  /* struct range */
+    int use_index, next_located = 0;
+    int fighter_id = *(int*)vec_get(&req->fighter_ids, fighter_idx);
+    int opponent_idx = search_index_opponent(index, fighter_idx);
+    int opponent_id = request_fighter_id(req, opponent_idx);
+    uint64_t t;
+
+    /* The compiled AST is still needed to extract the sequence of each match */
+    query = search_compile(ctx, req, fighter_id, opponent_id);
+    if (query == NULL)
+        return -1;
+    t = time_get_us();
+
+    vec_init(&located, sizeof(struct range));
+    use_index = req->is_stored ? 0 :
+        search_locate_literal(ctx, req, &query->ast, fighter_idx, &located);
+    if (use_index < 0)
+        goto locate_failed;
+
+    batch = search_batch_create(ctx, req, fighter_idx, fighter_id, opponent_idx, opponent_id);
+    if (batch == NULL)
+        goto create_batch_failed;
 
-    if (!search_index_has_data(&search->index))
+    /*
+     * Only the windows around occurrences of a motion required by the
+     * expression need to be searched. If there is no such motion, the
+     * prefilter returns the entire window. Approximate matches don't
+     * necessarily contain the motion, so they always search everything.
+     * Literal sequences skip straight to the ranges the FM-index located.
+     */
+    if (req->is_joint)
+    {
+        symbols = search_index_joint_symbols(index, fighter_idx);
+        window = search_index_joint_range(index, fighter_idx);
+    }
+    else
+    {
+        symbols = search_index_symbols(index, fighter_idx);
+        window = search_index_range(index, fighter_idx);
+    }
+    profile->method = req->is_stored ? SCAN_STORED : use_index ? SCAN_FM_INDEX :
+        req->max_edits <= 0 && prefilter_is_active(&query->prefilter) ? SCAN_PREFILTER : SCAN_FULL;
+    profile->symbols = window.end - window.start;
+
+    if (req->is_stored)
+    {
+        int i, first = stored_matches_offset(req, fighter_idx);
+        int count = *(int*)vec_get(&req->stored_counts, fighter_idx);
+        for (i = first; i != first + count; ++i)
+        {
+            const struct fuzzy_range* match = vec_get(&req->stored, i);
+            if (search_is_stale(ctx, req))
+                goto cancelled;
+            /* Guards against a stream that is shorter than when the matches were stored */
+            if (match->range.start < window.start || match->range.end > window.end)
+                goto fail;
+            if (search_batch_add_match(&batch, req, index, symbols, *match, &query->ast) < 0)
+                goto fail;
+            profile->matches++;
+        }
+    }
+    else for (;;)
+    {
+        struct range candidate =
+            use_index ? next_located_window(&located, &next_located, window) :
+            req->max_edits > 0 ? window :
+            prefilter_next_window(&query->prefilter, symbols, window);
+        struct range remaining = candidate;
+        if (candidate.start == candidate.end)
+            break;
+        profile->windows++;
+        profile->window_symbols += candidate.end - candidate.start;
+
+        while (remaining.start != remaining.end)
+        {
+            struct fuzzy_range match;
+            int chunk_end;
+            if (search_is_stale(ctx, req))
+                goto cancelled;
+
+            /*
+             * Long stretches without a match would otherwise be scanned in
+             * one go. Only the starts are limited to the chunk, matches can
+             * still extend past it.
+             */
+            chunk_end = remaining.end - remaining.start > SEARCH_SCAN_CHUNK ?
+                remaining.start + SEARCH_SCAN_CHUNK : remaining.end;
+            match = search_find_first_before(query, symbols, remaining, chunk_end, req->max_edits);
+            if (match.range.start == match.range.end)
+            {
+                remaining.start = chunk_end;
+                continue;
+            }
+            if (found && vec_push(found, &match) < 0)
+                goto fail;
+            if (search_batch_add_match(&batch, req, index, symbols, match, &query->ast) < 0)
+                goto fail;
+            profile->matches++;
+
+            remaining.start = match.range.end;
+        }
+
+        window.start = candidate.end;
+    }
+    profile->scan_us = time_get_us() - t;
+
+    vec_deinit(&located);
+    if (vec_count(&batch->ranges) == 0)
+    {
+        search_batch_destroy(batch);
+        return 0;
+    }
+    return search_batch_post(batch);
+
+    cancelled           : search_batch_destroy(batch); vec_deinit(&located); return 0;
+    fail                : search_batch_destroy(batch);
+    create_batch_failed :
+    locate_failed       : vec_deinit(&located); return -1;
+}
+
+static void
+search_execute(struct plugin_ctx* ctx, const struct search_request* req)
+{
+    struct search* search = &ctx->search;
+    struct search_batch* done;
+    struct explain_batch* explain = NULL;
+    struct store_batch* store = NULL;
+    struct scan_profile profile;
+    uint64_t t = time_get_us();
+    uint64_t load_us = 0;
+    int fighter_idx, loaded = 0;
+
+    if (search->game_id != req->game_id)
+    {
+        search_index_clear(&search->index);
+        frame_data_clear(&search->fdata);
+        search->game_id = -1;
+
+        if (req->game_id < 0)
+            goto finished;
+        if (frame_data_load(&search->fdata, req->game_id) != 0)
+            goto finished;
+        if (search_index_build(&search->index, &search->fdata, req->target_idx) < 0)
+            goto finished;
+        search->game_id = req->game_id;
+        search->target_idx = req->target_idx;
+        load_us = time_get_us() - t;
+        loaded = 1;
+
+        if (req->needs_buckets && similar_post_buckets(ctx, &search->index, req->game_id) < 0)
+            log_err("Failed to add game %d to the similarity index\n", req->game_id);
+    }
+    else if (search->game_id >= 0 && search->target_idx != req->target_idx)
+    {
+        /* Only the pairing of fighters changed, the frame data can be reused */
+        search_index_clear(&search->index);
+        if (search_index_build(&search->index, &search->fdata, req->target_idx) < 0)
+        {
+            frame_data_clear(&search->fdata);
+            search->game_id = -1;
+            goto finished;
+        }
+        search->target_idx = req->target_idx;
+        load_us = time_get_us() - t;
+        loaded = 1;
+    }
+
+    if (req->text.len == 0)
         return;
-    if (!asm_is_compiled(&search->assembly))
+
+    if (req->explain)
+    {
+        explain = explain_batch_create(ctx, req, loaded, load_us);
+        if (explain == NULL)
+            goto finished;
+    }
+
+    if (!req->is_stored && req->frame_data_stamp != 0)
+        store = store_batch_create(ctx, req);
+
+    for (fighter_idx = 0; fighter_idx != search_index_fighter_count(&search->index); ++fighter_idx)
+    {
+        vec_size found = store ? vec_count(&store->matches) : 0;
+
+        if (search_is_stale(ctx, req))
+            goto cancelled;
+
+        /* The game may be missing player information */
+        if (fighter_idx >= (int)vec_count(&req->fighter_ids))
+            break;
+
+        scan_profile_init(&profile);
+        if (search_scan_fighter(ctx, req, fighter_idx, &profile, store ? &store->matches : NULL) < 0)
+        {
+            log_err("Search failed on fighter %d\n", fighter_idx);
+            if (store)
+                store_batch_destroy(store);
+            store = NULL;
+            continue;
+        }
+        if (explain && explain_batch_add_fighter(explain, req, fighter_idx, &profile) < 0)
+            log_err("Failed to explain the search on fighter %d\n", fighter_idx);
+
+        if (store)
+        {
+            int count = (int)(vec_count(&store->matches) - found);
+            if (vec_push(&store->counts, &count) < 0)
+            {
+                store_batch_destroy(store);
+                store = NULL;
+            }
+        }
+    }
+
+    /* Only complete results are stored, so every fighter must have been searched */
+    if (store && !search_is_stale(ctx, req) &&
+        (int)vec_count(&store->counts) == search_index_fighter_count(&search->index))
+    {
+        store_batch_post(store);
+        store = NULL;
+    }
+
+finished:
+    /* Lets the UI know the search is complete */
+    if (req->text.len == 0)
         return;
+    done = search_batch_create(ctx, req, -1, -1, -1, -1);
+    if (done == NULL)
+        goto cancelled;
+    done->is_last = 1;
+    search_batch_post(done);
 
-    vec_init(&results, sizeof(struct range));
-    str_init(&label);
+    if (explain)
+    {
+        explain_batch_post(explain, time_get_us() - t);
+        explain = NULL;
+    }
 
-    symbols = search_index_symbols(&search->index, 0);
-    window = search_index_range(&search->index, 0);
-    asm_find_all(&results, &search->assembly, symbols, window);
+cancelled:
+    if (store)
+        store_batch_destroy(store);
+    if (explain)
+        explain_batch_destroy(explain);
+}
 
-    fprintf(stderr, "Matching Ranges (window %d-%d):\n", window.start, window.end);
-    VEC_FOR_EACH(&results, struct range, r)
-        fprintf(stderr, "  %d-%d: ", r->start, r->end);
-        for (i = r->start; i != r->end; ++i)
+struct fm_index_missing
+{
+    struct plugin_ctx* ctx;
+    guint source_id;
+};
+
+static void
+fm_index_missing_destroy(struct fm_index_missing* missing)
+{
+    mem_free(missing);
+}
+
+static gboolean
+on_fm_index_missing(gpointer user_data)
+{
+    struct fm_index_missing* missing = user_data;
+    struct plugin_ctx* ctx = missing->ctx;
+
+    pending_remove(ctx, missing->source_id);
+    if (ctx->dbi->game_tag.queue_all(ctx->db) < 0)
+        log_err("Failed to queue games for the FM-index\n");
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Games are added to the FM-index when they are tagged, which happens to
+ * every game after it was imported (see plugin_tags.c). If there is no index
+ * yet, e.g. because the library was imported before the index existed, every
+ * game is queued again. The tag poll picks them up from there.
+ */
+static void
+search_load_fm_index(struct plugin_ctx* ctx)
+{
+    struct fm_index_missing* missing;
+
+    if (fm_library_load(&ctx->search.fm, ctx->search.fm_file_name.data) < 0)
+        log_err("Failed to load the FM-index, it will be rebuilt\n");
+    if (fm_library_game_count(&ctx->search.fm) > 0)
+        return;
+
+    missing = mem_alloc(sizeof(struct fm_index_missing));
+    if (missing == NULL)
+        return;
+    missing->ctx = ctx;
+    pending_post(ctx, on_fm_index_missing, missing,
+        (GDestroyNotify)fm_index_missing_destroy, &missing->source_id);
+}
+
+static void*
+search_worker(void* args)
+{
+    struct plugin_ctx* ctx = args;
+    struct search_request req, tmp;
+    struct habit_request habit_req, habit_tmp;
+    struct stats_request stats_req, stats_tmp;
+    struct tag_request tag_req, tag_tmp;
+
+    vh_threadlocal_init();
+    if (search_request_init(&req) < 0)
+    {
+        vh_threadlocal_deinit();
+        return NULL;
+    }
+    habit_request_init(&habit_req);
+    tag_request_init(&tag_req);
+    if (stats_request_init(&stats_req) < 0)
+    {
+        tag_request_deinit(&tag_req);
+        habit_request_deinit(&habit_req);
+        search_request_deinit(&req);
+        vh_threadlocal_deinit();
+        return NULL;
+    }
+
+    search_load_fm_index(ctx);
+
+    mutex_lock(ctx->mutex);
+    for (;;)
+    {
+        while (!ctx->request_pending && !ctx->habit_pending && !ctx->stats_pending &&
+               !ctx->tag_pending && !ctx->request_stop)
+            cond_wait(ctx->cond, ctx->mutex);
+        if (ctx->request_stop)
+            break;
+
+        if (ctx->habit_pending)
         {
-            uint64_t motion = ((uint64_t)symbols[i].motionh << 32) | symbols[i].motionl;
-            str_clear(&label);
-            if (dbi->motion_label.to_notation_label(db, fighter_id, motion, usage_id, on_notation_label, &label) != 0)
-                str_fmt(&label, "0x%" PRIx64, motion);
-            if (i != r->start) fprintf(stderr, " -> ");
-            fprintf(stderr, "%.*s", label.len, label.data);
+            habit_tmp = ctx->habit_request;
+            ctx->habit_request = habit_req;
+            habit_req = habit_tmp;
+            ctx->habit_pending = 0;
+            mutex_unlock(ctx->mutex);
+
+            habit_execute(ctx, &habit_req);
+
+            mutex_lock(ctx->mutex);
+            continue;
         }
-        fprintf(stderr, "\n");
-    VEC_END_EACH
 
-    sequence_init(&seq);
-    fprintf(stderr, "Matching Sequences (window %d-%d):\n", window.start, window.end);
-    VEC_FOR_EACH(&results, struct range, r)
-        fprintf(stderr, "  %d-%d: ", r->start, r->end);
-        sequence_from_search_result(&seq, symbols, *r, &search->ast);
-        SEQ_FOR_EACH(&seq, i)
-            uint64_t motion = ((uint64_t)symbols[i].motionh << 32) | symbols[i].motionl;
-            str_clear(&label);
-            if (dbi->motion_label.to_notation_label(db, fighter_id, motion, usage_id, on_notation_label, &label) != 0)
-                str_fmt(&label, "0x%" PRIx64, motion);
-            if (i != seq_first(&seq)) fprintf(stderr, " -> ");
-            fprintf(stderr, "%.*s", label.len, label.data);
-        SEQ_END_EACH
-        fprintf(stderr, "\n");
-        sequence_clear(&seq);
-    VEC_END_EACH
-    sequence_deinit(&seq);
+        if (ctx->stats_pending)
+        {
+            stats_tmp = ctx->stats_request;
+            ctx->stats_request = stats_req;
+            stats_req = stats_tmp;
+            ctx->stats_pending = 0;
+            mutex_unlock(ctx->mutex);
 
-    str_deinit(&label);
-    vec_deinit(&results);
+            stats_execute(ctx, &stats_req);
+
+            mutex_lock(ctx->mutex);
+            continue;
+        }
+
+        /* Tagging runs last, only when nobody is waiting for results */
+        if (!ctx->request_pending)
+        {
+            tag_tmp = ctx->tag_request;
+            ctx->tag_request = tag_req;
+            tag_req = tag_tmp;
+            ctx->tag_pending = 0;
+            mutex_unlock(ctx->mutex);
+
+            tag_execute(ctx, &tag_req);
+
+            mutex_lock(ctx->mutex);
+            continue;
+        }
+
+        /* Take the request and leave our previous buffers behind */
+        tmp = ctx->request;
+        ctx->request = req;
+        req = tmp;
+        ctx->request_pending = 0;
+        mutex_unlock(ctx->mutex);
+
+        search_execute(ctx, &req);
+
+        mutex_lock(ctx->mutex);
+    }
+    mutex_unlock(ctx->mutex);
+
+    stats_request_deinit(&stats_req);
+    tag_request_deinit(&tag_req);
+    habit_request_deinit(&habit_req);
+    search_request_deinit(&req);
+    vh_threadlocal_deinit();
+
+    return NULL;
 }
 
-struct plugin_ctx
+/*
+ * Loads the matches a previous search with the same query stored for each
+ * fighter of the game. Unless every fighter has a valid set, the game is
+ * scanned again.
+ * \return Returns 1 if all sets were loaded, 0 if not, or negative on error.
+ */
+static int
+search_load_stored(struct db_interface* dbi, struct db* db, struct search_request* req)
 {
-    struct db_interface* dbi;
-    struct db* db;
+    struct result_key key;
+    int result;
+
+    vec_clear(&req->stored);
+    vec_clear(&req->stored_counts);
+    if (req->frame_data_stamp == 0)
+        return 0;
+
+    key.query_hash = req->ast_hash;
+    key.game_id = req->game_id;
+    key.target_idx = req->target_idx;
+    key.max_edits = req->max_edits;
+    for (key.fighter_idx = 0; key.fighter_idx != (int)vec_count(&req->fighter_ids); ++key.fighter_idx)
+    {
+        int count = (int)vec_count(&req->stored);
+        result = result_store_load(dbi, db, &key, req->frame_data_stamp, &req->stored);
+        if (result <= 0)
+            goto not_stored;
+
+        count = (int)vec_count(&req->stored) - count;
+        if (vec_push(&req->stored_counts, &count) < 0)
+        {
+            result = -1;
+            goto not_stored;
+        }
+    }
+
+    return 1;
+
+not_stored:
+    vec_clear(&req->stored);
+    vec_clear(&req->stored_counts);
+    return result;
+}
 
-    struct search search;
+/*
+ * Everything a search needs from the database and the disk is looked up on
+ * the db worker, before the request is handed to the search worker.
+ */
+struct search_prepare
+{
+    struct plugin_ctx* ctx;
+    struct search_request req;
 };
 
+static void
+search_prepare_destroy(void* user)
+{
+    struct search_prepare* prep = user;
+    search_request_deinit(&prep->req);
+    mem_free(prep);
+}
+
+/*
+ * Runs on the db worker. Resolves labels for all fighters of the game and
+ * loads the matches a previous search stored.
+ */
+static int
+search_prepare(struct db_interface* dbi, struct db* db, void* user)
+{
+    struct search_prepare* prep = user;
+    struct plugin_ctx* ctx = prep->ctx;
+    struct search_request* req = &prep->req;
+    struct motion_dict* dict;
+    int result = 0;
+
+    if (req->game_id >= 0 && frame_data_stamp(req->game_id, &req->frame_data_stamp) < 0)
+        req->frame_data_stamp = 0;
+
+    /* The dictionary is acquired first, so that the lock isn't held while querying */
+    dict = motion_dict_acquire(dbi, db);
+    if (dict == NULL)
+        return -1;
+    mutex_lock(ctx->mutex);
+        VEC_FOR_EACH(&req->fighter_ids, int, fighter_id)
+            if ((result = label_map_resolve_ast_dict(&ctx->labels, dict, *fighter_id, &req->ast)) < 0)
+                break;
+        VEC_END_EACH
+        req->labels_revision = ctx->labels.revision;
+    mutex_unlock(ctx->mutex);
+    motion_dict_release(dict);
+    if (result < 0)
+        return -1;
+
+    if (ctx->dbwi->is_cancelled(ctx->dbw))
+        return 0;
+    req->is_stored = search_load_stored(dbi, db, req) > 0;
+
+    return 0;
+}
+
+/* Hands the request over to the search worker. Any previous request that
+ * hasn't started yet is replaced. */
+static void
+search_post(struct plugin_ctx* ctx, struct search_request* req)
+{
+    struct search_request tmp;
+    mutex_lock(ctx->mutex);
+        tmp = ctx->request;
+        ctx->request = *req;
+        *req = tmp;
+        ctx->request_pending = 1;
+        cond_signal(ctx->cond);
+    mutex_unlock(ctx->mutex);
+}
+
+static void
+on_search_prepared(int result, void* user)
+{
+    struct search_prepare* prep = user;
+    struct plugin_ctx* ctx = prep->ctx;
+
+    ctx->prepare_request = 0;
+    if (result < 0)
+    {
+        status_set(ctx, "Search failed");
+        return;
+    }
+
+    search_post(ctx, &prep->req);
+}
+
+/*
+ * Parses the query and submits it to the db worker to prepare it. An empty
+ * query only loads the game, so it is handed to the search worker directly.
+ */
+static int
+search_submit(struct plugin_ctx* ctx, const char* text)
+{
+    struct search_prepare* prep;
+
+    /* The previous query is stale */
+    ctx->dbwi->cancel(ctx->dbw, ctx->prepare_request);
+    ctx->prepare_request = 0;
+
+    if (*text)
+    {
+        ast_clear(&ctx->ast);
+        if (parser_parse(&ctx->parser, text, &ctx->ast) < 0)
+            return -1;
+        if (nfa_check_ast(&ctx->ast) < 0)
+            return -1;
+        ast_export_dot(&ctx->ast, "ast.dot");
+    }
+
+    prep = mem_alloc(sizeof(struct search_prepare));
+    if (prep == NULL)
+        goto alloc_failed;
+    prep->ctx = ctx;
+    if (search_request_init(&prep->req) < 0)
+        goto init_request_failed;
+
+    if (cstr_set(&prep->req.text, text) < 0)
+        goto fail;
+    str_terminate(&prep->req.text);
+    if (vec_push_vec(&prep->req.fighter_ids, &ctx->fighter_ids) < 0)
+        goto fail;
+    prep->req.game_id = ctx->game_id;
+    prep->req.target_idx = ctx->target_idx;
+    prep->req.max_edits = ctx->max_edits;
+    prep->req.needs_buckets = ctx->needs_buckets;
+    prep->req.explain = ctx->explain;
+    prep->req.generation = g_atomic_int_get(&ctx->generation);
+
+    if (*text == 0)
+    {
+        search_post(ctx, &prep->req);
+        search_prepare_destroy(prep);
+        return 0;
+    }
+
+    if (search_request_set_ast(&prep->req, &ctx->ast) < 0)
+        goto fail;
+
+    ctx->prepare_request = ctx->dbwi->submit(ctx->dbw, DB_WORKER_HIGH,
+        search_prepare, on_search_prepared, prep, search_prepare_destroy);
+    if (ctx->prepare_request < 0)
+    {
+        ctx->prepare_request = 0;
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    search_request_deinit(&prep->req);
+init_request_failed:
+    mem_free(prep);
+alloc_failed:
+    return -1;
+}
+
+void
+search_restart(struct plugin_ctx* ctx, const char* text)
+{
+    /* Invalidates all running searches and results that are in flight */
+    g_atomic_int_inc(&ctx->generation);
+    results_clear(ctx);
+    explain_view_clear(ctx);
+
+    if (search_submit(ctx, text) < 0)
+        status_set(ctx, "Invalid search");
+    else if (*text && ctx->game_id >= 0)
+        status_set(ctx, "Searching...");
+    else
+        status_set(ctx, "");
+}
+
+/* The FM-index belongs to the library, so it is saved next to the database */
+static int
+search_fm_file_name(struct str* file_name, struct db_interface* dbi, struct db* db)
+{
+    struct path path;
+    path_init(&path);
+    if (dbi->connection.file_name(db, &path.str) < 0)
+        goto fail;
+    path_dirname(&path);
+    if (path_join(&path, cstr_view(FM_INDEX_FILE_NAME)) < 0)
+        goto fail;
+    if (str_set(file_name, path_view(path)) < 0)
+        goto fail;
+    str_terminate(file_name);
+    path_deinit(&path);
+    return 0;
+
+fail:
+    path_deinit(&path);
+    return -1;
+}
+
 static struct plugin_ctx*
-create(GTypeModule* type_module, struct db_interface* dbi, struct db* db)
+create(
+        GTypeModule* type_module,
+        struct db_interface* dbi, struct db* db,
+        struct db_worker_interface* dbwi, struct db_worker* dbw)
 {
     struct plugin_ctx* ctx = mem_alloc(sizeof(struct plugin_ctx));
+    if (ctx == NULL)
+        goto alloc_ctx_failed;
     memset(ctx, 0, sizeof *ctx);
 
     ctx->dbi = dbi;
     ctx->db = db;
+    ctx->dbwi = dbwi;
+    ctx->dbw = dbw;
 
-    search_init(&ctx->search);
+    if (ast_init(&ctx->ast) < 0)
+        goto ast_init_failed;
+    if (label_map_init(&ctx->labels) < 0)
+        goto label_map_init_failed;
+    if (search_init(&ctx->search) < 0)
+        goto search_init_failed;
+    if (search_fm_file_name(&ctx->search.fm_file_name, dbi, db) < 0)
+        goto fm_file_name_failed;
+    if (hit_stats_init(&ctx->stats) < 0)
+        goto stats_init_failed;
+    if (stats_request_init(&ctx->stats_request) < 0)
+        goto stats_request_init_failed;
+    if (search_request_init(&ctx->request) < 0)
+        goto request_init_failed;
+
+    parser_init(&ctx->parser);
+    vec_init(&ctx->fighter_ids, sizeof(int));
+    vec_init(&ctx->pending_batches, sizeof(guint));
+    vec_init(&ctx->result_bands, sizeof(uint64_t));
+    vec_init(&ctx->person_ids, sizeof(int));
+    habit_request_init(&ctx->habit_request);
+    tag_request_init(&ctx->tag_request);
+    mutex_init(&ctx->mutex);
+    cond_init(&ctx->cond);
+    ctx->game_id = -1;
+    ctx->target_idx = -1;
+
+    if (thread_start(&ctx->worker, search_worker, ctx) < 0)
+        goto start_worker_failed;
+
+    /* Picks up games that were imported since */
+    tag_poll_start(ctx);
 
     return ctx;
+
+start_worker_failed:
+    cond_deinit(ctx->cond);
+    mutex_deinit(ctx->mutex);
+    tag_request_deinit(&ctx->tag_request);
+    habit_request_deinit(&ctx->habit_request);
+    vec_deinit(&ctx->person_ids);
+    vec_deinit(&ctx->result_bands);
+    vec_deinit(&ctx->pending_batches);
+    vec_deinit(&ctx->fighter_ids);
+    parser_deinit(&ctx->parser);
+    search_request_deinit(&ctx->request);
+request_init_failed:
+    stats_request_deinit(&ctx->stats_request);
+stats_request_init_failed:
+    hit_stats_deinit(&ctx->stats);
+stats_init_failed:
+fm_file_name_failed:
+    search_deinit(&ctx->search);
+search_init_failed:
+    label_map_deinit(&ctx->labels);
+label_map_init_failed:
+    ast_deinit(&ctx->ast);
+ast_init_failed:
+    mem_free(ctx);
+alloc_ctx_failed:
+    return NULL;
 }
 
 static void
 destroy(GTypeModule* type_module, struct plugin_ctx* ctx)
 {
+    if (ctx->debounce_source)
+        g_source_remove(ctx->debounce_source);
+    tag_poll_stop(ctx);
+
+    g_atomic_int_inc(&ctx->generation);
+    g_atomic_int_inc(&ctx->habit_generation);
+    g_atomic_int_inc(&ctx->stats_generation);
+    mutex_lock(ctx->mutex);
+        ctx->request_stop = 1;
+        cond_signal(ctx->cond);
+    mutex_unlock(ctx->mutex);
+    thread_join(ctx->worker, 0);
+
+    /* Batches that were posted but never dispatched still reference ctx */
+    VEC_FOR_EACH(&ctx->pending_batches, guint, source_id)
+        g_source_remove(*source_id);
+    VEC_END_EACH
+
+    cond_deinit(ctx->cond);
+    mutex_deinit(ctx->mutex);
     search_deinit(&ctx->search);
+    stats_request_deinit(&ctx->stats_request);
+    hit_stats_deinit(&ctx->stats);
+    tag_request_deinit(&ctx->tag_request);
+    habit_request_deinit(&ctx->habit_request);
+    search_request_deinit(&ctx->request);
+    vec_deinit(&ctx->person_ids);
+    vec_deinit(&ctx->result_bands);
+    vec_deinit(&ctx->pending_batches);
+    vec_deinit(&ctx->fighter_ids);
+    parser_deinit(&ctx->parser);
+    label_map_deinit(&ctx->labels);
+    ast_deinit(&ctx->ast);
     mem_free(ctx);
 }
 
-static int
+const char*
+search_text(struct plugin_ctx* ctx)
+{
+    return ctx->entry ? gtk_editable_get_text(GTK_EDITABLE(ctx->entry)) : "";
+}
+
+static gboolean
+on_search_debounce(gpointer user_data)
+{
+    struct plugin_ctx* ctx = user_data;
+    ctx->debounce_source = 0;
+    search_restart(ctx, gtk_editable_get_text(GTK_EDITABLE(ctx->entry)));
+    return G_SOURCE_REMOVE;
+}
+
+static void
 on_search_text_changed(GtkEntry* self, struct plugin_ctx* ctx)
 {
-    const char* text = gtk_editable_get_text(GTK_EDITABLE(self));
-    if (search_compile(&ctx->search, text, ctx->dbi, ctx->db) < 0)
-        return -1;
+    /* Abort the running search right away, but wait for the user to stop
+     * typing before starting a new one */
+    g_atomic_int_inc(&ctx->generation);
+    if (ctx->debounce_source)
+        g_source_remove(ctx->debounce_source);
+    ctx->debounce_source = g_timeout_add(SEARCH_DEBOUNCE_MS, on_search_debounce, ctx);
+}
 
-    search_run(&ctx->search, ctx->dbi, ctx->db);
-    return 0;
+static void
+opponent_list_reset(struct plugin_ctx* ctx)
+{
+    ctx->target_idx = -1;
+    if (ctx->opponent == NULL)
+        return;
+    gtk_combo_box_text_remove_all(GTK_COMBO_BOX_TEXT(ctx->opponent));
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(ctx->opponent), "Opponent: Automatic");
+    gtk_combo_box_set_active(GTK_COMBO_BOX(ctx->opponent), 0);
+}
+
+/*
+ * In games with more than two fighters, the user chooses which fighter
+ * everybody else is matched against. The first entry pairs up fighters
+ * automatically.
+ */
+static void
+on_opponent_changed(GtkComboBox* self, struct plugin_ctx* ctx)
+{
+    int target_idx = gtk_combo_box_get_active(self) - 1;
+    if (target_idx < -1)
+        target_idx = -1;
+    if (target_idx == ctx->target_idx)
+        return;
+
+    ctx->target_idx = target_idx;
+    search_restart(ctx, search_text(ctx));
+}
+
+static void
+on_result_activated(GtkListBox* self, GtkListBoxRow* row, struct plugin_ctx* ctx)
+{
+    int idx = gtk_list_box_row_get_index(row);
+    if (idx < 0 || (idx + 1) * MINHASH_BANDS > (int)vec_count(&ctx->result_bands))
+        return;
+    similar_find(ctx, vec_get(&ctx->result_bands, idx * MINHASH_BANDS));
+}
+
+/*
+ * Players rarely execute a sequence the same way twice. Allowing a few
+ * inserted, missing or different motions finds those too.
+ */
+static void
+on_max_edits_changed(GtkSpinButton* self, struct plugin_ctx* ctx)
+{
+    int max_edits = gtk_spin_button_get_value_as_int(self);
+    if (max_edits == ctx->max_edits)
+        return;
+
+    ctx->max_edits = max_edits;
+    search_restart(ctx, search_text(ctx));
 }
 
 static GtkWidget* ui_center_create(struct plugin_ctx* ctx)
 {
     GtkWidget* search_box;
     GtkWidget* label;
+    GtkWidget* scroll;
     GtkWidget* vbox;
-    
+    GtkWidget* hbox;
+
     search_box = gtk_entry_new();
     g_signal_connect(search_box, "changed", G_CALLBACK(on_search_text_changed), ctx);
 
     label = gtk_label_new("Search:");
     gtk_label_set_xalign(GTK_LABEL(label), 0);
 
+    ctx->opponent = gtk_combo_box_text_new();
+    opponent_list_reset(ctx);
+    g_signal_connect(ctx->opponent, "changed", G_CALLBACK(on_opponent_changed), ctx);
+
+    ctx->max_edits_spin = gtk_spin_button_new_with_range(0, SEARCH_MAX_EDITS, 1);
+    g_signal_connect(ctx->max_edits_spin, "value-changed", G_CALLBACK(on_max_edits_changed), ctx);
+    hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
+    gtk_box_append(GTK_BOX(hbox), gtk_label_new("Max. edits:"));
+    gtk_box_append(GTK_BOX(hbox), ctx->max_edits_spin);
+    gtk_box_append(GTK_BOX(hbox), explain_check_create(ctx));
+
+    ctx->status = gtk_label_new("");
+    gtk_label_set_xalign(GTK_LABEL(ctx->status), 0);
+
+    ctx->results = gtk_list_box_new();
+    g_signal_connect(ctx->results, "row-activated", G_CALLBACK(on_result_activated), ctx);
+    scroll = gtk_scrolled_window_new();
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scroll), ctx->results);
+    gtk_widget_set_vexpand(scroll, TRUE);
+
     vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 8);
     gtk_box_append(GTK_BOX(vbox), label);
     gtk_box_append(GTK_BOX(vbox), search_box);
+    gtk_box_append(GTK_BOX(vbox), ctx->opponent);
+    gtk_box_append(GTK_BOX(vbox), hbox);
+    /* Games where the query matches are tagged with the name */
+    gtk_box_append(GTK_BOX(vbox), tags_ui_create(ctx));
+    gtk_box_append(GTK_BOX(vbox), ctx->status);
+    gtk_box_append(GTK_BOX(vbox), explain_view_create(ctx));
+    gtk_box_append(GTK_BOX(vbox), scroll);
+    /* Activating a result lists similar situations from other games */
+    gtk_box_append(GTK_BOX(vbox), similar_ui_create(ctx));
+    /* Most frequent sequences of a player after an event, across all games */
+    gtk_box_append(GTK_BOX(vbox), habits_ui_create(ctx));
+    /* Hits of the query across all games, grouped by player, matchup or stage */
+    gtk_box_append(GTK_BOX(vbox), stats_ui_create(ctx));
+    ctx->entry = search_box;
 
     return g_object_ref_sink(vbox);
 }
 static void ui_center_destroy(struct plugin_ctx* ctx, GtkWidget* ui)
 {
+    if (ctx->debounce_source)
+        g_source_remove(ctx->debounce_source);
+    ctx->debounce_source = 0;
+    ctx->entry = NULL;
+    ctx->opponent = NULL;
+    ctx->max_edits_spin = NULL;
+    ctx->status = NULL;
+    explain_ui_destroy(ctx);
+    ctx->results = NULL;
+    similar_ui_destroy(ctx);
+    habits_ui_destroy(ctx);
+    stats_ui_destroy(ctx);
+    tags_ui_destroy(ctx);
     g_object_unref(ui);
 }
 
@@ -288,23 +1770,58 @@ static struct ui_pane_interface ui_center = {
     ui_center_destroy
 };
 
-static void select_replays(struct plugin_ctx* ctx, const int* game_ids, int count)
+static int
+on_game_fighter(const char* player, int fighter_id, const char* fighter, void* user_data)
 {
-    search_index_clear(&ctx->search.index);
+    struct plugin_ctx* ctx = user_data;
+    if (ctx->opponent)
+    {
+        char buf[128];
+        snprintf(buf, sizeof buf, "Opponent: %s (%s)", player, fighter);
+        gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(ctx->opponent), buf);
+    }
+    habit_player_list_append(ctx, player, fighter);
+    return vec_push(&ctx->fighter_ids, &fighter_id);
+}
 
-    if (frame_data_load(&ctx->search.fdata, game_ids[0]) != 0)
-        return;
+static int
+on_game_person(int person_id, int fighter_id, void* user_data)
+{
+    struct plugin_ctx* ctx = user_data;
+    (void)fighter_id;
+    return vec_push(&ctx->person_ids, &person_id);
+}
 
-    if (search_index_build(&ctx->search.index, &ctx->search.fdata) < 0)
-        return;
+static void select_replays(struct plugin_ctx* ctx, const int* game_ids, int count)
+{
+    vec_clear(&ctx->fighter_ids);
+    vec_clear(&ctx->person_ids);
+    opponent_list_reset(ctx);
+    habit_player_list_reset(ctx);
+    ctx->game_id = -1;
+
+    /* Labels resolve differently per fighter, so the fighter IDs are needed
+     * to compile queries */
+    if (ctx->dbi->game.get_player_and_fighter_names(ctx->db, game_ids[0], on_game_fighter, ctx) >= 0)
+        ctx->game_id = game_ids[0];
+    if (ctx->game_id >= 0 && ctx->dbi->habit.get_players(ctx->db, ctx->game_id, on_game_person, ctx) < 0)
+        vec_clear(&ctx->person_ids);
+    habit_player_list_select_first(ctx);
+    ctx->needs_buckets = ctx->game_id >= 0 &&
+        ctx->dbi->similarity.has_game(ctx->db, ctx->game_id) == 0;
 
-    search_run(&ctx->search, ctx->dbi, ctx->db);
+    /* The worker loads the frame data and builds the index */
+    search_restart(ctx, search_text(ctx));
 }
 
 static void clear_replays(struct plugin_ctx* ctx)
 {
-    search_index_clear(&ctx->search.index);
-    frame_data_clear(&ctx->search.fdata);
+    vec_clear(&ctx->fighter_ids);
+    vec_clear(&ctx->person_ids);
+    opponent_list_reset(ctx);
+    habit_player_list_reset(ctx);
+    ctx->game_id = -1;
+    search_restart(ctx, search_text(ctx));
 }
 
 static struct replay_interface replays = {
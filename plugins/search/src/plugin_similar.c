@@ -0,0 +1,288 @@
+#include "search/minhash.h"
+#include "search/plugin_ctx.h"
+#include "search/plugin_similar.h"
+#include "search/search_index.h"
+
+#include "vh/db.h"
+#include "vh/hm.h"
+#include "vh/mem.h"
+#include "vh/str.h"
+
+#include <gtk/gtk.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#define SIMILAR_TOP_K 20
+
+/*
+ * Games are added to the similarity index the first time they are searched.
+ * The worker computes the buckets from the index it built anyway, and the
+ * main thread stores them.
+ */
+struct similarity_bucket
+{
+    int fighter_idx;
+    int band;
+    struct range frames;
+    uint64_t bucket;
+};
+
+struct bucket_batch
+{
+    struct plugin_ctx* ctx;
+    struct vec buckets;  /* struct similarity_bucket */
+    int game_id;
+    guint source_id;
+};
+
+static void
+bucket_batch_destroy(struct bucket_batch* batch)
+{
+    vec_deinit(&batch->buckets);
+    mem_free(batch);
+}
+
+static gboolean
+on_bucket_batch(gpointer user_data)
+{
+    struct bucket_batch* batch = user_data;
+    struct plugin_ctx* ctx = batch->ctx;
+    struct db_interface* dbi = ctx->dbi;
+
+    pending_remove(ctx, batch->source_id);
+
+    /* Another search of the same game may have beaten us to it */
+    if (dbi->similarity.has_game(ctx->db, batch->game_id) != 0)
+        goto done;
+
+    if (dbi->transaction.begin(ctx->db) < 0)
+        goto done;
+    VEC_FOR_EACH(&batch->buckets, const struct similarity_bucket, b)
+        if (dbi->similarity.add_bucket(ctx->db, batch->game_id, b->fighter_idx,
+                b->frames.start, b->frames.end, b->band, b->bucket) < 0)
+        {
+            dbi->transaction.rollback(ctx->db);
+            goto done;
+        }
+    VEC_END_EACH
+    dbi->transaction.commit(ctx->db);
+
+done:
+    if (batch->game_id == ctx->game_id)
+        ctx->needs_buckets = 0;
+    return G_SOURCE_REMOVE;
+}
+
+int
+similar_post_buckets(struct plugin_ctx* ctx, const struct search_index* index, int game_id)
+{
+    struct vec windows;
+    struct bucket_batch* batch;
+    int fighter_idx, band;
+
+    batch = mem_alloc(sizeof(struct bucket_batch));
+    if (batch == NULL)
+        return -1;
+    batch->ctx = ctx;
+    batch->game_id = game_id;
+    vec_init(&batch->buckets, sizeof(struct similarity_bucket));
+    vec_init(&windows, sizeof(struct minhash_window));
+
+    for (fighter_idx = 0; fighter_idx != search_index_fighter_count(index); ++fighter_idx)
+    {
+        vec_clear(&windows);
+        if (minhash_windows(&windows, search_index_symbols(index, fighter_idx), search_index_range(index, fighter_idx)) < 0)
+            goto fail;
+
+        VEC_FOR_EACH(&windows, const struct minhash_window, w)
+            struct range frames = search_index_frames(index, fighter_idx, w->symbols);
+            for (band = 0; band != MINHASH_BANDS; ++band)
+            {
+                struct similarity_bucket* b = vec_emplace(&batch->buckets);
+                if (b == NULL)
+                    goto fail;
+                b->fighter_idx = fighter_idx;
+                b->band = band;
+                b->frames = frames;
+                b->bucket = w->bands[band];
+            }
+        VEC_END_EACH
+    }
+
+    vec_deinit(&windows);
+    return pending_post(ctx, on_bucket_batch, batch,
+        (GDestroyNotify)bucket_batch_destroy, &batch->source_id);
+
+fail:
+    vec_deinit(&windows);
+    bucket_batch_destroy(batch);
+    return -1;
+}
+
+struct similar_key
+{
+    int game_id;
+    int fighter_idx;
+    int frame_start;
+};
+
+struct similar_window
+{
+    struct similar_key key;
+    int frame_end;
+    int hits;  /* Number of bands in the same bucket */
+};
+
+struct similar_state
+{
+    struct hm windows;  /* struct similar_key -> struct similar_window */
+    int exclude_game_id;
+};
+
+static int
+on_similar_row(int game_id, int fighter_idx, int frame_start, int frame_end, void* user_data)
+{
+    struct similar_state* state = user_data;
+    struct similar_window* w;
+    struct similar_key key;
+
+    if (game_id == state->exclude_game_id)
+        return 0;
+
+    memset(&key, 0, sizeof key);
+    key.game_id = game_id;
+    key.fighter_idx = fighter_idx;
+    key.frame_start = frame_start;
+    switch (hm_insert(&state->windows, &key, (void**)&w))
+    {
+        case 1:
+            w->key = key;
+            w->frame_end = frame_end;
+            w->hits = 0;
+            break;
+        case 0: break;
+        default: return -1;
+    }
+    w->hits++;
+
+    return 0;
+}
+
+static int
+similar_window_cmp(const void* a, const void* b)
+{
+    const struct similar_window* wa = a;
+    const struct similar_window* wb = b;
+    if (wa->hits != wb->hits)
+        return wb->hits - wa->hits;
+    if (wa->key.game_id != wb->key.game_id)
+        return wb->key.game_id - wa->key.game_id;
+    return wa->key.frame_start - wb->key.frame_start;
+}
+
+static int
+overlaps_listed(const struct vec* listed, const struct similar_window* w)
+{
+    VEC_FOR_EACH(listed, const struct similar_window, other)
+        if (other->key.game_id == w->key.game_id &&
+            other->key.fighter_idx == w->key.fighter_idx &&
+            other->key.frame_start < w->frame_end &&
+            w->key.frame_start < other->frame_end)
+        {
+            return 1;
+        }
+    VEC_END_EACH
+    return 0;
+}
+
+/*
+ * The more bands two windows have in common, the more similar they are likely
+ * to be. Neighbouring windows overlap, so only the best window of each
+ * situation is listed.
+ */
+void
+similar_find(struct plugin_ctx* ctx, const uint64_t* bands)
+{
+    struct similar_state state;
+    struct vec sorted, listed;
+    struct str text;
+    GtkWidget* child;
+    int band;
+
+    if (ctx->similar == NULL)
+        return;
+    while ((child = gtk_widget_get_first_child(ctx->similar)) != NULL)
+        gtk_list_box_remove(GTK_LIST_BOX(ctx->similar), child);
+
+    if (hm_init(&state.windows, sizeof(struct similar_key), sizeof(struct similar_window)) < 0)
+        return;
+    state.exclude_game_id = ctx->game_id;
+    vec_init(&sorted, sizeof(struct similar_window));
+    vec_init(&listed, sizeof(struct similar_window));
+    str_init(&text);
+
+    for (band = 0; band != MINHASH_BANDS; ++band)
+        if (ctx->dbi->similarity.find(ctx->db, band, bands[band], on_similar_row, &state) < 0)
+            goto fail;
+
+    HM_FOR_EACH(&state.windows, struct similar_key, struct similar_window, key, w)
+        if (vec_push(&sorted, w) < 0)
+            goto fail;
+    HM_END_EACH
+    if (vec_count(&sorted) > 0)
+        qsort(vec_data(&sorted), vec_count(&sorted), sizeof(struct similar_window), similar_window_cmp);
+
+    VEC_FOR_EACH(&sorted, const struct similar_window, w)
+        GtkWidget* row;
+        if ((int)vec_count(&listed) == SIMILAR_TOP_K)
+            break;
+        if (overlaps_listed(&listed, w))
+            continue;
+        if (vec_push(&listed, w) < 0)
+            goto fail;
+
+        str_fmt(&text, "Game %d, fighter %d, frames %d-%d (%d/%d bands)",
+            w->key.game_id, w->key.fighter_idx + 1, w->key.frame_start, w->frame_end,
+            w->hits, MINHASH_BANDS);
+        str_terminate(&text);
+        row = gtk_label_new(text.data);
+        gtk_label_set_xalign(GTK_LABEL(row), 0);
+        gtk_list_box_append(GTK_LIST_BOX(ctx->similar), row);
+    VEC_END_EACH
+
+fail:
+    str_deinit(&text);
+    vec_deinit(&listed);
+    vec_deinit(&sorted);
+    hm_deinit(&state.windows);
+}
+
+GtkWidget*
+similar_ui_create(struct plugin_ctx* ctx)
+{
+    GtkWidget* label;
+    GtkWidget* scroll;
+    GtkWidget* vbox;
+
+    ctx->similar = gtk_list_box_new();
+    scroll = gtk_scrolled_window_new();
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scroll), ctx->similar);
+    gtk_widget_set_vexpand(scroll, TRUE);
+
+    label = gtk_label_new("Similar situations:");
+    gtk_label_set_xalign(GTK_LABEL(label), 0);
+
+    vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 8);
+    gtk_box_append(GTK_BOX(vbox), label);
+    gtk_box_append(GTK_BOX(vbox), scroll);
+    gtk_widget_set_vexpand(vbox, TRUE);
+
+    return vbox;
+}
+
+void
+similar_ui_destroy(struct plugin_ctx* ctx)
+{
+    ctx->similar = NULL;
+}
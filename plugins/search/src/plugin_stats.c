@@ -0,0 +1,662 @@
+#include "search/ast.h"
+#include "search/ast_ops.h"
+#include "search/hit_stats.h"
+#include "search/label_map.h"
+#include "search/nfa.h"
+#include "search/parser.h"
+#include "search/plugin_ctx.h"
+#include "search/plugin_stats.h"
+#include "search/prefilter.h"
+#include "search/query_cache.h"
+#include "search/search_index.h"
+
+#include "vh/db.h"
+#include "vh/frame_data.h"
+#include "vh/hm.h"
+#include "vh/log.h"
+#include "vh/mem.h"
+#include "vh/str.h"
+
+#include <gtk/gtk.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define HIT_STATS_FILE "hit_stats.csv"
+
+/*
+ * Occurrences of a literal motion sequence in the library-wide FM-index.
+ * Labels resolve differently per fighter, but fighters whose query resolves
+ * to the same sequence share the occurrences.
+ */
+struct stats_located
+{
+    struct vec pattern;  /* union symbol */
+    struct vec matches;  /* struct fm_match, ordered by game, fighter and start */
+};
+
+struct stats_batch
+{
+    struct plugin_ctx* ctx;
+    struct hit_stats stats;
+    int generation;
+    guint source_id;
+};
+
+int
+stats_request_init(struct stats_request* req)
+{
+    if (hit_stats_init(&req->stats) < 0)
+        return -1;
+    if (search_request_init(&req->query) < 0)
+    {
+        hit_stats_deinit(&req->stats);
+        return -1;
+    }
+    req->generation = 0;
+    return 0;
+}
+
+void
+stats_request_deinit(struct stats_request* req)
+{
+    search_request_deinit(&req->query);
+    hit_stats_deinit(&req->stats);
+}
+
+static void
+stats_list_clear(struct plugin_ctx* ctx)
+{
+    GtkWidget* child;
+    if (ctx->stats_list == NULL)
+        return;
+    while ((child = gtk_widget_get_first_child(ctx->stats_list)) != NULL)
+        gtk_list_box_remove(GTK_LIST_BOX(ctx->stats_list), child);
+}
+
+static void
+stats_list_append(struct plugin_ctx* ctx, const char* text)
+{
+    GtkWidget* row;
+    if (ctx->stats_list == NULL)
+        return;
+    row = gtk_label_new(text);
+    gtk_label_set_xalign(GTK_LABEL(row), 0);
+    gtk_list_box_append(GTK_LIST_BOX(ctx->stats_list), row);
+}
+
+static enum hit_group
+stats_selected_group(struct plugin_ctx* ctx)
+{
+    int group = ctx->stats_group ? gtk_combo_box_get_active(GTK_COMBO_BOX(ctx->stats_group)) : -1;
+    return group >= 0 && group < HIT_GROUP_COUNT ? (enum hit_group)group : HIT_GROUP_PLAYER;
+}
+
+/* Groups the hits of the last run. Fast enough to do every time the grouping changes */
+static void
+stats_show(struct plugin_ctx* ctx)
+{
+    struct vec rows;
+    char buf[256];
+    enum hit_group group = stats_selected_group(ctx);
+
+    stats_list_clear(ctx);
+    vec_init(&rows, sizeof(struct hit_stats_row));
+    if (hit_stats_aggregate(&ctx->stats, group, &rows) < 0)
+    {
+        stats_list_append(ctx, "Failed to aggregate hits");
+        goto out;
+    }
+
+    snprintf(buf, sizeof buf, "%d hits in %d games",
+        (int)vec_count(&ctx->stats.hits), (int)vec_count(&ctx->stats.streams));
+    stats_list_append(ctx, buf);
+
+    VEC_FOR_EACH(&rows, const struct hit_stats_row, row)
+        struct str_view name = hit_stats_name(&ctx->stats, group, row->group_id);
+        int b, most = 0;
+        for (b = 1; b != HIT_STATS_PERCENT_BUCKETS; ++b)
+            if (row->histogram[b] > row->histogram[most])
+                most = b;
+        snprintf(buf, sizeof buf, "%.*s: %d hits in %d/%d games (%.2f per game), mostly at %d%%+",
+            name.len, name.data, row->hits, row->games_with_hits, row->games,
+            (double)row->hits / row->games, (int)(most * HIT_STATS_PERCENT_STEP));
+        stats_list_append(ctx, buf);
+    VEC_END_EACH
+
+out:
+    vec_deinit(&rows);
+}
+
+static void
+stats_batch_destroy(struct stats_batch* batch)
+{
+    hit_stats_deinit(&batch->stats);
+    mem_free(batch);
+}
+
+static gboolean
+on_stats_batch(gpointer user_data)
+{
+    struct stats_batch* batch = user_data;
+    struct plugin_ctx* ctx = batch->ctx;
+    struct hit_stats tmp;
+
+    pending_remove(ctx, batch->source_id);
+
+    if (batch->generation != g_atomic_int_get(&ctx->stats_generation))
+        return G_SOURCE_REMOVE;
+
+    /* The batch is destroyed with the previous hits */
+    tmp = ctx->stats;
+    ctx->stats = batch->stats;
+    batch->stats = tmp;
+    stats_show(ctx);
+
+    return G_SOURCE_REMOVE;
+}
+
+static int
+stats_is_stale(struct plugin_ctx* ctx, const struct stats_request* req)
+{
+    return g_atomic_int_get(&ctx->stats_generation) != req->generation;
+}
+
+static void
+stats_located_deinit(struct vec* located, struct hm* fighters)
+{
+    VEC_FOR_EACH(located, struct stats_located, loc)
+        vec_deinit(&loc->matches);
+        vec_deinit(&loc->pattern);
+    VEC_END_EACH
+    vec_deinit(located);
+    hm_deinit(fighters);
+}
+
+/*
+ * Sets "out" to the occurrences of the query in the FM-index if it is a
+ * literal sequence for the stream's fighter, or to NULL if the stream has to
+ * be scanned. "fighters" maps each fighter ID to an index into "located", or
+ * -1 if the query isn't literal for them. Pointers into "located" are only
+ * valid until the next call.
+ * \return Returns 0 on success or negative on error.
+ */
+static int
+stats_locate(
+        struct plugin_ctx* ctx,
+        const struct stats_request* req,
+        const struct hit_stream* stream,
+        struct vec* located,
+        struct hm* fighters,
+        const struct stats_located** out)
+{
+    struct compiled_query* query;
+    struct stats_located* loc;
+    struct vec pattern;
+    int* idx;
+    int result;
+
+    *out = NULL;
+    idx = hm_find(fighters, &stream->fighter_id);
+    if (idx)
+    {
+        *out = *idx >= 0 ? vec_get(located, *idx) : NULL;
+        return 0;
+    }
+    if (hm_insert(fighters, &stream->fighter_id, (void**)&idx) != 1)
+        return -1;
+    *idx = -1;
+
+    /* Joint queries match the opponent's motions too, which aren't indexed */
+    if (req->query.is_joint)
+        return 0;
+    query = search_compile(ctx, &req->query, stream->fighter_id, stream->groups[HIT_GROUP_OPPONENT]);
+    if (query == NULL)
+        return 0;
+
+    vec_init(&pattern, sizeof(union symbol));
+    result = literal_pattern(&query->ast, 0, &pattern);
+    if (result <= 0)
+        goto out;
+
+    result = 0;
+    VEC_FOR_EACH(located, struct stats_located, existing)
+        if (vec_count(&existing->pattern) == vec_count(&pattern) &&
+            memcmp(vec_data(&existing->pattern), vec_data(&pattern),
+                sizeof(union symbol) * vec_count(&pattern)) == 0)
+        {
+            *idx = (int)(existing - (struct stats_located*)vec_data(located));
+            *out = existing;
+            goto out;
+        }
+    VEC_END_EACH
+
+    result = -1;
+    loc = vec_emplace(located);
+    if (loc == NULL)
+        goto out;
+    loc->pattern = pattern;
+    vec_init(&loc->matches, sizeof(struct fm_match));
+    vec_init(&pattern, sizeof(union symbol));
+    if (fm_library_locate(&loc->matches, &ctx->search.fm,
+            vec_data(&loc->pattern), (int)vec_count(&loc->pattern)) < 0)
+        goto out;
+    *idx = (int)vec_count(located) - 1;
+    *out = loc;
+    result = 0;
+
+out:
+    vec_deinit(&pattern);
+    return result;
+}
+
+/* Returns the index of the first occurrence in the stream, and its count in "count" */
+static int
+stats_located_stream(const struct stats_located* loc, const struct hit_stream* stream, int* count)
+{
+    const struct fm_match* matches = vec_data(&loc->matches);
+    int lo = 0, hi = (int)vec_count(&loc->matches);
+    int first;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (matches[mid].game_id < stream->game_id ||
+            (matches[mid].game_id == stream->game_id && matches[mid].fighter_idx < stream->fighter_idx))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    first = lo;
+    while (lo != (int)vec_count(&loc->matches) &&
+           matches[lo].game_id == stream->game_id && matches[lo].fighter_idx == stream->fighter_idx)
+        lo++;
+    *count = lo - first;
+    return first;
+}
+
+/*
+ * Percent histograms are made from the frame data of the opponent on the
+ * first frame of a match. Joint streams don't map back to frames, so the
+ * quantized damage of the fighter's first symbol is used instead.
+ *
+ * If the query is a literal sequence that was located in the FM-index, only
+ * the located occurrences are searched.
+ */
+static int
+stats_scan_fighter(
+        struct plugin_ctx* ctx,
+        struct stats_request* req,
+        const struct frame_data* fdata,
+        const struct search_index* index,
+        int stream_idx,
+        const struct stats_located* loc)
+{
+    const struct hit_stream* stream = vec_get(&req->stats.streams, stream_idx);
+    int fighter_idx = stream->fighter_idx;
+    int opponent_idx = search_index_opponent(index, fighter_idx);
+    const union symbol* symbols;
+    const struct fm_match* located = NULL;
+    struct compiled_query* query;
+    struct range window;
+    int next_located = 0, located_count = 0;
+
+    query = search_compile(ctx, &req->query, stream->fighter_id, stream->groups[HIT_GROUP_OPPONENT]);
+    if (query == NULL)
+        return -1;
+
+    if (req->query.is_joint)
+    {
+        symbols = search_index_joint_symbols(index, fighter_idx);
+        window = search_index_joint_range(index, fighter_idx);
+    }
+    else
+    {
+        symbols = search_index_symbols(index, fighter_idx);
+        window = search_index_range(index, fighter_idx);
+    }
+    if (loc)
+        located = (const struct fm_match*)vec_data(&loc->matches) +
+            stats_located_stream(loc, stream, &located_count);
+
+    for (;;)
+    {
+        struct range candidate;
+        struct range remaining;
+        if (loc)
+        {
+            /* Occurrences that overlap the previous match are skipped */
+            while (next_located != located_count && located[next_located].start < window.start)
+                next_located++;
+            if (next_located == located_count)
+                break;
+            candidate.start = located[next_located++].start;
+            candidate.end = candidate.start + (int)vec_count(&loc->pattern);
+            if (candidate.end > window.end)
+                break;
+        }
+        else
+            candidate = prefilter_next_window(&query->prefilter, symbols, window);
+        remaining = candidate;
+        if (candidate.start == candidate.end)
+            break;
+
+        while (remaining.start != remaining.end)
+        {
+            struct range frames = { 0, 0 };
+            float percent = 0.f;
+            struct fuzzy_range match = search_find_first(query, symbols, remaining, 0);
+            if (match.range.start == match.range.end)
+                break;
+
+            if (req->query.is_joint)
+            {
+                int i = match.range.start;
+                while (i < match.range.end - 1 && symbols[i].is_op)
+                    i++;
+                percent = symbols[i].op_damage * SYMBOL_DAMAGE_STEP;
+            }
+            else
+            {
+                frames = search_index_frames(index, fighter_idx, match.range);
+                if (opponent_idx >= 0 && opponent_idx < fdata->fighter_count)
+                    percent = fdata->damage[opponent_idx][frames.start];
+            }
+            if (hit_stats_add_hit(&req->stats, stream_idx, frames, percent) < 0)
+                return -1;
+
+            remaining.start = match.range.end;
+        }
+
+        window.start = candidate.end;
+    }
+
+    return 0;
+}
+
+/*
+ * Like habits, every game is loaded once and the search's own game is left
+ * alone. Literal sequences are located in the FM-index first, and games that
+ * were indexed with their current frame data are only loaded if the sequence
+ * occurs in them.
+ */
+void
+stats_execute(struct plugin_ctx* ctx, struct stats_request* req)
+{
+    struct frame_data fdata;
+    struct search_index index;
+    struct stats_batch* batch;
+    struct vec located;  /* struct stats_located */
+    struct hm fighters;  /* int fighter_id -> int index into "located", or -1 */
+    int stream_idx, game_id = -1;
+    int loaded = 0, load_attempted = 0, is_indexed = 0;
+
+    if (hm_init(&fighters, sizeof(int), sizeof(int)) < 0)
+    {
+        log_err("Failed to compute hit statistics\n");
+        return;
+    }
+    vec_init(&located, sizeof(struct stats_located));
+    frame_data_init(&fdata);
+    search_index_init(&index);
+
+    for (stream_idx = 0; stream_idx != (int)vec_count(&req->stats.streams); ++stream_idx)
+    {
+        const struct hit_stream* stream = vec_get(&req->stats.streams, stream_idx);
+        const struct stats_located* loc = NULL;
+        if (stats_is_stale(ctx, req))
+            goto cancelled;
+
+        if (stream->game_id != game_id)
+        {
+            uint64_t stamp;
+            game_id = stream->game_id;
+            search_index_clear(&index);
+            frame_data_clear(&fdata);
+            loaded = 0;
+            load_attempted = 0;
+            is_indexed = frame_data_stamp(game_id, &stamp) == 0 &&
+                fm_library_has_game(&ctx->search.fm, game_id, stamp);
+        }
+
+        if (is_indexed)
+        {
+            int count = 1;
+            if (stats_locate(ctx, req, stream, &located, &fighters, &loc) < 0)
+                goto fail;
+            if (loc)
+                stats_located_stream(loc, stream, &count);
+            if (count == 0)
+                continue;  /* Without loading the game */
+        }
+
+        if (!load_attempted)
+        {
+            load_attempted = 1;
+            loaded = frame_data_load(&fdata, game_id) == 0 &&
+                search_index_build(&index, &fdata, -1) == 0;
+        }
+
+        if (!loaded || stream->fighter_idx >= search_index_fighter_count(&index))
+            continue;
+        if (stats_scan_fighter(ctx, req, &fdata, &index, stream_idx, loc) < 0)
+            goto fail;
+    }
+
+    batch = mem_alloc(sizeof(struct stats_batch));
+    if (batch == NULL)
+        goto fail;
+    batch->ctx = ctx;
+    batch->generation = req->generation;
+    /* The hits go to the main thread, the request gets new, empty buffers */
+    batch->stats = req->stats;
+    if (hit_stats_init(&req->stats) < 0)
+    {
+        req->stats = batch->stats;
+        mem_free(batch);
+        goto fail;
+    }
+    pending_post(ctx, on_stats_batch, batch,
+        (GDestroyNotify)stats_batch_destroy, &batch->source_id);
+    goto done;
+
+fail:
+    log_err("Failed to compute hit statistics\n");
+cancelled:
+done:
+    search_index_deinit(&index);
+    frame_data_deinit(&fdata);
+    stats_located_deinit(&located, &fighters);
+}
+
+static int
+on_stats_stream(
+        int game_id, int fighter_idx, int fighter_id,
+        int person_id, const char* person,
+        int opponent_fighter_id, const char* opponent_fighter,
+        int stage_id, const char* stage,
+        void* user_data)
+{
+    struct hit_stats* stats = user_data;
+    struct hit_stream stream;
+
+    stream.game_id = game_id;
+    stream.fighter_idx = fighter_idx;
+    stream.fighter_id = fighter_id;
+    stream.groups[HIT_GROUP_PLAYER] = person_id;
+    stream.groups[HIT_GROUP_OPPONENT] = opponent_fighter_id;
+    stream.groups[HIT_GROUP_STAGE] = stage_id;
+    if (hit_stats_add_stream(stats, &stream) < 0)
+        return -1;
+
+    if (hit_stats_set_name(stats, HIT_GROUP_PLAYER, person_id, cstr_view(person)) < 0 ||
+        hit_stats_set_name(stats, HIT_GROUP_OPPONENT, opponent_fighter_id, cstr_view(opponent_fighter)) < 0 ||
+        hit_stats_set_name(stats, HIT_GROUP_STAGE, stage_id, cstr_view(stage)) < 0)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Runs the current query on every game in the library. Labels resolve
+ * differently per fighter, so they are resolved for every fighter that shows
+ * up before handing the request to the worker.
+ */
+static void
+on_compute_stats(GtkWidget* self, struct plugin_ctx* ctx)
+{
+    struct hit_stats stats;
+    struct hm resolved;  /* int fighter_id -> char */
+    const char* text = search_text(ctx);
+    char* value;
+
+    /* Invalidates statistics that are still being computed */
+    g_atomic_int_inc(&ctx->stats_generation);
+    stats_list_clear(ctx);
+
+    if (*text == '\0')
+        return;
+    ast_clear(&ctx->ast);
+    if (parser_parse(&ctx->parser, text, &ctx->ast) < 0 || nfa_check_ast(&ctx->ast) < 0)
+    {
+        stats_list_append(ctx, "Invalid search");
+        return;
+    }
+
+    if (hit_stats_init(&stats) < 0)
+        goto stats_init_failed;
+    if (hm_init(&resolved, sizeof(int), sizeof(char)) < 0)
+        goto resolved_init_failed;
+    if (ctx->dbi->hit_stats.find_streams(ctx->db, on_stats_stream, &stats) < 0)
+        goto fail;
+
+    mutex_lock(ctx->mutex);
+        VEC_FOR_EACH(&stats.streams, const struct hit_stream, stream)
+            switch (hm_insert(&resolved, &stream->fighter_id, (void**)&value))
+            {
+                case 1:
+                    if (label_map_resolve_ast(&ctx->labels, ctx->dbi, ctx->db, stream->fighter_id, &ctx->ast) < 0)
+                        goto fail_locked;
+                    break;
+                case 0: break;
+                default: goto fail_locked;
+            }
+        VEC_END_EACH
+
+        if (cstr_set(&ctx->stats_request.query.text, text) < 0)
+            goto fail_locked;
+        str_terminate(&ctx->stats_request.query.text);
+        if (search_request_set_ast(&ctx->stats_request.query, &ctx->ast) < 0)
+            goto fail_locked;
+        ctx->stats_request.query.labels_revision = ctx->labels.revision;
+        ctx->stats_request.query.max_edits = 0;
+        hit_stats_deinit(&ctx->stats_request.stats);
+        ctx->stats_request.stats = stats;
+        ctx->stats_request.generation = g_atomic_int_get(&ctx->stats_generation);
+        ctx->stats_pending = 1;
+        cond_signal(ctx->cond);
+    mutex_unlock(ctx->mutex);
+
+    hm_deinit(&resolved);
+    stats_list_append(ctx, "Searching all games...");
+    return;
+
+fail_locked:
+    mutex_unlock(ctx->mutex);
+fail:
+    hm_deinit(&resolved);
+resolved_init_failed:
+    hit_stats_deinit(&stats);
+stats_init_failed:
+    stats_list_append(ctx, "Failed to look up games");
+}
+
+static void
+on_stats_group_changed(GtkComboBox* self, struct plugin_ctx* ctx)
+{
+    stats_show(ctx);
+}
+
+static void
+on_export_stats(GtkWidget* self, struct plugin_ctx* ctx)
+{
+    struct vec rows;
+    struct str csv;
+    FILE* fp;
+    enum hit_group group = stats_selected_group(ctx);
+
+    vec_init(&rows, sizeof(struct hit_stats_row));
+    str_init(&csv);
+    if (hit_stats_aggregate(&ctx->stats, group, &rows) < 0 ||
+        hit_stats_to_csv(&ctx->stats, group, &rows, &csv) < 0)
+        goto fail;
+
+    fp = fopen(HIT_STATS_FILE, "wb");
+    if (fp == NULL)
+        goto fail;
+    if (fwrite(csv.data, 1, (size_t)csv.len, fp) != (size_t)csv.len)
+    {
+        fclose(fp);
+        goto fail;
+    }
+    fclose(fp);
+    stats_list_append(ctx, "Exported to " HIT_STATS_FILE);
+    goto out;
+
+fail:
+    log_err("Failed to export hit statistics to " HIT_STATS_FILE "\n");
+    stats_list_append(ctx, "Failed to export to " HIT_STATS_FILE);
+out:
+    str_deinit(&csv);
+    vec_deinit(&rows);
+}
+
+GtkWidget*
+stats_ui_create(struct plugin_ctx* ctx)
+{
+    GtkWidget* label;
+    GtkWidget* button;
+    GtkWidget* export;
+    GtkWidget* scroll;
+    GtkWidget* hbox;
+    GtkWidget* vbox;
+    int group;
+
+    ctx->stats_group = gtk_combo_box_text_new();
+    for (group = 0; group != HIT_GROUP_COUNT; ++group)
+        gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(ctx->stats_group), hit_group_name(group));
+    gtk_combo_box_set_active(GTK_COMBO_BOX(ctx->stats_group), 0);
+    g_signal_connect(ctx->stats_group, "changed", G_CALLBACK(on_stats_group_changed), ctx);
+    button = gtk_button_new_with_label("Search all games");
+    g_signal_connect(button, "clicked", G_CALLBACK(on_compute_stats), ctx);
+    export = gtk_button_new_with_label("Export CSV");
+    g_signal_connect(export, "clicked", G_CALLBACK(on_export_stats), ctx);
+    hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
+    gtk_box_append(GTK_BOX(hbox), ctx->stats_group);
+    gtk_box_append(GTK_BOX(hbox), button);
+    gtk_box_append(GTK_BOX(hbox), export);
+
+    ctx->stats_list = gtk_list_box_new();
+    scroll = gtk_scrolled_window_new();
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scroll), ctx->stats_list);
+    gtk_widget_set_vexpand(scroll, TRUE);
+
+    label = gtk_label_new("Statistics:");
+    gtk_label_set_xalign(GTK_LABEL(label), 0);
+
+    vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 8);
+    gtk_box_append(GTK_BOX(vbox), label);
+    gtk_box_append(GTK_BOX(vbox), hbox);
+    gtk_box_append(GTK_BOX(vbox), scroll);
+    gtk_widget_set_vexpand(vbox, TRUE);
+
+    return vbox;
+}
+
+void
+stats_ui_destroy(struct plugin_ctx* ctx)
+{
+    ctx->stats_group = NULL;
+    ctx->stats_list = NULL;
+}
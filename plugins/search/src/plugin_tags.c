@@ -0,0 +1,751 @@
+#include "search/ast.h"
+#include "search/ast_ops.h"
+#include "search/label_map.h"
+#include "search/multi_nfa.h"
+#include "search/nfa.h"
+#include "search/parser.h"
+#include "search/plugin_ctx.h"
+#include "search/plugin_tags.h"
+#include "search/prefilter.h"
+#include "search/query_cache.h"
+#include "search/search_index.h"
+
+#include "vh/db.h"
+#include "vh/frame_data.h"
+#include "vh/hash.h"
+#include "vh/log.h"
+#include "vh/mem.h"
+#include "vh/str.h"
+#include "vh/time.h"
+
+#include <gtk/gtk.h>
+
+#include <string.h>
+
+#define TAG_POLL_MS     5000
+#define TAG_BATCH_GAMES 32
+#define TAG_BUDGET_MS   100
+
+struct tag_count
+{
+    int game_id;
+    int query_id;
+    int count;
+};
+
+/*
+ * The exact tag queries, compiled for one fighter and opponent and merged
+ * into one automaton per stream, so that tagging a fighter scans each of
+ * their streams once no matter how many tags there are. Approximate queries
+ * are still scanned one at a time. Sets are built for each batch of games.
+ */
+struct tag_set
+{
+    struct multi_nfa plain;    /* Queries that only look at the fighter */
+    struct multi_nfa joint;    /* Queries with steps of the opponent */
+    struct vec plain_queries;  /* int - index into tag_request.queries of each query in "plain" */
+    struct vec joint_queries;  /* int - index into tag_request.queries of each query in "joint" */
+    int fighter_id;
+    int opponent_id;
+};
+
+struct tag_batch
+{
+    struct plugin_ctx* ctx;
+    struct vec game_ids;  /* int - games that were tagged */
+    struct vec counts;    /* struct tag_count - only tags with at least one match */
+    hash32 queries_hash;
+    guint source_id;
+};
+
+void
+tag_request_init(struct tag_request* req)
+{
+    vec_init(&req->games, sizeof(struct tag_game));
+    vec_init(&req->fighter_ids, sizeof(int));
+    vec_init(&req->queries, sizeof(struct tag_query));
+    req->queries_hash = 0;
+}
+
+void
+tag_request_deinit(struct tag_request* req)
+{
+    VEC_FOR_EACH(&req->queries, struct tag_query, query)
+        search_request_deinit(&query->query);
+    VEC_END_EACH
+    vec_deinit(&req->queries);
+    vec_deinit(&req->fighter_ids);
+    vec_deinit(&req->games);
+}
+
+static void
+tag_batch_destroy(struct tag_batch* batch)
+{
+    vec_deinit(&batch->counts);
+    vec_deinit(&batch->game_ids);
+    mem_free(batch);
+}
+
+static hash32
+tag_queries_hash_add(hash32 hash, int id, const char* query, int max_edits)
+{
+    hash = hash32_combine(hash, (hash32)id);
+    hash = hash32_combine(hash, hash32_jenkins_oaat(query, (int)strlen(query)));
+    return hash32_combine(hash, (hash32)max_edits);
+}
+
+static int
+on_tag_query_hash(int id, const char* query, int max_edits, void* user_data)
+{
+    hash32* hash = user_data;
+    *hash = tag_queries_hash_add(*hash, id, query, max_edits);
+    return 0;
+}
+
+static int
+on_tag_fighter(int game_id, int fighter_id, void* user_data)
+{
+    struct tag_request* req = user_data;
+    struct tag_game* game = vec_count(&req->games) ? vec_back(&req->games) : NULL;
+    if (game == NULL || game->game_id != game_id)
+    {
+        game = vec_emplace(&req->games);
+        if (game == NULL)
+            return -1;
+        game->game_id = game_id;
+        game->first_fighter = (int)vec_count(&req->fighter_ids);
+        game->fighter_count = 0;
+    }
+    game->fighter_count++;
+    return vec_push(&req->fighter_ids, &fighter_id);
+}
+
+struct on_tag_query_ctx
+{
+    struct plugin_ctx* ctx;
+    struct tag_request* req;
+    uint64_t labels_revision;
+    int labels_changed;
+};
+
+/*
+ * Labels are resolved for every fighter of the queued games. Queries that
+ * don't parse are skipped, but still count towards the hash, so that
+ * the tags of the other queries are stored.
+ */
+static int
+on_tag_query(int id, const char* text, int max_edits, void* user_data)
+{
+    struct on_tag_query_ctx* submit = user_data;
+    struct plugin_ctx* ctx = submit->ctx;
+    struct tag_request* req = submit->req;
+    struct tag_query* query;
+
+    req->queries_hash = tag_queries_hash_add(req->queries_hash, id, text, max_edits);
+
+    ast_clear(&ctx->ast);
+    if (parser_parse(&ctx->parser, text, &ctx->ast) < 0 || nfa_check_ast(&ctx->ast) < 0)
+    {
+        log_dbg("Skipping invalid tag query %d: %s\n", id, text);
+        return 0;
+    }
+
+    query = vec_emplace(&req->queries);
+    if (query == NULL)
+        return -1;
+    if (search_request_init(&query->query) < 0)
+    {
+        vec_pop(&req->queries);
+        return -1;
+    }
+    query->query_id = id;
+    if (cstr_set(&query->query.text, text) < 0)
+        return -1;
+    str_terminate(&query->query.text);
+    if (search_request_set_ast(&query->query, &ctx->ast) < 0)
+        return -1;
+    query->query.max_edits = max_edits < 0 ? 0 : max_edits > SEARCH_MAX_EDITS ? SEARCH_MAX_EDITS : max_edits;
+
+    mutex_lock(ctx->mutex);
+        VEC_FOR_EACH(&req->fighter_ids, int, fighter_id)
+            if (label_map_resolve_ast(&ctx->labels, ctx->dbi, ctx->db, *fighter_id, &ctx->ast) < 0)
+            {
+                mutex_unlock(ctx->mutex);
+                return -1;
+            }
+        VEC_END_EACH
+        query->query.labels_revision = ctx->labels.revision;
+    mutex_unlock(ctx->mutex);
+
+    /* Resolutions of the previous queries were cleared from the map */
+    if (vec_count(&req->queries) > 1 && submit->labels_revision != query->query.labels_revision)
+        submit->labels_changed = 1;
+    submit->labels_revision = query->query.labels_revision;
+
+    return 0;
+}
+
+/* Replaces the tags of the games and takes them off the queue */
+static int
+tag_store(struct plugin_ctx* ctx, const struct vec* game_ids, const struct vec* counts)
+{
+    struct db_interface* dbi = ctx->dbi;
+
+    if (dbi->transaction.begin(ctx->db) < 0)
+        return -1;
+    VEC_FOR_EACH(game_ids, const int, game_id)
+        if (dbi->game_tag.clear(ctx->db, *game_id) < 0 ||
+            dbi->game_tag.dequeue(ctx->db, *game_id) < 0)
+            goto fail;
+    VEC_END_EACH
+    VEC_FOR_EACH(counts, const struct tag_count, tag)
+        if (dbi->game_tag.set(ctx->db, tag->game_id, tag->query_id, tag->count) < 0)
+            goto fail;
+    VEC_END_EACH
+    if (dbi->transaction.commit(ctx->db) < 0)
+        goto fail;
+
+    return 0;
+
+fail:
+    dbi->transaction.rollback(ctx->db);
+    return -1;
+}
+
+/*
+ * Hands the next queued games to the worker, unless it is still busy with
+ * the previous ones.
+ */
+static void
+tag_submit(struct plugin_ctx* ctx)
+{
+    struct tag_request req;
+    struct on_tag_query_ctx submit;
+    int running;
+
+    mutex_lock(ctx->mutex);
+        running = ctx->tag_running;
+    mutex_unlock(ctx->mutex);
+    if (running)
+        return;
+
+    tag_request_init(&req);
+    if (ctx->dbi->game_tag.get_queued(ctx->db, TAG_BATCH_GAMES, on_tag_fighter, &req) < 0)
+        goto fail;
+    if (vec_count(&req.games) == 0)
+        goto out;
+
+    submit.ctx = ctx;
+    submit.req = &req;
+    submit.labels_revision = 0;
+    submit.labels_changed = 0;
+    if (ctx->dbi->saved_query.get_tags(ctx->db, on_tag_query, &submit) < 0)
+        goto fail;
+    if (submit.labels_changed)
+        goto out;  /* Try again with the new labels next time */
+
+    /* Even without any queries, the worker adds the games to the FM-index */
+
+    mutex_lock(ctx->mutex);
+        tag_request_deinit(&ctx->tag_request);
+        ctx->tag_request = req;
+        ctx->tag_pending = 1;
+        ctx->tag_running = 1;
+        cond_signal(ctx->cond);
+    mutex_unlock(ctx->mutex);
+    return;
+
+fail:
+    log_err("Failed to look up games to tag\n");
+out:
+    tag_request_deinit(&req);
+}
+
+static gboolean
+on_tag_batch(gpointer user_data)
+{
+    struct tag_batch* batch = user_data;
+    struct plugin_ctx* ctx = batch->ctx;
+    hash32 queries_hash = 0;
+
+    pending_remove(ctx, batch->source_id);
+    mutex_lock(ctx->mutex);
+        ctx->tag_running = 0;
+    mutex_unlock(ctx->mutex);
+
+    /*
+     * Editing the tag queries queues every game again, so tags that were
+     * counted with the old queries are dropped.
+     */
+    if (ctx->dbi->saved_query.get_tags(ctx->db, on_tag_query_hash, &queries_hash) < 0 ||
+        queries_hash != batch->queries_hash)
+        return G_SOURCE_REMOVE;
+
+    /* The worker was interrupted before it could tag anything */
+    if (vec_count(&batch->game_ids) == 0)
+        return G_SOURCE_REMOVE;
+
+    if (tag_store(ctx, &batch->game_ids, &batch->counts) < 0)
+    {
+        log_err("Failed to store tags\n");
+        return G_SOURCE_REMOVE;
+    }
+
+    /* Keep going until the queue is empty */
+    tag_submit(ctx);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_tag_poll(gpointer user_data)
+{
+    tag_submit(user_data);
+    return G_SOURCE_CONTINUE;
+}
+
+void
+tag_poll_start(struct plugin_ctx* ctx)
+{
+    ctx->tag_source = g_timeout_add(TAG_POLL_MS, on_tag_poll, ctx);
+}
+
+void
+tag_poll_stop(struct plugin_ctx* ctx)
+{
+    g_source_remove(ctx->tag_source);
+    ctx->tag_source = 0;
+}
+
+/* Tagging always gives way to requests the user is waiting for */
+static int
+tag_should_yield(struct plugin_ctx* ctx, uint64_t start_us)
+{
+    int other_pending;
+    if (time_get_us() - start_us >= TAG_BUDGET_MS * 1000)
+        return 1;
+    mutex_lock(ctx->mutex);
+        other_pending = ctx->request_pending || ctx->habit_pending ||
+            ctx->stats_pending || ctx->request_stop;
+    mutex_unlock(ctx->mutex);
+    return other_pending;
+}
+
+static int
+tag_count_matches(const struct compiled_query* query, const struct search_request* req, const struct search_index* index, int fighter_idx)
+{
+    const union symbol* symbols;
+    struct range window;
+    int count = 0;
+
+    if (req->is_joint)
+    {
+        symbols = search_index_joint_symbols(index, fighter_idx);
+        window = search_index_joint_range(index, fighter_idx);
+    }
+    else
+    {
+        symbols = search_index_symbols(index, fighter_idx);
+        window = search_index_range(index, fighter_idx);
+    }
+
+    for (;;)
+    {
+        struct range candidate = req->max_edits > 0 ? window :
+            prefilter_next_window(&query->prefilter, symbols, window);
+        struct range remaining = candidate;
+        if (candidate.start == candidate.end)
+            break;
+
+        while (remaining.start != remaining.end)
+        {
+            struct fuzzy_range match = search_find_first(query, symbols, remaining, req->max_edits);
+            if (match.range.start == match.range.end)
+                break;
+            count++;
+            remaining.start = match.range.end;
+        }
+
+        window.start = candidate.end;
+    }
+
+    return count;
+}
+
+static void
+tag_set_deinit(struct tag_set* set)
+{
+    vec_deinit(&set->joint_queries);
+    vec_deinit(&set->plain_queries);
+    multi_nfa_deinit(&set->joint);
+    multi_nfa_deinit(&set->plain);
+}
+
+static void
+tag_sets_deinit(struct vec* sets)
+{
+    VEC_FOR_EACH(sets, struct tag_set, set)
+        tag_set_deinit(set);
+    VEC_END_EACH
+    vec_deinit(sets);
+}
+
+static void
+free_nfas(struct vec* nfas)
+{
+    VEC_FOR_EACH(nfas, struct nfa_graph, nfa)
+        nfa_deinit(nfa);
+    VEC_END_EACH
+    vec_deinit(nfas);
+}
+
+/*
+ * A query that doesn't compile for the fighter is left out of the set, so
+ * it has no matches for them.
+ */
+static int
+tag_set_build(struct plugin_ctx* ctx, const struct tag_request* req, struct tag_set* set)
+{
+    struct vec plain_nfas;  /* struct nfa_graph */
+    struct vec joint_nfas;  /* struct nfa_graph */
+    struct ast ast;
+    int i;
+    int ret = -1;
+
+    vec_init(&plain_nfas, sizeof(struct nfa_graph));
+    vec_init(&joint_nfas, sizeof(struct nfa_graph));
+    ast_init(&ast);
+
+    for (i = 0; i != (int)vec_count(&req->queries); ++i)
+    {
+        const struct tag_query* query = vec_get(&req->queries, i);
+        int is_joint = query->query.is_joint;
+        struct vec* nfas = is_joint ? &joint_nfas : &plain_nfas;
+        struct nfa_graph* nfa;
+
+        if (query->query.max_edits > 0)
+            continue;
+
+        if (ast_copy(&ast, &query->query.ast) < 0)
+            goto fail;
+        if (resolve_labels(ctx, &ast, set->fighter_id, is_joint ? set->opponent_id : -1) < 0)
+            continue;
+
+        nfa = vec_emplace(nfas);
+        if (nfa == NULL)
+            goto fail;
+        nfa_init(nfa);
+        /* An automaton without positions can't be merged */
+        if (nfa_compile(nfa, &ast) < 0 || nfa->node_count <= 1)
+        {
+            nfa_deinit(nfa);
+            vec_pop(nfas);
+            continue;
+        }
+        if (vec_push(is_joint ? &set->joint_queries : &set->plain_queries, &i) < 0)
+            goto fail;
+    }
+
+    if (vec_count(&plain_nfas) &&
+        multi_nfa_compile(&set->plain, vec_data(&plain_nfas), vec_count(&plain_nfas)) < 0)
+        goto fail;
+    if (vec_count(&joint_nfas) &&
+        multi_nfa_compile(&set->joint, vec_data(&joint_nfas), vec_count(&joint_nfas)) < 0)
+        goto fail;
+    ret = 0;
+
+fail:
+    ast_deinit(&ast);
+    free_nfas(&joint_nfas);
+    free_nfas(&plain_nfas);
+    return ret;
+}
+
+static struct tag_set*
+tag_sets_get(struct plugin_ctx* ctx, const struct tag_request* req, struct vec* sets, int fighter_id, int opponent_id)
+{
+    struct tag_set* set;
+
+    VEC_FOR_EACH(sets, struct tag_set, existing)
+        if (existing->fighter_id == fighter_id && existing->opponent_id == opponent_id)
+            return existing;
+    VEC_END_EACH
+
+    set = vec_emplace(sets);
+    if (set == NULL)
+        return NULL;
+    multi_nfa_init(&set->plain);
+    multi_nfa_init(&set->joint);
+    vec_init(&set->plain_queries, sizeof(int));
+    vec_init(&set->joint_queries, sizeof(int));
+    set->fighter_id = fighter_id;
+    set->opponent_id = opponent_id;
+    if (tag_set_build(ctx, req, set) < 0)
+    {
+        tag_set_deinit(set);
+        vec_pop(sets);
+        return NULL;
+    }
+
+    return set;
+}
+
+/* Adds the matches of every query in "multi" to the count of that query */
+static int
+tag_count_set_matches(
+        int* counts,
+        struct vec* matches,
+        const struct multi_nfa* multi,
+        const struct vec* queries,
+        const union symbol* symbols,
+        struct range window)
+{
+    if (multi_nfa_query_count(multi) == 0)
+        return 0;
+
+    vec_clear(matches);
+    if (multi_nfa_find_all(matches, multi, symbols, window) < 0)
+        return -1;
+    VEC_FOR_EACH(matches, const struct query_range, match)
+        counts[*(int*)vec_get(queries, match->query)]++;
+    VEC_END_EACH
+
+    return 0;
+}
+
+/*
+ * Counts the matches of every query, summed over all fighters of the game.
+ * "counts" and "matches" are scratch space that is reused between games.
+ */
+static int
+tag_game(
+        struct plugin_ctx* ctx,
+        const struct tag_request* req,
+        const struct tag_game* game,
+        const struct search_index* index,
+        struct vec* sets,
+        struct vec* counts,
+        struct vec* matches,
+        struct tag_batch* batch)
+{
+    const int* fighter_ids = vec_get(&req->fighter_ids, game->first_fighter);
+    int fighter_count = search_index_fighter_count(index);
+    int fighter_idx, i;
+    if (fighter_count > game->fighter_count)
+        fighter_count = game->fighter_count;
+    if (vec_count(&req->queries) == 0)
+        return 0;
+
+    if (vec_resize(counts, vec_count(&req->queries)) < 0)
+        return -1;
+    memset(vec_data(counts), 0, sizeof(int) * vec_count(counts));
+
+    for (fighter_idx = 0; fighter_idx != fighter_count; ++fighter_idx)
+    {
+        int opponent_idx = search_index_opponent(index, fighter_idx);
+        int opponent_id = opponent_idx >= 0 && opponent_idx < game->fighter_count ?
+            fighter_ids[opponent_idx] : -1;
+        struct tag_set* set = tag_sets_get(ctx, req, sets, fighter_ids[fighter_idx], opponent_id);
+        if (set == NULL)
+            return -1;
+
+        if (tag_count_set_matches(vec_data(counts), matches, &set->plain, &set->plain_queries,
+                search_index_symbols(index, fighter_idx),
+                search_index_range(index, fighter_idx)) < 0)
+            return -1;
+        if (tag_count_set_matches(vec_data(counts), matches, &set->joint, &set->joint_queries,
+                search_index_joint_symbols(index, fighter_idx),
+                search_index_joint_range(index, fighter_idx)) < 0)
+            return -1;
+
+        for (i = 0; i != (int)vec_count(&req->queries); ++i)
+        {
+            const struct tag_query* query = vec_get(&req->queries, i);
+            struct compiled_query* compiled;
+            if (query->query.max_edits == 0)
+                continue;
+            compiled = search_compile(ctx, &query->query, fighter_ids[fighter_idx], opponent_id);
+            if (compiled)
+                *(int*)vec_get(counts, i) += tag_count_matches(compiled, &query->query, index, fighter_idx);
+        }
+    }
+
+    for (i = 0; i != (int)vec_count(&req->queries); ++i)
+    {
+        const struct tag_query* query = vec_get(&req->queries, i);
+        struct tag_count tag;
+        tag.game_id = game->game_id;
+        tag.query_id = query->query_id;
+        tag.count = *(int*)vec_get(counts, i);
+        if (tag.count > 0 && vec_push(&batch->counts, &tag) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Adds every stream of the game to the library-wide FM-index. Streams left
+ * over from a batch that failed before the index was built are replaced.
+ */
+static int
+tag_index_game(struct fm_library* fm, int game_id, uint64_t stamp, const struct search_index* index)
+{
+    int fighter_idx;
+    fm_library_remove_game(fm, game_id);
+    for (fighter_idx = 0; fighter_idx != search_index_fighter_count(index); ++fighter_idx)
+        if (fm_library_add(fm, game_id, stamp, fighter_idx,
+                search_index_symbols(index, fighter_idx),
+                search_index_range(index, fighter_idx)) < 0)
+        {
+            fm_library_remove_game(fm, game_id);
+            return -1;
+        }
+    return 0;
+}
+
+/*
+ * Like statistics, tagging loads every game itself and leaves the search's
+ * own game alone. Games without frame data are taken off the queue without
+ * any tags.
+ *
+ * Every game is queued after it was imported, so this is also where games
+ * are added to the FM-index while their frame data is loaded anyway. The
+ * index is built and saved once per batch. Games that are already indexed
+ * aren't loaded at all if there are no tag queries.
+ */
+void
+tag_execute(struct plugin_ctx* ctx, const struct tag_request* req)
+{
+    struct frame_data fdata;
+    struct search_index index;
+    struct tag_batch* batch;
+    struct vec sets;     /* struct tag_set */
+    struct vec counts;   /* int - matches of each query in the current game */
+    struct vec matches;  /* struct query_range */
+    uint64_t start_us = time_get_us();
+    int i, indexed = 0;
+
+    frame_data_init(&fdata);
+    search_index_init(&index);
+    vec_init(&sets, sizeof(struct tag_set));
+    vec_init(&counts, sizeof(int));
+    vec_init(&matches, sizeof(struct query_range));
+
+    batch = mem_alloc(sizeof(struct tag_batch));
+    if (batch == NULL)
+        goto alloc_batch_failed;
+    batch->ctx = ctx;
+    batch->queries_hash = req->queries_hash;
+    vec_init(&batch->game_ids, sizeof(int));
+    vec_init(&batch->counts, sizeof(struct tag_count));
+
+    for (i = 0; i != (int)vec_count(&req->games); ++i)
+    {
+        const struct tag_game* game = vec_get(&req->games, i);
+        uint64_t stamp;
+        int needs_index;
+        if (tag_should_yield(ctx, start_us))
+            break;
+
+        needs_index = frame_data_stamp(game->game_id, &stamp) == 0 &&
+            !fm_library_has_game(&ctx->search.fm, game->game_id, stamp);
+        search_index_clear(&index);
+        frame_data_clear(&fdata);
+        if ((needs_index || vec_count(&req->queries) > 0) &&
+            frame_data_load(&fdata, game->game_id) == 0 &&
+            search_index_build(&index, &fdata, -1) == 0)
+        {
+            if (needs_index)
+            {
+                if (tag_index_game(&ctx->search.fm, game->game_id, stamp, &index) < 0)
+                    log_err("Failed to add game %d to the FM-index\n", game->game_id);
+                else
+                    indexed++;
+            }
+            if (tag_game(ctx, req, game, &index, &sets, &counts, &matches, batch) < 0)
+                goto fail;
+        }
+        if (vec_push(&batch->game_ids, &game->game_id) < 0)
+            goto fail;
+    }
+
+    if (indexed > 0 && (fm_library_build(&ctx->search.fm) < 0 ||
+            fm_library_save(&ctx->search.fm, ctx->search.fm_file_name.data) < 0))
+        log_err("Failed to update the FM-index\n");
+
+    /* Destroys the batch on failure */
+    if (pending_post(ctx, on_tag_batch, batch,
+            (GDestroyNotify)tag_batch_destroy, &batch->source_id) < 0)
+        goto post_failed;
+    goto done;
+
+fail:
+    tag_batch_destroy(batch);
+post_failed:
+alloc_batch_failed:
+    log_err("Failed to tag games\n");
+    mutex_lock(ctx->mutex);
+        ctx->tag_running = 0;
+    mutex_unlock(ctx->mutex);
+done:
+    vec_deinit(&matches);
+    vec_deinit(&counts);
+    tag_sets_deinit(&sets);
+    search_index_deinit(&index);
+    frame_data_deinit(&fdata);
+}
+
+/*
+ * Saves the current query under a name and marks it as a tag. Every game is
+ * queued again, and the worker counts the matches in the background.
+ */
+static void
+on_save_tag(GtkWidget* self, struct plugin_ctx* ctx)
+{
+    const char* name = gtk_editable_get_text(GTK_EDITABLE(ctx->tag_name));
+    const char* text = search_text(ctx);
+
+    if (*name == '\0' || *text == '\0')
+    {
+        status_set(ctx, "Enter a query and a name for the tag");
+        return;
+    }
+    ast_clear(&ctx->ast);
+    if (parser_parse(&ctx->parser, text, &ctx->ast) < 0 || nfa_check_ast(&ctx->ast) < 0)
+    {
+        status_set(ctx, "Invalid search");
+        return;
+    }
+    if (ctx->dbi->saved_query.set(ctx->db, cstr_view(name), cstr_view(text), ctx->max_edits, 1) < 0)
+    {
+        status_set(ctx, "Failed to save tag");
+        return;
+    }
+
+    status_set(ctx, "Tagging games...");
+    tag_submit(ctx);
+}
+
+GtkWidget*
+tags_ui_create(struct plugin_ctx* ctx)
+{
+    GtkWidget* button;
+    GtkWidget* hbox;
+
+    ctx->tag_name = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(ctx->tag_name), "Tag name");
+    gtk_widget_set_hexpand(ctx->tag_name, TRUE);
+    button = gtk_button_new_with_label("Save as tag");
+    g_signal_connect(button, "clicked", G_CALLBACK(on_save_tag), ctx);
+    hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
+    gtk_box_append(GTK_BOX(hbox), ctx->tag_name);
+    gtk_box_append(GTK_BOX(hbox), button);
+
+    return hbox;
+}
+
+void
+tags_ui_destroy(struct plugin_ctx* ctx)
+{
+    ctx->tag_name = NULL;
+}
@@ -0,0 +1,434 @@
+#include "search/ast.h"
+#include "search/ast_ops.h"
+#include "search/match.h"
+#include "search/prefilter.h"
+#include "search/symbol.h"
+
+#include "vh/vec.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#   define PREFILTER_X86_64
+#   if defined(_MSC_VER)
+#       include <intrin.h>
+#       define TARGET_AVX2
+#   else
+#       include <cpuid.h>
+#       define TARGET_AVX2 __attribute__((target("avx2")))
+#   endif
+#   include <immintrin.h>
+#endif
+
+/*
+ * Window sizes beyond this are treated as unbounded. Symbol streams of a
+ * single game are much shorter, and it prevents overflows when multiplying
+ * large repetition counts.
+ */
+#define LEN_LIMIT (1 << 24)
+
+struct literal
+{
+    uint64_t motion;
+    int before;
+    int after;
+};
+
+static int
+len_add(int a, int b)
+{
+    if (a < 0 || b < 0 || a + b > LEN_LIMIT)
+        return -1;
+    return a + b;
+}
+
+static int
+len_mul(int a, int n)
+{
+    if (a == 0 || n == 0)
+        return 0;
+    if (a < 0 || n < 0 || a > LEN_LIMIT / n)
+        return -1;
+    return a * n;
+}
+
+static int
+len_max(int a, int b)
+{
+    if (a < 0 || b < 0)
+        return -1;
+    return a > b ? a : b;
+}
+
+static int
+literal_cost(const struct literal* l)
+{
+    if (l->before < 0 || l->after < 0)
+        return LEN_LIMIT * 2;
+    return l->before + l->after;
+}
+
+/*
+ * Returns the maximum number of symbols the node can match, or -1 if the
+ * match length is unbounded.
+ */
+static int
+max_length(const struct ast* ast, int n)
+{
+    const union ast_node* node = &ast->nodes[n];
+    switch (node->info.type)
+    {
+        case AST_STATEMENT:
+            return len_add(
+                max_length(ast, node->statement.child),
+                max_length(ast, node->statement.next));
+        case AST_UNION:
+            return len_max(
+                max_length(ast, node->union_.child),
+                max_length(ast, node->union_.next));
+        case AST_REPETITION:
+            return len_mul(
+                max_length(ast, node->repetition.child),
+                node->repetition.max_reps);
+        case AST_CONTEXT: return max_length(ast, node->context.child);
+        case AST_TIMING:  return max_length(ast, node->timing.child);
+        case AST_DAMAGE:  return max_length(ast, node->damage.child);
+        case AST_INVERSION:
+        case AST_WILDCARD:
+        case AST_LABEL:
+        case AST_MOTION:
+            return 1;
+    }
+
+    return -1;
+}
+
+static struct literal*
+find_literal(struct vec* literals, uint64_t motion)
+{
+    VEC_FOR_EACH(literals, struct literal, l)
+        if (l->motion == motion)
+            return l;
+    VEC_END_EACH
+    return NULL;
+}
+
+static int
+add_literal(struct vec* literals, uint64_t motion, int before, int after)
+{
+    struct literal l;
+    struct literal* existing = find_literal(literals, motion);
+    l.motion = motion;
+    l.before = before;
+    l.after = after;
+
+    /* A motion occurring more than once is required at every occurrence.
+     * Keep the one giving the smallest window */
+    if (existing)
+    {
+        if (literal_cost(&l) < literal_cost(existing))
+            *existing = l;
+        return 0;
+    }
+
+    return vec_push(literals, &l);
+}
+
+/*
+ * Collects all motions that must appear in every match of node "n", along
+ * with how many symbols of the match can come before and after them.
+ */
+static int
+required_literals(const struct ast* ast, int n, struct vec* out)
+{
+    const union ast_node* node = &ast->nodes[n];
+    struct vec left, right;
+    int ret = -1;
+
+    switch (node->info.type)
+    {
+        case AST_MOTION:
+            return add_literal(out, node->motion.motion, 0, 0);
+
+        case AST_STATEMENT: {
+            int left_len = max_length(ast, node->statement.child);
+            int right_len = max_length(ast, node->statement.next);
+            vec_init(&left, sizeof(struct literal));
+            vec_init(&right, sizeof(struct literal));
+            if (required_literals(ast, node->statement.child, &left) < 0) goto statement_failed;
+            if (required_literals(ast, node->statement.next, &right) < 0) goto statement_failed;
+            VEC_FOR_EACH(&left, struct literal, l)
+                if (add_literal(out, l->motion, l->before, len_add(l->after, right_len)) < 0)
+                    goto statement_failed;
+            VEC_END_EACH
+            VEC_FOR_EACH(&right, struct literal, l)
+                if (add_literal(out, l->motion, len_add(left_len, l->before), l->after) < 0)
+                    goto statement_failed;
+            VEC_END_EACH
+            ret = 0;
+        statement_failed:
+            vec_deinit(&right);
+            vec_deinit(&left);
+            return ret;
+        }
+
+        case AST_UNION: {
+            vec_init(&left, sizeof(struct literal));
+            vec_init(&right, sizeof(struct literal));
+            if (required_literals(ast, node->union_.child, &left) < 0) goto union_failed;
+            if (required_literals(ast, node->union_.next, &right) < 0) goto union_failed;
+
+            /* Only motions required by both sides are required by the union */
+            VEC_FOR_EACH(&left, struct literal, l)
+                struct literal* r = find_literal(&right, l->motion);
+                if (r == NULL)
+                    continue;
+                if (add_literal(out, l->motion, len_max(l->before, r->before), len_max(l->after, r->after)) < 0)
+                    goto union_failed;
+            VEC_END_EACH
+            ret = 0;
+        union_failed:
+            vec_deinit(&right);
+            vec_deinit(&left);
+            return ret;
+        }
+
+        case AST_REPETITION: {
+            int child_len;
+            if (node->repetition.min_reps < 1 || node->repetition.max_reps == 0)
+                return 0;
+
+            /* Use the occurrence in the first repetition */
+            child_len = max_length(ast, node->repetition.child);
+            vec_init(&left, sizeof(struct literal));
+            if (required_literals(ast, node->repetition.child, &left) < 0)
+                goto repetition_failed;
+            VEC_FOR_EACH(&left, struct literal, l)
+                int after = node->repetition.max_reps < 0 ? -1 :
+                    len_add(l->after, len_mul(child_len, node->repetition.max_reps - 1));
+                if (add_literal(out, l->motion, l->before, after) < 0)
+                    goto repetition_failed;
+            VEC_END_EACH
+            ret = 0;
+        repetition_failed:
+            vec_deinit(&left);
+            return ret;
+        }
+
+        case AST_CONTEXT: return required_literals(ast, node->context.child, out);
+        case AST_TIMING:  return required_literals(ast, node->timing.child, out);
+        case AST_DAMAGE:  return required_literals(ast, node->damage.child, out);
+
+        /* An inversion matches any symbol except its child */
+        case AST_INVERSION:
+        case AST_WILDCARD:
+        case AST_LABEL:
+            return 0;
+    }
+
+    return 0;
+}
+
+static int
+find_scalar(const union symbol* symbols, int start, int end, uint64_t motion, uint64_t mask)
+{
+    for (; start != end; ++start)
+        if ((symbols[start].u64 & mask) == motion)
+            return start;
+    return end;
+}
+
+#if defined(PREFILTER_X86_64)
+static int
+lowest_bit(int bits)
+{
+    int i = 0;
+    while (!(bits & (1 << i)))
+        i++;
+    return i;
+}
+
+static int
+find_sse2(const union symbol* symbols, int start, int end, uint64_t motion, uint64_t mask)
+{
+    const __m128i m = _mm_set1_epi64x((long long)mask);
+    const __m128i v = _mm_set1_epi64x((long long)motion);
+    for (; start + 2 <= end; start += 2)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i*)(symbols + start));
+        __m128i eq32 = _mm_cmpeq_epi32(_mm_and_si128(s, m), v);
+        /* SSE2 has no 64-bit compare, both 32-bit halves must be equal */
+        __m128i eq64 = _mm_and_si128(eq32, _mm_shuffle_epi32(eq32, _MM_SHUFFLE(2, 3, 0, 1)));
+        int bits = _mm_movemask_pd(_mm_castsi128_pd(eq64));
+        if (bits)
+            return start + lowest_bit(bits);
+    }
+
+    return find_scalar(symbols, start, end, motion, mask);
+}
+
+TARGET_AVX2 static int
+find_avx2(const union symbol* symbols, int start, int end, uint64_t motion, uint64_t mask)
+{
+    const __m256i m = _mm256_set1_epi64x((long long)mask);
+    const __m256i v = _mm256_set1_epi64x((long long)motion);
+    for (; start + 4 <= end; start += 4)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(symbols + start));
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_and_si256(s, m), v);
+        int bits = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if (bits)
+            return start + lowest_bit(bits);
+    }
+
+    return find_scalar(symbols, start, end, motion, mask);
+}
+
+static int
+cpu_has_avx2(void)
+{
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+        return 0;
+    __cpuid(regs, 1);
+    /* OSXSAVE and AVX, then make sure the OS saves YMM registers */
+    if ((regs[2] & (1 << 27)) == 0 || (regs[2] & (1 << 28)) == 0)
+        return 0;
+    if ((_xgetbv(0) & 6) != 6)
+        return 0;
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+enum prefilter_isa
+prefilter_best_isa(void)
+{
+#if defined(PREFILTER_X86_64)
+    if (cpu_has_avx2())
+        return PREFILTER_AVX2;
+    return PREFILTER_SSE2;  /* Always available on x86_64 */
+#else
+    return PREFILTER_SCALAR;
+#endif
+}
+
+int
+prefilter_set_isa(struct prefilter* pf, enum prefilter_isa isa)
+{
+    if (isa > prefilter_best_isa())
+        return -1;
+
+    switch (isa)
+    {
+        case PREFILTER_SCALAR: pf->find = find_scalar; break;
+#if defined(PREFILTER_X86_64)
+        case PREFILTER_SSE2: pf->find = find_sse2; break;
+        case PREFILTER_AVX2: pf->find = find_avx2; break;
+#else
+        default: return -1;
+#endif
+    }
+
+    return 0;
+}
+
+void
+prefilter_init(struct prefilter* pf)
+{
+    pf->motion = 0;
+    pf->mask = 0;
+    pf->before = -1;
+    pf->after = -1;
+    pf->is_active = 0;
+    prefilter_set_isa(pf, prefilter_best_isa());
+}
+
+int
+prefilter_from_ast(struct prefilter* pf, const struct ast* ast)
+{
+    struct vec literals;
+    struct literal* best = NULL;
+
+    pf->is_active = 0;
+    if (ast->node_count == 0)
+        return 0;
+
+    vec_init(&literals, sizeof(struct literal));
+    if (required_literals(ast, 0, &literals) < 0)
+    {
+        vec_deinit(&literals);
+        return -1;
+    }
+
+    VEC_FOR_EACH(&literals, struct literal, l)
+        if (best == NULL || literal_cost(l) < literal_cost(best))
+            best = l;
+    VEC_END_EACH
+
+    if (best)
+    {
+        /* Compare the same bits the automaton compares */
+        struct matcher m = match_motion(best->motion, 0);
+        pf->motion = m.symbol.u64;
+        pf->mask = m.mask.u64;
+        pf->before = best->before;
+        pf->after = best->after;
+        pf->is_active = 1;
+
+        /* The joint stream can interleave any number of the other fighter's
+         * symbols between two steps */
+        if (ast_references_opponent(ast, 0))
+            pf->before = pf->after = -1;
+    }
+
+    vec_deinit(&literals);
+    return 0;
+}
+
+struct range
+prefilter_next_window(const struct prefilter* pf, const union symbol* symbols, struct range window)
+{
+    struct range result;
+    int p, q;
+
+    if (!pf->is_active)
+        return window;
+
+    p = prefilter_find_next(pf, symbols, window);
+    if (p == window.end)
+    {
+        result.start = result.end = window.end;
+        return result;
+    }
+
+    result.start = pf->before < 0 || p - pf->before < window.start ?
+        window.start : p - pf->before;
+    if (pf->after < 0)
+    {
+        result.end = window.end;
+        return result;
+    }
+    result.end = p + pf->after + 1 < window.end ? p + pf->after + 1 : window.end;
+
+    /* Merge windows of following occurrences if they overlap */
+    while (result.end != window.end)
+    {
+        struct range rest;
+        rest.start = p + 1;
+        rest.end = window.end;
+        q = prefilter_find_next(pf, symbols, rest);
+        if (q == window.end)
+            break;
+        if (pf->before >= 0 && q - pf->before > result.end)
+            break;
+        result.end = q + pf->after + 1 < window.end ? q + pf->after + 1 : window.end;
+        p = q;
+    }
+
+    return result;
+}
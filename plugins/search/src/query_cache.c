@@ -0,0 +1,213 @@
+#include "search/ast_ops.h"
+#include "search/dfa.h"
+#include "search/match.h"
+#include "search/nfa.h"
+#include "search/query_cache.h"
+
+#include "vh/time.h"
+
+#include <string.h>
+
+struct query_cache_entry
+{
+    struct compiled_query query;
+    struct ast key;  /* Normalized query, before labels were resolved */
+    uint64_t ast_hash;
+    int fighter_id;
+    int opponent_id;
+    unsigned last_used;
+};
+
+int
+compiled_query_init(struct compiled_query* query)
+{
+    if (ast_init(&query->ast) < 0)
+        return -1;
+    asm_init(&query->assembly);
+    bitnfa_init(&query->bitnfa);
+    prefilter_init(&query->prefilter);
+    memset(&query->stats, 0, sizeof(query->stats));
+    return 0;
+}
+
+void
+compiled_query_deinit(struct compiled_query* query)
+{
+    bitnfa_deinit(&query->bitnfa);
+    asm_deinit(&query->assembly);
+    ast_deinit(&query->ast);
+}
+
+/*
+ * Cutoffs measured with search-benchmarks. Up to one word of positions, the
+ * bit-parallel NFA compiles in 2-12us while the DFA and its assembly take
+ * 20-100us. The assembled DFA scans at about twice the speed, which only
+ * catches up after 10k symbols or so, more than a fighter's stream in a game.
+ *
+ * Every additional word slows the bit-parallel NFA down, while the DFA scans
+ * at the same speed and is reused from the cache for every game. Compiling it
+ * takes ~400us, but wildcards after a repetition blow it up: 1ms with 6
+ * wildcards, 5ms with 8, 58ms with 10.
+ */
+#define BITNFA_MAX_POSITIONS BITNFA_WORD_BITS
+#define BITNFA_MIN_WILDCARDS 6
+
+static int
+prefer_bitnfa(const struct nfa_graph* nfa)
+{
+    int n, wildcards = 0;
+    if (nfa->node_count - 1 <= BITNFA_MAX_POSITIONS)
+        return 1;
+    for (n = 1; n != nfa->node_count; ++n)
+        if (matches_wildcard(&nfa->nodes[n].matcher))
+            wildcards++;
+    return wildcards >= BITNFA_MIN_WILDCARDS;
+}
+
+int
+compiled_query_build(struct compiled_query* query, int max_edits)
+{
+    struct nfa_graph nfa;
+    struct dfa_table dfa;
+    struct query_stats* stats = &query->stats;
+    uint64_t t = time_get_us();
+
+    stats->ast_nodes = query->ast.node_count;
+    if (prefilter_from_ast(&query->prefilter, &query->ast) < 0)
+        goto prefilter_failed;
+    stats->stage_us[QUERY_STAGE_PREFILTER] = time_get_us() - t;
+
+    t = time_get_us();
+    nfa_init(&nfa);
+    if (nfa_compile(&nfa, &query->ast))
+        goto nfa_compile_failed;
+    nfa_export_dot(&nfa, "nfa.dot");
+    stats->nfa_states = nfa.node_count;
+    stats->stage_us[QUERY_STAGE_NFA] = time_get_us() - t;
+
+    /* Only one of the two engines is active at a time */
+    if (max_edits > 0 || prefer_bitnfa(&nfa))
+    {
+        t = time_get_us();
+        if (bitnfa_from_nfa(&query->bitnfa, &nfa) < 0)
+            goto bitnfa_compile_failed;
+        stats->bitnfa_positions = query->bitnfa.positions;
+        stats->stage_us[QUERY_STAGE_BITNFA] = time_get_us() - t;
+        nfa_deinit(&nfa);
+        return 0;
+    }
+
+    t = time_get_us();
+    dfa_init(&dfa);
+    if (dfa_from_nfa(&dfa, &nfa))
+        goto dfa_compile_failed;
+    dfa_export_dot(&dfa, "dfa.dot");
+    stats->dfa_states = dfa.tt.rows;
+    stats->stage_us[QUERY_STAGE_DFA] = time_get_us() - t;
+
+    t = time_get_us();
+    if (asm_compile(&query->assembly, &dfa))
+        goto assemble_failed;
+    stats->asm_size = query->assembly.code_size;
+    stats->stage_us[QUERY_STAGE_ASM] = time_get_us() - t;
+
+    dfa_deinit(&dfa);
+    nfa_deinit(&nfa);
+
+    return 0;
+
+    assemble_failed      : dfa_deinit(&dfa);
+    dfa_compile_failed   :
+    bitnfa_compile_failed: nfa_deinit(&nfa);
+    nfa_compile_failed   :
+    prefilter_failed     : return -1;
+}
+
+void
+query_cache_init(struct query_cache* cache, int capacity)
+{
+    vec_init(&cache->entries, sizeof(struct query_cache_entry));
+    cache->capacity = capacity;
+    cache->clock = 0;
+}
+
+void
+query_cache_deinit(struct query_cache* cache)
+{
+    query_cache_clear(cache);
+    vec_deinit(&cache->entries);
+}
+
+void
+query_cache_clear(struct query_cache* cache)
+{
+    VEC_FOR_EACH(&cache->entries, struct query_cache_entry, entry)
+        ast_deinit(&entry->key);
+        compiled_query_deinit(&entry->query);
+    VEC_END_EACH
+    vec_clear(&cache->entries);
+}
+
+struct compiled_query*
+query_cache_find(struct query_cache* cache, uint64_t ast_hash, const struct ast* ast, int fighter_id, int opponent_id)
+{
+    /* The cache is small, a linear search is fine. Hashes can collide, so the trees are compared too */
+    VEC_FOR_EACH(&cache->entries, struct query_cache_entry, entry)
+        if (entry->ast_hash == ast_hash && entry->fighter_id == fighter_id && entry->opponent_id == opponent_id &&
+            ast_trees_equal(&entry->key, 0, ast, 0))
+        {
+            entry->last_used = ++cache->clock;
+            return &entry->query;
+        }
+    VEC_END_EACH
+
+    return NULL;
+}
+
+struct compiled_query*
+query_cache_insert(struct query_cache* cache, uint64_t ast_hash, const struct ast* ast, int fighter_id, int opponent_id)
+{
+    struct query_cache_entry* entry;
+
+    if ((int)vec_count(&cache->entries) >= cache->capacity)
+    {
+        struct query_cache_entry* lru = NULL;
+        VEC_FOR_EACH(&cache->entries, struct query_cache_entry, e)
+            if (lru == NULL || e->last_used < lru->last_used)
+                lru = e;
+        VEC_END_EACH
+        if (lru)
+            query_cache_erase(cache, &lru->query);
+    }
+
+    entry = vec_emplace(&cache->entries);
+    if (entry == NULL)
+        goto emplace_failed;
+    if (ast_init(&entry->key) < 0)
+        goto init_key_failed;
+    if (ast_copy(&entry->key, ast) < 0)
+        goto copy_key_failed;
+    if (compiled_query_init(&entry->query) < 0)
+        goto init_query_failed;
+
+    entry->ast_hash = ast_hash;
+    entry->fighter_id = fighter_id;
+    entry->opponent_id = opponent_id;
+    entry->last_used = ++cache->clock;
+    return &entry->query;
+
+    init_query_failed :
+    copy_key_failed   : ast_deinit(&entry->key);
+    init_key_failed   : vec_pop(&cache->entries);
+    emplace_failed    : return NULL;
+}
+
+void
+query_cache_erase(struct query_cache* cache, struct compiled_query* query)
+{
+    /* "query" is the first member of the entry */
+    struct query_cache_entry* entry = (struct query_cache_entry*)query;
+    ast_deinit(&entry->key);
+    compiled_query_deinit(&entry->query);
+    vec_erase_element(&cache->entries, entry);
+}
@@ -0,0 +1,77 @@
+#include "search/bitnfa.h"
+#include "search/query_cache.h"
+#include "search/result_store.h"
+#include "search/search_index.h"
+
+#include "vh/db.h"
+
+struct load_ctx
+{
+    struct vec* matches;
+    int rows;
+};
+
+static int
+on_result(int symbol_start, int symbol_end, int distance, void* user)
+{
+    struct load_ctx* ctx = user;
+    struct fuzzy_range match;
+
+    /* A set without matches is returned as a single row of NULLs */
+    ctx->rows++;
+    if (symbol_start < 0)
+        return 0;
+
+    match.range.start = symbol_start;
+    match.range.end = symbol_end;
+    match.distance = distance;
+    return vec_push(ctx->matches, &match) < 0 ? -1 : 0;
+}
+
+int
+result_store_load(
+    struct db_interface* dbi, struct db* db,
+    const struct result_key* key, uint64_t frame_data_stamp,
+    struct vec* matches)
+{
+    struct load_ctx ctx = { matches, 0 };
+    vec_size count = vec_count(matches);
+
+    if (dbi->search_result.get(db,
+            key->query_hash, key->game_id, key->fighter_idx, key->target_idx, key->max_edits,
+            frame_data_stamp, SEARCH_INDEX_VERSION, SEARCH_ENGINE_VERSION,
+            on_result, &ctx) < 0)
+    {
+        vec_resize(matches, count);
+        return -1;
+    }
+
+    return ctx.rows > 0;
+}
+
+int
+result_store_save(
+    struct db_interface* dbi, struct db* db,
+    const struct result_key* key, uint64_t frame_data_stamp, int uses_labels,
+    const struct fuzzy_range* matches, int count)
+{
+    int i, set_id;
+
+    /* Deleting the old set also deletes its matches */
+    if (dbi->search_result.delete_set(db,
+            key->query_hash, key->game_id, key->fighter_idx, key->target_idx, key->max_edits) < 0)
+        return -1;
+
+    set_id = dbi->search_result.add_set(db,
+        key->query_hash, key->game_id, key->fighter_idx, key->target_idx, key->max_edits,
+        uses_labels, frame_data_stamp, SEARCH_INDEX_VERSION, SEARCH_ENGINE_VERSION);
+    if (set_id < 0)
+        return -1;
+
+    for (i = 0; i != count; ++i)
+        if (dbi->search_result.add(db, set_id,
+                matches[i].range.start, matches[i].range.end, matches[i].distance) < 0)
+            return -1;
+
+    return 0;
+}
@@ -2,21 +2,54 @@
 #include "search/symbol.h"
 
 #include "vh/frame_data.h"
+#include "vh/thread.h"
 
 #include <stddef.h>
 #include <stdio.h>
 
+#if defined(__x86_64__) || defined(_M_X64)
+#   define SEARCH_INDEX_X86_64
+#   if defined(_MSC_VER)
+#       define TARGET_AVX2
+#   else
+#       define TARGET_AVX2 __attribute__((target("avx2")))
+#   endif
+#   include <immintrin.h>
+#endif
+
 struct fighter_index
 {
     struct vec symbols;
     struct vec frame_start_idxs;
     struct vec frame_end_idxs;
+    struct vec joint_symbols;
+    int opponent;
 };
 
+static void
+fighter_index_init(struct fighter_index* fidx)
+{
+    vec_init(&fidx->symbols, sizeof(union symbol));
+    vec_init(&fidx->frame_start_idxs, sizeof(int));
+    vec_init(&fidx->frame_end_idxs, sizeof(int));
+    vec_init(&fidx->joint_symbols, sizeof(union symbol));
+    fidx->opponent = -1;
+}
+
+static void
+fighter_index_deinit(struct fighter_index* fidx)
+{
+    vec_deinit(&fidx->joint_symbols);
+    vec_deinit(&fidx->frame_end_idxs);
+    vec_deinit(&fidx->frame_start_idxs);
+    vec_deinit(&fidx->symbols);
+}
+
 void
 search_index_init(struct search_index* index)
 {
     vec_init(&index->fighters, sizeof(struct fighter_index));
+    search_index_set_isa(index, prefilter_best_isa());
 }
 
 void
@@ -26,150 +59,469 @@ search_index_deinit(struct search_index* index)
     vec_deinit(&index->fighters);
 }
 
+/* Status kinds, see FIGHTER_STATUS_KIND_* */
+#define STATUS_REBOUND_STOP 0x24
+#define STATUS_REBOUND      0x25
+#define STATUS_GUARD_DAMAGE 0x1E
+
+/*
+ * A fast fall instantly sets the vertical speed to the fast fall speed. This
+ * is a lot more than any fighter's gravity can accelerate in a single frame.
+ */
+#define FASTFALL_MIN_ACCEL  0.4f
+
+struct fighter_flags
+{
+    char dead;
+    char hitlag;
+    char hitstun;
+    char shieldlag;
+    char rising;
+    char falling;
+    char buried;
+    char clank;
+    char crossup;
+    char fastfall;
+};
+
 static int
-search_index_build_fighter(struct fighter_index* fidx, int me_idx, const struct frame_data* fdata)
+is_buried_motion(uint64_t motion)
 {
-    int frame;
-    for (frame = 0; frame != fdata->frame_count; ++frame)
+    /* hash40("bury") = 0x4d68198c3 */
+    /* hash40("bury_wait") = 0x9c11fbb90 */
+    /* hash40("bury_jump") = 0x91b423e63 */
+    return motion == 0x4d68198c3ul || motion == 0x9c11fbb90ul || motion == 0x91b423e63ul;
+}
+
+/*
+ * Derives the state of fighter "idx" on a single frame. "other" is the
+ * fighter it is interacting with.
+ */
+static void
+derive_fighter_flags(struct fighter_flags* f, const struct frame_data* fdata, int idx, int other, int frame)
+{
+    int prev = frame > 0 ? frame - 1 : 0;
+    int prev2 = frame > 1 ? frame - 2 : prev;
+    float dy = fdata->posy[idx][frame] - fdata->posy[idx][prev];
+    float prev_dy = fdata->posy[idx][prev] - fdata->posy[idx][prev2];
+
+    f->dead =
+        (fdata->stocks[idx][frame] < fdata->stocks[idx][prev]);
+    f->shieldlag =
+        (fdata->status[idx][frame] == STATUS_GUARD_DAMAGE);
+    f->hitlag =
+        !f->shieldlag &&
+        (fdata->flags[other][frame] & FRAME_DATA_ATTACK_CONNECTED) &&
+        (fdata->hitstun[idx][frame] == fdata->hitstun[idx][prev]);
+    f->hitstun =
+        !f->hitlag &&
+        (fdata->hitstun[idx][frame] > 0);
+    f->rising = (dy > 0);
+    f->falling = (dy < 0);
+    f->buried = is_buried_motion(fdata->motion[idx][frame]);
+    f->clank =
+        (fdata->status[idx][frame] == STATUS_REBOUND_STOP) ||
+        (fdata->status[idx][frame] == STATUS_REBOUND);
+    f->fastfall =
+        !f->hitstun &&
+        (prev_dy - dy > FASTFALL_MIN_ACCEL) &&
+        dy < 0;
+
+    /* Connecting with an attack from behind the other fighter */
+    f->crossup =
+        (fdata->flags[idx][frame] & FRAME_DATA_ATTACK_CONNECTED) &&
+        ((fdata->flags[other][frame] & FRAME_DATA_FACING_LEFT) ?
+            fdata->posx[idx][frame] > fdata->posx[other][frame] :
+            fdata->posx[idx][frame] < fdata->posx[other][frame]);
+}
+
+/*
+ * Returns the frames on which the motion changes, i.e. where a new symbol
+ * starts. Frame 0 always starts a symbol. "starts" must have room for
+ * "frame_count" entries.
+ */
+static int
+find_runs_scalar(int* starts, const uint64_t* motion, int frame_count)
+{
+    int frame, count = 0;
+    for (frame = 0; frame != frame_count; ++frame)
+        if (frame == 0 || motion[frame] != motion[frame - 1])
+            starts[count++] = frame;
+    return count;
+}
+
+#if defined(SEARCH_INDEX_X86_64)
+/*
+ * Offsets of the set bits of a 4-bit mask, packed to the front, followed by
+ * the number of set bits.
+ */
+static const int32_t compact_lut[16][5] = {
+    {0, 0, 0, 0, 0}, {0, 0, 0, 0, 1}, {1, 0, 0, 0, 1}, {0, 1, 0, 0, 2},
+    {2, 0, 0, 0, 1}, {0, 2, 0, 0, 2}, {1, 2, 0, 0, 2}, {0, 1, 2, 0, 3},
+    {3, 0, 0, 0, 1}, {0, 3, 0, 0, 2}, {1, 3, 0, 0, 2}, {0, 1, 3, 0, 3},
+    {2, 3, 0, 0, 2}, {0, 2, 3, 0, 3}, {1, 2, 3, 0, 3}, {0, 1, 2, 3, 4}
+};
+
+/*
+ * Compares 4 motions at a time with the motions of the previous frames. The
+ * frames that differ are written out by storing all 4 lanes from a lookup
+ * table and only advancing by the number of changes, which avoids branching
+ * on every bit.
+ */
+TARGET_AVX2 static int
+find_runs_avx2(int* starts, const uint64_t* motion, int frame_count)
+{
+    int frame = 1, count = 0;
+    if (frame_count == 0)
+        return 0;
+
+    starts[count++] = 0;
+    for (; frame + 4 <= frame_count; frame += 4)
     {
-        int op_idx = fdata->fighter_count - me_idx - 1;
-        int prev_frame = frame > 0 ? frame - 1 : 0;
-
-        char me_dead = 0;  /* TODO */
-        char me_hitlag =
-            (fdata->flags[op_idx][frame] & FRAME_DATA_ATTACK_CONNECTED) &&
-            (fdata->hitstun[me_idx][frame] == fdata->hitstun[me_idx][prev_frame]);
-        char me_hitstun =
-            !me_hitlag &&
-            (fdata->hitstun[me_idx][frame] > 0);
-        char me_shieldlag =
-            (fdata->status[me_idx][frame] == 30);  /* FIGHTER_STATUS_KIND_GUARD_DAMAGE */
-        char me_rising =
-            (fdata->posy[me_idx][frame] > fdata->posy[me_idx][prev_frame]);
-        char me_falling =
-            (fdata->posy[me_idx][frame] < fdata->posy[me_idx][prev_frame]);
-        char me_buried = 0;   /* TODO */
-        char me_phantom = 0;  /* TODO */
-
-        char op_dead = 0;  /* TODO */
-        char op_hitlag =
-            (fdata->flags[me_idx][frame] & FRAME_DATA_ATTACK_CONNECTED) &&
-            (fdata->hitstun[op_idx][frame] == fdata->hitstun[op_idx][prev_frame]);
-        char op_hitstun =
-            !op_hitlag &&
-            (fdata->hitstun[op_idx][frame] > 0);
-        char op_shieldlag =
-            (fdata->status[op_idx][frame] == 30);  /* FIGHTER_STATUS_KIND_GUARD_DAMAGE */
-        char op_rising =
-            (fdata->posy[op_idx][frame] > fdata->posy[op_idx][prev_frame]);
-        char op_falling =
-            (fdata->posy[op_idx][frame] < fdata->posy[op_idx][prev_frame]);
-        char op_buried = 0;   /* TODO */
-        char op_phantom = 0;  /* TODO */
-
-        /*
-         * Only add a symbol if it is meaningfully different from the previously
-         * added symbol.
-         *
-         * Currently, the granularity of symbols is based on the motion value.
-         * We make sure that successive motion values are always different.
-         *
-         * The consequence of this is we'll need to merge some of the state
-         * flags.
-         */
-        uint64_t motion = fdata->motion[me_idx][frame];
-        if (vec_count(&fidx->symbols) > 0)
+        __m256i cur = _mm256_loadu_si256((const __m256i*)(motion + frame));
+        __m256i prev = _mm256_loadu_si256((const __m256i*)(motion + frame - 1));
+        int bits = ~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(cur, prev))) & 0xF;
+        __m128i offsets = _mm_loadu_si128((const __m128i*)compact_lut[bits]);
+
+        /* count <= frame, so the 4 lanes always fit into "starts" */
+        _mm_storeu_si128((__m128i*)(starts + count), _mm_add_epi32(offsets, _mm_set1_epi32(frame)));
+        count += compact_lut[bits][4];
+    }
+
+    for (; frame != frame_count; ++frame)
+        if (motion[frame] != motion[frame - 1])
+            starts[count++] = frame;
+
+    return count;
+}
+#endif
+
+/*
+ * Builds the symbols of fighter "me_idx" as seen from that fighter, with
+ * "op_idx" being its opponent. Jobs run on worker threads, so they must not
+ * allocate: the vectors are sized for one symbol per frame beforehand, and
+ * "count" is the number of symbols that were actually written.
+ */
+struct build_job
+{
+    struct fighter_index stream;
+    const struct frame_data* fdata;
+    search_index_find_runs_func find_runs;
+    struct thread thread;
+    int me_idx;
+    int op_idx;
+    int count;
+    unsigned is_threaded : 1;
+};
+
+static void*
+build_stream(void* arg)
+{
+    struct build_job* job = arg;
+    const struct frame_data* fdata = job->fdata;
+    union symbol* symbols = vec_data(&job->stream.symbols);
+    int* starts = vec_data(&job->stream.frame_start_idxs);
+    int* ends = vec_data(&job->stream.frame_end_idxs);
+    int me_idx = job->me_idx;
+    int op_idx = job->op_idx;
+    int count, i, frame;
+    int last_hit_idx = -1;
+
+    /*
+     * The granularity of symbols is based on the motion value, so every
+     * symbol covers a run of frames with the same motion. The state flags of
+     * all frames in the run are merged into the symbol.
+     */
+    count = job->find_runs(starts, fdata->motion[me_idx], fdata->frame_count);
+    for (i = 0; i != count; ++i)
+    {
+        union symbol* sym = &symbols[i];
+        int start = starts[i];
+        int end = i + 1 < count ? starts[i + 1] : fdata->frame_count;
+
+        ends[i] = end;
+        *sym = symbol_make(fdata->motion[me_idx][start]);
+        sym->op_damage = symbol_damage_bucket(fdata->damage[op_idx][start]);
+        sym->prev_frames = i > 0 ?
+            symbol_frames_bucket(start - starts[i - 1]) :
+            SYMBOL_FRAMES_BUCKETS - 1;
+
+        for (frame = start; frame != end; ++frame)
+        {
+            struct fighter_flags me, op;
+            char trade;
+
+            derive_fighter_flags(&me, fdata, me_idx, op_idx, frame);
+            derive_fighter_flags(&op, fdata, op_idx, me_idx, frame);
+            trade =
+                (fdata->flags[me_idx][frame] & FRAME_DATA_ATTACK_CONNECTED) &&
+                (fdata->flags[op_idx][frame] & FRAME_DATA_ATTACK_CONNECTED) &&
+                !me.shieldlag && !op.shieldlag;
+
+            /*
+             * It's possible that a move starts before it hits a shield or
+             * connects with the opponent. If this happpens, modify the flag on
+             * the existing symbol so it looks like the move always hit. Rising
+             * and falling moves are handled the same way.
+             */
+            if (me.hitlag)    sym->me_hitlag = 1;
+            if (me.hitstun)   sym->me_hitstun = 1;
+            if (me.shieldlag) sym->me_shieldlag = 1;
+            if (me.rising)    sym->me_rising = 1;
+            if (me.falling)   sym->me_falling = 1;
+            if (me.buried)    sym->me_buried = 1;
+            if (me.clank)     sym->me_clank = 1;
+            if (me.crossup)   sym->me_crossup = 1;
+            if (me.fastfall)  sym->me_fastfall = 1;
+            if (op.hitlag)    sym->op_hitlag = 1;
+            if (op.hitstun)   sym->op_hitstun = 1;
+            if (op.shieldlag) sym->op_shieldlag = 1;
+            if (op.buried)    sym->op_buried = 1;
+            if (trade)        sym->trade = 1;
+
+            /*
+             * A fighter usually loses its stock long after the move that killed
+             * it connected. The kill is credited to the last move that put the
+             * opponent into hitlag.
+             */
+            if (op.hitlag)
+                last_hit_idx = i;
+            if (me.dead)
+                sym->me_dead = 1;
+            if (op.dead && last_hit_idx >= 0)
+                symbols[last_hit_idx].op_dead = 1;
+        }
+    }
+
+    job->count = count;
+    return NULL;
+}
+
+/*
+ * Merges our own symbols with the symbols of the opponent in the order they
+ * started. The opponent's symbols are built from the opponent's perspective,
+ * i.e. "me_hitstun" on an opponent symbol means the opponent is in hitstun,
+ * and they are marked with "is_op".
+ */
+static int
+search_index_build_joint(struct fighter_index* fidx, const struct fighter_index* op)
+{
+    int i = 0, j = 0;
+    int own_count = vec_count(&fidx->symbols);
+    int op_count = vec_count(&op->symbols);
+
+    if (vec_reserve(&fidx->joint_symbols, own_count + op_count) < 0)
+        return -1;
+
+    while (i != own_count || j != op_count)
+    {
+        union symbol s;
+
+        /* Our own motion goes first if both fighters change on the same frame */
+        if (j == op_count || (i != own_count &&
+            *(int*)vec_get(&fidx->frame_start_idxs, i) <= *(int*)vec_get(&op->frame_start_idxs, j)))
         {
-            union symbol* last_sym = vec_back(&fidx->symbols);
-            if (last_sym->motionl == (motion & 0xFFFFFFFF) &&
-                last_sym->motionh == (motion >> 32))
-            {
-                /*
-                 * It's possible that a move starts before it hits a shield or
-                 * connects with the opponent. If this happpens, modify the
-                 * flag on the existing symbol so it looks like the move always
-                 * hit.
-                 */
-                if (me_hitlag)    last_sym->me_hitlag = 1;
-                if (me_hitstun)   last_sym->me_hitstun = 1;
-                if (me_shieldlag) last_sym->me_shieldlag = 1;
-                if (op_hitlag)    last_sym->op_hitlag = 1;
-                if (op_hitstun)   last_sym->op_hitstun = 1;
-                if (op_shieldlag) last_sym->op_shieldlag = 1;
-
-                /* It probably makes sense to handle rising and falling moves
-                 * the same way */
-                if (me_rising)    last_sym->me_rising = 1;
-                if (me_falling)   last_sym->me_falling = 1;
-                if (op_rising)    last_sym->op_rising = 1;
-                if (op_falling)   last_sym->op_falling = 1;
-
-                /* The last symbol had the same motion value as the current, skip */
-                continue;
-            }
+            s = *(union symbol*)vec_get(&fidx->symbols, i++);
+        }
+        else
+        {
+            s = *(union symbol*)vec_get(&op->symbols, j++);
+            s.is_op = 1;
         }
 
-        union symbol* new_sym = vec_emplace(&fidx->symbols);
-        int* frame_start_idx = vec_emplace(&fidx->frame_start_idxs);
-        int* frame_end_idx = vec_emplace(&fidx->frame_end_idxs);
-        if (new_sym == NULL || frame_start_idx == NULL || frame_end_idx == NULL)
+        if (vec_push(&fidx->joint_symbols, &s) < 0)
             return -1;
-        *new_sym = symbol_make(motion,
-            me_dead, me_hitlag, me_hitstun, me_shieldlag, me_rising, me_falling, me_buried, me_phantom,
-            op_dead, op_hitlag, op_hitstun, op_shieldlag, op_rising, op_falling, op_buried, op_phantom);
-        *frame_start_idx = frame;
-        *frame_end_idx = frame + 1;  /* Should be updated on the next iteration, but just in case */
-
-        /* Update the previous symbol's frame end index */
-        if (vec_count(&fidx->frame_end_idxs) > 1)
-            *(int*)vec_get_back(&fidx->frame_end_idxs, 2) = frame;  /* 2nd last element */
     }
 
-    /* Update the previous symbol's frame end index */
-    if (vec_count(&fidx->frame_end_idxs) > 1)
-        *(int*)vec_back(&fidx->frame_end_idxs) = fdata->frame_count;
+    return 0;
+}
+
+/*
+ * In 1v1, the opponent is the other fighter. Without a target in games with
+ * more fighters, the first fighter is paired with the last, the second with
+ * the second to last, and so on.
+ */
+static int
+pick_opponent(int fighter_count, int fighter, int target)
+{
+    int op;
+    if (target >= 0 && target < fighter_count && target != fighter)
+        return target;
+    op = fighter_count - fighter - 1;
+    return op != fighter ? op : (fighter + 1) % fighter_count;
+}
+
+static struct build_job*
+find_job(struct vec* jobs, int me_idx, int op_idx)
+{
+    VEC_FOR_EACH(jobs, struct build_job, job)
+        if (job->me_idx == me_idx && job->op_idx == op_idx)
+            return job;
+    VEC_END_EACH
+    return NULL;
+}
+
+static int
+add_job(struct vec* jobs, const struct search_index* index, const struct frame_data* fdata, int me_idx, int op_idx)
+{
+    struct build_job* job;
+    if (find_job(jobs, me_idx, op_idx) != NULL)
+        return 0;
+
+    job = vec_emplace(jobs);
+    if (job == NULL)
+        return -1;
+    fighter_index_init(&job->stream);
+    job->fdata = fdata;
+    job->find_runs = index->find_runs;
+    job->me_idx = me_idx;
+    job->op_idx = op_idx;
+    job->count = 0;
+    job->is_threaded = 0;
+
+    if (vec_resize(&job->stream.symbols, fdata->frame_count) < 0 ||
+        vec_resize(&job->stream.frame_start_idxs, fdata->frame_count) < 0 ||
+        vec_resize(&job->stream.frame_end_idxs, fdata->frame_count) < 0)
+    {
+        return -1;
+    }
 
     return 0;
 }
 
+static void
+free_jobs(struct vec* jobs)
+{
+    VEC_FOR_EACH(jobs, struct build_job, job)
+        fighter_index_deinit(&job->stream);
+    VEC_END_EACH
+    vec_deinit(jobs);
+}
+
+/*
+ * Every fighter needs its own stream and the stream of its opponent as seen
+ * from the opponent. In 1v1 these are the same two streams, so each distinct
+ * pair of fighters is only built once. The streams are independent of each
+ * other and are built in parallel.
+ */
+static void
+run_jobs(struct vec* jobs)
+{
+    int i, count = vec_count(jobs);
+
+    /* The calling thread builds the last stream itself */
+    for (i = 0; i < count - 1; ++i)
+    {
+        struct build_job* job = vec_get(jobs, i);
+        job->is_threaded = thread_start(&job->thread, build_stream, job) == 0;
+    }
+    for (i = 0; i != count; ++i)
+    {
+        struct build_job* job = vec_get(jobs, i);
+        if (!job->is_threaded)
+            build_stream(job);
+    }
+    for (i = 0; i != count; ++i)
+    {
+        struct build_job* job = vec_get(jobs, i);
+        if (job->is_threaded)
+            thread_join(job->thread, 0);
+
+        vec_resize(&job->stream.symbols, job->count);
+        vec_resize(&job->stream.frame_start_idxs, job->count);
+        vec_resize(&job->stream.frame_end_idxs, job->count);
+    }
+}
+
 int
-search_index_build(struct search_index* index, const struct frame_data* fdata)
+search_index_build(struct search_index* index, const struct frame_data* fdata, int target)
 {
+    struct vec jobs;
     int fighter;
+
+    vec_init(&jobs, sizeof(struct build_job));
     for (fighter = 0; fighter != fdata->fighter_count; ++fighter)
     {
+        int op_idx = pick_opponent(fdata->fighter_count, fighter, target);
+        if (add_job(&jobs, index, fdata, fighter, op_idx) < 0 ||
+            add_job(&jobs, index, fdata, op_idx, fighter) < 0)
+        {
+            goto fail;
+        }
+    }
+
+    run_jobs(&jobs);
+
+    for (fighter = 0; fighter != fdata->fighter_count; ++fighter)
+    {
+        int op_idx = pick_opponent(fdata->fighter_count, fighter, target);
+        const struct build_job* me = find_job(&jobs, fighter, op_idx);
+        const struct build_job* op = find_job(&jobs, op_idx, fighter);
         struct fighter_index* fidx = vec_emplace(&index->fighters);
         if (fidx == NULL)
             goto fail;
-        vec_init(&fidx->symbols, sizeof(union symbol));
-        vec_init(&fidx->frame_start_idxs, sizeof(int));
-        vec_init(&fidx->frame_end_idxs, sizeof(int));
-        if (search_index_build_fighter(vec_get(&index->fighters, fighter), fighter, fdata) < 0)
+        fighter_index_init(fidx);
+        fidx->opponent = op_idx;
+
+        if (vec_push_vec(&fidx->symbols, &me->stream.symbols) < 0 ||
+            vec_push_vec(&fidx->frame_start_idxs, &me->stream.frame_start_idxs) < 0 ||
+            vec_push_vec(&fidx->frame_end_idxs, &me->stream.frame_end_idxs) < 0)
+        {
+            goto fail;
+        }
+
+        /* The opponent's symbols, as seen from the opponent */
+        if (search_index_build_joint(fidx, &op->stream) < 0)
             goto fail;
     }
 
+    free_jobs(&jobs);
     return 0;
 
 fail:
+    free_jobs(&jobs);
     search_index_clear(index);
     return -1;
 }
 
+int
+search_index_set_isa(struct search_index* index, enum prefilter_isa isa)
+{
+    if (isa > prefilter_best_isa())
+        return -1;
+
+    switch (isa)
+    {
+#if defined(SEARCH_INDEX_X86_64)
+        case PREFILTER_AVX2: index->find_runs = find_runs_avx2; break;
+#endif
+        /* There is no SSE2 version, SSE2 has no 64-bit compare */
+        default: index->find_runs = find_runs_scalar; break;
+    }
+
+    return 0;
+}
+
 void
 search_index_clear(struct search_index* index)
 {
     VEC_FOR_EACH(&index->fighters, struct fighter_index, fighter)
-        vec_deinit(&fighter->symbols);
-        vec_deinit(&fighter->frame_start_idxs);
-        vec_deinit(&fighter->frame_end_idxs);
+        fighter_index_deinit(fighter);
     VEC_END_EACH
     vec_clear(&index->fighters);
 }
 
 int
-search_index_symbol_count(struct search_index* index, int fighter_idx)
+search_index_opponent(const struct search_index* index, int fighter_idx)
 {
-    struct fighter_index* fighter = vec_get(&index->fighters, fighter_idx);
+    const struct fighter_index* fighter = vec_get(&index->fighters, fighter_idx);
+    return fighter->opponent;
+}
+
+int
+search_index_symbol_count(const struct search_index* index, int fighter_idx)
+{
+    const struct fighter_index* fighter = vec_get(&index->fighters, fighter_idx);
     return vec_count(&fighter->symbols);
 }
 
@@ -179,3 +531,46 @@ search_index_symbols(const struct search_index* index, int fighter_idx)
     struct fighter_index* fighter = vec_get(&index->fighters, fighter_idx);
     return vec_data(&fighter->symbols);
 }
+
+int
+search_index_joint_symbol_count(const struct search_index* index, int fighter_idx)
+{
+    const struct fighter_index* fighter = vec_get(&index->fighters, fighter_idx);
+    return vec_count(&fighter->joint_symbols);
+}
+
+const union symbol*
+search_index_joint_symbols(const struct search_index* index, int fighter_idx)
+{
+    const struct fighter_index* fighter = vec_get(&index->fighters, fighter_idx);
+    return vec_data(&fighter->joint_symbols);
+}
+
+int
+search_index_find_frame(const struct search_index* index, int fighter_idx, int frame)
+{
+    const struct fighter_index* fighter = vec_get(&index->fighters, fighter_idx);
+    int lo = 0, hi = vec_count(&fighter->frame_start_idxs);
+
+    /* Last symbol that starts on or before the frame */
+    while (hi - lo > 1)
+    {
+        int mid = (lo + hi) / 2;
+        if (*(int*)vec_get(&fighter->frame_start_idxs, mid) <= frame)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+struct range
+search_index_frames(const struct search_index* index, int fighter_idx, struct range symbols)
+{
+    const struct fighter_index* fighter = vec_get(&index->fighters, fighter_idx);
+    struct range frames;
+    frames.start = *(int*)vec_get(&fighter->frame_start_idxs, symbols.start);
+    frames.end = *(int*)vec_get(&fighter->frame_end_idxs, symbols.end - 1);
+    return frames;
+}
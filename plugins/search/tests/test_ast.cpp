@@ -552,3 +552,33 @@ TEST_F(NAME, damage_range7)
     ASSERT_THAT(parser_parse(&parser, "0xa >=15% 10%-30% 50%-80%", &ast2), Eq(0));
     EXPECT_THAT(ast_trees_equal(&ast1, 0, &ast2, 0), IsTrue());
 }
+
+TEST_F(NAME, normalize_grouped_statements)
+{
+    ASSERT_THAT(parser_parse(&parser, "0xa->0xb->0xc->0xd", &ast1), Eq(0));
+    ASSERT_THAT(parser_parse(&parser, "0xa->(0xb->(0xc->0xd))", &ast2), Eq(0));
+    EXPECT_THAT(ast_trees_equal(&ast1, 0, &ast2, 0), IsFalse());
+    ast_normalize(&ast1);
+    ast_normalize(&ast2);
+    EXPECT_THAT(ast_trees_equal(&ast1, 0, &ast2, 0), IsTrue());
+    EXPECT_THAT(ast_hash(&ast1, 0), Eq(ast_hash(&ast2, 0)));
+}
+
+TEST_F(NAME, normalize_grouped_unions)
+{
+    ASSERT_THAT(parser_parse(&parser, "0xa->(0xb|0xc|0xd)", &ast1), Eq(0));
+    ASSERT_THAT(parser_parse(&parser, "(0xa)->(0xb|(0xc|0xd))", &ast2), Eq(0));
+    ast_normalize(&ast1);
+    ast_normalize(&ast2);
+    EXPECT_THAT(ast_trees_equal(&ast1, 0, &ast2, 0), IsTrue());
+    EXPECT_THAT(ast_hash(&ast1, 0), Eq(ast_hash(&ast2, 0)));
+}
+
+TEST_F(NAME, normalize_keeps_order)
+{
+    ASSERT_THAT(parser_parse(&parser, "0xa->0xb->0xc", &ast1), Eq(0));
+    ASSERT_THAT(parser_parse(&parser, "0xa->(0xc->0xb)", &ast2), Eq(0));
+    ast_normalize(&ast1);
+    ast_normalize(&ast2);
+    EXPECT_THAT(ast_trees_equal(&ast1, 0, &ast2, 0), IsFalse());
+}
@@ -0,0 +1,344 @@
+#include "gmock/gmock.h"
+
+#include "search/asm.h"
+#include "search/ast.h"
+#include "search/ast_post.h"
+#include "search/bitnfa.h"
+#include "search/dfa.h"
+#include "search/nfa.h"
+#include "search/parser.h"
+#include "search/symbol.h"
+
+#include "vh/vec.h"
+
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define NAME search_differential
+
+using namespace testing;
+
+/*
+ * Generates random queries and symbol streams, and checks that the
+ * bit-parallel NFA simulation, the DFA and the JIT compiled DFA find exactly
+ * the same matches. Any disagreement is minimized before it is reported, by
+ * replacing parts of the query with their children and removing symbols from
+ * the stream for as long as the engines still disagree.
+ *
+ * Set SEARCH_DIFFERENTIAL_ITERATIONS to run more than the default number of
+ * queries, e.g. after changing one of the engines.
+ */
+
+static bool
+operator==(const struct range& a, const struct range& b)
+{
+    return a.start == b.start && a.end == b.end;
+}
+
+namespace {
+
+struct Expr
+{
+    enum Type { MOTION, WILDCARD, SEQUENCE, UNION, REPETITION } type;
+    std::vector<std::shared_ptr<Expr>> children;
+    uint64_t motion = 0;
+    int min_reps = 0;
+    int max_reps = 0;
+};
+
+typedef std::shared_ptr<Expr> ExprPtr;
+
+class Random
+{
+public:
+    explicit Random(uint32_t seed) : state(seed) {}
+    int next(int n)
+    {
+        state = state * 1103515245 + 12345;
+        return (int)((state >> 16) & 0x7FFF) % n;
+    }
+private:
+    uint32_t state;
+};
+
+#define MOTION_COUNT 4
+
+ExprPtr
+leaf(Random& rng)
+{
+    ExprPtr e = std::make_shared<Expr>();
+    if (rng.next(6) == 0)
+        e->type = Expr::WILDCARD;
+    else
+    {
+        e->type = Expr::MOTION;
+        e->motion = 0xa + rng.next(MOTION_COUNT);
+    }
+    return e;
+}
+
+ExprPtr
+generate(Random& rng, int depth)
+{
+    if (depth == 0 || rng.next(3) == 0)
+        return leaf(rng);
+
+    ExprPtr e = std::make_shared<Expr>();
+    switch (rng.next(3))
+    {
+        case 0:
+            e->type = Expr::SEQUENCE;
+            e->children.push_back(generate(rng, depth - 1));
+            e->children.push_back(generate(rng, depth - 1));
+            break;
+        case 1:
+            e->type = Expr::UNION;
+            e->children.push_back(generate(rng, depth - 1));
+            e->children.push_back(generate(rng, depth - 1));
+            break;
+        default:
+            e->type = Expr::REPETITION;
+            e->children.push_back(generate(rng, depth - 1));
+            switch (rng.next(4))
+            {
+                case 0: e->min_reps = 1; e->max_reps = -1; break;
+                case 1: e->min_reps = 0; e->max_reps = -1; break;
+                case 2: e->min_reps = 0; e->max_reps = 1; break;
+                default:
+                    e->min_reps = 1 + rng.next(3);
+                    e->max_reps = e->min_reps + rng.next(3);
+                    break;
+            }
+            break;
+    }
+    return e;
+}
+
+void
+write(std::ostream& os, const ExprPtr& e)
+{
+    switch (e->type)
+    {
+        case Expr::MOTION:
+            os << "0x" << std::hex << e->motion << std::dec;
+            break;
+        case Expr::WILDCARD:
+            os << ".";
+            break;
+        case Expr::SEQUENCE:
+            os << "("; write(os, e->children[0]); os << " -> "; write(os, e->children[1]); os << ")";
+            break;
+        case Expr::UNION:
+            os << "("; write(os, e->children[0]); os << " | "; write(os, e->children[1]); os << ")";
+            break;
+        case Expr::REPETITION:
+            os << "("; write(os, e->children[0]); os << ")";
+            if (e->min_reps == 1 && e->max_reps == -1)
+                os << "+";
+            else if (e->min_reps == 0 && e->max_reps == -1)
+                os << "*";
+            else if (e->min_reps == 0 && e->max_reps == 1)
+                os << "?";
+            else
+                os << "{" << e->min_reps << "," << e->max_reps << "}";
+            break;
+    }
+}
+
+std::string
+to_string(const ExprPtr& e)
+{
+    std::ostringstream os;
+    write(os, e);
+    return os.str();
+}
+
+/* All expressions that are one step simpler, i.e. a subtree replaced by one of its children */
+void
+simplifications(const ExprPtr& e, std::vector<ExprPtr>& out)
+{
+    for (const ExprPtr& child : e->children)
+        out.push_back(child);
+    for (size_t i = 0; i != e->children.size(); ++i)
+    {
+        std::vector<ExprPtr> simpler;
+        simplifications(e->children[i], simpler);
+        for (const ExprPtr& s : simpler)
+        {
+            ExprPtr copy = std::make_shared<Expr>(*e);
+            copy->children[i] = s;
+            out.push_back(copy);
+        }
+    }
+}
+
+std::vector<struct range>
+to_vector(struct vec* ranges)
+{
+    std::vector<struct range> result;
+    VEC_FOR_EACH(ranges, struct range, r)
+        result.push_back(*r);
+    VEC_END_EACH
+    vec_clear(ranges);
+    return result;
+}
+
+std::string
+to_string(const std::vector<struct range>& ranges)
+{
+    std::ostringstream os;
+    for (const struct range& r : ranges)
+        os << "[" << r.start << "," << r.end << ") ";
+    return os.str();
+}
+
+}
+
+class NAME : public Test
+{
+protected:
+    void SetUp() override
+    {
+        ASSERT_THAT(parser_init(&parser), Eq(0));
+    }
+
+    void TearDown() override
+    {
+        parser_deinit(&parser);
+    }
+
+    /*
+     * Returns an empty string if all engines agree, otherwise a description
+     * of what each engine found. Queries that fail to compile are skipped.
+     */
+    std::string compare(const std::string& text, const std::vector<union symbol>& symbols)
+    {
+        struct ast ast;
+        struct nfa_graph nfa;
+        struct dfa_table dfa;
+        struct asm_dfa assembly;
+        struct bitnfa bitnfa;
+        struct vec ranges;
+        std::string result;
+
+        ast_init(&ast);
+        nfa_init(&nfa);
+        dfa_init(&dfa);
+        asm_init(&assembly);
+        bitnfa_init(&bitnfa);
+        vec_init(&ranges, sizeof(struct range));
+
+        if (parser_parse(&parser, text.c_str(), &ast) == 0)
+        {
+            ast_post_hash40_remaining_labels(&ast);
+            if (nfa_compile(&nfa, &ast) == 0 &&
+                bitnfa_from_nfa(&bitnfa, &nfa) == 0 &&
+                dfa_from_nfa(&dfa, &nfa) == 0 &&
+                asm_compile(&assembly, &dfa) == 0)
+            {
+                struct range window = { 0, (int)symbols.size() };
+                EXPECT_THAT(bitnfa_find_all(&ranges, &bitnfa, symbols.data(), window), Eq(0));
+                std::vector<struct range> nfa_ranges = to_vector(&ranges);
+                EXPECT_THAT(dfa_find_all(&ranges, &dfa, symbols.data(), window), Eq(0));
+                std::vector<struct range> dfa_ranges = to_vector(&ranges);
+                EXPECT_THAT(asm_find_all(&ranges, &assembly, symbols.data(), window), Eq(0));
+                std::vector<struct range> asm_ranges = to_vector(&ranges);
+
+                if (nfa_ranges != dfa_ranges || dfa_ranges != asm_ranges)
+                    result = "nfa: " + to_string(nfa_ranges) +
+                             "\ndfa: " + to_string(dfa_ranges) +
+                             "\nasm: " + to_string(asm_ranges);
+            }
+        }
+
+        vec_deinit(&ranges);
+        bitnfa_deinit(&bitnfa);
+        asm_deinit(&assembly);
+        dfa_deinit(&dfa);
+        nfa_deinit(&nfa);
+        ast_deinit(&ast);
+        return result;
+    }
+
+    /* Shrinks the query and then the stream for as long as the engines disagree */
+    std::string minimize(ExprPtr query, std::vector<union symbol> symbols)
+    {
+        for (bool progress = true; progress; )
+        {
+            std::vector<ExprPtr> simpler;
+            progress = false;
+            simplifications(query, simpler);
+            for (const ExprPtr& s : simpler)
+                if (!compare(to_string(s), symbols).empty())
+                {
+                    query = s;
+                    progress = true;
+                    break;
+                }
+        }
+
+        std::string text = to_string(query);
+        for (size_t chunk = symbols.size() / 2; chunk > 0; chunk /= 2)
+            for (size_t i = 0; i + chunk <= symbols.size(); )
+            {
+                std::vector<union symbol> shorter(symbols);
+                shorter.erase(shorter.begin() + i, shorter.begin() + i + chunk);
+                if (!compare(text, shorter).empty())
+                    symbols = shorter;
+                else
+                    i += chunk;
+            }
+
+        std::ostringstream os;
+        os << "query: " << text << "\nsymbols:";
+        for (const union symbol& s : symbols)
+            os << " 0x" << std::hex << s.motionl << std::dec;
+        os << "\n" << compare(text, symbols);
+        return os.str();
+    }
+
+    struct parser parser;
+};
+
+TEST_F(NAME, engines_agree_on_random_queries)
+{
+    Random rng(42);
+    int iterations = 300;
+    if (const char* env = getenv("SEARCH_DIFFERENTIAL_ITERATIONS"))
+        iterations = atoi(env);
+
+    for (int i = 0; i != iterations; ++i)
+    {
+        ExprPtr query = generate(rng, 4);
+        for (int s = 0; s != 4; ++s)
+        {
+            std::vector<union symbol> symbols;
+            int length = rng.next(40);
+            for (int j = 0; j != length; ++j)
+                symbols.push_back(symbol_make(0xa + rng.next(MOTION_COUNT + 1)));
+
+            if (!compare(to_string(query), symbols).empty())
+            {
+                ADD_FAILURE() << "Engines disagree after " << i << " queries\n" << minimize(query, symbols);
+                return;
+            }
+        }
+    }
+}
+
+TEST_F(NAME, wildcard_loop_before_motion)
+{
+    std::vector<union symbol> symbols = { symbol_make(0xa), symbol_make(0xd) };
+    EXPECT_THAT(compare("(.)* -> 0xd", symbols), IsEmpty());
+}
+
+TEST_F(NAME, more_than_32_dfa_states)
+{
+    std::vector<union symbol> symbols;
+    for (int i = 0; i != 25; ++i)
+        symbols.push_back(symbol_make(i % 3 ? 0xd : 0xa));
+    EXPECT_THAT(compare("((((0xd){2,3} | .)){1,2}){3,4}", symbols), IsEmpty());
+}
@@ -3,9 +3,11 @@
 #include "search/asm.h"
 #include "search/ast.h"
 #include "search/ast_post.h"
+#include "search/bitnfa.h"
 #include "search/dfa.h"
 #include "search/nfa.h"
 #include "search/parser.h"
+#include "search/prefilter.h"
 #include "search/range.h"
 
 #include "vh/hash40.h"
@@ -27,6 +29,8 @@ protected:
         struct nfa_graph nfa;
         struct dfa_table dfa;
         struct asm_dfa asm_dfa;
+        struct bitnfa bitnfa;
+        struct prefilter pf;
 
         ASSERT_THAT(parser_init(&parser), Eq(0));
         ASSERT_THAT(ast_init(&ast), Eq(0));
@@ -37,23 +41,75 @@ protected:
         nfa_init(&nfa);
         ASSERT_THAT(nfa_compile(&nfa, &ast), Eq(0));
         nfa_export_dot(&nfa, "nfa.dot");
+
+        prefilter_init(&pf);
+        ASSERT_THAT(prefilter_from_ast(&pf, &ast), Eq(0));
         ast_deinit(&ast);
 
+        bitnfa_init(&bitnfa);
+        ASSERT_THAT(bitnfa_from_nfa(&bitnfa, &nfa), Eq(0));
+
         dfa_init(&dfa);
         ASSERT_THAT(dfa_from_nfa(&dfa, &nfa), Eq(0));
         dfa_export_dot(&dfa, "dfa.dot");
         nfa_deinit(&nfa);
 
+        asm_init(&asm_dfa);
         ASSERT_THAT(asm_compile(&asm_dfa, &dfa), Eq(0));
 
         struct range window = { 0, (int)symbols.size() };
         struct range dfa_res = dfa_find_first(&dfa, symbols.data(), window);
         struct range asm_res = asm_find_first(&asm_dfa, symbols.data(), window);
+        struct range bitnfa_res = bitnfa_find_first(&bitnfa, symbols.data(), window);
+
+        /* Searching only the windows returned by the prefilter must not
+         * change the results */
+        struct vec all, all_prefiltered;
+        vec_init(&all, sizeof(struct range));
+        vec_init(&all_prefiltered, sizeof(struct range));
+        ASSERT_THAT(dfa_find_all(&all, &dfa, symbols.data(), window), Eq(0));
+        for (struct range w = window; ; )
+        {
+            struct range candidate = prefilter_next_window(&pf, symbols.data(), w);
+            if (candidate.start == candidate.end)
+                break;
+            ASSERT_THAT(dfa_find_all(&all_prefiltered, &dfa, symbols.data(), candidate), Eq(0));
+            w.start = candidate.end;
+        }
+        ASSERT_THAT(vec_count(&all_prefiltered), Eq(vec_count(&all)));
+        for (int i = 0; i != (int)vec_count(&all); ++i)
+        {
+            EXPECT_THAT(((struct range*)vec_get(&all_prefiltered, i))->start, Eq(((struct range*)vec_get(&all, i))->start));
+            EXPECT_THAT(((struct range*)vec_get(&all_prefiltered, i))->end, Eq(((struct range*)vec_get(&all, i))->end));
+        }
+        vec_deinit(&all_prefiltered);
+        vec_deinit(&all);
+
+        /* Limiting the starts to small chunks must find the same match */
+        struct range asm_chunked = { window.end, window.end };
+        struct range bitnfa_chunked = { window.end, window.end };
+        for (struct range w = window; w.start != w.end; )
+        {
+            int start_end = w.end - w.start > 2 ? w.start + 2 : w.end;
+            asm_chunked = asm_find_first_before(&asm_dfa, symbols.data(), w, start_end);
+            bitnfa_chunked = bitnfa_find_first_before(&bitnfa, symbols.data(), w, start_end);
+            if (asm_chunked.start != asm_chunked.end)
+                break;
+            w.start = start_end;
+        }
+        EXPECT_THAT(asm_chunked.start, Eq(asm_res.start));
+        EXPECT_THAT(asm_chunked.end, Eq(asm_res.end));
+        EXPECT_THAT(bitnfa_chunked.start, Eq(bitnfa_res.start));
+        EXPECT_THAT(bitnfa_chunked.end, Eq(bitnfa_res.end));
+
         dfa_deinit(&dfa);
         asm_deinit(&asm_dfa);
+        bitnfa_deinit(&bitnfa);
 
         EXPECT_THAT(dfa_res.start, Eq(asm_res.start));
         EXPECT_THAT(dfa_res.end, Eq(asm_res.end));
+        EXPECT_THAT(dfa_res.start, Eq(bitnfa_res.start));
+        EXPECT_THAT(dfa_res.end, Eq(bitnfa_res.end));
         result = asm_res;
     }
 
@@ -363,3 +419,307 @@ TEST_F(NAME, negate_wildcard_expressions_2)
     EXPECT_THAT(result.start, Eq(0));
     EXPECT_THAT(result.end, Eq(2));
 }
+
+TEST_F(NAME, many_positions_single_word)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(h40_to_symbol(0x9));
+    symbols.push_back(h40_to_symbol(0xa));
+    for (int i = 0; i != 40; ++i)
+        symbols.push_back(h40_to_symbol(0xc));
+    symbols.push_back(h40_to_symbol(0xb));
+    symbols.push_back(h40_to_symbol(0xb));
+
+    run("0xa->.0,60->0xb", symbols);
+    EXPECT_THAT(result.start, Eq(1));
+    EXPECT_THAT(result.end, Eq(44));
+}
+
+TEST_F(NAME, many_positions_multi_word)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(h40_to_symbol(0x9));
+    symbols.push_back(h40_to_symbol(0xa));
+    for (int i = 0; i != 100; ++i)
+        symbols.push_back(h40_to_symbol(0xc));
+    symbols.push_back(h40_to_symbol(0xb));
+    symbols.push_back(h40_to_symbol(0xd));
+
+    run("0xa->.0,150->0xb", symbols);
+    EXPECT_THAT(result.start, Eq(1));
+    EXPECT_THAT(result.end, Eq(103));
+}
+
+static union symbol
+nair_with(void (*set_flag)(union symbol*))
+{
+    union symbol s = h40_to_symbol("nair");
+    set_flag(&s);
+    return s;
+}
+
+/* Only the second nair has the flag, so only it may match */
+#define QUALIFIER_TEST(name, query, flag)                                    \
+    TEST_F(NAME, qualifier_##name)                                           \
+    {                                                                        \
+        std::vector<union symbol> symbols;                                   \
+        symbols.push_back(h40_to_symbol("nair"));                            \
+        symbols.push_back(nair_with([](union symbol* s) { s->flag = 1; }));  \
+        symbols.push_back(h40_to_symbol("nair"));                            \
+                                                                             \
+        run(query, symbols);                                                 \
+        EXPECT_THAT(result.start, Eq(1));                                    \
+        EXPECT_THAT(result.end, Eq(2));                                      \
+    }
+
+QUALIFIER_TEST(hit, "nair hit", op_hitlag)
+QUALIFIER_TEST(os, "nair os", op_shieldlag)
+QUALIFIER_TEST(clank, "nair clank", me_clank)
+QUALIFIER_TEST(trade, "nair trade", trade)
+QUALIFIER_TEST(crossup, "nair crossup", me_crossup)
+QUALIFIER_TEST(kill, "nair kill", op_dead)
+QUALIFIER_TEST(die, "nair die", me_dead)
+QUALIFIER_TEST(bury, "nair bury", op_buried)
+QUALIFIER_TEST(buried, "nair buried", me_buried)
+QUALIFIER_TEST(rising, "rising nair", me_rising)
+QUALIFIER_TEST(falling, "falling nair", me_falling)
+QUALIFIER_TEST(fastfall, "fs nair", me_fastfall)
+
+TEST_F(NAME, qualifier_whiff)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(nair_with([](union symbol* s) { s->op_hitlag = 1; }));
+    symbols.push_back(nair_with([](union symbol* s) { s->op_shieldlag = 1; }));
+    symbols.push_back(nair_with([](union symbol* s) { s->me_clank = 1; }));
+    symbols.push_back(h40_to_symbol("nair"));
+
+    run("nair whiff", symbols);
+    EXPECT_THAT(result.start, Eq(3));
+    EXPECT_THAT(result.end, Eq(4));
+}
+
+TEST_F(NAME, qualifier_alternatives)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(h40_to_symbol("nair"));
+    symbols.push_back(nair_with([](union symbol* s) { s->op_shieldlag = 1; }));
+    symbols.push_back(nair_with([](union symbol* s) { s->op_hitlag = 1; }));
+    symbols.push_back(h40_to_symbol("nair"));
+
+    run("(nair os|hit)+", symbols);
+    EXPECT_THAT(result.start, Eq(1));
+    EXPECT_THAT(result.end, Eq(3));
+}
+
+TEST_F(NAME, qualifier_groups_must_all_match)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(nair_with([](union symbol* s) { s->me_rising = 1; }));
+    symbols.push_back(nair_with([](union symbol* s) { s->op_hitlag = 1; }));
+    symbols.push_back(nair_with([](union symbol* s) { s->me_rising = 1; s->op_hitlag = 1; }));
+
+    run("rising nair hit", symbols);
+    EXPECT_THAT(result.start, Eq(2));
+    EXPECT_THAT(result.end, Eq(3));
+}
+
+TEST_F(NAME, qualified_symbol_matches_unqualified_motion)
+{
+    /* The second nair is consumed by the column "nair hit", which must also
+     * advance the unqualified "nair" */
+    std::vector<union symbol> symbols;
+    symbols.push_back(nair_with([](union symbol* s) { s->op_hitlag = 1; }));
+    symbols.push_back(nair_with([](union symbol* s) { s->op_hitlag = 1; }));
+    symbols.push_back(h40_to_symbol("fair"));
+
+    run("nair hit->nair->fair", symbols);
+    EXPECT_THAT(result.start, Eq(0));
+    EXPECT_THAT(result.end, Eq(3));
+}
+
+TEST_F(NAME, overlapping_qualifiers)
+{
+    /* Neither "rising nair" nor "nair hit" subsumes the other. A rising nair
+     * that hits has to advance both */
+    std::vector<union symbol> symbols;
+    symbols.push_back(nair_with([](union symbol* s) { s->me_rising = 1; }));
+    symbols.push_back(nair_with([](union symbol* s) { s->me_rising = 1; s->op_hitlag = 1; }));
+    symbols.push_back(nair_with([](union symbol* s) { s->me_rising = 1; s->op_hitlag = 1; }));
+
+    run("rising nair->nair hit->.", symbols);
+    EXPECT_THAT(result.start, Eq(0));
+    EXPECT_THAT(result.end, Eq(3));
+}
+
+static union symbol
+with_damage(uint64_t h40, float damage)
+{
+    union symbol s = h40_to_symbol(h40);
+    s.op_damage = symbol_damage_bucket(damage);
+    return s;
+}
+
+static union symbol
+with_prev_frames(uint64_t h40, int frames)
+{
+    union symbol s = h40_to_symbol(h40);
+    s.prev_frames = symbol_frames_bucket(frames);
+    return s;
+}
+
+TEST_F(NAME, damage_at_least)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(with_damage(0xa, 95.f));
+    symbols.push_back(with_damage(0xa, 104.f));
+
+    run("0xa >=100%", symbols);
+    EXPECT_THAT(result.start, Eq(1));
+    EXPECT_THAT(result.end, Eq(2));
+}
+
+TEST_F(NAME, damage_range_spans_several_buckets)
+{
+    std::vector<union symbol> symbols;
+    for (int damage = 20; damage != 80; damage += 10)
+        symbols.push_back(with_damage(0xa, (float)damage));
+
+    run("(0xa 30%-69%)+", symbols);
+    EXPECT_THAT(result.start, Eq(1));
+    EXPECT_THAT(result.end, Eq(5));
+}
+
+TEST_F(NAME, damage_ranges_are_a_union)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(with_damage(0xa, 25.f));
+    symbols.push_back(with_damage(0xb, 25.f));
+    symbols.push_back(with_damage(0xa, 10.f));
+    symbols.push_back(with_damage(0xa, 150.f));
+
+    run("0xb->(0xa <20% >=100%)+", symbols);
+    EXPECT_THAT(result.start, Eq(1));
+    EXPECT_THAT(result.end, Eq(4));
+}
+
+TEST_F(NAME, timing_window_relative_to_previous)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(with_prev_frames(0xa, 10));
+    symbols.push_back(with_prev_frames(0xb, 5));
+    symbols.push_back(with_prev_frames(0xa, 10));
+    symbols.push_back(with_prev_frames(0xb, 2));
+
+    run("0xa->f1-3 0xb", symbols);
+    EXPECT_THAT(result.start, Eq(2));
+    EXPECT_THAT(result.end, Eq(4));
+}
+
+TEST_F(NAME, timing_applies_to_each_repetition)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(with_prev_frames(0xa, 10));
+    symbols.push_back(with_prev_frames(0xb, 2));
+    symbols.push_back(with_prev_frames(0xb, 2));
+    symbols.push_back(with_prev_frames(0xb, 7));
+
+    run("0xa->f2 0xb+", symbols);
+    EXPECT_THAT(result.start, Eq(0));
+    EXPECT_THAT(result.end, Eq(3));
+}
+
+TEST_F(NAME, damage_compares_whole_percent)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(with_damage(0xa, 70.f));
+    symbols.push_back(with_damage(0xa, 69.5f));
+
+    run("0xa <70%", symbols);
+    EXPECT_THAT(result.start, Eq(1));
+    EXPECT_THAT(result.end, Eq(2));
+}
+
+static int
+check_predicates(const char* text)
+{
+    struct parser parser;
+    struct ast ast;
+    int result;
+
+    parser_init(&parser);
+    ast_init(&ast);
+    result = parser_parse(&parser, text, &ast);
+    if (result == 0)
+        result = nfa_check_ast(&ast);
+    ast_deinit(&ast);
+    parser_deinit(&parser);
+    return result;
+}
+
+TEST_F(NAME, predicates_the_symbol_cant_represent_are_rejected)
+{
+    EXPECT_THAT(check_predicates("0xa >=100%"), Eq(0));
+    EXPECT_THAT(check_predicates("0xa <100%"), Eq(0));
+    EXPECT_THAT(check_predicates("0xa >99%"), Eq(0));
+    EXPECT_THAT(check_predicates("0xa 30%-69%"), Eq(0));
+    EXPECT_THAT(check_predicates("0xa >=150%"), Eq(0));
+    EXPECT_THAT(check_predicates("0xa->f1-14 0xb"), Eq(0));
+
+    EXPECT_THAT(check_predicates("0xa >=105%"), Eq(-1));
+    EXPECT_THAT(check_predicates("0xa >100%"), Eq(-1));
+    EXPECT_THAT(check_predicates("0xa <=100%"), Eq(-1));
+    EXPECT_THAT(check_predicates("0xa >=160%"), Eq(-1));
+    EXPECT_THAT(check_predicates("0xa 100%-200%"), Eq(-1));
+    EXPECT_THAT(check_predicates("0xa->f1-15 0xb"), Eq(-1));
+    EXPECT_THAT(check_predicates("0xa->f20 0xb"), Eq(-1));
+}
+
+static union symbol
+opponent(uint64_t h40)
+{
+    union symbol s = h40_to_symbol(h40);
+    s.is_op = 1;
+    return s;
+}
+
+TEST_F(NAME, joint_opponent_then_self)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(h40_to_symbol(0xc));
+    symbols.push_back(opponent(0xa));
+    symbols.push_back(opponent(0xd));
+    symbols.push_back(h40_to_symbol(0xb));
+
+    run("op 0xa->0xb", symbols);
+    EXPECT_THAT(result.start, Eq(1));
+    EXPECT_THAT(result.end, Eq(4));
+}
+
+TEST_F(NAME, joint_steps_skip_other_fighter)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(h40_to_symbol(0xa));
+    symbols.push_back(opponent(0xd));
+    symbols.push_back(opponent(0xe));
+    symbols.push_back(h40_to_symbol(0xb));
+    symbols.push_back(opponent(0xc));
+
+    /* The opponent's 0xd and 0xe don't interrupt our own sequence */
+    run("0xa->0xb->op 0xc", symbols);
+    EXPECT_THAT(result.start, Eq(0));
+    EXPECT_THAT(result.end, Eq(5));
+}
+
+TEST_F(NAME, joint_steps_match_their_own_fighter_only)
+{
+    std::vector<union symbol> symbols;
+    symbols.push_back(h40_to_symbol(0xa));
+    symbols.push_back(h40_to_symbol(0xb));
+    symbols.push_back(opponent(0xa));
+    symbols.push_back(h40_to_symbol(0xc));
+    symbols.push_back(h40_to_symbol(0xb));
+
+    /* Our own 0xc interrupts the sequence */
+    run("op 0xa->0xb", symbols);
+    EXPECT_THAT(result.start, Eq(result.end));
+}
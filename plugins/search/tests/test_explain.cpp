@@ -0,0 +1,101 @@
+#include "gmock/gmock.h"
+
+#include "search/ast_post.h"
+#include "search/explain.h"
+#include "search/parser.h"
+#include "search/query_cache.h"
+#include "search/symbol.h"
+
+#include "vh/hash40.h"
+#include "vh/str.h"
+
+#include <string>
+#include <vector>
+
+#define NAME search_explain
+
+using namespace testing;
+
+class NAME : public Test
+{
+protected:
+    void SetUp() override
+    {
+        str_init(&report);
+    }
+
+    void TearDown() override
+    {
+        str_deinit(&report);
+    }
+
+    std::string text() const
+    {
+        return std::string(report.data, report.len);
+    }
+
+    struct str report;
+};
+
+TEST_F(NAME, reports_labels_engine_and_stages)
+{
+    ASSERT_THAT(explain_query(&report, "attack_air_n -> attack_air_f", NULL, 1, -1, 0), Eq(0));
+    std::string r = text();
+
+    char expansion[64];
+    snprintf(expansion, sizeof expansion, "attack_air_n -> 0x%llx", (unsigned long long)hash40_cstr("attack_air_n"));
+    EXPECT_THAT(r, HasSubstr(expansion));
+    EXPECT_THAT(r, HasSubstr("AST (3 nodes)"));
+    EXPECT_THAT(r, HasSubstr("Engine: bit-parallel NFA, 2 positions"));
+    EXPECT_THAT(r, HasSubstr("Prefilter: motion"));
+    EXPECT_THAT(r, HasSubstr("Compile time: parse"));
+}
+
+TEST_F(NAME, queries_beyond_one_word_use_dfa)
+{
+    ASSERT_THAT(explain_query(&report, "(0xa | 0xb | 0xc | 0xd | 0xe){14} -> 0xf", NULL, 1, -1, 0), Eq(0));
+    EXPECT_THAT(text(), HasSubstr("Engine: JIT compiled DFA"));
+}
+
+TEST_F(NAME, approximate_search_uses_bitnfa)
+{
+    ASSERT_THAT(explain_query(&report, "0xa -> 0xb -> 0xc", NULL, 1, -1, 1), Eq(0));
+    EXPECT_THAT(text(), HasSubstr("Engine: bit-parallel NFA, 3 positions"));
+    EXPECT_THAT(text(), Not(HasSubstr("JIT compiled DFA")));
+}
+
+TEST_F(NAME, parse_errors_are_reported)
+{
+    EXPECT_THAT(explain_query(&report, "0xa -> ->", NULL, 1, -1, 0), Eq(-1));
+    EXPECT_THAT(text(), HasSubstr("Failed to parse"));
+}
+
+TEST_F(NAME, scan_counts_windows_and_matches)
+{
+    struct parser parser;
+    struct compiled_query query;
+    struct scan_profile profile;
+    std::vector<union symbol> symbols;
+    for (uint64_t motion : {0x1, 0x1, 0xa, 0xb, 0x1, 0x1, 0x1, 0x1, 0xa, 0xb, 0x1, 0x1})
+        symbols.push_back(symbol_make(motion));
+
+    ASSERT_THAT(parser_init(&parser), Eq(0));
+    ASSERT_THAT(compiled_query_init(&query), Eq(0));
+    ASSERT_THAT(parser_parse(&parser, "0xa -> 0xb", &query.ast), Eq(0));
+    ast_post_hash40_remaining_labels(&query.ast);
+    ASSERT_THAT(compiled_query_build(&query, 0), Eq(0));
+
+    struct range window = { 0, (int)symbols.size() };
+    EXPECT_THAT(explain_scan(&profile, &query, symbols.data(), window, 0), Eq(2));
+    EXPECT_THAT(profile.method, Eq(SCAN_PREFILTER));
+    EXPECT_THAT(profile.symbols, Eq(12));
+    EXPECT_THAT(profile.windows, Eq(2));
+    EXPECT_THAT(profile.window_symbols, Lt(profile.symbols));
+    EXPECT_THAT(profile.matches, Eq(2));
+
+    ASSERT_THAT(explain_scan_profile(&report, &profile), Eq(0));
+    EXPECT_THAT(text(), HasSubstr("2 matches"));
+
+    compiled_query_deinit(&query);
+    parser_deinit(&parser);
+}
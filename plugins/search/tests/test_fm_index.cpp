@@ -0,0 +1,224 @@
+#include "gmock/gmock.h"
+
+#include "search/fm_index.h"
+#include "search/symbol.h"
+
+#include "vh/fs.h"
+
+#include <algorithm>
+#include <vector>
+
+#define NAME search_fm_index
+
+using namespace testing;
+
+class NAME : public Test
+{
+protected:
+    void SetUp() override
+    {
+        ASSERT_THAT(fm_index_init(&fmi), Eq(0));
+    }
+
+    void TearDown() override
+    {
+        fm_index_deinit(&fmi);
+    }
+
+    std::vector<union symbol> make_symbols(const std::vector<uint64_t>& motions)
+    {
+        std::vector<union symbol> symbols;
+        for (uint64_t motion : motions)
+            symbols.push_back(symbol_make(motion));
+        return symbols;
+    }
+
+    void add(int game_id, int fighter_idx, const std::vector<uint64_t>& motions)
+    {
+        std::vector<union symbol> symbols = make_symbols(motions);
+        struct range r = { 0, (int)symbols.size() };
+        ASSERT_THAT(fm_index_add(&fmi, game_id, 0, fighter_idx, symbols.data(), r), Eq(0));
+        docs.push_back({game_id, fighter_idx, motions});
+    }
+
+    /* Every occurrence, including overlapping ones, ordered like fm_index_locate() */
+    std::vector<struct fm_match> brute_force(const std::vector<uint64_t>& pattern)
+    {
+        std::vector<struct fm_match> result;
+        for (const Doc& doc : docs)
+            for (size_t i = 0; i + pattern.size() <= doc.motions.size(); ++i)
+                if (std::equal(pattern.begin(), pattern.end(), doc.motions.begin() + i))
+                    result.push_back({doc.game_id, doc.fighter_idx, (int)i});
+        std::sort(result.begin(), result.end(), [](const struct fm_match& a, const struct fm_match& b) {
+            if (a.game_id != b.game_id) return a.game_id < b.game_id;
+            if (a.fighter_idx != b.fighter_idx) return a.fighter_idx < b.fighter_idx;
+            return a.start < b.start;
+        });
+        return result;
+    }
+
+    std::vector<struct fm_match> locate(const std::vector<uint64_t>& pattern)
+    {
+        std::vector<union symbol> symbols = make_symbols(pattern);
+        std::vector<struct fm_match> result;
+        struct vec matches;
+        vec_init(&matches, sizeof(struct fm_match));
+        EXPECT_THAT(fm_index_locate(&matches, &fmi, symbols.data(), (int)symbols.size()), Ge(0));
+        VEC_FOR_EACH(&matches, struct fm_match, m)
+            result.push_back(*m);
+        VEC_END_EACH
+        vec_deinit(&matches);
+        return result;
+    }
+
+    int count(const std::vector<uint64_t>& pattern)
+    {
+        std::vector<union symbol> symbols = make_symbols(pattern);
+        return fm_index_count(&fmi, symbols.data(), (int)symbols.size());
+    }
+
+    struct Doc
+    {
+        int game_id;
+        int fighter_idx;
+        std::vector<uint64_t> motions;
+    };
+
+    struct fm_index fmi;
+    std::vector<Doc> docs;
+};
+
+MATCHER(MatchEq, "")
+{
+    return std::get<0>(arg).game_id == std::get<1>(arg).game_id
+        && std::get<0>(arg).fighter_idx == std::get<1>(arg).fighter_idx
+        && std::get<0>(arg).start == std::get<1>(arg).start;
+}
+
+TEST_F(NAME, count_and_locate)
+{
+    add(1, 0, {0xa, 0xb, 0xa, 0xb, 0xc});
+    add(1, 1, {0xb, 0xc, 0xa});
+    ASSERT_THAT(fm_index_build(&fmi), Eq(0));
+
+    EXPECT_THAT(count({0xa, 0xb}), Eq(2));
+    EXPECT_THAT(count({0xb, 0xc}), Eq(2));
+    EXPECT_THAT(count({0xa}), Eq(3));
+    EXPECT_THAT(count({0xd}), Eq(0));
+    EXPECT_THAT(locate({0xb, 0xc}), Pointwise(MatchEq(), brute_force({0xb, 0xc})));
+}
+
+TEST_F(NAME, matches_dont_span_documents)
+{
+    /* 0xc->0xb would match across the boundary of the two streams */
+    add(1, 0, {0xa, 0xc});
+    add(2, 0, {0xb, 0xa});
+    ASSERT_THAT(fm_index_build(&fmi), Eq(0));
+    EXPECT_THAT(count({0xc, 0xb}), Eq(0));
+    EXPECT_THAT(count({0xa}), Eq(2));
+}
+
+TEST_F(NAME, random_corpus_matches_brute_force)
+{
+    uint32_t state = 1234;
+    auto next = [&state]() { state = state * 1103515245 + 12345; return (state >> 16) & 0x7FFF; };
+
+    /* Long enough that locating has to walk to sampled rows */
+    for (int game = 0; game != 8; ++game)
+        for (int fighter = 0; fighter != 2; ++fighter)
+        {
+            std::vector<uint64_t> motions;
+            int length = 50 + (int)(next() % 200);
+            for (int i = 0; i != length; ++i)
+                motions.push_back(0x100000000ULL + next() % 6);
+            add(game, fighter, motions);
+        }
+    ASSERT_THAT(fm_index_build(&fmi), Eq(0));
+
+    for (int p = 0; p != 50; ++p)
+    {
+        std::vector<uint64_t> pattern;
+        int length = 1 + (int)(next() % 4);
+        for (int i = 0; i != length; ++i)
+            pattern.push_back(0x100000000ULL + next() % 6);
+        std::vector<struct fm_match> expected = brute_force(pattern);
+        EXPECT_THAT(count(pattern), Eq((int)expected.size()));
+        EXPECT_THAT(locate(pattern), Pointwise(MatchEq(), expected));
+    }
+}
+
+TEST_F(NAME, incremental_rebuild)
+{
+    add(1, 0, {0xa, 0xb});
+    ASSERT_THAT(fm_index_build(&fmi), Eq(0));
+    EXPECT_THAT(fm_index_has_game(&fmi, 2), IsFalse());
+
+    add(2, 0, {0xc, 0xa, 0xb});
+    EXPECT_THAT(fm_index_is_built(&fmi), IsFalse());
+    ASSERT_THAT(fm_index_build(&fmi), Eq(0));
+    EXPECT_THAT(fm_index_has_game(&fmi, 2), IsTrue());
+    EXPECT_THAT(locate({0xa, 0xb}), Pointwise(MatchEq(), brute_force({0xa, 0xb})));
+    EXPECT_THAT(count({0xc}), Eq(1));
+}
+
+TEST_F(NAME, save_and_load)
+{
+    struct fm_index loaded;
+    add(1, 0, {0xa, 0xb, 0xc, 0xa, 0xb});
+    add(3, 1, {0xb, 0xa, 0xb});
+    ASSERT_THAT(fm_index_build(&fmi), Eq(0));
+    ASSERT_THAT(fm_index_save(&fmi, "test_fm_index.fmi"), Eq(0));
+
+    ASSERT_THAT(fm_index_init(&loaded), Eq(0));
+    ASSERT_THAT(fm_index_load(&loaded, "test_fm_index.fmi"), Eq(0));
+    fs_remove_file("test_fm_index.fmi");
+    fm_index_deinit(&fmi);
+    fmi = loaded;
+
+    EXPECT_THAT(fm_index_has_game(&fmi, 3), IsTrue());
+    EXPECT_THAT(locate({0xa, 0xb}), Pointwise(MatchEq(), brute_force({0xa, 0xb})));
+
+    /* The corpus is restored too, so games can still be added */
+    add(4, 0, {0xa, 0xb});
+    ASSERT_THAT(fm_index_build(&fmi), Eq(0));
+    EXPECT_THAT(count({0xa, 0xb}), Eq(4));
+}
+
+TEST_F(NAME, remove_game)
+{
+    add(1, 0, {0xa, 0xb});
+    add(2, 0, {0xa, 0xb, 0xc});
+    add(2, 1, {0xc, 0xa});
+    add(3, 0, {0xc, 0xa, 0xb});
+    ASSERT_THAT(fm_index_build(&fmi), Eq(0));
+
+    EXPECT_THAT(fm_index_remove_game(&fmi, 2), Eq(2));
+    EXPECT_THAT(fm_index_remove_game(&fmi, 2), Eq(0));
+    EXPECT_THAT(fm_index_is_built(&fmi), IsFalse());
+    docs.erase(std::remove_if(docs.begin(), docs.end(), [](const Doc& doc) { return doc.game_id == 2; }), docs.end());
+
+    ASSERT_THAT(fm_index_build(&fmi), Eq(0));
+    EXPECT_THAT(fm_index_has_game(&fmi, 2), IsFalse());
+    EXPECT_THAT(locate({0xa, 0xb}), Pointwise(MatchEq(), brute_force({0xa, 0xb})));
+    EXPECT_THAT(count({0xc, 0xa}), Eq(1));
+}
+
+TEST_F(NAME, append_remaps_motions)
+{
+    struct fm_index other;
+    std::vector<union symbol> symbols = make_symbols({0xc, 0xa, 0xb, 0xd});
+    struct range r = { 0, (int)symbols.size() };
+
+    /* The other index numbers its motions in a different order */
+    add(1, 0, {0xa, 0xb, 0xc});
+    ASSERT_THAT(fm_index_init(&other), Eq(0));
+    ASSERT_THAT(fm_index_add(&other, 2, 0, 1, symbols.data(), r), Eq(0));
+    ASSERT_THAT(fm_index_append(&fmi, &other), Eq(0));
+    fm_index_deinit(&other);
+    docs.push_back({2, 1, {0xc, 0xa, 0xb, 0xd}});
+
+    ASSERT_THAT(fm_index_build(&fmi), Eq(0));
+    EXPECT_THAT(locate({0xa, 0xb}), Pointwise(MatchEq(), brute_force({0xa, 0xb})));
+    EXPECT_THAT(locate({0xb, 0xd}), Pointwise(MatchEq(), brute_force({0xb, 0xd})));
+    EXPECT_THAT(count({0xc, 0xa}), Eq(1));
+}
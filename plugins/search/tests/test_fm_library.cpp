@@ -0,0 +1,218 @@
+#include "gmock/gmock.h"
+
+#include "search/fm_library.h"
+#include "search/symbol.h"
+
+#include "vh/fs.h"
+
+#include <algorithm>
+#include <vector>
+
+#define NAME search_fm_library
+
+using namespace testing;
+
+class NAME : public Test
+{
+protected:
+    void SetUp() override
+    {
+        ASSERT_THAT(fm_library_init(&lib), Eq(0));
+    }
+
+    void TearDown() override
+    {
+        fm_library_deinit(&lib);
+        for (int i = 0; i != 16; ++i)
+            fs_remove_file(file_name(i).c_str());
+    }
+
+    static std::string file_name(int segment)
+    {
+        return "test_fm_library.fmi." + std::to_string(segment);
+    }
+
+    std::vector<union symbol> make_symbols(const std::vector<uint64_t>& motions)
+    {
+        std::vector<union symbol> symbols;
+        for (uint64_t motion : motions)
+            symbols.push_back(symbol_make(motion));
+        return symbols;
+    }
+
+    void add(int game_id, uint64_t stamp, int fighter_idx, const std::vector<uint64_t>& motions)
+    {
+        std::vector<union symbol> symbols = make_symbols(motions);
+        struct range r = { 0, (int)symbols.size() };
+        ASSERT_THAT(fm_library_add(&lib, game_id, stamp, fighter_idx, symbols.data(), r), Eq(0));
+        docs.erase(std::remove_if(docs.begin(), docs.end(), [&](const Doc& doc) {
+            return doc.game_id == game_id && doc.stamp != stamp;
+        }), docs.end());
+        docs.push_back({game_id, fighter_idx, stamp, motions});
+    }
+
+    /* Every occurrence, including overlapping ones, ordered like fm_library_locate() */
+    std::vector<struct fm_match> brute_force(const std::vector<uint64_t>& pattern)
+    {
+        std::vector<struct fm_match> result;
+        for (const Doc& doc : docs)
+            for (size_t i = 0; i + pattern.size() <= doc.motions.size(); ++i)
+                if (std::equal(pattern.begin(), pattern.end(), doc.motions.begin() + i))
+                    result.push_back({doc.game_id, doc.fighter_idx, (int)i});
+        std::sort(result.begin(), result.end(), [](const struct fm_match& a, const struct fm_match& b) {
+            if (a.game_id != b.game_id) return a.game_id < b.game_id;
+            if (a.fighter_idx != b.fighter_idx) return a.fighter_idx < b.fighter_idx;
+            return a.start < b.start;
+        });
+        return result;
+    }
+
+    std::vector<struct fm_match> locate(const std::vector<uint64_t>& pattern)
+    {
+        std::vector<union symbol> symbols = make_symbols(pattern);
+        std::vector<struct fm_match> result;
+        struct vec matches;
+        vec_init(&matches, sizeof(struct fm_match));
+        EXPECT_THAT(fm_library_locate(&matches, &lib, symbols.data(), (int)symbols.size()), Ge(0));
+        VEC_FOR_EACH(&matches, struct fm_match, m)
+            result.push_back(*m);
+        VEC_END_EACH
+        vec_deinit(&matches);
+        return result;
+    }
+
+    int count(const std::vector<uint64_t>& pattern)
+    {
+        std::vector<union symbol> symbols = make_symbols(pattern);
+        return fm_library_count(&lib, symbols.data(), (int)symbols.size());
+    }
+
+    struct Doc
+    {
+        int game_id;
+        int fighter_idx;
+        uint64_t stamp;
+        std::vector<uint64_t> motions;
+    };
+
+    struct fm_library lib;
+    std::vector<Doc> docs;
+};
+
+MATCHER(MatchEq, "")
+{
+    return std::get<0>(arg).game_id == std::get<1>(arg).game_id
+        && std::get<0>(arg).fighter_idx == std::get<1>(arg).fighter_idx
+        && std::get<0>(arg).start == std::get<1>(arg).start;
+}
+
+TEST_F(NAME, games_are_searchable_once_built)
+{
+    add(1, 10, 0, {0xa, 0xb});
+    EXPECT_THAT(fm_library_has_game(&lib, 1, 10), IsFalse());
+    ASSERT_THAT(fm_library_build(&lib), Eq(0));
+    EXPECT_THAT(fm_library_has_game(&lib, 1, 10), IsTrue());
+    EXPECT_THAT(fm_library_has_game(&lib, 1, 11), IsFalse());
+    EXPECT_THAT(fm_library_has_game(&lib, 2, 10), IsFalse());
+    EXPECT_THAT(count({0xa, 0xb}), Eq(1));
+}
+
+TEST_F(NAME, batches_match_brute_force)
+{
+    uint32_t state = 4321;
+    auto next = [&state]() { state = state * 1103515245 + 12345; return (state >> 16) & 0x7FFF; };
+
+    /* Batches of different sizes, so some are merged and some aren't */
+    int game = 0;
+    for (int batch = 0; batch != 12; ++batch)
+    {
+        int games = 1 + (int)(next() % 6);
+        for (int i = 0; i != games; ++i, ++game)
+            for (int fighter = 0; fighter != 2; ++fighter)
+            {
+                std::vector<uint64_t> motions;
+                int length = 20 + (int)(next() % 100);
+                for (int j = 0; j != length; ++j)
+                    motions.push_back(0x100000000ULL + next() % 5);
+                add(game, 1, fighter, motions);
+            }
+        ASSERT_THAT(fm_library_build(&lib), Eq(0));
+    }
+    EXPECT_THAT(fm_library_game_count(&lib), Eq(game));
+    EXPECT_THAT((int)vec_count(&lib.segments), Lt(12));
+
+    for (int p = 0; p != 50; ++p)
+    {
+        std::vector<uint64_t> pattern;
+        int length = 1 + (int)(next() % 4);
+        for (int i = 0; i != length; ++i)
+            pattern.push_back(0x100000000ULL + next() % 5);
+        std::vector<struct fm_match> expected = brute_force(pattern);
+        EXPECT_THAT(count(pattern), Eq((int)expected.size()));
+        EXPECT_THAT(locate(pattern), Pointwise(MatchEq(), expected));
+    }
+}
+
+TEST_F(NAME, new_stamp_replaces_game)
+{
+    add(1, 10, 0, {0xa, 0xb, 0xc});
+    add(1, 10, 1, {0xc, 0xa});
+    add(2, 10, 0, {0xa, 0xb});
+    ASSERT_THAT(fm_library_build(&lib), Eq(0));
+
+    add(1, 11, 0, {0xb, 0xd});
+    ASSERT_THAT(fm_library_build(&lib), Eq(0));
+    EXPECT_THAT(fm_library_has_game(&lib, 1, 10), IsFalse());
+    EXPECT_THAT(fm_library_has_game(&lib, 1, 11), IsTrue());
+    EXPECT_THAT(fm_library_has_game(&lib, 2, 10), IsTrue());
+    EXPECT_THAT(locate({0xa, 0xb}), Pointwise(MatchEq(), brute_force({0xa, 0xb})));
+    EXPECT_THAT(count({0xc, 0xa}), Eq(0));
+    EXPECT_THAT(count({0xb, 0xd}), Eq(1));
+}
+
+TEST_F(NAME, adding_again_after_build_doesnt_duplicate)
+{
+    add(1, 10, 0, {0xa, 0xb});
+    ASSERT_THAT(fm_library_build(&lib), Eq(0));
+    docs.clear();
+    add(1, 10, 0, {0xa, 0xb});
+    ASSERT_THAT(fm_library_build(&lib), Eq(0));
+    EXPECT_THAT(count({0xa, 0xb}), Eq(1));
+}
+
+TEST_F(NAME, save_and_load)
+{
+    struct fm_library loaded;
+
+    add(1, 10, 0, {0xa, 0xb, 0xc, 0xa, 0xb});
+    add(2, 10, 0, {0xb, 0xa, 0xb});
+    ASSERT_THAT(fm_library_build(&lib), Eq(0));
+    ASSERT_THAT(fm_library_save(&lib, "test_fm_library.fmi"), Eq(0));
+    add(3, 10, 1, {0xa, 0xb});
+    ASSERT_THAT(fm_library_build(&lib), Eq(0));
+    ASSERT_THAT(fm_library_save(&lib, "test_fm_library.fmi"), Eq(0));
+
+    ASSERT_THAT(fm_library_init(&loaded), Eq(0));
+    ASSERT_THAT(fm_library_load(&loaded, "test_fm_library.fmi"), Eq(0));
+    fm_library_deinit(&lib);
+    lib = loaded;
+
+    EXPECT_THAT(fm_library_has_game(&lib, 3, 10), IsTrue());
+    EXPECT_THAT(locate({0xa, 0xb}), Pointwise(MatchEq(), brute_force({0xa, 0xb})));
+
+    /* Merging leaves fewer segments, the files of the others are removed */
+    add(4, 10, 0, {0xa, 0xb, 0xa, 0xb, 0xa, 0xb, 0xa, 0xb, 0xa, 0xb});
+    ASSERT_THAT(fm_library_build(&lib), Eq(0));
+    ASSERT_THAT(fm_library_save(&lib, "test_fm_library.fmi"), Eq(0));
+    EXPECT_THAT(fs_file_exists(file_name((int)vec_count(&lib.segments)).c_str()), IsFalse());
+    ASSERT_THAT(fm_library_load(&lib, "test_fm_library.fmi"), Eq(0));
+    EXPECT_THAT(fm_library_game_count(&lib), Eq(4));
+    EXPECT_THAT(locate({0xa, 0xb}), Pointwise(MatchEq(), brute_force({0xa, 0xb})));
+}
+
+TEST_F(NAME, load_without_files_is_empty)
+{
+    ASSERT_THAT(fm_library_load(&lib, "test_fm_library.fmi"), Eq(0));
+    EXPECT_THAT(fm_library_game_count(&lib), Eq(0));
+    EXPECT_THAT(count({0xa}), Eq(0));
+}
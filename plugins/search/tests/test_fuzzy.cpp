@@ -0,0 +1,116 @@
+#include "gmock/gmock.h"
+
+#include "search/ast.h"
+#include "search/ast_post.h"
+#include "search/bitnfa.h"
+#include "search/nfa.h"
+#include "search/parser.h"
+#include "search/symbol.h"
+
+#include <vector>
+
+#define NAME search_fuzzy
+
+using namespace testing;
+
+class NAME : public Test
+{
+protected:
+    void SetUp() override
+    {
+        bitnfa_init(&bitnfa);
+    }
+
+    void TearDown() override
+    {
+        bitnfa_deinit(&bitnfa);
+    }
+
+    int compile(const char* text)
+    {
+        struct parser parser;
+        struct ast ast;
+        int result;
+
+        parser_init(&parser);
+        ast_init(&ast);
+        result = parser_parse(&parser, text, &ast);
+        if (result == 0)
+        {
+            ast_post_hash40_remaining_labels(&ast);
+            result = bitnfa_compile(&bitnfa, &ast);
+        }
+        ast_deinit(&ast);
+        parser_deinit(&parser);
+        return result;
+    }
+
+    std::vector<struct fuzzy_range> find_all(const std::vector<uint64_t>& motions, int max_edits)
+    {
+        std::vector<union symbol> symbols;
+        std::vector<struct fuzzy_range> result;
+        struct vec ranges;
+        struct range window = { 0, (int)motions.size() };
+
+        for (uint64_t motion : motions)
+            symbols.push_back(symbol_make(motion));
+        vec_init(&ranges, sizeof(struct fuzzy_range));
+        EXPECT_THAT(bitnfa_find_all_fuzzy(&ranges, &bitnfa, symbols.data(), window, max_edits), Eq(0));
+        VEC_FOR_EACH(&ranges, struct fuzzy_range, r)
+            result.push_back(*r);
+        VEC_END_EACH
+        vec_deinit(&ranges);
+        return result;
+    }
+
+    struct bitnfa bitnfa;
+};
+
+TEST_F(NAME, exact_with_zero_edits)
+{
+    ASSERT_THAT(compile("0xa->0xb->0xc"), Eq(0));
+    std::vector<struct fuzzy_range> r = find_all({0xa, 0xb, 0xc, 0xa, 0xd, 0xc}, 0);
+    ASSERT_THAT(r.size(), Eq(1u));
+    EXPECT_THAT(r[0].range.start, Eq(0));
+    EXPECT_THAT(r[0].range.end, Eq(3));
+    EXPECT_THAT(r[0].distance, Eq(0));
+}
+
+TEST_F(NAME, substitution_insertion_deletion)
+{
+    ASSERT_THAT(compile("0xa->0xb->0xc->0xd"), Eq(0));
+
+    /* Substituted, extra symbol, missing symbol */
+    std::vector<struct fuzzy_range> r = find_all({
+        0xa, 0xe, 0xc, 0xd, 0xf,
+        0xa, 0xb, 0xe, 0xc, 0xd, 0xf,
+        0xa, 0xc, 0xd}, 1);
+    ASSERT_THAT(r.size(), Eq(3u));
+    EXPECT_THAT(r[0].range.start, Eq(0));
+    EXPECT_THAT(r[0].range.end, Eq(4));
+    EXPECT_THAT(r[0].distance, Eq(1));
+    EXPECT_THAT(r[1].range.start, Eq(5));
+    EXPECT_THAT(r[1].range.end, Eq(10));
+    EXPECT_THAT(r[1].distance, Eq(1));
+    EXPECT_THAT(r[2].range.start, Eq(11));
+    EXPECT_THAT(r[2].range.end, Eq(14));
+    EXPECT_THAT(r[2].distance, Eq(1));
+}
+
+TEST_F(NAME, too_many_edits)
+{
+    ASSERT_THAT(compile("0xa->0xb->0xc->0xd"), Eq(0));
+    EXPECT_THAT(find_all({0xa, 0xe, 0xf, 0xd}, 1), IsEmpty());
+    EXPECT_THAT(find_all({0xa, 0xe, 0xf, 0xd}, 2), SizeIs(1));
+}
+
+TEST_F(NAME, prefers_exact_match_starting_later)
+{
+    /* Starting at the first 0xa would match with one insertion */
+    ASSERT_THAT(compile("0xa->0xb->0xc"), Eq(0));
+    std::vector<struct fuzzy_range> r = find_all({0xa, 0xa, 0xb, 0xc}, 1);
+    ASSERT_THAT(r.size(), Eq(1u));
+    EXPECT_THAT(r[0].range.start, Eq(1));
+    EXPECT_THAT(r[0].range.end, Eq(4));
+    EXPECT_THAT(r[0].distance, Eq(0));
+}
@@ -0,0 +1,109 @@
+#include "gmock/gmock.h"
+
+#include "search/habit.h"
+#include "search/search_index.h"
+
+#include "vh/frame_data.h"
+#include "vh/hash40.h"
+
+#include <vector>
+
+#define NAME search_habit
+
+using namespace testing;
+
+class NAME : public Test
+{
+protected:
+    void SetUp() override
+    {
+        frame_data_init(&fdata);
+        search_index_init(&index);
+    }
+
+    void TearDown() override
+    {
+        search_index_deinit(&index);
+        frame_data_deinit(&fdata);
+    }
+
+    /* Every motion lasts two frames. The second fighter stands still */
+    void build(const std::vector<uint64_t>& motions)
+    {
+        int frame_count = (int)motions.size() * 2;
+        ASSERT_THAT(frame_data_alloc_structure(&fdata, 2, frame_count), Eq(0));
+        for (int frame = 0; frame != frame_count; ++frame)
+            for (int f = 0; f != 2; ++f)
+            {
+                fdata.motion[f][frame] = f == 0 ? motions[frame / 2] : 0x1;
+                fdata.posx[f][frame] = 0.0f;
+                fdata.posy[f][frame] = 0.0f;
+                fdata.damage[f][frame] = 0.0f;
+                fdata.hitstun[f][frame] = 0.0f;
+                fdata.shield[f][frame] = 50.0f;
+                fdata.status[f][frame] = 0;
+                fdata.stocks[f][frame] = 3;
+                fdata.flags[f][frame] = 0;
+            }
+        ASSERT_THAT(search_index_build(&index, &fdata, -1), Eq(0));
+    }
+
+    std::vector<struct habit> rank(struct habit_miner* miner)
+    {
+        std::vector<struct habit> result;
+        struct vec habits;
+        vec_init(&habits, sizeof(struct habit));
+        EXPECT_THAT(habit_miner_rank(miner, &habits, 10), Eq(0));
+        VEC_FOR_EACH(&habits, struct habit, h)
+            result.push_back(*h);
+        VEC_END_EACH
+        vec_deinit(&habits);
+        return result;
+    }
+
+    struct frame_data fdata;
+    struct search_index index;
+};
+
+TEST_F(NAME, counts_sequences_after_event)
+{
+    uint64_t ledge = hash40_cstr("cliff_catch");
+    build({0xa, ledge, 0xb, 0xc, 0xd, ledge, 0xb, 0xc, 0xe, ledge, 0xf, 0xa});
+
+    struct habit_miner miner;
+    ASSERT_THAT(habit_miner_init(&miner, HABIT_AFTER_LEDGE_GRAB), Eq(0));
+    ASSERT_THAT(habit_miner_add(&miner, &index, 7, 0), Eq(0));
+    EXPECT_THAT(miner.events, Eq(3));
+
+    std::vector<struct habit> habits = rank(&miner);
+    ASSERT_THAT(habits.size(), Ge(1u));
+    EXPECT_THAT(habits[0].count, Eq(2));
+    ASSERT_THAT(habits[0].length, Eq(2));
+    EXPECT_THAT(habits[0].motions[0], Eq(0xbu));
+    EXPECT_THAT(habits[0].motions[1], Eq(0xcu));
+
+    /* The first sample is the sequence after the first ledge grab */
+    ASSERT_THAT(habits[0].sample_count, Eq(2));
+    EXPECT_THAT(habits[0].samples[0].game_id, Eq(7));
+    EXPECT_THAT(habits[0].samples[0].frames.start, Eq(4));
+    EXPECT_THAT(habits[0].samples[0].frames.end, Eq(8));
+    habit_miner_deinit(&miner);
+}
+
+TEST_F(NAME, prefixes_of_longer_habits_are_absorbed)
+{
+    build({0xa, 0xb, 0xc, 0xa, 0xb, 0xc, 0xa, 0xb, 0xd});
+
+    struct habit_miner miner;
+    ASSERT_THAT(habit_miner_init(&miner, HABIT_AFTER_ANYTHING), Eq(0));
+    ASSERT_THAT(habit_miner_add(&miner, &index, 1, 0), Eq(0));
+
+    /* "b c" only happens as part of "b c a", which doesn't add anything.
+     * "c a b" happens twice but continues differently, so it stays */
+    for (const struct habit& h : rank(&miner))
+    {
+        EXPECT_FALSE(h.length == 2 && h.motions[0] == 0xb && h.motions[1] == 0xc)
+            << "count " << h.count;
+    }
+    habit_miner_deinit(&miner);
+}
@@ -0,0 +1,125 @@
+#include "gmock/gmock.h"
+
+#include "search/hit_stats.h"
+
+#include <string>
+#include <vector>
+
+#define NAME search_hit_stats
+
+using namespace testing;
+
+class NAME : public Test
+{
+protected:
+    void SetUp() override
+    {
+        ASSERT_THAT(hit_stats_init(&stats), Eq(0));
+    }
+
+    void TearDown() override
+    {
+        hit_stats_deinit(&stats);
+    }
+
+    int add_stream(int game_id, int fighter_idx, int person_id, int opponent_fighter_id, int stage_id)
+    {
+        struct hit_stream stream;
+        stream.game_id = game_id;
+        stream.fighter_idx = fighter_idx;
+        stream.fighter_id = 1;
+        stream.groups[HIT_GROUP_PLAYER] = person_id;
+        stream.groups[HIT_GROUP_OPPONENT] = opponent_fighter_id;
+        stream.groups[HIT_GROUP_STAGE] = stage_id;
+        return hit_stats_add_stream(&stats, &stream);
+    }
+
+    void add_hit(int stream, float percent)
+    {
+        struct range frames = { 0, 10 };
+        ASSERT_THAT(hit_stats_add_hit(&stats, stream, frames, percent), Eq(0));
+    }
+
+    std::vector<struct hit_stats_row> aggregate(enum hit_group group)
+    {
+        std::vector<struct hit_stats_row> result;
+        struct vec rows;
+        vec_init(&rows, sizeof(struct hit_stats_row));
+        EXPECT_THAT(hit_stats_aggregate(&stats, group, &rows), Eq(0));
+        VEC_FOR_EACH(&rows, struct hit_stats_row, row)
+            result.push_back(*row);
+        VEC_END_EACH
+        vec_deinit(&rows);
+        return result;
+    }
+
+    struct hit_stats stats;
+};
+
+TEST_F(NAME, games_without_hits_count_towards_the_rate)
+{
+    int s1 = add_stream(1, 0, 10, 20, 30);
+    int s2 = add_stream(2, 0, 10, 21, 30);
+    add_stream(3, 0, 10, 20, 31);
+    add_hit(s1, 5.0f);
+    add_hit(s1, 45.0f);
+    add_hit(s2, 47.0f);
+
+    std::vector<struct hit_stats_row> rows = aggregate(HIT_GROUP_PLAYER);
+    ASSERT_THAT(rows.size(), Eq(1u));
+    EXPECT_THAT(rows[0].group_id, Eq(10));
+    EXPECT_THAT(rows[0].games, Eq(3));
+    EXPECT_THAT(rows[0].games_with_hits, Eq(2));
+    EXPECT_THAT(rows[0].hits, Eq(3));
+    EXPECT_THAT(rows[0].histogram[0], Eq(1));
+    EXPECT_THAT(rows[0].histogram[4], Eq(2));
+}
+
+TEST_F(NAME, regroup_without_searching_again)
+{
+    int s1 = add_stream(1, 0, 10, 20, 30);
+    int s2 = add_stream(1, 1, 11, 21, 30);
+    int s3 = add_stream(2, 0, 10, 21, 31);
+    add_hit(s1, 0.0f);
+    add_hit(s2, 0.0f);
+    add_hit(s3, 0.0f);
+    add_hit(s3, 200.0f);
+
+    std::vector<struct hit_stats_row> rows = aggregate(HIT_GROUP_OPPONENT);
+    ASSERT_THAT(rows.size(), Eq(2u));
+    EXPECT_THAT(rows[0].group_id, Eq(21));
+    EXPECT_THAT(rows[0].hits, Eq(3));
+    EXPECT_THAT(rows[0].histogram[HIT_STATS_PERCENT_BUCKETS - 1], Eq(1));
+    EXPECT_THAT(rows[1].group_id, Eq(20));
+    EXPECT_THAT(rows[1].hits, Eq(1));
+
+    rows = aggregate(HIT_GROUP_STAGE);
+    ASSERT_THAT(rows.size(), Eq(2u));
+    EXPECT_THAT(rows[0].group_id, Eq(30));
+    EXPECT_THAT(rows[0].games, Eq(2));
+    EXPECT_THAT(rows[0].hits, Eq(2));
+    EXPECT_THAT(rows[1].group_id, Eq(31));
+    EXPECT_THAT(rows[1].hits, Eq(2));
+}
+
+TEST_F(NAME, csv_quotes_names)
+{
+    struct vec rows;
+    struct str csv;
+    int s1 = add_stream(1, 0, 10, 20, 30);
+    add_hit(s1, 12.0f);
+    ASSERT_THAT(hit_stats_set_name(&stats, HIT_GROUP_PLAYER, 10, cstr_view("Team \"A\", p1")), Eq(0));
+
+    vec_init(&rows, sizeof(struct hit_stats_row));
+    str_init(&csv);
+    ASSERT_THAT(hit_stats_aggregate(&stats, HIT_GROUP_PLAYER, &rows), Eq(0));
+    ASSERT_THAT(hit_stats_to_csv(&stats, HIT_GROUP_PLAYER, &rows, &csv), Eq(0));
+
+    std::string text(csv.data, csv.len);
+    EXPECT_THAT(text, StartsWith("player,games,games_with_hits,hits,hits_per_game,0-9%,10-19%,"));
+    EXPECT_THAT(text, HasSubstr("150%+\n"));
+    EXPECT_THAT(text, HasSubstr("\n\"Team \"\"A\"\", p1\",1,1,1,1.000,0,1,0,"));
+
+    str_deinit(&csv);
+    vec_deinit(&rows);
+}
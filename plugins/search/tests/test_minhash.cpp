@@ -0,0 +1,80 @@
+#include "gmock/gmock.h"
+
+#include "search/minhash.h"
+#include "search/symbol.h"
+
+#include <vector>
+
+#define NAME search_minhash
+
+using namespace testing;
+
+class NAME : public Test
+{
+protected:
+    std::vector<union symbol> make_symbols(const std::vector<uint64_t>& motions)
+    {
+        std::vector<union symbol> symbols;
+        for (uint64_t motion : motions)
+            symbols.push_back(symbol_make(motion));
+        return symbols;
+    }
+
+    struct minhash compute(const std::vector<union symbol>& symbols, int start, int end)
+    {
+        struct minhash mh;
+        minhash_compute(&mh, symbols.data(), {start, end});
+        return mh;
+    }
+};
+
+TEST_F(NAME, same_motions_same_buckets)
+{
+    /* Flags must not influence the signature */
+    std::vector<union symbol> a = make_symbols({0xa, 0xb, 0xc, 0xd, 0xe, 0xf});
+    std::vector<union symbol> b = a;
+    b[2].me_hitlag = 1;
+    b[4].op_damage = 5;
+
+    struct minhash mha = compute(a, 0, 6);
+    struct minhash mhb = compute(b, 0, 6);
+    EXPECT_THAT(minhash_similarity(&mha, &mhb), Eq(MINHASH_HASHES));
+
+    uint64_t bands_a[MINHASH_BANDS], bands_b[MINHASH_BANDS];
+    minhash_bands(bands_a, &mha);
+    minhash_bands(bands_b, &mhb);
+    for (int i = 0; i != MINHASH_BANDS; ++i)
+        EXPECT_THAT(bands_a[i], Eq(bands_b[i]));
+}
+
+TEST_F(NAME, similarity_follows_overlap)
+{
+    std::vector<union symbol> symbols = make_symbols({
+        0xa, 0xb, 0xc, 0xd, 0xe, 0xf, 0x10, 0x11, 0x12, 0x13,
+        0xa, 0xb, 0xc, 0xd, 0xe, 0x20, 0x21, 0x22, 0x23, 0x24,
+        0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39});
+    struct minhash first = compute(symbols, 0, 10);
+    struct minhash half = compute(symbols, 10, 20);
+    struct minhash none = compute(symbols, 20, 30);
+    EXPECT_THAT(minhash_similarity(&first, &half), Gt(minhash_similarity(&first, &none)));
+    EXPECT_THAT(minhash_similarity(&first, &none), Lt(MINHASH_HASHES / 8));
+}
+
+TEST_F(NAME, windows_cover_range)
+{
+    std::vector<uint64_t> motions;
+    for (int i = 0; i != 50; ++i)
+        motions.push_back(0xa + i % 7);
+    std::vector<union symbol> symbols = make_symbols(motions);
+
+    struct vec windows;
+    vec_init(&windows, sizeof(struct minhash_window));
+    ASSERT_THAT(minhash_windows(&windows, symbols.data(), {0, 50}), Eq(0));
+    ASSERT_THAT(vec_count(&windows), Gt(0u));
+    EXPECT_THAT(((struct minhash_window*)vec_front(&windows))->symbols.start, Eq(0));
+    EXPECT_THAT(((struct minhash_window*)vec_back(&windows))->symbols.end, Eq(50));
+    VEC_FOR_EACH(&windows, struct minhash_window, w)
+        EXPECT_THAT(w->symbols.end - w->symbols.start, Le(MINHASH_WINDOW));
+    VEC_END_EACH
+    vec_deinit(&windows);
+}
@@ -0,0 +1,238 @@
+#include "gmock/gmock.h"
+
+#include "search/ast.h"
+#include "search/ast_post.h"
+#include "search/dfa.h"
+#include "search/multi_nfa.h"
+#include "search/nfa.h"
+#include "search/parser.h"
+#include "search/symbol.h"
+
+#include "vh/hash40.h"
+
+#include <vector>
+
+#define NAME search_multi_nfa
+
+using namespace testing;
+
+class NAME : public Test
+{
+protected:
+    void SetUp() override
+    {
+        multi_nfa_init(&multi);
+    }
+
+    void TearDown() override
+    {
+        multi_nfa_deinit(&multi);
+        for (struct nfa_graph& nfa : nfas)
+            nfa_deinit(&nfa);
+    }
+
+    int compile(const std::vector<const char*>& texts)
+    {
+        for (const char* text : texts)
+        {
+            struct parser parser;
+            struct ast ast;
+            int result;
+
+            parser_init(&parser);
+            ast_init(&ast);
+            nfas.emplace_back();
+            nfa_init(&nfas.back());
+            result = parser_parse(&parser, text, &ast);
+            if (result == 0)
+            {
+                ast_post_hash40_remaining_labels(&ast);
+                result = nfa_compile(&nfas.back(), &ast);
+            }
+            ast_deinit(&ast);
+            parser_deinit(&parser);
+            if (result < 0)
+                return -1;
+        }
+
+        return multi_nfa_compile(&multi, nfas.data(), (int)nfas.size());
+    }
+
+    /* Runs each query on its own through the DFA and merges the results */
+    std::vector<std::vector<struct range>> expected(const std::vector<union symbol>& symbols)
+    {
+        std::vector<std::vector<struct range>> result;
+        for (struct nfa_graph& nfa : nfas)
+        {
+            struct dfa_table dfa;
+            struct vec ranges;
+            struct range window = { 0, (int)symbols.size() };
+
+            result.emplace_back();
+            dfa_init(&dfa);
+            vec_init(&ranges, sizeof(struct range));
+            EXPECT_THAT(dfa_from_nfa(&dfa, &nfa), Eq(0));
+            EXPECT_THAT(dfa_find_all(&ranges, &dfa, symbols.data(), window), Eq(0));
+            VEC_FOR_EACH(&ranges, struct range, r)
+                result.back().push_back(*r);
+            VEC_END_EACH
+            vec_deinit(&ranges);
+            dfa_deinit(&dfa);
+        }
+        return result;
+    }
+
+    std::vector<std::vector<struct range>> find_all(const std::vector<union symbol>& symbols)
+    {
+        std::vector<std::vector<struct range>> result(nfas.size());
+        struct vec matches;
+        struct range window = { 0, (int)symbols.size() };
+        int last_start = 0;
+
+        vec_init(&matches, sizeof(struct query_range));
+        EXPECT_THAT(multi_nfa_find_all(&matches, &multi, symbols.data(), window), Eq(0));
+        VEC_FOR_EACH(&matches, struct query_range, m)
+            EXPECT_THAT(m->range.start, Ge(last_start));
+            last_start = m->range.start;
+            result[m->query].push_back(m->range);
+        VEC_END_EACH
+        vec_deinit(&matches);
+        return result;
+    }
+
+    std::vector<struct nfa_graph> nfas;
+    struct multi_nfa multi;
+};
+
+static union symbol
+motion_to_symbol(uint64_t motion)
+{
+    union symbol s;
+    s.u64 = 0;
+    s.motionl = motion & 0xFFFFFFFF;
+    s.motionh = motion >> 32UL;
+    return s;
+}
+
+static std::vector<union symbol>
+make_symbols(const std::vector<uint64_t>& motions)
+{
+    std::vector<union symbol> symbols;
+    for (uint64_t motion : motions)
+        symbols.push_back(motion_to_symbol(motion));
+    return symbols;
+}
+
+MATCHER(RangeEq, "")
+{
+    return std::get<0>(arg).start == std::get<1>(arg).start
+        && std::get<0>(arg).end == std::get<1>(arg).end;
+}
+
+TEST_F(NAME, single_query)
+{
+    ASSERT_THAT(compile({"0xa->0xb"}), Eq(0));
+    ASSERT_THAT(multi_nfa_query_count(&multi), Eq(1));
+    std::vector<union symbol> symbols = make_symbols({0xa, 0xb, 0xc, 0xa, 0xb});
+    std::vector<std::vector<struct range>> result = find_all(symbols);
+    ASSERT_THAT(result[0].size(), Eq(2u));
+    EXPECT_THAT(result[0][0].start, Eq(0));
+    EXPECT_THAT(result[0][0].end, Eq(2));
+    EXPECT_THAT(result[0][1].start, Eq(3));
+    EXPECT_THAT(result[0][1].end, Eq(5));
+}
+
+TEST_F(NAME, overlapping_queries)
+{
+    /* Both queries match inside each other's ranges, which mustn't block the
+     * other query from finding its own matches */
+    ASSERT_THAT(compile({"0xa->0xb->0xc", "0xb->0xc", "0xa+"}), Eq(0));
+    std::vector<union symbol> symbols = make_symbols({0xa, 0xa, 0xb, 0xc, 0xb, 0xc, 0xa});
+    std::vector<std::vector<struct range>> exp = expected(symbols);
+    std::vector<std::vector<struct range>> result = find_all(symbols);
+    for (size_t q = 0; q != exp.size(); ++q)
+        EXPECT_THAT(result[q], Pointwise(RangeEq(), exp[q])) << "query " << q;
+    EXPECT_THAT(result[1].size(), Eq(2u));
+}
+
+TEST_F(NAME, wildcards_keep_per_query_semantics)
+{
+    /* In the first query 0xb is an explicit column, in the second it is only
+     * matched by the wildcard. Merging must not change what either matches */
+    ASSERT_THAT(compile({"0xa->!0xb", "0xa->.->0xc", ".?->0xb"}), Eq(0));
+    std::vector<union symbol> symbols = make_symbols({0xa, 0xb, 0xc, 0xa, 0xd, 0xc, 0xb});
+    std::vector<std::vector<struct range>> exp = expected(symbols);
+    std::vector<std::vector<struct range>> result = find_all(symbols);
+    for (size_t q = 0; q != exp.size(); ++q)
+        EXPECT_THAT(result[q], Pointwise(RangeEq(), exp[q])) << "query " << q;
+}
+
+TEST_F(NAME, many_queries_multi_word)
+{
+    std::vector<const char*> queries = {
+        "0xa->.0,40->0xb",
+        "0xb->0xc",
+        "0xc->.0,30->0xa",
+        "(0xa|0xc)+",
+        "0xd->.*->0xa",
+    };
+    ASSERT_THAT(compile(queries), Eq(0));
+    ASSERT_THAT(multi.words, Gt(1));
+
+    std::vector<uint64_t> motions;
+    for (int i = 0; i != 200; ++i)
+        motions.push_back(0xa + (i * 7 + i / 3) % 4);
+    std::vector<union symbol> symbols = make_symbols(motions);
+    std::vector<std::vector<struct range>> exp = expected(symbols);
+    std::vector<std::vector<struct range>> result = find_all(symbols);
+    for (size_t q = 0; q != exp.size(); ++q)
+        EXPECT_THAT(result[q], Pointwise(RangeEq(), exp[q])) << "query " << q;
+}
+
+TEST_F(NAME, matches_found_while_an_older_thread_is_active)
+{
+    /* The thread starting at 0xa stays active over several matches of 0xb,
+     * which are only valid if it never reaches 0xd */
+    ASSERT_THAT(compile({"(0xa->.*->0xd)|0xb", "0xb->0xb"}), Eq(0));
+    std::vector<std::vector<uint64_t>> inputs = {
+        {0xa, 0xb, 0xc, 0xb, 0xb, 0xc},
+        {0xa, 0xb, 0xc, 0xb, 0xb, 0xd, 0xb},
+        {0xb, 0xa, 0xb, 0xb, 0xa, 0xb, 0xd, 0xb, 0xb},
+    };
+    for (const std::vector<uint64_t>& motions : inputs)
+    {
+        std::vector<union symbol> symbols = make_symbols(motions);
+        std::vector<std::vector<struct range>> exp = expected(symbols);
+        std::vector<std::vector<struct range>> result = find_all(symbols);
+        for (size_t q = 0; q != exp.size(); ++q)
+            EXPECT_THAT(result[q], Pointwise(RangeEq(), exp[q])) << "query " << q;
+    }
+}
+
+TEST_F(NAME, same_results_as_dfa_on_random_input)
+{
+    std::vector<const char*> queries = {
+        "0xa->0xb?->0xc",
+        "(0xa->.*->0xd)|0xb",
+        "0xc+->0xa",
+        ".->0xd",
+        "(0xb|0xc)->.0,3->0xb",
+    };
+    ASSERT_THAT(compile(queries), Eq(0));
+
+    unsigned seed = 12345;
+    for (int round = 0; round != 20; ++round)
+    {
+        std::vector<uint64_t> motions;
+        for (int i = 0; i != 100; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            motions.push_back(0xa + (seed >> 16) % 4);
+        }
+        std::vector<union symbol> symbols = make_symbols(motions);
+        std::vector<std::vector<struct range>> exp = expected(symbols);
+        std::vector<std::vector<struct range>> result = find_all(symbols);
+        for (size_t q = 0; q != exp.size(); ++q)
+            EXPECT_THAT(result[q], Pointwise(RangeEq(), exp[q])) << "round " << round << " query " << q;
+    }
+}
@@ -0,0 +1,154 @@
+#include "gmock/gmock.h"
+
+#include "search/ast.h"
+#include "search/ast_post.h"
+#include "search/parser.h"
+#include "search/prefilter.h"
+#include "search/symbol.h"
+
+#include "vh/hash40.h"
+
+#include <vector>
+
+#define NAME search_prefilter
+
+using namespace testing;
+
+class NAME : public Test
+{
+protected:
+    void SetUp() override
+    {
+        parser_init(&parser);
+        ast_init(&ast);
+        prefilter_init(&pf);
+    }
+
+    void TearDown() override
+    {
+        ast_deinit(&ast);
+        parser_deinit(&parser);
+    }
+
+    int compile(const char* text)
+    {
+        if (parser_parse(&parser, text, &ast) < 0)
+            return -1;
+        ast_post_hash40_remaining_labels(&ast);
+        return prefilter_from_ast(&pf, &ast);
+    }
+
+    struct parser parser;
+    struct ast ast;
+    struct prefilter pf;
+};
+
+static union symbol
+motion_to_symbol(uint64_t motion)
+{
+    union symbol s;
+    s.u64 = 0;
+    s.motionl = motion & 0xFFFFFFFF;
+    s.motionh = motion >> 32UL;
+    return s;
+}
+
+TEST_F(NAME, single_motion)
+{
+    ASSERT_THAT(compile("0xa"), Eq(0));
+    ASSERT_THAT(prefilter_is_active(&pf), IsTrue());
+    EXPECT_THAT(pf.motion, Eq(motion_to_symbol(0xa).u64));
+    EXPECT_THAT(pf.before, Eq(0));
+    EXPECT_THAT(pf.after, Eq(0));
+}
+
+TEST_F(NAME, sequence_with_bounded_wildcard)
+{
+    ASSERT_THAT(compile("0xa->.0,3->0xb"), Eq(0));
+    ASSERT_THAT(prefilter_is_active(&pf), IsTrue());
+    EXPECT_THAT(pf.motion, Eq(motion_to_symbol(0xa).u64));
+    EXPECT_THAT(pf.before, Eq(0));
+    EXPECT_THAT(pf.after, Eq(4));
+}
+
+TEST_F(NAME, prefer_bounded_literal)
+{
+    ASSERT_THAT(compile(".*->0xa->0xb"), Eq(0));
+    ASSERT_THAT(prefilter_is_active(&pf), IsTrue());
+    EXPECT_THAT(pf.before, Eq(-1));
+    EXPECT_THAT(pf.after, Eq(1));
+}
+
+TEST_F(NAME, union_requires_motion_on_both_sides)
+{
+    ASSERT_THAT(compile("(0xa->0xb)|(0xc->0xa)"), Eq(0));
+    ASSERT_THAT(prefilter_is_active(&pf), IsTrue());
+    EXPECT_THAT(pf.motion, Eq(motion_to_symbol(0xa).u64));
+    EXPECT_THAT(pf.before, Eq(1));
+    EXPECT_THAT(pf.after, Eq(1));
+}
+
+TEST_F(NAME, union_without_common_motion)
+{
+    ASSERT_THAT(compile("0xa|0xb"), Eq(0));
+    EXPECT_THAT(prefilter_is_active(&pf), IsFalse());
+}
+
+TEST_F(NAME, optional_and_inverted_motions_are_not_required)
+{
+    ASSERT_THAT(compile("0xa?->!0xb"), Eq(0));
+    EXPECT_THAT(prefilter_is_active(&pf), IsFalse());
+}
+
+TEST_F(NAME, all_isas_find_same_positions)
+{
+    std::vector<union symbol> symbols;
+    for (int i = 0; i != 103; ++i)
+    {
+        union symbol s = motion_to_symbol(i % 7 == 3 ? 0xa : 0xb);
+        s.me_hitlag = i & 1;  /* Flags must be ignored */
+        symbols.push_back(s);
+    }
+
+    ASSERT_THAT(compile("0xa"), Eq(0));
+    for (int isa = PREFILTER_SCALAR; isa <= prefilter_best_isa(); ++isa)
+    {
+        struct range window = { 0, (int)symbols.size() };
+        std::vector<int> found;
+        ASSERT_THAT(prefilter_set_isa(&pf, (enum prefilter_isa)isa), Eq(0));
+        for (;;)
+        {
+            window.start = prefilter_find_next(&pf, symbols.data(), window);
+            if (window.start == window.end)
+                break;
+            found.push_back(window.start++);
+        }
+
+        ASSERT_THAT(found.size(), Eq(15u));
+        for (int i = 0; i != (int)found.size(); ++i)
+            EXPECT_THAT(found[i], Eq(i * 7 + 3));
+    }
+}
+
+TEST_F(NAME, windows_around_occurrences_are_merged)
+{
+    std::vector<union symbol> symbols(50, motion_to_symbol(0xc));
+    symbols[10] = motion_to_symbol(0xa);
+    symbols[13] = motion_to_symbol(0xa);
+    symbols[40] = motion_to_symbol(0xa);
+
+    ASSERT_THAT(compile(".0,2->0xa->.0,1"), Eq(0));
+    struct range window = { 0, (int)symbols.size() };
+    struct range w1 = prefilter_next_window(&pf, symbols.data(), window);
+    EXPECT_THAT(w1.start, Eq(8));
+    EXPECT_THAT(w1.end, Eq(15));
+
+    window.start = w1.end;
+    struct range w2 = prefilter_next_window(&pf, symbols.data(), window);
+    EXPECT_THAT(w2.start, Eq(38));
+    EXPECT_THAT(w2.end, Eq(42));
+
+    window.start = w2.end;
+    struct range w3 = prefilter_next_window(&pf, symbols.data(), window);
+    EXPECT_THAT(w3.start, Eq(w3.end));
+}
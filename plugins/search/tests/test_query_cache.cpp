@@ -0,0 +1,112 @@
+#include "gmock/gmock.h"
+
+#include "search/ast.h"
+#include "search/ast_ops.h"
+#include "search/parser.h"
+#include "search/query_cache.h"
+
+#define NAME search_query_cache
+
+using namespace testing;
+
+class NAME : public Test
+{
+protected:
+    void SetUp() override
+    {
+        parser_init(&parser);
+        ast_init(&ast);
+        query_cache_init(&cache, 2);
+    }
+
+    void TearDown() override
+    {
+        query_cache_deinit(&cache);
+        ast_deinit(&ast);
+        parser_deinit(&parser);
+    }
+
+    uint64_t hash(const char* text)
+    {
+        ast_clear(&ast);
+        EXPECT_THAT(parser_parse(&parser, text, &ast), Eq(0));
+        return ast_hash(&ast, 0);
+    }
+
+    struct parser parser;
+    struct ast ast;
+    struct query_cache cache;
+};
+
+TEST_F(NAME, hash_ignores_formatting)
+{
+    EXPECT_THAT(hash("nair->0xa"), Eq(hash("  nair  ->   0xa ")));
+    EXPECT_THAT(hash("(nair|fair)+"), Eq(hash("(nair | fair)+")));
+}
+
+TEST_F(NAME, hash_distinguishes_queries)
+{
+    EXPECT_THAT(hash("nair->fair"), Ne(hash("fair->nair")));
+    EXPECT_THAT(hash("nair->fair"), Ne(hash("nair|fair")));
+    EXPECT_THAT(hash("nair{2,3}"), Ne(hash("nair{2,4}")));
+    EXPECT_THAT(hash("nair"), Ne(hash("bair")));
+}
+
+TEST_F(NAME, find_is_keyed_by_fighter)
+{
+    uint64_t h = hash("nair");
+    struct compiled_query* q = query_cache_insert(&cache, h, &ast, 8, -1);
+    ASSERT_THAT(q, NotNull());
+    EXPECT_THAT(query_cache_find(&cache, h, &ast, 8, -1), Eq(q));
+    EXPECT_THAT(query_cache_find(&cache, h, &ast, 9, -1), IsNull());
+    EXPECT_THAT(query_cache_find(&cache, h, &ast, 8, 9), IsNull());
+    h = hash("bair");
+    EXPECT_THAT(query_cache_find(&cache, h, &ast, 8, -1), IsNull());
+}
+
+TEST_F(NAME, find_compares_trees_if_hashes_collide)
+{
+    uint64_t h = hash("nair");
+    ASSERT_THAT(query_cache_insert(&cache, h, &ast, 8, -1), NotNull());
+
+    /* Pretend that a different query has the same hash */
+    hash("fair");
+    EXPECT_THAT(query_cache_find(&cache, h, &ast, 8, -1), IsNull());
+
+    /* The entry keeps its own copy of the tree */
+    hash("nair");
+    EXPECT_THAT(query_cache_find(&cache, h, &ast, 8, -1), NotNull());
+}
+
+TEST_F(NAME, evicts_least_recently_used)
+{
+    uint64_t h1, h2, h3;
+    h1 = hash("nair");
+    ASSERT_THAT(query_cache_insert(&cache, h1, &ast, 0, -1), NotNull());
+    h2 = hash("fair");
+    ASSERT_THAT(query_cache_insert(&cache, h2, &ast, 0, -1), NotNull());
+
+    /* Touching 1 makes 2 the oldest entry */
+    hash("nair");
+    ASSERT_THAT(query_cache_find(&cache, h1, &ast, 0, -1), NotNull());
+    h3 = hash("bair");
+    ASSERT_THAT(query_cache_insert(&cache, h3, &ast, 0, -1), NotNull());
+
+    EXPECT_THAT(query_cache_count(&cache), Eq(2));
+    hash("nair");
+    EXPECT_THAT(query_cache_find(&cache, h1, &ast, 0, -1), NotNull());
+    hash("fair");
+    EXPECT_THAT(query_cache_find(&cache, h2, &ast, 0, -1), IsNull());
+    hash("bair");
+    EXPECT_THAT(query_cache_find(&cache, h3, &ast, 0, -1), NotNull());
+}
+
+TEST_F(NAME, erase)
+{
+    uint64_t h = hash("nair");
+    struct compiled_query* q = query_cache_insert(&cache, h, &ast, 0, -1);
+    ASSERT_THAT(q, NotNull());
+    query_cache_erase(&cache, q);
+    EXPECT_THAT(query_cache_count(&cache), Eq(0));
+    EXPECT_THAT(query_cache_find(&cache, h, &ast, 0, -1), IsNull());
+}
@@ -0,0 +1,110 @@
+#include "gmock/gmock.h"
+
+#include "search/search_index.h"
+#include "search/symbol.h"
+
+#include "vh/frame_data.h"
+
+#define NAME search_search_index
+
+using namespace testing;
+
+class NAME : public Test
+{
+protected:
+    void SetUp() override
+    {
+        frame_data_init(&fdata);
+        search_index_init(&index);
+    }
+
+    void TearDown() override
+    {
+        search_index_deinit(&index);
+        frame_data_deinit(&fdata);
+    }
+
+    /* Runs of motions with some flags sprinkled in, deterministic */
+    void generate(int fighter_count, int frame_count)
+    {
+        uint32_t rng = 12345;
+        ASSERT_THAT(frame_data_alloc_structure(&fdata, fighter_count, frame_count), Eq(0));
+        for (int f = 0; f != fighter_count; ++f)
+        {
+            uint64_t motion = 0;
+            for (int frame = 0; frame != frame_count; ++frame)
+            {
+                rng = rng * 1103515245 + 12345;
+                if (frame == 0 || (rng >> 16) % 5 == 0)
+                    motion = ((uint64_t)(rng % 20) << 32) | (rng >> 8);
+                fdata.motion[f][frame] = motion;
+                fdata.posx[f][frame] = (float)((rng >> 4) % 100);
+                fdata.posy[f][frame] = (float)((rng >> 7) % 50);
+                fdata.damage[f][frame] = (float)(frame / 10);
+                fdata.hitstun[f][frame] = (rng >> 12) % 3 == 0 ? 10.0f : 0.0f;
+                fdata.shield[f][frame] = 50.0f;
+                fdata.status[f][frame] = (rng >> 20) % 40;
+                fdata.stocks[f][frame] = (uint8_t)(3 - frame * 3 / frame_count);
+                fdata.flags[f][frame] = (rng >> 24) & 0x07;
+            }
+        }
+    }
+
+    struct frame_data fdata;
+    struct search_index index;
+};
+
+TEST_F(NAME, one_symbol_per_motion_change)
+{
+    const uint64_t motions[] = { 0xa, 0xa, 0xb, 0xb, 0xb, 0xa };
+    generate(2, 6);
+    for (int frame = 0; frame != 6; ++frame)
+        fdata.motion[0][frame] = motions[frame];
+
+    ASSERT_THAT(search_index_build(&index, &fdata, -1), Eq(0));
+    ASSERT_THAT(search_index_symbol_count(&index, 0), Eq(3));
+    const union symbol* symbols = search_index_symbols(&index, 0);
+    EXPECT_THAT(symbols[0].motionl, Eq(0xau));
+    EXPECT_THAT(symbols[1].motionl, Eq(0xbu));
+    EXPECT_THAT(symbols[2].motionl, Eq(0xau));
+
+    struct range frames = search_index_frames(&index, 0, {1, 2});
+    EXPECT_THAT(frames.start, Eq(2));
+    EXPECT_THAT(frames.end, Eq(5));
+    frames = search_index_frames(&index, 0, {2, 3});
+    EXPECT_THAT(frames.start, Eq(5));
+    EXPECT_THAT(frames.end, Eq(6));
+}
+
+TEST_F(NAME, isa_does_not_change_result)
+{
+    struct search_index scalar;
+
+    generate(4, 1003);
+    search_index_init(&scalar);
+    ASSERT_THAT(search_index_set_isa(&scalar, PREFILTER_SCALAR), Eq(0));
+    ASSERT_THAT(search_index_build(&scalar, &fdata, 1), Eq(0));
+    ASSERT_THAT(search_index_build(&index, &fdata, 1), Eq(0));
+
+    ASSERT_THAT(search_index_fighter_count(&index), Eq(4));
+    for (int f = 0; f != 4; ++f)
+    {
+        int count = search_index_symbol_count(&scalar, f);
+        ASSERT_THAT(search_index_symbol_count(&index, f), Eq(count));
+        ASSERT_THAT(search_index_joint_symbol_count(&index, f), Eq(search_index_joint_symbol_count(&scalar, f)));
+        EXPECT_THAT(search_index_opponent(&index, f), Eq(search_index_opponent(&scalar, f)));
+
+        for (int i = 0; i != count; ++i)
+        {
+            struct range a = search_index_frames(&scalar, f, {i, i + 1});
+            struct range b = search_index_frames(&index, f, {i, i + 1});
+            EXPECT_THAT(search_index_symbols(&index, f)[i].u64, Eq(search_index_symbols(&scalar, f)[i].u64));
+            EXPECT_THAT(b.start, Eq(a.start));
+            EXPECT_THAT(b.end, Eq(a.end));
+        }
+        for (int i = 0; i != search_index_joint_symbol_count(&scalar, f); ++i)
+            EXPECT_THAT(search_index_joint_symbols(&index, f)[i].u64, Eq(search_index_joint_symbols(&scalar, f)[i].u64));
+    }
+
+    search_index_deinit(&scalar);
+}
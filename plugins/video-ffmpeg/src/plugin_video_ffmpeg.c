@@ -50,7 +50,10 @@ on_render(GtkWidget* widget, GdkGLContext* context, void* user_pointer)
 }
 
 static struct plugin_ctx*
-create(GTypeModule* type_module, struct db_interface* dbi, struct db* db)
+create(
+        GTypeModule* type_module,
+        struct db_interface* dbi, struct db* db,
+        struct db_worker_interface* dbwi, struct db_worker* dbw)
 {
     struct plugin_ctx* ctx = mem_alloc(sizeof(struct plugin_ctx));
     memset(ctx, 0, sizeof *ctx);
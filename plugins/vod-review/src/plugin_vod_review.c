@@ -14,6 +14,8 @@ struct plugin_ctx
     GTypeModule* type_module;
     struct db_interface* dbi;
     struct db* db;
+    struct db_worker_interface* dbwi;
+    struct db_worker* dbw;
 
     /* These are loaded from the video player plugin */
     struct plugin_lib video_plugin;
@@ -28,7 +30,8 @@ static int on_scan_plugin(struct plugin_lib lib, void* user)
     if (cstr_equal(cstr_view("FFmpeg Video Player"), lib.i->info->name))
     {
         ctx->video_plugin = lib;
-        ctx->video_ctx = ctx->video_plugin.i->create(ctx->type_module, ctx->dbi, ctx->db);
+        ctx->video_ctx = ctx->video_plugin.i->create(
+            ctx->type_module, ctx->dbi, ctx->db, ctx->dbwi, ctx->dbw);
         if (ctx->video_ctx == NULL)
         {
             log_err("Failed to load FFmpeg video player plugin!\n");
@@ -41,7 +44,10 @@ static int on_scan_plugin(struct plugin_lib lib, void* user)
 }
 
 static struct plugin_ctx*
-create(GTypeModule* type_module, struct db_interface* dbi, struct db* db)
+create(
+        GTypeModule* type_module,
+        struct db_interface* dbi, struct db* db,
+        struct db_worker_interface* dbwi, struct db_worker* dbw)
 {
     struct strlist plugins;
     struct plugin_ctx* ctx = mem_alloc(sizeof(struct plugin_ctx));
@@ -49,6 +55,8 @@ create(GTypeModule* type_module, struct db_interface* dbi, struct db* db)
     ctx->type_module = type_module;
     ctx->dbi = dbi;
     ctx->db = db;
+    ctx->dbwi = dbwi;
+    ctx->dbw = dbw;
 
     ctx->video_plugin.handle = NULL;
     ctx->video_ctx = NULL;
@@ -19,12 +19,18 @@
 #include <ctype.h>
 #include <limits.h>
 
+#if defined(SQLGEN_CHECK_PLANS)
+#include "sqlite3.h"
+#endif
+
 #define DEFAULT_PREFIX "sqlgen"
 #define DEFAULT_MALLOC "malloc"
 #define DEFAULT_FREE "free"
 #define DEFAULT_LOG_DBG "printf"
 #define DEFAULT_LOG_ERR "printf"
 #define DEFAULT_LOG_SQL_ERR "sqlgen_error"
+#define DEFAULT_LOG_WARN "printf"
+#define DEFAULT_PROFILE_SLOW_MS "100"
 #define PREFIX(sv, data) \
         (sv).len ? (sv) : str_view(DEFAULT_PREFIX), (sv).len ? (data) : DEFAULT_PREFIX
 #define MALLOC(sv, data) \
@@ -37,6 +43,10 @@
         (sv).len ? (sv) : str_view(DEFAULT_LOG_ERR), (sv).len ? (data) : DEFAULT_LOG_ERR
 #define LOG_SQL_ERR(sv, data) \
         (sv).len ? (sv) : str_view(DEFAULT_LOG_SQL_ERR), (sv).len ? (data) : DEFAULT_LOG_SQL_ERR
+#define LOG_WARN(sv, data) \
+        (sv).len ? (sv) : str_view(DEFAULT_LOG_WARN), (sv).len ? (data) : DEFAULT_LOG_WARN
+#define PROFILE_SLOW_MS(sv, data) \
+        (sv).len ? (sv) : str_view(DEFAULT_PROFILE_SLOW_MS), (sv).len ? (data) : DEFAULT_PROFILE_SLOW_MS
 
 /* ----------------------------------------------------------------------------
  * Platform abstractions & Utilities
@@ -522,13 +532,22 @@ enum backend
     BACKEND_SQLITE3 = 0x01
 };
 
+enum check_plans
+{
+    CHECK_PLANS_OFF,
+    CHECK_PLANS_WARN,
+    CHECK_PLANS_ERROR
+};
+
 struct cfg
 {
     const char* input_file;
     const char* output_header;
     const char* output_source;
     enum backend backends;
+    enum check_plans check_plans;
     unsigned debug_layer        : 1;
+    unsigned profile            : 1;
     unsigned custom_init        : 1;
     unsigned custom_init_decl   : 1;
     unsigned custom_deinit      : 1;
@@ -611,6 +630,29 @@ parse_cmdline(int argc, char** argv, struct cfg* cfg)
         }
         else if (strcmp(argv[i], "--debug-layer") == 0)
             cfg->debug_layer = 1;
+        else if (strcmp(argv[i], "--profile") == 0)
+            cfg->profile = 1;
+        else if (strcmp(argv[i], "--check-plans") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Error: Missing argument to option --check-plans\n");
+                return -1;
+            }
+
+            ++i;
+            if (strcmp(argv[i], "off") == 0)
+                cfg->check_plans = CHECK_PLANS_OFF;
+            else if (strcmp(argv[i], "warn") == 0)
+                cfg->check_plans = CHECK_PLANS_WARN;
+            else if (strcmp(argv[i], "error") == 0)
+                cfg->check_plans = CHECK_PLANS_ERROR;
+            else
+            {
+                fprintf(stderr, "Error: Unknown argument \"%s\" to option --check-plans. Use off, warn or error\n", argv[i]);
+                return -1;
+            }
+        }
         else
         {
             fprintf(stderr, "Error: Unknown option \"%s\"\n", argv[i]);
@@ -693,7 +735,8 @@ enum token
     TOK_STMT,
     TOK_BIND,
     TOK_CALLBACK,
-    TOK_RETURN
+    TOK_RETURN,
+    TOK_ALLOW_SCAN
 };
 
 static int
@@ -842,6 +885,11 @@ scan_next_token(struct parser* p)
             p->head += sizeof("%function") - 1;
             return TOK_FUNCTION;
         }
+        if (memcmp(p->data + p->head, "allow-scan", sizeof("allow-scan") - 1) == 0)
+        {
+            p->head += sizeof("allow-scan") - 1;
+            return TOK_ALLOW_SCAN;
+        }
         if (memcmp(p->data + p->head, "type", sizeof("type") - 1) == 0)
         {
             p->head += sizeof("type") - 1;
@@ -974,6 +1022,7 @@ struct query
     struct arg* in_args;
     struct arg* cb_args;
     struct arg* bind_args;
+    struct arg* allow_scan;
     enum query_type type;
 };
 
@@ -1009,6 +1058,10 @@ struct root
     struct str_view log_dbg;
     struct str_view log_err;
     struct str_view log_sql_err;
+    struct str_view log_warn;
+    struct str_view profile_slow_ms;
+    struct str_view profile_clock;
+    struct str_view large_tables;
     struct str_view header_preamble;
     struct str_view header_postamble;
     struct str_view source_includes;
@@ -1086,6 +1139,8 @@ parse(struct parser* p, struct root* root, struct cfg* cfg)
                 /* Options with no arguments */
                 if (cstr_eq_str("debug-layer", option, p->data))
                     { cfg->debug_layer = 1; break; }
+                else if (cstr_eq_str("profile", option, p->data))
+                    { cfg->profile = 1; break; }
                 else if (cstr_eq_str("custom-init", option, p->data))
                     { cfg->custom_init = 1; cfg->custom_init_decl = 1; break; }
                 else if (cstr_eq_str("custom-init-decl", option, p->data))
@@ -1118,6 +1173,20 @@ parse(struct parser* p, struct root* root, struct cfg* cfg)
                     root->log_err = p->value.str;
                 else if (cstr_eq_str("log-sql-error", option, p->data))
                     root->log_sql_err = p->value.str;
+                else if (cstr_eq_str("log-warning", option, p->data))
+                    root->log_warn = p->value.str;
+                else if (cstr_eq_str("profile-slow-ms", option, p->data))
+                {
+                    int i;
+                    for (i = 0; i != p->value.str.len; ++i)
+                        if (!isdigit(p->data[p->value.str.off + i]))
+                            return print_error(p, "Error: Expected a number of milliseconds for profile-slow-ms\n");
+                    root->profile_slow_ms = p->value.str;
+                }
+                else if (cstr_eq_str("profile-clock", option, p->data))
+                    root->profile_clock = p->value.str;
+                else if (cstr_eq_str("large-tables", option, p->data))
+                    root->large_tables = p->value.str;
                 else
                     return print_error(p, "Unknown option \"%.*s\"\n", option.len, p->data + option.off);
             } break;
@@ -1394,6 +1463,20 @@ parse(struct parser* p, struct root* root, struct cfg* cfg)
                         query->return_name = p->value.str;
                     } goto expect_next_stmt;
 
+                    case TOK_ALLOW_SCAN: {
+                        do
+                        {
+                            struct arg* arg;
+                            if (scan_next_token(p) != TOK_LABEL)
+                                return print_error(p, "Error: Expected table name after \"allow-scan\"\n");
+
+                            arg = arg_alloc();
+                            arg->name = p->value.str;
+                            arg->next = query->allow_scan;
+                            query->allow_scan = arg;
+                        } while ((tok = scan_next_token(p)) == ',');
+                    } goto switch_next_stmt;
+
                     case TOK_CALLBACK: {
                     expect_next_cb_param: tok = scan_next_token(p);
                     switch_next_cb_param:
@@ -1771,15 +1854,98 @@ write_func_ptr_decl(struct mstream* ms, const struct root* root, const struct qu
     mstream_putc(ms, ')');
 }
 
+/*!
+ * \brief Select-all queries that return rows can also be read with a cursor.
+ */
+static int
+has_cursor(const struct query* q)
+{
+    return q->type == QUERY_SELECT_ALL && q->cb_args != NULL;
+}
+
+static int
+count_cursors(const struct root* root)
+{
+    const struct query* q;
+    const struct query_group* g;
+    int count = 0;
+    for (q = root->queries; q; q = q->next)
+        count += has_cursor(q);
+    for (g = root->query_groups; g; g = g->next)
+        for (q = g->queries; q; q = q->next)
+            count += has_cursor(q);
+    return count;
+}
+
 static void
-write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const struct query_group* g, const struct query* q, const char* data)
+write_row_struct_name(struct mstream* ms, const struct root* root, const struct query_group* g, const struct query* q, const char* data)
+{
+    mstream_fmt(ms, "struct %S_", PREFIX(root->prefix, data));
+    write_func_name(ms, g, q, data);
+    mstream_cstr(ms, "_row");
+}
+
+static void
+write_row_struct(struct mstream* ms, const struct root* root, const struct query_group* g, const struct query* q, const char* data)
 {
     struct arg* a;
 
-    mstream_cstr(ms, "    if (ctx->");
-    write_func_name(ms, g, q, data);
-    mstream_cstr(ms, " == NULL)" NL);
-    mstream_cstr(ms, "        if ((ret = sqlite3_prepare_v2(ctx->db," NL);
+    write_row_struct_name(ms, root, g, q, data);
+    mstream_cstr(ms, NL "{" NL);
+    for (a = q->cb_args; a; a = a->next)
+        mstream_fmt(ms, "    %S %S;" NL, a->type, data, a->name, data);
+    mstream_cstr(ms, "};" NL NL);
+}
+
+static void
+write_cursor_func_ptr_decls(struct mstream* ms, const struct root* root, const struct query_group* g, const struct query* q, const char* data, const char* indent)
+{
+    struct arg* a;
+
+    mstream_fmt(ms, "%sstruct %S_cursor* (*%S_open)(struct %S* ctx",
+        indent, PREFIX(root->prefix, data), q->name, data, PREFIX(root->prefix, data));
+    for (a = q->in_args; a; a = a->next)
+        mstream_fmt(ms, ", %S %S", a->type, data, a->name, data);
+    mstream_cstr(ms, ");" NL);
+
+    mstream_fmt(ms, "%sint (*%S_next)(struct %S_cursor* cursor, ",
+        indent, q->name, data, PREFIX(root->prefix, data));
+    write_row_struct_name(ms, root, g, q, data);
+    mstream_cstr(ms, "* row);" NL);
+
+    mstream_fmt(ms, "%svoid (*%S_close)(struct %S_cursor* cursor);" NL,
+        indent, q->name, data, PREFIX(root->prefix, data));
+}
+
+/*!
+ * \brief Writes the statement a query runs on. Queries share one statement
+ * per connection, cursors prepare their own.
+ */
+static void
+write_stmt(struct mstream* ms, const struct query_group* g, const struct query* q, char cursor, const char* data)
+{
+    if (cursor)
+        mstream_cstr(ms, "cursor->stmt");
+    else
+    {
+        mstream_cstr(ms, "ctx->");
+        write_func_name(ms, g, q, data);
+    }
+}
+
+/*!
+ * \brief Writes the SQL statement of a query. If as_c_string is set, the
+ * statement is written as a C string literal that is split over multiple
+ * lines, otherwise it is written as plain SQL on a single line.
+ */
+static void
+write_query_sql(struct mstream* ms, const struct query* q, const char* data, char as_c_string)
+{
+    const char* brk = as_c_string ? " \"" NL "            \"" : " ";
+    struct arg* a;
+
+    if (as_c_string)
+        mstream_cstr(ms, "            \"");
 
     if (q->stmt.len)
     {
@@ -1788,7 +1954,6 @@ write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const str
             if (!isspace(data[q->stmt.off + p]))
                 break;
 
-        mstream_cstr(ms, "            \"");
         for (; p != q->stmt.len; ++p)
         {
             if (data[q->stmt.off + p] == '\n')
@@ -1797,22 +1962,21 @@ write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const str
                     if (!isspace(data[q->stmt.off + p + 1]))
                         break;
                 if (p + 1 < q->stmt.len)
-                    mstream_cstr(ms, " \"" NL "            \"");
+                    mstream_cstr(ms, brk);
             }
             else if (data[q->stmt.off + p] != '\r')
             {
                 char c = data[q->stmt.off + p];
-                if (c == '"')
+                if (c == '"' && as_c_string)
                     mstream_putc(ms, '\\');
                 mstream_putc(ms, c);
             }
         }
-        mstream_cstr(ms, "\"," NL);
     }
     else switch (q->type)
     {
         case QUERY_UPSERT:
-            mstream_fmt(ms, "            \"INSERT INTO %S (", q->table_name, data);
+            mstream_fmt(ms, "INSERT INTO %S (", q->table_name, data);
 
             for (a = q->in_args; a; a = a->next)
             {
@@ -1828,7 +1992,8 @@ write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const str
             }
             mstream_cstr(ms, ")");
 
-            mstream_cstr(ms, " \"" NL "            \"ON CONFLICT DO UPDATE SET ");
+            mstream_cstr(ms, brk);
+            mstream_cstr(ms, "ON CONFLICT DO UPDATE SET ");
             for (a = q->in_args; a; a = a->next)
             {
                 if (a != q->in_args)
@@ -1838,8 +2003,8 @@ write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const str
 
             if (q->return_name.len || q->cb_args)
             {
-                mstream_cstr(ms, " \"" NL);
-                mstream_cstr(ms, "            \"RETURNING ");
+                mstream_cstr(ms, brk);
+                mstream_cstr(ms, "RETURNING ");
                 if (q->return_name.len)
                     mstream_fmt(ms, "%S", q->return_name, data);
                 for (a = q->cb_args; a; a = a->next)
@@ -1849,15 +2014,15 @@ write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const str
                     mstream_fmt(ms, "%S", a->name, data);
                 }
             }
-            mstream_cstr(ms, ";\"," NL);
+            mstream_cstr(ms, ";");
 
             break;
 
         case QUERY_INSERT:
             if (q->return_name.len || q->cb_args)
-                mstream_fmt(ms, "            \"INSERT INTO %S (", q->table_name, data);
+                mstream_fmt(ms, "INSERT INTO %S (", q->table_name, data);
             else
-                mstream_fmt(ms, "            \"INSERT OR IGNORE INTO %S (", q->table_name, data);
+                mstream_fmt(ms, "INSERT OR IGNORE INTO %S (", q->table_name, data);
 
             for (a = q->in_args; a; a = a->next)
             {
@@ -1880,8 +2045,8 @@ write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const str
                  * In SQLite, a column named "rowid" is guaranteed to always exist,
                  * and its datatype is trivial to copy.
                  */
-                mstream_cstr(ms, " \"" NL);
-                mstream_cstr(ms, "            \"ON CONFLICT DO UPDATE SET rowid=rowid RETURNING ");
+                mstream_cstr(ms, brk);
+                mstream_cstr(ms, "ON CONFLICT DO UPDATE SET rowid=rowid RETURNING ");
                 if (q->return_name.len)
                     mstream_fmt(ms, "%S", q->return_name, data);
                 for (a = q->cb_args; a; a = a->next)
@@ -1891,14 +2056,13 @@ write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const str
                     mstream_fmt(ms, "%S", a->name, data);
                 }
             }
-            mstream_cstr(ms, ";\"," NL);
+            mstream_cstr(ms, ";");
 
             break;
 
         case QUERY_DELETE:
         case QUERY_UPDATE: {
             char first;
-            mstream_cstr(ms, "            \"");
             mstream_cstr(ms, q->type == QUERY_UPDATE ? "UPDATE" : "DELETE FROM");
 
             mstream_fmt(ms, " %S ",
@@ -1933,8 +2097,8 @@ write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const str
             /* RETURNING ... */
             if (q->return_name.len || q->cb_args)
             {
-                mstream_cstr(ms, " \"" NL);
-                mstream_cstr(ms, "            \"RETURNING ");
+                mstream_cstr(ms, brk);
+                mstream_cstr(ms, "RETURNING ");
                 if (q->return_name.len)
                     mstream_fmt(ms, "%S", q->return_name, data);
                 for (a = q->cb_args; a; a = a->next)
@@ -1945,23 +2109,23 @@ write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const str
                 }
             }
 
-            mstream_cstr(ms, ";\"," NL);
+            mstream_cstr(ms, ";");
         } break;
 
         case QUERY_EXISTS:
-            mstream_fmt(ms, "            \"SELECT 1 FROM %S", q->table_name, data);
+            mstream_fmt(ms, "SELECT 1 FROM %S", q->table_name, data);
             for (a = q->in_args; a; a = a->next)
             {
-                if (a == q->in_args) mstream_cstr(ms, " \"" NL "            \"WHERE ");
+                if (a == q->in_args) mstream_fmt(ms, "%sWHERE ", brk);
                 else                 mstream_cstr(ms, " AND ");
                 mstream_fmt(ms, "%S=?", a->name, data);
             }
-            mstream_cstr(ms, " LIMIT 1;\"," NL);
+            mstream_cstr(ms, " LIMIT 1;");
             break;
 
         case QUERY_SELECT_FIRST:
         case QUERY_SELECT_ALL:
-            mstream_cstr(ms, "            \"SELECT ");
+            mstream_cstr(ms, "SELECT ");
             if (q->return_name.len)
                 mstream_fmt(ms, "%S", q->return_name, data);
             for (a = q->cb_args; a; a = a->next)
@@ -1973,7 +2137,7 @@ write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const str
 
             for (a = q->in_args; a; a = a->next)
             {
-                if (a == q->in_args) mstream_cstr(ms, " \"" NL "            \"WHERE ");
+                if (a == q->in_args) mstream_fmt(ms, "%sWHERE ", brk);
                 else                 mstream_cstr(ms, " AND ");
                 mstream_fmt(ms, "%S=?", a->name, data);
             }
@@ -1981,10 +2145,25 @@ write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const str
             if (q->type == QUERY_SELECT_FIRST)
                 mstream_cstr(ms, " LIMIT 1");
 
-            mstream_cstr(ms, ";\"," NL);
+            mstream_cstr(ms, ";");
             break;
     }
 
+
+    if (as_c_string)
+        mstream_cstr(ms, "\"," NL);
+}
+
+static void
+write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const struct query_group* g, const struct query* q, const char* data)
+{
+    mstream_cstr(ms, "    if (ctx->");
+    write_func_name(ms, g, q, data);
+    mstream_cstr(ms, " == NULL)" NL);
+    mstream_cstr(ms, "        if ((ret = sqlite3_prepare_v2(ctx->db," NL);
+
+    write_query_sql(ms, q, data, 1);
+
     mstream_cstr(ms, "            -1, &ctx->");
     write_func_name(ms, g, q, data);
     mstream_cstr(ms, ", NULL)) != SQLITE_OK)" NL);
@@ -1996,7 +2175,7 @@ write_sqlite_prepare_stmt(struct mstream* ms, const struct root* root, const str
 }
 
 static void
-write_sqlite_bind_args(struct mstream* ms, const struct root* root, const struct query_group* g, const struct query* q, const char* data)
+write_sqlite_bind_args(struct mstream* ms, const struct root* root, const struct query_group* g, const struct query* q, char cursor, const char* data)
 {
     struct arg* a;
     int i = 1;
@@ -2038,12 +2217,12 @@ again:
 
         if (a->nullable)
         {
-            mstream_fmt(ms, "%S %s ? sqlite3_bind_null(ctx->", a->name, data, null_cmp);
-            write_func_name(ms, g, q, data);
+            mstream_fmt(ms, "%S %s ? sqlite3_bind_null(", a->name, data, null_cmp);
+            write_stmt(ms, g, q, cursor, data);
             mstream_fmt(ms, ", %d) : ", i);
         }
-        mstream_fmt(ms, "sqlite3_bind_%s(ctx->", sqlite_type);
-        write_func_name(ms, g, q, data);
+        mstream_fmt(ms, "sqlite3_bind_%s(", sqlite_type);
+        write_stmt(ms, g, q, cursor, data);
         mstream_fmt(ms, ", %d, %s%S", i, cast, a->name, data);
 
         if (cstr_eq_str("struct str_view", a->type, data))
@@ -2061,7 +2240,47 @@ again:
     mstream_cstr(ms, ")" NL "    {" NL);
     mstream_fmt(ms, "        %S(ret, sqlite3_errstr(ret), sqlite3_errmsg(ctx->db));" NL,
         LOG_SQL_ERR(root->log_sql_err, data));
-    mstream_cstr(ms, "        return -1;" NL "    }" NL NL);
+    if (cursor)
+        mstream_fmt(ms, "        %S_cursor_close(cursor);" NL "        return NULL;" NL "    }" NL NL,
+            PREFIX(root->prefix, data));
+    else
+        mstream_cstr(ms, "        return -1;" NL "    }" NL NL);
+}
+
+static void
+write_sqlite_column(struct mstream* ms, const struct query_group* g, const struct query* q, const struct arg* a, int i, char cursor, const char* data)
+{
+    const char* sqlite_type = "";
+    const char* cast = "";
+    const char* null_value = "";
+
+    if (cstr_eq_str("uint64_t", a->type, data))
+        { sqlite_type = "int64"; cast = "(uint64_t)"; null_value = "(uint64_t)-1"; }
+    else if (cstr_eq_str("int64_t", a->type, data))
+        { sqlite_type = "int64"; null_value = "-1"; }
+    else if (cstr_eq_str("int", a->type, data))
+        { sqlite_type = "int"; null_value = "-1"; }
+    else if (cstr_eq_str("uint32_t", a->type, data))
+        { sqlite_type = "int"; cast = "(uint32_t)"; null_value = "(uint32_t)-1"; }
+    else if (cstr_eq_str("uint16_t", a->type, data))
+        { sqlite_type = "int"; cast = "(uint16_t)"; null_value = "(uint16_t)-1"; }
+    else if (cstr_eq_str("struct str_view", a->type, data))
+        { sqlite_type = "text"; cast = "(const char*)"; null_value = "NULL"; }
+    else if (cstr_eq_str("const char*", a->type, data))
+        { sqlite_type = "text"; cast = "(const char*)"; null_value = "NULL"; }
+
+    if (a->nullable)
+    {
+        mstream_cstr(ms, "sqlite3_column_type(");
+        write_stmt(ms, g, q, cursor, data);
+        mstream_fmt(ms, ", %d) == SQLITE_NULL ? ", i);
+        mstream_cstr(ms, null_value);
+        mstream_cstr(ms, " : ");
+    }
+
+    mstream_fmt(ms, "%ssqlite3_column_%s(", cast, sqlite_type);
+    write_stmt(ms, g, q, cursor, data);
+    mstream_fmt(ms, ", %d)", i);
 }
 
 static void
@@ -2073,38 +2292,9 @@ write_sqlite_exec_callback(struct mstream* ms, const struct query_group* g, cons
     mstream_cstr(ms, "            ret = on_row(" NL);
     for (; a; a = a->next, i++)
     {
-        const char* sqlite_type = "";
-        const char* cast = "";
-        const char* null_value = "";
-
-        if (cstr_eq_str("uint64_t", a->type, data))
-            { sqlite_type = "int64"; cast = "(uint64_t)"; null_value = "(uint64_t)-1"; }
-        else if (cstr_eq_str("int64_t", a->type, data))
-            { sqlite_type = "int64"; null_value = "-1"; }
-        else if (cstr_eq_str("int", a->type, data))
-            { sqlite_type = "int"; null_value = "-1"; }
-        else if (cstr_eq_str("uint32_t", a->type, data))
-            { sqlite_type = "int"; cast = "(uint32_t)"; null_value = "(uint32_t)-1"; }
-        else if (cstr_eq_str("uint16_t", a->type, data))
-            { sqlite_type = "int"; cast = "(uint16_t)"; null_value = "(uint16_t)-1"; }
-        else if (cstr_eq_str("struct str_view", a->type, data))
-            { sqlite_type = "text"; cast = "(const char*)"; null_value = "NULL"; }
-        else if (cstr_eq_str("const char*", a->type, data))
-            { sqlite_type = "text"; cast = "(const char*)"; null_value = "NULL"; }
-
         mstream_cstr(ms, "                ");
-        if (a->nullable)
-        {
-            mstream_cstr(ms, "sqlite3_column_type(ctx->");
-            write_func_name(ms, g, q, data);
-            mstream_fmt(ms, ", %d) == SQLITE_NULL ? ", i);
-            mstream_cstr(ms, null_value);
-            mstream_cstr(ms, " : ");
-        }
-
-        mstream_fmt(ms, "%ssqlite3_column_%s(ctx->", cast, sqlite_type);
-        write_func_name(ms, g, q, data);
-        mstream_fmt(ms, ", %d)," NL, i);
+        write_sqlite_column(ms, g, q, a, i, 0, data);
+        mstream_cstr(ms, "," NL);
     }
     mstream_cstr(ms, "                user_data);" NL);
 }
@@ -2506,9 +2696,10 @@ write_migration_body(struct mstream* ms, const struct root* root, const char* da
     for (m = root->downgrade; m; m = m->next)
     {
         mstream_fmt (ms, "        case %d:" NL, m->version + 1);
+        /* Databases older than the target must not be downgraded on their way up */
         if (!reinit_db)
         {
-            mstream_cstr(ms, "            if (version == target_version)" NL);
+            mstream_cstr(ms, "            if (version <= target_version)" NL);
             mstream_cstr(ms, "                break;" NL);
         }
         mstream_fmt (ms, "            if (run_sqlite3_sql(ctx->db, %S_downgrade%d) != 0)" NL,
@@ -2523,6 +2714,7 @@ write_migration_body(struct mstream* ms, const struct root* root, const char* da
         }
 
         mstream_fmt (ms, "            version = %d;" NL, m->version);
+        mstream_cstr(ms, "            /* fallthrough */" NL);
     }
     mstream_cstr(ms, "        case 0:" NL);
     mstream_cstr(ms, "            break;" NL);
@@ -2599,6 +2791,7 @@ write_migration_body(struct mstream* ms, const struct root* root, const char* da
         mstream_fmt(ms, "            if (run_sqlite3_sql(ctx->db, %S_upgrade%d) != 0)" NL, PREFIX(root->prefix, data), m->version);
         mstream_cstr(ms, "                goto migration_failed;" NL);
         mstream_fmt (ms, "            version = %d;" NL, m->version);
+        mstream_cstr(ms, "            /* fallthrough */" NL);
     }
     mstream_fmt (ms, "        case %d: break;" NL, max_version);
     mstream_cstr(ms, "        default:" NL);
@@ -2819,6 +3012,291 @@ write_debug_wrapper(struct mstream* ms, const struct root* root, const struct qu
     mstream_cstr(ms, "}" NL NL);
 }
 
+static int
+count_queries(const struct root* root)
+{
+    const struct query* q;
+    const struct query_group* g;
+    int count = 0;
+    for (q = root->queries; q; q = q->next)
+        count++;
+    for (g = root->query_groups; g; g = g->next)
+        for (q = g->queries; q; q = q->next)
+            count++;
+    return count;
+}
+
+static void
+write_profile_explain(struct mstream* ms, const struct root* root, const struct query_group* g, const struct query* q, int idx, char cursor, const char* data)
+{
+    mstream_fmt(ms, "    if (!ctx->stats[%d].explained)" NL, idx);
+    mstream_fmt(ms, "        %S_stats_explain(ctx, %d, ", PREFIX(root->prefix, data), idx);
+    write_stmt(ms, g, q, cursor, data);
+    mstream_cstr(ms, ");" NL NL);
+}
+
+/*
+ * Timing and row counts come from sqlite3_trace_v2(). SQLITE_TRACE_PROFILE
+ * fires once per execution, when the statement is reset, so the generated
+ * query functions only need to explain their statement the first time.
+ *
+ * SQLite's own estimate of the time taken often only has millisecond
+ * resolution. If a clock returning microseconds is set with
+ * %option profile-clock, the time is measured from SQLITE_TRACE_STMT instead.
+ */
+static void
+write_profile_funcs(struct mstream* ms, const struct root* root, const char* data, int query_count)
+{
+    const struct query* q;
+    const struct query_group* g;
+    int idx;
+
+    mstream_fmt(ms, "static const char* %S_query_names[%d] = {" NL, PREFIX(root->prefix, data), query_count);
+    for (q = root->queries; q; q = q->next)
+        mstream_fmt(ms, "    \"%S\"," NL, q->name, data);
+    for (g = root->query_groups; g; g = g->next)
+        for (q = g->queries; q; q = q->next)
+            mstream_fmt(ms, "    \"%S.%S\"," NL, g->name, data, q->name, data);
+    mstream_cstr(ms, "};" NL NL);
+
+    /* Maps statements back to queries. The last match is cached, because
+     * every row of a statement is traced separately */
+    mstream_fmt(ms, "static int" NL "%S_stats_find(struct %S* ctx, sqlite3_stmt* stmt)" NL "{" NL,
+        PREFIX(root->prefix, data), PREFIX(root->prefix, data));
+    mstream_cstr(ms, "    if (stmt == ctx->stats_stmt)" NL);
+    mstream_cstr(ms, "        return ctx->stats_idx;" NL);
+    idx = 0;
+    for (q = root->queries; q; q = q->next, idx++)
+        mstream_fmt(ms, "    %sif (stmt == ctx->%S) ctx->stats_idx = %d;" NL,
+            idx ? "else " : "", q->name, data, idx);
+    for (g = root->query_groups; g; g = g->next)
+        for (q = g->queries; q; q = q->next, idx++)
+            mstream_fmt(ms, "    %sif (stmt == ctx->%S_%S) ctx->stats_idx = %d;" NL,
+                idx ? "else " : "", g->name, data, q->name, data, idx);
+    if (count_cursors(root))
+    {
+        /* Every cursor has its own statement */
+        mstream_cstr(ms, "    else" NL "    {" NL);
+        mstream_fmt(ms, "        struct %S_cursor* cursor;" NL, PREFIX(root->prefix, data));
+        mstream_cstr(ms, "        for (cursor = ctx->cursors; cursor; cursor = cursor->next)" NL);
+        mstream_cstr(ms, "            if (cursor->stmt == stmt)" NL);
+        mstream_cstr(ms, "                break;" NL);
+        mstream_cstr(ms, "        if (cursor == NULL)" NL);
+        mstream_cstr(ms, "            return -1;" NL);
+        mstream_cstr(ms, "        ctx->stats_idx = cursor->stats_idx;" NL);
+        mstream_cstr(ms, "    }" NL);
+    }
+    else
+        mstream_cstr(ms, "    else return -1;" NL);
+    mstream_cstr(ms, "    ctx->stats_stmt = stmt;" NL);
+    mstream_cstr(ms, "    return ctx->stats_idx;" NL);
+    mstream_cstr(ms, "}" NL NL);
+
+    mstream_fmt(ms, "static int" NL "%S_stats_trace(unsigned type, void* user, void* p, void* x)" NL "{" NL,
+        PREFIX(root->prefix, data));
+    mstream_fmt(ms, "    struct %S* ctx = user;" NL, PREFIX(root->prefix, data));
+    mstream_fmt(ms, "    struct %S_query_stats* stats;" NL, PREFIX(root->prefix, data));
+    mstream_cstr(ms, "    sqlite3_int64 ns;" NL);
+    mstream_cstr(ms, "    char* sql;" NL);
+    mstream_fmt(ms, "    int idx = %S_stats_find(ctx, p);" NL, PREFIX(root->prefix, data));
+    mstream_cstr(ms, "    if (idx < 0)" NL);
+    mstream_cstr(ms, "        return 0;" NL NL);
+    mstream_cstr(ms, "    stats = &ctx->stats[idx];" NL);
+    mstream_cstr(ms, "    if (type == SQLITE_TRACE_ROW)" NL "    {" NL);
+    mstream_cstr(ms, "        stats->rows++;" NL);
+    mstream_cstr(ms, "        return 0;" NL "    }" NL NL);
+    if (root->profile_clock.len)
+    {
+        /* Triggers are traced as SQL comments and must not restart the clock */
+        mstream_cstr(ms, "    if (type == SQLITE_TRACE_STMT)" NL "    {" NL);
+        mstream_cstr(ms, "        if (strncmp(x, \"--\", 2) != 0)" NL);
+        mstream_fmt(ms, "            stats->start_us = (sqlite3_int64)%S();" NL, root->profile_clock, data);
+        mstream_cstr(ms, "        return 0;" NL "    }" NL NL);
+        mstream_fmt(ms, "    ns = ((sqlite3_int64)%S() - stats->start_us) * 1000;" NL, root->profile_clock, data);
+    }
+    else
+        mstream_cstr(ms, "    ns = *(sqlite3_int64*)x;" NL);
+    mstream_cstr(ms, "    stats->calls++;" NL);
+    mstream_cstr(ms, "    stats->total_ns += ns;" NL);
+    mstream_cstr(ms, "    if (stats->max_ns < ns)" NL);
+    mstream_cstr(ms, "        stats->max_ns = ns;" NL NL);
+    mstream_fmt(ms, "    if (ns >= (sqlite3_int64)%S * 1000000)" NL "    {" NL,
+        PROFILE_SLOW_MS(root->profile_slow_ms, data));
+    mstream_cstr(ms, "        sql = sqlite3_expanded_sql(p);" NL);
+    mstream_fmt(ms, "        %S(\"Slow query %%s took %%.3f ms: %%s\\n\"," NL,
+        LOG_WARN(root->log_warn, data));
+    mstream_fmt(ms, "            %S_query_names[idx], (double)ns / 1e6, sql ? sql : sqlite3_sql(p));" NL,
+        PREFIX(root->prefix, data));
+    mstream_cstr(ms, "        sqlite3_free(sql);" NL "    }" NL NL);
+    mstream_cstr(ms, "    return 0;" NL);
+    mstream_cstr(ms, "}" NL NL);
+
+    mstream_fmt(ms, "static void" NL "%S_stats_explain(struct %S* ctx, int idx, sqlite3_stmt* stmt)" NL "{" NL,
+        PREFIX(root->prefix, data), PREFIX(root->prefix, data));
+    mstream_cstr(ms, "    int ret;" NL);
+    mstream_cstr(ms, "    char* sql;" NL);
+    mstream_cstr(ms, "    sqlite3_stmt* plan;" NL NL);
+    mstream_cstr(ms, "    ctx->stats[idx].explained = 1;" NL);
+    mstream_cstr(ms, "    sql = sqlite3_mprintf(\"EXPLAIN QUERY PLAN %s\", sqlite3_sql(stmt));" NL);
+    mstream_cstr(ms, "    if (sql == NULL)" NL);
+    mstream_cstr(ms, "        return;" NL);
+    mstream_cstr(ms, "    ret = sqlite3_prepare_v2(ctx->db, sql, -1, &plan, NULL);" NL);
+    mstream_cstr(ms, "    sqlite3_free(sql);" NL);
+    mstream_cstr(ms, "    if (ret != SQLITE_OK)" NL "    {" NL);
+    mstream_fmt(ms, "        %S(ret, sqlite3_errstr(ret), sqlite3_errmsg(ctx->db));" NL,
+        LOG_SQL_ERR(root->log_sql_err, data));
+    mstream_cstr(ms, "        return;" NL "    }" NL NL);
+    mstream_fmt(ms, "    %S(\"Query plan of %%s:\\n\", %S_query_names[idx]);" NL,
+        LOG_DBG(root->log_dbg, data), PREFIX(root->prefix, data));
+    mstream_cstr(ms, "    while (sqlite3_step(plan) == SQLITE_ROW)" NL);
+    mstream_fmt(ms, "        %S(\"  %%s\\n\", (const char*)sqlite3_column_text(plan, 3));" NL,
+        LOG_DBG(root->log_dbg, data));
+    mstream_cstr(ms, "    sqlite3_finalize(plan);" NL);
+    mstream_cstr(ms, "}" NL NL);
+
+    mstream_fmt(ms, "static int" NL "%S_stats_cmp(const void* a, const void* b)" NL "{" NL,
+        PREFIX(root->prefix, data));
+    mstream_fmt(ms, "    const struct %S_query_stats* s1 = *(const struct %S_query_stats* const*)a;" NL,
+        PREFIX(root->prefix, data), PREFIX(root->prefix, data));
+    mstream_fmt(ms, "    const struct %S_query_stats* s2 = *(const struct %S_query_stats* const*)b;" NL,
+        PREFIX(root->prefix, data), PREFIX(root->prefix, data));
+    mstream_cstr(ms, "    if (s1->total_ns != s2->total_ns)" NL);
+    mstream_cstr(ms, "        return s1->total_ns < s2->total_ns ? 1 : -1;" NL);
+    mstream_cstr(ms, "    return s1 < s2 ? -1 : s1 > s2;" NL);
+    mstream_cstr(ms, "}" NL NL);
+
+    mstream_fmt(ms, "static void" NL "%S_dump_stats(struct %S* ctx)" NL "{" NL,
+        PREFIX(root->prefix, data), PREFIX(root->prefix, data));
+    mstream_fmt(ms, "    struct %S_query_stats* sorted[%d];" NL, PREFIX(root->prefix, data), query_count);
+    mstream_cstr(ms, "    int i, count = 0;" NL NL);
+    mstream_fmt(ms, "    for (i = 0; i != %d; ++i)" NL, query_count);
+    mstream_cstr(ms, "        if (ctx->stats[i].calls)" NL);
+    mstream_cstr(ms, "            sorted[count++] = &ctx->stats[i];" NL);
+    mstream_fmt(ms, "    qsort(sorted, (size_t)count, sizeof(sorted[0]), %S_stats_cmp);" NL NL,
+        PREFIX(root->prefix, data));
+    mstream_fmt(ms, "    %S(\"%%10s %%10s %%12s %%10s %%10s  %%s\\n\", \"calls\", \"rows\", \"total ms\", \"avg ms\", \"max ms\", \"query\");" NL,
+        LOG_DBG(root->log_dbg, data));
+    mstream_cstr(ms, "    for (i = 0; i != count; ++i)" NL);
+    mstream_fmt(ms, "        %S(\"%%10lld %%10lld %%12.3f %%10.3f %%10.3f  %%s\\n\"," NL,
+        LOG_DBG(root->log_dbg, data));
+    mstream_cstr(ms, "            (long long)sorted[i]->calls," NL);
+    mstream_cstr(ms, "            (long long)sorted[i]->rows," NL);
+    mstream_cstr(ms, "            (double)sorted[i]->total_ns / 1e6," NL);
+    mstream_cstr(ms, "            (double)sorted[i]->total_ns / 1e6 / (double)sorted[i]->calls," NL);
+    mstream_cstr(ms, "            (double)sorted[i]->max_ns / 1e6," NL);
+    mstream_fmt(ms, "            %S_query_names[sorted[i] - ctx->stats]);" NL, PREFIX(root->prefix, data));
+    mstream_cstr(ms, "}" NL NL);
+}
+
+/*
+ * Cursors prepare their own statement, so any number of them can be open on
+ * the same connection, and the statement a query function shares is never
+ * left half-stepped. Rows are read straight from the statement: text
+ * columns point into SQLite's buffers and are valid until the next step.
+ */
+static void
+write_cursor_close_func(struct mstream* ms, const struct root* root, const char* data, char profile)
+{
+    mstream_fmt(ms, "static void" NL "%S_cursor_close(struct %S_cursor* cursor)" NL "{" NL,
+        PREFIX(root->prefix, data), PREFIX(root->prefix, data));
+    if (profile)
+        mstream_fmt(ms, "    struct %S_cursor** link;" NL NL, PREFIX(root->prefix, data));
+    mstream_cstr(ms, "    if (cursor == NULL)" NL);
+    mstream_cstr(ms, "        return;" NL NL);
+    mstream_cstr(ms, "    sqlite3_finalize(cursor->stmt);" NL);
+    if (profile)
+    {
+        /* Finalizing is traced, so the cursor is unlinked afterwards */
+        mstream_cstr(ms, "    for (link = &cursor->ctx->cursors; *link; link = &(*link)->next)" NL);
+        mstream_cstr(ms, "        if (*link == cursor)" NL "        {" NL);
+        mstream_cstr(ms, "            *link = cursor->next;" NL);
+        mstream_cstr(ms, "            break;" NL "        }" NL);
+        mstream_cstr(ms, "    if (cursor->ctx->stats_stmt == cursor->stmt)" NL);
+        mstream_cstr(ms, "        cursor->ctx->stats_stmt = NULL;" NL);
+    }
+    mstream_fmt(ms, "    %S(cursor);" NL, FREE(root->free, data));
+    mstream_cstr(ms, "}" NL NL);
+}
+
+static void
+write_cursor_funcs(struct mstream* ms, const struct root* root, const struct query_group* g, const struct query* q, int idx, char profile, const char* data)
+{
+    struct arg* a;
+    int i;
+
+    /* Open */
+    mstream_fmt(ms, "static struct %S_cursor*" NL, PREFIX(root->prefix, data));
+    write_func_name(ms, g, q, data);
+    mstream_fmt(ms, "_open(struct %S* ctx", PREFIX(root->prefix, data));
+    for (a = q->in_args; a; a = a->next)
+        mstream_fmt(ms, ", %S %S", a->type, data, a->name, data);
+    mstream_cstr(ms, ")" NL "{" NL);
+    mstream_cstr(ms, "    int ret;" NL);
+    mstream_fmt(ms, "    struct %S_cursor* cursor = %S(sizeof *cursor);" NL,
+        PREFIX(root->prefix, data), MALLOC(root->malloc, data));
+    mstream_cstr(ms, "    if (cursor == NULL)" NL);
+    mstream_cstr(ms, "        return NULL;" NL);
+    mstream_cstr(ms, "    memset(cursor, 0, sizeof *cursor);" NL);
+    mstream_cstr(ms, "    cursor->ctx = ctx;" NL NL);
+    mstream_cstr(ms, "    if ((ret = sqlite3_prepare_v2(ctx->db," NL);
+    write_query_sql(ms, q, data, 1);
+    mstream_cstr(ms, "            -1, &cursor->stmt, NULL)) != SQLITE_OK)" NL);
+    mstream_cstr(ms, "    {" NL);
+    mstream_fmt(ms, "        %S(ret, sqlite3_errstr(ret), sqlite3_errmsg(ctx->db));" NL,
+        LOG_SQL_ERR(root->log_sql_err, data));
+    mstream_fmt(ms, "        %S(cursor);" NL, FREE(root->free, data));
+    mstream_cstr(ms, "        return NULL;" NL);
+    mstream_cstr(ms, "    }" NL NL);
+    if (profile)
+    {
+        mstream_cstr(ms, "    cursor->next = ctx->cursors;" NL);
+        mstream_fmt(ms, "    cursor->stats_idx = %d;" NL, idx);
+        mstream_cstr(ms, "    ctx->cursors = cursor;" NL);
+        write_profile_explain(ms, root, g, q, idx, 1, data);
+    }
+    write_sqlite_bind_args(ms, root, g, q, 1, data);
+    mstream_cstr(ms, "    return cursor;" NL);
+    mstream_cstr(ms, "}" NL NL);
+
+    /* Next */
+    mstream_cstr(ms, "static int" NL);
+    write_func_name(ms, g, q, data);
+    mstream_fmt(ms, "_next(struct %S_cursor* cursor, ", PREFIX(root->prefix, data));
+    write_row_struct_name(ms, root, g, q, data);
+    mstream_cstr(ms, "* row)" NL "{" NL);
+    mstream_cstr(ms, "    int ret;" NL);
+    mstream_cstr(ms, "    if (cursor->done)" NL);
+    mstream_cstr(ms, "        return 0;" NL NL);
+    mstream_cstr(ms, "next_step:" NL);
+    mstream_cstr(ms, "    ret = sqlite3_step(cursor->stmt);" NL);
+    mstream_cstr(ms, "    switch (ret)" NL "    {" NL);
+    mstream_cstr(ms, "        case SQLITE_ROW:" NL);
+    i = q->return_name.len ? 1 : 0;
+    for (a = q->cb_args; a; a = a->next, i++)
+    {
+        mstream_fmt(ms, "            row->%S", a->name, data);
+        if (cstr_eq_str("struct str_view", a->type, data))
+            mstream_cstr(ms, ".data");
+        mstream_cstr(ms, " = ");
+        write_sqlite_column(ms, g, q, a, i, 1, data);
+        mstream_cstr(ms, ";" NL);
+        if (cstr_eq_str("struct str_view", a->type, data))
+            mstream_fmt(ms, "            row->%S.len = sqlite3_column_bytes(cursor->stmt, %d);" NL,
+                a->name, data, i);
+    }
+    mstream_cstr(ms, "            return 1;" NL);
+    mstream_cstr(ms, "        case SQLITE_BUSY: goto next_step;" NL);
+    mstream_cstr(ms, "        case SQLITE_DONE:" NL);
+    mstream_cstr(ms, "            cursor->done = 1;" NL);
+    mstream_cstr(ms, "            return 0;" NL);
+    mstream_cstr(ms, "    }" NL NL);
+    mstream_fmt(ms, "    %S(ret, sqlite3_errstr(ret), sqlite3_errmsg(cursor->ctx->db));" NL,
+        LOG_SQL_ERR(root->log_sql_err, data));
+    mstream_cstr(ms, "    cursor->done = 1;" NL);
+    mstream_cstr(ms, "    return -1;" NL);
+    mstream_cstr(ms, "}" NL NL);
+}
+
 static int
 determine_indent(struct mstream* ms, struct str_view str, const char* data)
 {
@@ -2908,6 +3386,28 @@ gen_header(const struct root* root, const char* data, const char* file_name,
         mstream_fmt(&ms, NL "%S" NL, root->header_preamble, data);
 
     mstream_fmt(&ms, "struct %S;" NL, PREFIX(root->prefix, data));
+
+    /* Cursors and the rows they return */
+    if (count_cursors(root))
+    {
+        write_block_reindented_cstr(&ms, 0, "/*!" NL
+            " * \\brief Every select-all query can also be read one row at a time with a" NL
+            " * cursor. name_open() binds the arguments and returns a cursor, or NULL on" NL
+            " * error. name_next() fills in the next row and returns 1, returns 0 once all" NL
+            " * rows were read, or negative on error. Strings in a row are owned by the" NL
+            " * cursor and are only valid until the next call to name_next() or" NL
+            " * name_close(). All cursors must be closed before the connection is closed." NL
+            " */");
+        mstream_fmt(&ms, "struct %S_cursor;" NL NL, PREFIX(root->prefix, data));
+        for (q = root->queries; q; q = q->next)
+            if (has_cursor(q))
+                write_row_struct(&ms, root, NULL, q, data);
+        for (g = root->query_groups; g; g = g->next)
+            for (q = g->queries; q; q = q->next)
+                if (has_cursor(q))
+                    write_row_struct(&ms, root, g, q, data);
+    }
+
     mstream_fmt(&ms, "struct %S_interface" NL "{" NL, PREFIX(root->prefix, data));
 
     /* Hard-coded functions */
@@ -2952,6 +3452,13 @@ gen_header(const struct root* root, const char* data, const char* file_name,
         " */");
     mstream_fmt(&ms, "    int (*migrate_to)(struct %S* ctx, int target_version);" NL,
         PREFIX(root->prefix, data));
+    write_block_reindented_cstr(&ms, 4, "/*!" NL
+        " * \\brief Logs the number of calls, rows and time spent of every query that" NL
+        " * ran on this connection, slowest first." NL
+        " * \\note This is NULL unless the bindings were generated with profiling enabled." NL
+        " */");
+    mstream_fmt(&ms, "    void (*dump_stats)(struct %S* ctx);" NL,
+        PREFIX(root->prefix, data));
 
     /* Global queries */
     for (q = root->queries; q; q = q->next)
@@ -2959,6 +3466,8 @@ gen_header(const struct root* root, const char* data, const char* file_name,
         mstream_cstr(&ms, "    ");
         write_func_ptr_decl(&ms, root, NULL, q, data);
         mstream_cstr(&ms, ";" NL);
+        if (has_cursor(q))
+            write_cursor_func_ptr_decls(&ms, root, NULL, q, data, "    ");
     }
     mstream_cstr(&ms, NL);
 
@@ -2989,6 +3498,8 @@ gen_header(const struct root* root, const char* data, const char* file_name,
             mstream_cstr(&ms, "        ");
             write_func_ptr_decl(&ms, root, NULL, q, data);
             mstream_cstr(&ms, ";" NL);
+            if (has_cursor(q))
+                write_cursor_func_ptr_decls(&ms, root, g, q, data, "        ");
         }
 
         /* Functions */
@@ -3044,7 +3555,7 @@ gen_header(const struct root* root, const char* data, const char* file_name,
 
 static int
 gen_source(const struct root* root, const char* data, const char* file_name,
-    char debug_layer, char custom_init, char custom_deinit, char custom_api, char forwards_compat)
+    char debug_layer, char profile, char custom_init, char custom_deinit, char custom_api, char forwards_compat)
 {
     struct query* q;
     struct query_group* g;
@@ -3052,6 +3563,13 @@ gen_source(const struct root* root, const char* data, const char* file_name,
     struct arg* a;
     struct mfile mf;
     struct mstream ms = mstream_init_writeable();
+    int query_count = count_queries(root);
+    int cursor_count = count_cursors(root);
+    int idx;
+
+    /* There is nothing to profile */
+    if (query_count == 0)
+        profile = 0;
 
     if (root->source_includes.len)
         mstream_fmt(&ms, NL "%S" NL NL, root->source_includes, data);
@@ -3065,6 +3583,19 @@ gen_source(const struct root* root, const char* data, const char* file_name,
      * Context structure declaration
      * --------------------------------------------------------------------- */
 
+    if (profile)
+    {
+        mstream_fmt(&ms, "struct %S_query_stats" NL "{" NL, PREFIX(root->prefix, data));
+        mstream_cstr(&ms, "    sqlite3_int64 calls;" NL);
+        mstream_cstr(&ms, "    sqlite3_int64 rows;" NL);
+        mstream_cstr(&ms, "    sqlite3_int64 total_ns;" NL);
+        mstream_cstr(&ms, "    sqlite3_int64 max_ns;" NL);
+        if (root->profile_clock.len)
+            mstream_cstr(&ms, "    sqlite3_int64 start_us;" NL);
+        mstream_cstr(&ms, "    int explained;" NL);
+        mstream_cstr(&ms, "};" NL NL);
+    }
+
     mstream_fmt(&ms, "struct %S" NL "{" NL,
             PREFIX(root->prefix, data));
     mstream_fmt(&ms, "    sqlite3* db;" NL);
@@ -3075,8 +3606,30 @@ gen_source(const struct root* root, const char* data, const char* file_name,
     for (g = root->query_groups; g; g = g->next)
         for (q = g->queries; q; q = q->next)
             mstream_fmt(&ms, "    sqlite3_stmt* %S_%S;" NL, g->name, data, q->name, data);
+    if (profile)
+    {
+        mstream_fmt(&ms, "    struct %S_query_stats stats[%d];" NL, PREFIX(root->prefix, data), query_count);
+        mstream_cstr(&ms, "    sqlite3_stmt* stats_stmt;" NL);
+        mstream_cstr(&ms, "    int stats_idx;" NL);
+        if (cursor_count)
+            mstream_fmt(&ms, "    struct %S_cursor* cursors;" NL, PREFIX(root->prefix, data));
+    }
     mstream_cstr(&ms, "};" NL);
 
+    if (cursor_count)
+    {
+        mstream_fmt(&ms, NL "struct %S_cursor" NL "{" NL, PREFIX(root->prefix, data));
+        mstream_fmt(&ms, "    struct %S* ctx;" NL, PREFIX(root->prefix, data));
+        mstream_cstr(&ms, "    sqlite3_stmt* stmt;" NL);
+        if (profile)
+        {
+            mstream_fmt(&ms, "    struct %S_cursor* next;" NL, PREFIX(root->prefix, data));
+            mstream_cstr(&ms, "    int stats_idx;" NL);
+        }
+        mstream_cstr(&ms, "    char done;" NL);
+        mstream_cstr(&ms, "};" NL);
+    }
+
     /* Error function */
     if (root->log_sql_err.len == 0)
     {
@@ -3088,11 +3641,15 @@ gen_source(const struct root* root, const char* data, const char* file_name,
     if (root->source_preamble.len)
         mstream_fmt(&ms, NL "%S" NL NL, root->source_preamble, data);
 
+    if (profile)
+        write_profile_funcs(&ms, root, data, query_count);
+
     /* ------------------------------------------------------------------------
      * Query implementations
      * --------------------------------------------------------------------- */
 
-    for (q = root->queries; q; q = q->next)
+    idx = 0;
+    for (q = root->queries; q; q = q->next, idx++)
     {
         write_func_decl(&ms, root, NULL, q, data);
         mstream_cstr(&ms, NL "{" NL);
@@ -3104,14 +3661,16 @@ gen_source(const struct root* root, const char* data, const char* file_name,
         mstream_cstr(&ms, ";" NL);
 
         write_sqlite_prepare_stmt(&ms, root, NULL, q, data);
-        write_sqlite_bind_args(&ms, root, NULL, q, data);
+        if (profile)
+            write_profile_explain(&ms, root, NULL, q, idx, 0, data);
+        write_sqlite_bind_args(&ms, root, NULL, q, 0, data);
         write_sqlite_exec(&ms, root, NULL, q, data);
 
         mstream_cstr(&ms, "}" NL NL);
     }
 
     for (g = root->query_groups; g; g = g->next)
-        for (q = g->queries; q; q = q->next)
+        for (q = g->queries; q; q = q->next, idx++)
         {
             write_func_decl(&ms, root, g, q, data);
             mstream_cstr(&ms, NL "{" NL);
@@ -3123,12 +3682,32 @@ gen_source(const struct root* root, const char* data, const char* file_name,
             mstream_cstr(&ms, ";" NL);
 
             write_sqlite_prepare_stmt(&ms, root, g, q, data);
-            write_sqlite_bind_args(&ms, root, g, q, data);
+            if (profile)
+                write_profile_explain(&ms, root, g, q, idx, 0, data);
+            write_sqlite_bind_args(&ms, root, g, q, 0, data);
             write_sqlite_exec(&ms, root, g, q, data);
 
             mstream_cstr(&ms, "}" NL NL);
         }
 
+    /* ------------------------------------------------------------------------
+     * Cursors
+     * --------------------------------------------------------------------- */
+
+    if (cursor_count)
+    {
+        write_cursor_close_func(&ms, root, data, profile);
+
+        idx = 0;
+        for (q = root->queries; q; q = q->next, idx++)
+            if (has_cursor(q))
+                write_cursor_funcs(&ms, root, NULL, q, idx, profile, data);
+        for (g = root->query_groups; g; g = g->next)
+            for (q = g->queries; q; q = q->next, idx++)
+                if (has_cursor(q))
+                    write_cursor_funcs(&ms, root, g, q, idx, profile, data);
+    }
+
     /* ------------------------------------------------------------------------
      * Functions
      * --------------------------------------------------------------------- */
@@ -3173,8 +3752,18 @@ gen_source(const struct root* root, const char* data, const char* file_name,
     mstream_cstr(&ms, "        return NULL;" NL);
     mstream_cstr(&ms, "    memset(ctx, 0, sizeof *ctx);" NL NL);
     mstream_cstr(&ms, "    ret = sqlite3_open_v2(uri, &ctx->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);" NL);
-    mstream_cstr(&ms, "    if (ret == SQLITE_OK)" NL);
-    mstream_cstr(&ms, "        return ctx;" NL NL);
+    if (profile)
+    {
+        mstream_cstr(&ms, "    if (ret == SQLITE_OK)" NL "    {" NL);
+        mstream_fmt(&ms, "        sqlite3_trace_v2(ctx->db, %sSQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW, %S_stats_trace, ctx);" NL,
+            root->profile_clock.len ? "SQLITE_TRACE_STMT | " : "", PREFIX(root->prefix, data));
+        mstream_cstr(&ms, "        return ctx;" NL "    }" NL NL);
+    }
+    else
+    {
+        mstream_cstr(&ms, "    if (ret == SQLITE_OK)" NL);
+        mstream_cstr(&ms, "        return ctx;" NL NL);
+    }
     mstream_fmt(&ms, "    %S(ret, sqlite3_errstr(ret), sqlite3_errmsg(ctx->db));" NL,
                 LOG_SQL_ERR(root->log_sql_err, data));
     mstream_fmt(&ms, "    %S(ctx);" NL, FREE(root->free, data));
@@ -3221,10 +3810,19 @@ gen_source(const struct root* root, const char* data, const char* file_name,
     mstream_fmt(&ms, "    %S_upgrade," NL, PREFIX(root->prefix, data));
     mstream_fmt(&ms, "    %S_reinit," NL, PREFIX(root->prefix, data));
     mstream_fmt(&ms, "    %S_migrate_to," NL, PREFIX(root->prefix, data));
+    if (profile)
+        mstream_fmt(&ms, "    %S_dump_stats," NL, PREFIX(root->prefix, data));
+    else
+        mstream_cstr(&ms, "    NULL," NL);
 
     /* Global queries */
     for (q = root->queries; q; q = q->next)
+    {
         mstream_fmt(&ms, "    %S," NL, q->name, data);
+        if (has_cursor(q))
+            mstream_fmt(&ms, "    %S_open," NL "    %S_next," NL "    %S_cursor_close," NL,
+                q->name, data, q->name, data, PREFIX(root->prefix, data));
+    }
 
     /* Global functions */
     for (f = root->functions; f; f = f->next)
@@ -3237,7 +3835,12 @@ gen_source(const struct root* root, const char* data, const char* file_name,
 
         /* Queries */
         for (q = g->queries; q; q = q->next)
+        {
             mstream_fmt(&ms, "        %S_%S," NL, g->name, data, q->name, data);
+            if (has_cursor(q))
+                mstream_fmt(&ms, "        %S_%S_open," NL "        %S_%S_next," NL "        %S_cursor_close," NL,
+                    g->name, data, q->name, data, g->name, data, q->name, data, PREFIX(root->prefix, data));
+        }
 
         /* Functions */
         for (f = g->functions; f; f = f->next)
@@ -3320,18 +3923,32 @@ gen_source(const struct root* root, const char* data, const char* file_name,
                 PREFIX(root->prefix, data),
                 PREFIX(root->prefix, data),
                 PREFIX(root->prefix, data));
+        if (profile)
+            mstream_fmt(&ms, "    %S_dump_stats," NL, PREFIX(root->prefix, data));
+        else
+            mstream_cstr(&ms, "    NULL," NL);
         /* Functions */
         for (f = root->functions; f; f = f->next)
             mstream_fmt(&ms, "    %S," NL, f->name, data);
         /* Global queries */
         for (q = root->queries; q; q = q->next)
+        {
             mstream_fmt(&ms, "    dbg_%S," NL, q->name, data);
+            if (has_cursor(q))
+                mstream_fmt(&ms, "    %S_open," NL "    %S_next," NL "    %S_cursor_close," NL,
+                    q->name, data, q->name, data, PREFIX(root->prefix, data));
+        }
         /* Grouped queries */
         for (g = root->query_groups; g; g = g->next)
         {
             mstream_cstr(&ms, "    {" NL);
             for (q = g->queries; q; q = q->next)
+            {
                 mstream_fmt(&ms, "        dbg_%S_%S," NL, g->name, data, q->name, data);
+                if (has_cursor(q))
+                    mstream_fmt(&ms, "        %S_%S_open," NL "        %S_%S_next," NL "        %S_cursor_close," NL,
+                        g->name, data, q->name, data, g->name, data, q->name, data, PREFIX(root->prefix, data));
+            }
             mstream_cstr(&ms, "    }," NL);
         }
         mstream_cstr(&ms, "};" NL NL);
@@ -3390,6 +4007,325 @@ gen_source(const struct root* root, const char* data, const char* file_name,
     return 0;
 }
 
+/* ----------------------------------------------------------------------------
+ * Query plan checks
+ * ------------------------------------------------------------------------- */
+
+#if defined(SQLGEN_CHECK_PLANS)
+struct table_alias
+{
+    const char* alias;
+    const char* table;
+    int alias_len;
+    int table_len;
+};
+
+static int
+line_number(const char* data, int off)
+{
+    int i, line = 1;
+    for (i = 0; i != off; ++i)
+        if (data[i] == '\n')
+            line++;
+    return line;
+}
+
+static int
+is_ident_char(char c)
+{
+    return isalnum(c) || c == '_';
+}
+
+/*! Returns non-zero if "word" is one of the tables in a comma separated list */
+static int
+list_contains(const char* list, int list_len, const char* word, int word_len)
+{
+    int i = 0;
+    while (i < list_len)
+    {
+        int start;
+        while (i < list_len && (list[i] == ',' || isspace(list[i])))
+            i++;
+        start = i;
+        while (i < list_len && list[i] != ',' && !isspace(list[i]))
+            i++;
+        if (i - start == word_len && sqlite3_strnicmp(list + start, word, word_len) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int
+allow_scan_contains(const struct query* q, const char* data, const char* table, int table_len)
+{
+    const struct arg* a;
+    for (a = q->allow_scan; a; a = a->next)
+        if (a->name.len == table_len && sqlite3_strnicmp(data + a->name.off, table, table_len) == 0)
+            return 1;
+    return 0;
+}
+
+/*!
+ * \brief Finds the aliases given to tables in an SQL statement, e.g.
+ * "FROM games g" or "JOIN games AS g". EXPLAIN QUERY PLAN reports a table by
+ * its alias if it has one.
+ */
+static int
+find_table_aliases(const char* sql, struct table_alias* aliases, int max_aliases)
+{
+    static const char* keywords[] = {
+        "AS", "CROSS", "EXCEPT", "FULL", "GROUP", "HAVING", "INDEXED", "INNER",
+        "INTERSECT", "JOIN", "LEFT", "LIMIT", "NATURAL", "NOT", "ON", "ORDER",
+        "OUTER", "RETURNING", "RIGHT", "SET", "UNION", "USING", "VALUES",
+        "WHERE", "WINDOW", NULL
+    };
+    const char* prev = "";
+    int prev_len = 0;
+    int count = 0;
+    const char* p = sql;
+
+    while (*p)
+    {
+        const char* word;
+        int word_len;
+
+        /* Skip over string literals and anything that isn't an identifier */
+        if (*p == '\'')
+        {
+            for (++p; *p && *p != '\''; ++p) {}
+            if (*p)
+                ++p;
+            continue;
+        }
+        if (!is_ident_char(*p))
+        {
+            ++p;
+            continue;
+        }
+
+        word = p;
+        while (is_ident_char(*p))
+            ++p;
+        word_len = (int)(p - word);
+
+        if (((prev_len == 4 && sqlite3_strnicmp(prev, "FROM", 4) == 0) ||
+             (prev_len == 4 && sqlite3_strnicmp(prev, "JOIN", 4) == 0)) &&
+            count < max_aliases)
+        {
+            const char* alias = p;
+            int i, alias_len;
+
+            while (*alias == ' ')
+                ++alias;
+            if (sqlite3_strnicmp(alias, "AS ", 3) == 0)
+                for (alias += 3; *alias == ' '; ++alias) {}
+            for (alias_len = 0; is_ident_char(alias[alias_len]); ++alias_len) {}
+
+            for (i = 0; keywords[i]; ++i)
+                if ((int)strlen(keywords[i]) == alias_len && sqlite3_strnicmp(keywords[i], alias, alias_len) == 0)
+                    break;
+            if (alias_len && keywords[i] == NULL)
+            {
+                aliases[count].alias = alias;
+                aliases[count].alias_len = alias_len;
+                aliases[count].table = word;
+                aliases[count].table_len = word_len;
+                count++;
+            }
+        }
+
+        prev = word;
+        prev_len = word_len;
+    }
+
+    return count;
+}
+
+static void
+resolve_alias(const struct table_alias* aliases, int count, const char** name, int* name_len)
+{
+    int i;
+    for (i = 0; i != count; ++i)
+        if (aliases[i].alias_len == *name_len && sqlite3_strnicmp(aliases[i].alias, *name, *name_len) == 0)
+        {
+            *name = aliases[i].table;
+            *name_len = aliases[i].table_len;
+            return;
+        }
+}
+
+/*!
+ * \brief Runs EXPLAIN QUERY PLAN on a query and reports full scans of large
+ * tables and automatic indexes.
+ * \return Returns the number of problems that were found.
+ */
+static int
+check_query_plan(sqlite3* db, const struct root* root, const struct query_group* g, const struct query* q,
+                 const char* data, const char* file_name, const char* severity)
+{
+    struct table_alias aliases[16];
+    struct mstream sql = mstream_init_writeable();
+    sqlite3_stmt* stmt;
+    int alias_count;
+    int ret;
+    int issues = 0;
+    int line = line_number(data, q->name.off);
+
+    mstream_cstr(&sql, "EXPLAIN QUERY PLAN ");
+    write_query_sql(&sql, q, data, 0);
+    mstream_putc(&sql, '\0');
+
+    ret = sqlite3_prepare_v2(db, sql.address, -1, &stmt, NULL);
+    if (ret != SQLITE_OK)
+    {
+        fprintf(stderr, "%s:%d: %s: Failed to prepare query %.*s%s%.*s: %s\n",
+            file_name, line, severity,
+            g ? g->name.len : 0, g ? data + g->name.off : "", g ? "." : "",
+            q->name.len, data + q->name.off, sqlite3_errmsg(db));
+        free(sql.address);
+        return 1;
+    }
+
+    alias_count = find_table_aliases(sql.address, aliases, (int)(sizeof(aliases) / sizeof(*aliases)));
+
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const char* detail = (const char*)sqlite3_column_text(stmt, 3);
+        const char* table;
+        const char* automatic;
+        int table_len;
+
+        /*
+         * "SCAN <table> ...", "SEARCH <table> USING AUTOMATIC ... INDEX (<cols>)"
+         * and "BLOOM FILTER ON <table> (<cols>)"
+         */
+        if (strncmp(detail, "SCAN ", 5) == 0)
+            table = detail + 5;
+        else if (strncmp(detail, "SEARCH ", 7) == 0)
+            table = detail + 7;
+        else if (strncmp(detail, "BLOOM FILTER ON ", 16) == 0)
+            table = detail + 16;
+        else
+            continue;
+        for (table_len = 0; is_ident_char(table[table_len]); ++table_len) {}
+        resolve_alias(aliases, alias_count, &table, &table_len);
+
+        if (allow_scan_contains(q, data, table, table_len))
+            continue;
+
+        automatic = strstr(detail, "AUTOMATIC ");
+        if (automatic || strncmp(detail, "BLOOM ", 6) == 0)
+        {
+            const char* cols = strchr(detail, '(');
+            struct mstream col_list = mstream_init_writeable();
+            if (cols)
+            {
+                /* "(a=? AND b>?)" -> "a, b" */
+                while (*cols && *cols != ')')
+                {
+                    int len;
+                    while (*cols && !is_ident_char(*cols))
+                        ++cols;
+                    for (len = 0; is_ident_char(cols[len]); ++len) {}
+                    if (len == 0)
+                        break;
+                    if (col_list.write_ptr)
+                        mstream_cstr(&col_list, ", ");
+                    mstream_pad(&col_list, len);
+                    memcpy((char*)col_list.address + col_list.write_ptr, cols, len);
+                    col_list.write_ptr += len;
+                    cols += len;
+                    while (*cols && *cols != ')' && strncmp(cols, " AND ", 5) != 0)
+                        ++cols;
+                }
+            }
+            mstream_putc(&col_list, '\0');
+
+            fprintf(stderr, "%s:%d: %s: Query %.*s%s%.*s needs an index on %.*s(%s), SQLite has to build one every time the query runs: %s\n",
+                file_name, line, severity,
+                g ? g->name.len : 0, g ? data + g->name.off : "", g ? "." : "",
+                q->name.len, data + q->name.off,
+                table_len, table, (const char*)col_list.address, detail);
+            free(col_list.address);
+            issues++;
+        }
+        else if (strncmp(detail, "SCAN ", 5) == 0 &&
+                 list_contains(data + root->large_tables.off, root->large_tables.len, table, table_len))
+        {
+            fprintf(stderr, "%s:%d: %s: Query %.*s%s%.*s scans the large table \"%.*s\": %s\n",
+                file_name, line, severity,
+                g ? g->name.len : 0, g ? data + g->name.off : "", g ? "." : "",
+                q->name.len, data + q->name.off,
+                table_len, table, detail);
+            issues++;
+        }
+    }
+
+    sqlite3_finalize(stmt);
+    free(sql.address);
+    return issues;
+}
+
+/*!
+ * \brief Creates the schema in an in-memory database by running all upgrade
+ * migrations, then checks the query plan of every query.
+ * \return Returns -1 if the schema could not be created, or if problems were
+ * found and the check is configured to fail. Returns 0 otherwise.
+ */
+static int
+check_query_plans(const struct root* root, const char* data, const char* file_name, enum check_plans check_plans)
+{
+    const char* severity = check_plans == CHECK_PLANS_ERROR ? "error" : "warning";
+    const struct migration* m;
+    const struct query_group* g;
+    const struct query* q;
+    sqlite3* db;
+    int issues = 0;
+
+    if (sqlite3_open(":memory:", &db) != SQLITE_OK)
+    {
+        fprintf(stderr, "Error: Failed to open in-memory database: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return -1;
+    }
+
+    for (m = root->upgrade; m; m = m->next)
+    {
+        char* err;
+        char* sql = malloc(m->sql.len + 1);
+        memcpy(sql, data + m->sql.off, m->sql.len);
+        sql[m->sql.len] = '\0';
+        if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK)
+        {
+            fprintf(stderr, "%s:%d: error: Failed to run %%upgrade %d: %s\n",
+                file_name, line_number(data, m->sql.off), m->version, err);
+            sqlite3_free(err);
+            free(sql);
+            sqlite3_close(db);
+            return -1;
+        }
+        free(sql);
+    }
+
+    for (q = root->queries; q; q = q->next)
+        issues += check_query_plan(db, root, NULL, q, data, file_name, severity);
+    for (g = root->query_groups; g; g = g->next)
+        for (q = g->queries; q; q = q->next)
+            issues += check_query_plan(db, root, g, q, data, file_name, severity);
+
+    sqlite3_close(db);
+
+    if (issues && check_plans == CHECK_PLANS_ERROR)
+    {
+        fprintf(stderr, "Error: Found %d problem(s) in query plans. Add the missing indexes, "
+            "or add \"allow-scan <table>\" to the query if the scan is intended\n", issues);
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
 int main(int argc, char** argv)
 {
     struct parser parser;
@@ -3410,11 +4346,22 @@ int main(int argc, char** argv)
     if (post_parse(&root, mf.address) != 0)
         return -1;
 
+    if (cfg.check_plans != CHECK_PLANS_OFF)
+    {
+#if defined(SQLGEN_CHECK_PLANS)
+        if (check_query_plans(&root, mf.address, cfg.input_file, cfg.check_plans) != 0)
+            return -1;
+#else
+        fprintf(stderr, "Error: --check-plans requires sqlgen to be compiled with SQLGEN_CHECK_PLANS and linked against sqlite3\n");
+        return -1;
+#endif
+    }
+
     if (gen_header(&root, mf.address, cfg.output_header,
             cfg.custom_init_decl, cfg.custom_deinit_decl, cfg.custom_api_decl) < 0)
         return -1;
     if (gen_source(&root, mf.address, cfg.output_source,
-            cfg.debug_layer, cfg.custom_init, cfg.custom_deinit, cfg.custom_api, cfg.forwards_compat) < 0)
+            cfg.debug_layer, cfg.profile, cfg.custom_init, cfg.custom_deinit, cfg.custom_api, cfg.forwards_compat) < 0)
         return -1;
 
     return 0;
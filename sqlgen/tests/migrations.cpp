@@ -104,3 +104,21 @@ TEST_F(NAME, migrate_0_1_0_with_data)
     ASSERT_THAT(name2, Eq("name2"));
     ASSERT_THAT(name3, Eq(""));
 }
+static int on_person_get_v2(const char* first_name, const char* last_name, void* user)
+{
+    *(std::string*)user = first_name;
+    return 1;
+}
+TEST_F(NAME, migrate_1_2_keeps_data)
+{
+    ASSERT_THAT(dbi->migrate_to(db, 1), Eq(0));
+    int id = dbi->v1.person_add(db, "name1");
+    ASSERT_THAT(id, Gt(0));
+
+    ASSERT_THAT(dbi->migrate_to(db, 2), Eq(0));
+    ASSERT_THAT(dbi->version(db), Eq(2));
+
+    std::string first_name;
+    ASSERT_THAT(dbi->v2.person_get(db, id, on_person_get_v2, &first_name), Eq(1));
+    ASSERT_THAT(first_name, Eq("name1"));
+}
@@ -0,0 +1,91 @@
+#include <gmock/gmock.h>
+#include "sqlgen/tests/exists.h"
+#include "sqlgen/tests/profile.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+
+#define NAME sqlgen_profile
+
+using namespace testing;
+
+static std::string log_output;
+
+extern "C" void profile_log(const char* fmt, ...)
+{
+    char buf[1024];
+    va_list va;
+    va_start(va, fmt);
+    vsnprintf(buf, sizeof buf, fmt, va);
+    va_end(va);
+    log_output += buf;
+}
+
+struct NAME : public Test
+{
+    void SetUp() override {
+        profile_init();
+        dbi = profile("sqlite3");
+        db = dbi->open("profile.db");
+        dbi->reinit(db);
+        log_output.clear();
+    }
+
+    void TearDown() override {
+        dbi->close(db);
+        profile_deinit();
+    }
+
+    struct profile_interface* dbi;
+    struct profile* db;
+};
+
+static int on_name(const char* name, void* user)
+{
+    return 0;
+}
+
+TEST_F(NAME, dump_stats_is_only_set_when_profiling)
+{
+    ASSERT_THAT(dbi->dump_stats, NotNull());
+    ASSERT_THAT(exists("sqlite3")->dump_stats, IsNull());
+}
+TEST_F(NAME, query_plan_is_logged_once)
+{
+    ASSERT_THAT(dbi->people.exists(db, "name1"), Gt(0));
+    ASSERT_THAT(dbi->people.exists(db, "name3"), Eq(0));
+    EXPECT_THAT(log_output, HasSubstr("Query plan of people.exists"));
+    EXPECT_THAT(log_output, HasSubstr("SEARCH people USING"));
+    EXPECT_THAT(log_output.find("Query plan of people.exists"), Eq(log_output.rfind("Query plan of people.exists")));
+}
+TEST_F(NAME, slow_queries_are_logged_with_parameters)
+{
+    ASSERT_THAT(dbi->people.exists(db, "name1"), Gt(0));
+    EXPECT_THAT(log_output, HasSubstr("Slow query people.exists"));
+    EXPECT_THAT(log_output, HasSubstr("'name1'"));
+}
+TEST_F(NAME, dump_stats_counts_calls_and_rows)
+{
+    ASSERT_THAT(dbi->people.get_all(db, on_name, NULL), Eq(0));
+    ASSERT_THAT(dbi->people.get_all(db, on_name, NULL), Eq(0));
+    ASSERT_THAT(dbi->people.get_all(db, on_name, NULL), Eq(0));
+    log_output.clear();
+
+    dbi->dump_stats(db);
+    EXPECT_THAT(log_output, ContainsRegex("3 +6 +.*people.get_all"));
+    EXPECT_THAT(log_output, Not(HasSubstr("people.exists")));
+}
+TEST_F(NAME, cursors_are_profiled)
+{
+    struct profile_people_get_all_row row;
+    struct profile_cursor* cursor = dbi->people.get_all_open(db);
+    ASSERT_THAT(cursor, NotNull());
+    while (dbi->people.get_all_next(cursor, &row) > 0) {}
+    dbi->people.get_all_close(cursor);
+    EXPECT_THAT(log_output, HasSubstr("Query plan of people.get_all"));
+    log_output.clear();
+
+    dbi->dump_stats(db);
+    EXPECT_THAT(log_output, ContainsRegex("1 +2 +.*people.get_all"));
+}
@@ -22,3 +22,76 @@ struct NAME : public Test
     struct select_all_interface* dbi;
     struct select_all* db;
 };
+
+static int on_person(const char* name, int age, void* user)
+{
+    (*(int*)user)++;
+    return 0;
+}
+
+TEST_F(NAME, cursor_returns_all_rows)
+{
+    struct select_all_people_get_all_row row;
+    struct select_all_cursor* cursor = dbi->people.get_all_open(db);
+    ASSERT_THAT(cursor, NotNull());
+
+    ASSERT_THAT(dbi->people.get_all_next(cursor, &row), Eq(1));
+    EXPECT_THAT(row.name, StrEq("name1"));
+    EXPECT_THAT(row.age, Eq(69));
+    ASSERT_THAT(dbi->people.get_all_next(cursor, &row), Eq(1));
+    EXPECT_THAT(row.name, StrEq("name2"));
+    EXPECT_THAT(row.age, Eq(42));
+    EXPECT_THAT(dbi->people.get_all_next(cursor, &row), Eq(0));
+    EXPECT_THAT(dbi->people.get_all_next(cursor, &row), Eq(0));
+
+    dbi->people.get_all_close(cursor);
+}
+TEST_F(NAME, cursor_binds_arguments)
+{
+    struct select_all_people_get_by_age_row row;
+    struct select_all_cursor* cursor = dbi->people.get_by_age_open(db, 42);
+    ASSERT_THAT(cursor, NotNull());
+
+    ASSERT_THAT(dbi->people.get_by_age_next(cursor, &row), Eq(1));
+    EXPECT_THAT(row.name, StrEq("name2"));
+    EXPECT_THAT(dbi->people.get_by_age_next(cursor, &row), Eq(0));
+
+    dbi->people.get_by_age_close(cursor);
+}
+TEST_F(NAME, cursor_can_be_closed_early)
+{
+    struct select_all_people_get_all_row row;
+    struct select_all_cursor* cursor = dbi->people.get_all_open(db);
+    ASSERT_THAT(cursor, NotNull());
+    ASSERT_THAT(dbi->people.get_all_next(cursor, &row), Eq(1));
+    dbi->people.get_all_close(cursor);
+
+    /* Dropping the table fails if the statement is still running */
+    ASSERT_THAT(dbi->reinit(db), Eq(0));
+    dbi->people.get_all_close(NULL);
+}
+TEST_F(NAME, multiple_cursors_can_be_open_at_once)
+{
+    struct select_all_people_get_all_row row1, row2;
+    struct select_all_cursor* c1 = dbi->people.get_all_open(db);
+    struct select_all_cursor* c2 = dbi->people.get_all_open(db);
+    int calls = 0;
+    ASSERT_THAT(c1, NotNull());
+    ASSERT_THAT(c2, NotNull());
+
+    ASSERT_THAT(dbi->people.get_all_next(c1, &row1), Eq(1));
+    ASSERT_THAT(dbi->people.get_all_next(c2, &row2), Eq(1));
+    ASSERT_THAT(dbi->people.get_all_next(c2, &row2), Eq(1));
+    EXPECT_THAT(row1.name, StrEq("name1"));
+    EXPECT_THAT(row2.name, StrEq("name2"));
+
+    /* The query function uses a different statement */
+    ASSERT_THAT(dbi->people.get_all(db, on_person, &calls), Eq(0));
+    EXPECT_THAT(calls, Eq(2));
+
+    ASSERT_THAT(dbi->people.get_all_next(c1, &row1), Eq(1));
+    EXPECT_THAT(row1.name, StrEq("name2"));
+
+    dbi->people.get_all_close(c2);
+    dbi->people.get_all_close(c1);
+}
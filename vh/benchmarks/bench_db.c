@@ -0,0 +1,455 @@
+#include "synth_library.h"
+
+#include "vh/db.h"
+#include "vh/frame_data.h"
+#include "vh/fs.h"
+#include "vh/init.h"
+#include "vh/log.h"
+#include "vh/mem.h"
+#include "vh/time.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Generates a synthetic library (by default 100k games between 5k people,
+ * with tournaments, brackets, doubles, videos and frame data) and measures
+ * the queries the UI depends on against it.
+ *
+ * Usage: vh-db-benchmarks [--games N] [--people N] [--fdat-games N]
+ *                         [--frames N] [--seed N] [--runs N]
+ *
+ * Run it from an empty directory, it creates bench.db and fdata/ in the
+ * current directory. Progress is logged to stderr. The results are written
+ * to stdout with one JSON object per line, so they can be collected by a
+ * script and compared across versions:
+ *
+ *   {"benchmark":"game.get_all","runs":5,"items":100000,"min_us":...,"median_us":...,"max_us":...}
+ *
+ * "items" is the number of rows, lookups or frames a single run processed.
+ */
+
+#define DB_FILE_NAME        "bench.db"
+#define MAX_RUNS            100
+#define EVENT_LISTINGS      50  /* How many entries of the event list to open */
+
+struct event_listing
+{
+    struct str date;
+    int event_id;
+};
+
+struct bench_ctx
+{
+    struct db_interface* dbi;
+    struct db* db;
+    struct synth_library* lib;
+    struct vec motions;         /* uint64_t */
+    struct vec listings;        /* struct event_listing */
+    uint64_t checksum;          /* Keeps the compiler from optimizing away reads */
+};
+
+typedef int (*bench_func)(struct bench_ctx* ctx);
+
+static int
+count_row_cb(void* user_data)
+{
+    (*(int*)user_data)++;
+    return 0;
+}
+
+static int
+on_game(
+        int game_id,
+        int event_id,
+        uint64_t time_started,
+        int duration,
+        const char* tournament,
+        const char* event,
+        const char* stage,
+        const char* round,
+        const char* format,
+        const char* scores,
+        const char* slots,
+        const char* teams,
+        const char* players,
+        const char* fighter_ids,
+        const char* costumes,
+        const char* tags,
+        void* user_data)
+{
+    return count_row_cb(user_data);
+}
+
+static int
+bench_get_all(struct bench_ctx* ctx)
+{
+    int rows = 0;
+    if (ctx->dbi->game.get_all(ctx->db, on_game, &rows) < 0)
+        return -1;
+    return rows;
+}
+
+static int
+bench_get_all_cursor(struct bench_ctx* ctx)
+{
+    struct db_game_get_all_row row;
+    int ret, rows = 0;
+    struct db_cursor* cursor = ctx->dbi->game.get_all_open(ctx->db);
+    if (cursor == NULL)
+        return -1;
+    while ((ret = ctx->dbi->game.get_all_next(cursor, &row)) > 0)
+        rows++;
+    ctx->dbi->game.get_all_close(cursor);
+    return ret < 0 ? -1 : rows;
+}
+
+static int
+on_event(const char* date, const char* name, int event_id, void* user_data)
+{
+    return count_row_cb(user_data);
+}
+
+static int
+bench_get_events(struct bench_ctx* ctx)
+{
+    int rows = 0;
+    if (ctx->dbi->game.get_events(ctx->db, on_event, &rows) < 0)
+        return -1;
+    return rows;
+}
+
+static int
+on_event_listing(const char* date, const char* name, int event_id, void* user_data)
+{
+    struct vec* listings = user_data;
+    struct event_listing* listing;
+
+    if (vec_count(listings) == EVENT_LISTINGS)
+        return 1;
+
+    listing = vec_emplace(listings);
+    if (listing == NULL)
+        return -1;
+    str_init(&listing->date);
+    listing->event_id = event_id;
+    return cstr_set(&listing->date, date);
+}
+
+static int
+on_game_in_event(
+        int game_id,
+        uint64_t time_started,
+        int duration,
+        const char* tournament,
+        const char* event,
+        const char* stage,
+        const char* round,
+        const char* format,
+        const char* teams,
+        const char* scores,
+        const char* slots,
+        const char* sponsors,
+        const char* players,
+        const char* fighters,
+        const char* costumes,
+        void* user_data)
+{
+    return count_row_cb(user_data);
+}
+
+static int
+bench_get_all_in_event(struct bench_ctx* ctx)
+{
+    int rows = 0;
+    VEC_FOR_EACH(&ctx->listings, struct event_listing, listing)
+        if (ctx->dbi->game.get_all_in_event(ctx->db,
+                listing->event_id, str_view(listing->date), on_game_in_event, &rows) < 0)
+            return -1;
+    VEC_END_EACH
+    return rows;
+}
+
+/* Half of the lookups hit an existing game, like when a folder is imported
+ * a second time, the other half are new games */
+static int
+bench_exists_fingerprint(struct bench_ctx* ctx)
+{
+    strlist_idx i;
+    struct str missing;
+    const struct strlist* fingerprints = &ctx->lib->fingerprints;
+
+    str_init(&missing);
+    for (i = 0; i != (strlist_idx)strlist_count(fingerprints); ++i)
+    {
+        int ret = ctx->dbi->game.exists_fingerprint(ctx->db, strlist_view(fingerprints, i).data);
+        if (ret < 0)
+            goto fail;
+        ctx->checksum += (uint64_t)ret;
+
+        if (str_fmt(&missing, "%d:missing", i) != 0)
+            goto fail;
+        ret = ctx->dbi->game.exists_fingerprint(ctx->db, missing.data);
+        if (ret < 0)
+            goto fail;
+        ctx->checksum += (uint64_t)ret;
+    }
+    str_deinit(&missing);
+
+    return (int)strlist_count(fingerprints) * 2;
+
+fail:
+    str_deinit(&missing);
+    return -1;
+}
+
+static int
+on_label_motion(uint64_t hash40, void* user_data)
+{
+    struct bench_ctx* ctx = user_data;
+    ctx->checksum += hash40;
+    return 0;
+}
+
+static int
+bench_to_motions(struct bench_ctx* ctx)
+{
+    strlist_idx i;
+    int lookups = 0;
+    const struct strlist* labels = &ctx->lib->labels;
+
+    VEC_FOR_EACH(&ctx->lib->fighter_ids, int, fighter_id)
+        for (i = 0; i != (strlist_idx)strlist_count(labels); ++i, ++lookups)
+            if (ctx->dbi->motion_label.to_motions(ctx->db,
+                    *fighter_id, strlist_view(labels, i), on_label_motion, ctx) < 0)
+                return -1;
+    VEC_END_EACH
+
+    return lookups;
+}
+
+static int
+on_notation_label(const char* label, void* user_data)
+{
+    struct bench_ctx* ctx = user_data;
+    ctx->checksum += (uint64_t)strlen(label);
+    return 0;
+}
+
+static int
+bench_to_notation_label(struct bench_ctx* ctx)
+{
+    int lookups = 0;
+
+    VEC_FOR_EACH(&ctx->lib->fighter_ids, int, fighter_id)
+        VEC_FOR_EACH(&ctx->motions, uint64_t, hash40)
+            if (ctx->dbi->motion_label.to_notation_label(ctx->db,
+                    *fighter_id, *hash40, ctx->lib->label_usage_id, on_notation_label, ctx) < 0)
+                return -1;
+            lookups++;
+        VEC_END_EACH
+    VEC_END_EACH
+
+    return lookups;
+}
+
+static int
+bench_frame_data_load(struct bench_ctx* ctx)
+{
+    struct frame_data fdata;
+    int f, i, frames = 0;
+
+    frame_data_init(&fdata);
+    VEC_FOR_EACH(&ctx->lib->fdat_game_ids, int, game_id)
+        frame_data_clear(&fdata);
+        if (frame_data_load(&fdata, *game_id) != 0)
+        {
+            log_err("Failed to load frame data of game %d\n", *game_id);
+            return -1;
+        }
+
+        /* The file is memory mapped, so touch a column to actually read it */
+        for (f = 0; f != fdata.fighter_count; ++f)
+            for (i = 0; i != fdata.frame_count; ++i)
+                ctx->checksum += fdata.motion[f][i];
+        frames += fdata.frame_count;
+    VEC_END_EACH
+    frame_data_deinit(&fdata);
+
+    return frames;
+}
+
+static int
+u64_cmp(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+report(const char* name, int runs, int items, uint64_t* times_us)
+{
+    qsort(times_us, (size_t)runs, sizeof(uint64_t), u64_cmp);
+    printf("{\"benchmark\":\"%s\",\"runs\":%d,\"items\":%d,"
+           "\"min_us\":%" PRIu64 ",\"median_us\":%" PRIu64 ",\"max_us\":%" PRIu64 "}\n",
+        name, runs, items, times_us[0], times_us[runs / 2], times_us[runs - 1]);
+    fflush(stdout);
+}
+
+static int
+run(struct bench_ctx* ctx, const char* name, bench_func func, int runs)
+{
+    uint64_t times_us[MAX_RUNS];
+    int r, items = 0;
+
+    log_info("Running %s...\n", name);
+    for (r = 0; r != runs; ++r)
+    {
+        uint64_t start = time_get_us();
+        items = func(ctx);
+        times_us[r] = time_get_us() - start;
+        if (items < 0)
+        {
+            log_err("Benchmark %s failed\n", name);
+            return -1;
+        }
+    }
+
+    report(name, runs, items, times_us);
+    return 0;
+}
+
+static int
+on_motion(uint64_t hash40, const char* string, void* user_data)
+{
+    struct vec* motions = user_data;
+    return vec_push(motions, &hash40);
+}
+
+static int
+parse_args(int argc, char** argv, struct synth_library_params* params, int* runs)
+{
+    int i;
+    for (i = 1; i < argc; ++i)
+    {
+        int* value = NULL;
+        if (strcmp(argv[i], "--games") == 0)           value = &params->games;
+        else if (strcmp(argv[i], "--people") == 0)     value = &params->people;
+        else if (strcmp(argv[i], "--fdat-games") == 0) value = &params->fdat_games;
+        else if (strcmp(argv[i], "--frames") == 0)     value = &params->frames;
+        else if (strcmp(argv[i], "--runs") == 0)       value = runs;
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            params->seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+            continue;
+        }
+
+        if (value == NULL || i + 1 >= argc)
+        {
+            log_err("Unknown or incomplete option \"%s\"\n", argv[i]);
+            return -1;
+        }
+        *value = atoi(argv[++i]);
+        if (*value < 0)
+        {
+            log_err("Option \"%s\" must not be negative\n", argv[i - 1]);
+            return -1;
+        }
+    }
+
+    if (*runs < 1 || *runs > MAX_RUNS)
+    {
+        log_err("--runs must be between 1 and %d\n", MAX_RUNS);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct synth_library_params params;
+    struct synth_library lib;
+    struct bench_ctx ctx;
+    uint64_t generate_us;
+    int runs = 5;
+    int result = -1;
+
+    if (vh_threadlocal_init() != 0)
+        goto vh_init_tl_failed;
+    if (vh_init() != 0)
+        goto vh_init_failed;
+
+    synth_library_default_params(&params);
+    if (parse_args(argc, argv, &params, &runs) != 0)
+        goto parse_args_failed;
+
+    /* Frame data is always written to fdata/, don't mix it with a real library */
+    if (fs_dir_exists("fdata") && !fs_file_exists(DB_FILE_NAME))
+    {
+        log_err("fdata/ already exists here. Run the benchmark from an empty directory.\n");
+        goto parse_args_failed;
+    }
+
+    ctx.dbi = db("sqlite3");
+    ctx.db = ctx.dbi->open(DB_FILE_NAME);
+    if (ctx.db == NULL)
+        goto open_db_failed;
+    if (ctx.dbi->reinit(ctx.db) != 0)
+        goto reinit_db_failed;
+
+    synth_library_init(&lib);
+    log_info("Generating %d games...\n", params.games);
+    generate_us = time_get_us();
+    if (synth_library_generate(&lib, ctx.dbi, ctx.db, &params) != 0)
+        goto generate_failed;
+    generate_us = time_get_us() - generate_us;
+    report("generate", 1, lib.games, &generate_us);
+    log_info("%d games, %d people, %d tournaments, %d events, %d videos, %d fdat files\n",
+        lib.games, lib.people, lib.tournaments, lib.events, lib.videos,
+        (int)vec_count(&lib.fdat_game_ids));
+
+    ctx.lib = &lib;
+    ctx.checksum = 0;
+    vec_init(&ctx.motions, sizeof(uint64_t));
+    vec_init(&ctx.listings, sizeof(struct event_listing));
+    if (ctx.dbi->motion.get_all(ctx.db, on_motion, &ctx.motions) < 0)
+        goto prepare_failed;
+    if (ctx.dbi->game.get_events(ctx.db, on_event_listing, &ctx.listings) < 0)
+        goto prepare_failed;
+
+    if (run(&ctx, "game.get_all", bench_get_all, runs) != 0 ||
+        run(&ctx, "game.get_all_cursor", bench_get_all_cursor, runs) != 0 ||
+        run(&ctx, "game.get_events", bench_get_events, runs) != 0 ||
+        run(&ctx, "game.get_all_in_event", bench_get_all_in_event, runs) != 0 ||
+        run(&ctx, "game.exists_fingerprint", bench_exists_fingerprint, runs) != 0 ||
+        run(&ctx, "motion_label.to_motions", bench_to_motions, runs) != 0 ||
+        run(&ctx, "motion_label.to_notation_label", bench_to_notation_label, runs) != 0 ||
+        run(&ctx, "frame_data_load", bench_frame_data_load, runs) != 0)
+    {
+        goto prepare_failed;
+    }
+    log_info("Checksum: %" PRIx64 "\n", ctx.checksum);
+
+    if (ctx.dbi->dump_stats)
+        ctx.dbi->dump_stats(ctx.db);
+
+    result = 0;
+
+    prepare_failed    : VEC_FOR_EACH(&ctx.listings, struct event_listing, listing)
+                            str_deinit(&listing->date);
+                        VEC_END_EACH
+                        vec_deinit(&ctx.listings);
+                        vec_deinit(&ctx.motions);
+    generate_failed   : VEC_FOR_EACH(&lib.fdat_game_ids, int, game_id)
+                            frame_data_delete(*game_id);
+                        VEC_END_EACH
+                        synth_library_deinit(&lib);
+    reinit_db_failed  : ctx.dbi->close(ctx.db);
+    open_db_failed    :
+    parse_args_failed : vh_deinit();
+    vh_init_failed    : vh_threadlocal_deinit();
+    vh_init_tl_failed : return result == 0 ? 0 : 1;
+}
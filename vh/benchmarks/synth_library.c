@@ -0,0 +1,586 @@
+#include "synth_library.h"
+
+#include "vh/db.h"
+#include "vh/frame_data.h"
+#include "vh/hash40.h"
+#include "vh/log.h"
+#include "vh/mem.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#define FIGHTER_COUNT       90
+#define SPONSOR_COUNT       60
+#define LABELED_FIGHTERS    8
+#define BASE_TIME_MS        UINT64_C(1609502400000)  /* 2021-01-01 12:00 UTC */
+#define DAY_MS              UINT64_C(86400000)
+
+static const char* stage_names[] = {
+    "Battlefield", "Small Battlefield", "Final Destination", "Pokemon Stadium 2",
+    "Smashville", "Town and City", "Kalos Pokemon League", "Hollow Bastion",
+    "Yoshi's Story", "Lylat Cruise", "Northern Cave",
+};
+#define STAGE_COUNT ((int)(sizeof(stage_names) / sizeof(*stage_names)))
+
+/* Roughly ordered from most to least common, so a zipf distribution over the
+ * index looks like real frame data */
+static const struct { const char* motion; const char* label; } motions[] = {
+    { "wait_1", "idle" }, { "run", "run" }, { "dash", "dash" },
+    { "jump_f", "jump" }, { "fall", "fall" }, { "landing_light", "land" },
+    { "attack_air_n", "nair" }, { "landing_air_n", "nair-land" },
+    { "turn_dash", "turn" }, { "guard_on", "shield" }, { "guard_off", "drop" },
+    { "jump_b", "bjump" }, { "jump_aerial_f", "djump" },
+    { "attack_air_f", "fair" }, { "landing_air_f", "fair-land" },
+    { "attack_air_b", "bair" }, { "escape_air", "airdodge" },
+    { "special_hi", "upb" }, { "special_n", "neutralb" }, { "special_s", "sideb" },
+    { "special_lw", "downb" }, { "attack_11", "jab" }, { "attack_dash", "dattack" },
+    { "attack_s3_s", "ftilt" }, { "attack_hi3", "utilt" }, { "attack_lw3", "dtilt" },
+    { "catch", "grab" }, { "catch_dash", "dgrab" }, { "throw_f", "fthrow" },
+    { "throw_b", "bthrow" }, { "throw_hi", "uthrow" }, { "throw_lw", "dthrow" },
+    { "escape_f", "froll" }, { "escape_b", "broll" }, { "cliff_catch", "ledge" },
+    { "cliff_jump_quick_1", "ledgejump" }, { "attack_air_hi", "uair" },
+    { "attack_air_lw", "dair" }, { "attack_s4_s", "fsmash" },
+    { "attack_hi4", "usmash" }, { "attack_lw4", "dsmash" },
+};
+#define MOTION_COUNT ((int)(sizeof(motions) / sizeof(*motions)))
+
+enum event_kind
+{
+    EVENT_SINGLES,
+    EVENT_DOUBLES,
+    EVENT_AMATEURS,
+    EVENT_KIND_COUNT
+};
+static const char* event_type_names[EVENT_KIND_COUNT] = { "Singles", "Doubles", "Amateurs" };
+
+static const struct { const char* short_name; const char* long_name; int numbered; } round_types[] = {
+    { "WR", "Winner's Round", 1 },
+    { "LR", "Loser's Round", 1 },
+    { "WQF", "Winner's Quarter-Finals", 0 },
+    { "WSF", "Winner's Semi-Finals", 0 },
+    { "WF", "Winner's Finals", 0 },
+    { "LF", "Loser's Finals", 0 },
+    { "GF", "Grand Finals", 0 },
+};
+#define ROUND_TYPE_COUNT ((int)(sizeof(round_types) / sizeof(*round_types)))
+
+struct generator
+{
+    struct synth_library* lib;
+    struct db_interface* dbi;
+    struct db* db;
+    const struct synth_library_params* params;
+    uint32_t rng;
+
+    int* person_ids;
+    int* person_team_ids;       /* Every person plays singles in their own team */
+    int round_type_ids[ROUND_TYPE_COUNT];
+    int set_format_ids[2];      /* Bo3, Bo5 */
+    int event_type_ids[EVENT_KIND_COUNT];
+    uint64_t motion_hashes[MOTION_COUNT];
+    double motion_weights[MOTION_COUNT];
+    double motion_weight_total;
+
+    struct str name;
+    struct str name2;
+    struct str fingerprint;
+};
+
+struct set
+{
+    int event_id;
+    int video_id;
+    int tournament_id;
+    int round_type_id;
+    int round_number;
+    int set_format_id;
+    int wins_needed;
+    int team_count;
+    int players_per_team;
+    int people[4];              /* Index into person_ids */
+    int team_ids[2];
+    int fighter_ids[4];
+    int costumes[4];
+};
+
+static uint32_t
+rng_next(uint32_t* state)
+{
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 8) & 0xFFFFFF;
+}
+
+static int
+rng_range(uint32_t* state, int n)
+{
+    return (int)(rng_next(state) % (uint32_t)n);
+}
+
+static int
+add_static_data(struct generator* g)
+{
+    int i, group_id, layer_id, category_id, usage_id;
+    struct db_interface* dbi = g->dbi;
+    struct db* db = g->db;
+
+    for (i = 0; i != FIGHTER_COUNT; ++i)
+    {
+        if (str_fmt(&g->name, "Fighter %02d", i) != 0 ||
+            dbi->fighter.add(db, i, str_view(g->name)) != 0)
+            return -1;
+    }
+    for (i = 0; i != STAGE_COUNT; ++i)
+        if (dbi->stage.add(db, i, cstr_view(stage_names[i])) != 0)
+            return -1;
+
+    for (i = 0; i != ROUND_TYPE_COUNT; ++i)
+        if ((g->round_type_ids[i] = dbi->round.add_or_get_type(db,
+                cstr_view(round_types[i].short_name), cstr_view(round_types[i].long_name))) < 0)
+            return -1;
+    if ((g->set_format_ids[0] = dbi->set_format.add_or_get(db, cstr_view("Bo3"), cstr_view("Best of 3"))) < 0 ||
+        (g->set_format_ids[1] = dbi->set_format.add_or_get(db, cstr_view("Bo5"), cstr_view("Best of 5"))) < 0)
+        return -1;
+    for (i = 0; i != EVENT_KIND_COUNT; ++i)
+        if ((g->event_type_ids[i] = dbi->event.add_or_get_type(db, cstr_view(event_type_names[i]))) < 0)
+            return -1;
+
+    /* Motions, and a notation label for each of them on a few fighters */
+    if ((group_id = dbi->motion_label.add_or_get_group(db, cstr_view("Benchmark"))) < 0 ||
+        (layer_id = dbi->motion_label.add_or_get_layer(db, group_id, cstr_view("Benchmark"))) < 0 ||
+        (category_id = dbi->motion_label.add_or_get_category(db, cstr_view("Benchmark"))) < 0 ||
+        (usage_id = dbi->motion_label.add_or_get_usage(db, cstr_view("Notation"))) < 0)
+        return -1;
+    g->lib->label_usage_id = usage_id;
+
+    g->motion_weight_total = 0.0;
+    for (i = 0; i != MOTION_COUNT; ++i)
+    {
+        g->motion_hashes[i] = hash40_cstr(motions[i].motion);
+        g->motion_weight_total += g->motion_weights[i] = 1.0 / (i + 1);
+        if (dbi->motion.add(db, g->motion_hashes[i], cstr_view(motions[i].motion)) != 0)
+            return -1;
+        if (strlist_add_terminated(&g->lib->labels, cstr_view(motions[i].label)) != 0)
+            return -1;
+    }
+
+    for (i = 0; i != LABELED_FIGHTERS; ++i)
+    {
+        int m, fighter_id = i * (FIGHTER_COUNT / LABELED_FIGHTERS);
+        for (m = 0; m != MOTION_COUNT; ++m)
+            if (dbi->motion_label.add_or_get_label(db, g->motion_hashes[m],
+                    fighter_id, layer_id, category_id, usage_id, cstr_view(motions[m].label)) < 0)
+                return -1;
+        if (vec_push(&g->lib->fighter_ids, &fighter_id) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+add_people(struct generator* g)
+{
+    int i, sponsor_ids[SPONSOR_COUNT];
+    struct db_interface* dbi = g->dbi;
+    struct db* db = g->db;
+
+    for (i = 0; i != SPONSOR_COUNT; ++i)
+    {
+        if (str_fmt(&g->name, "SP%d", i) != 0)
+            return -1;
+        if ((sponsor_ids[i] = dbi->sponsor.add_or_get(db, str_view(g->name), cstr_view(""), cstr_view(""))) < 0)
+            return -1;
+    }
+
+    for (i = 0; i != g->params->people; ++i)
+    {
+        /* About a quarter of all players have a sponsor */
+        int sponsor_id = rng_range(&g->rng, 4) == 0 ?
+            sponsor_ids[rng_range(&g->rng, SPONSOR_COUNT)] : -1;
+        if (str_fmt(&g->name, "Player %04d", i) != 0 ||
+            str_fmt(&g->name2, "P%d", i) != 0)
+            return -1;
+
+        g->person_ids[i] = dbi->person.add_or_get(db, sponsor_id,
+            str_view(g->name), str_view(g->name2), cstr_view(""), cstr_view(""));
+        if (g->person_ids[i] < 0)
+            return -1;
+
+        g->person_team_ids[i] = dbi->team.add_or_get(db, str_view(g->name), cstr_view(""));
+        if (g->person_team_ids[i] < 0)
+            return -1;
+        if (dbi->team.add_member(db, g->person_team_ids[i], g->person_ids[i]) != 0)
+            return -1;
+    }
+
+    g->lib->people = g->params->people;
+    return 0;
+}
+
+static int
+pick_set_players(struct generator* g, struct set* set)
+{
+    int i, j;
+    int count = set->team_count * set->players_per_team;
+
+    for (i = 0; i != count; ++i)
+    {
+    retry:
+        set->people[i] = rng_range(&g->rng, g->params->people);
+        for (j = 0; j != i; ++j)
+            if (set->people[j] == set->people[i])
+                goto retry;
+        /* Players mostly stick to a main */
+        set->fighter_ids[i] = (set->people[i] * 7 + (rng_range(&g->rng, 8) == 0)) % FIGHTER_COUNT;
+        set->costumes[i] = rng_range(&g->rng, 8);
+    }
+
+    if (set->players_per_team == 1)
+    {
+        set->team_ids[0] = g->person_team_ids[set->people[0]];
+        set->team_ids[1] = g->person_team_ids[set->people[1]];
+        return 0;
+    }
+
+    for (i = 0; i != set->team_count; ++i)
+    {
+        int p1 = set->people[i * 2 + 0];
+        int p2 = set->people[i * 2 + 1];
+        if (str_fmt(&g->name, "Player %04d + Player %04d", p1, p2) != 0)
+            return -1;
+        if ((set->team_ids[i] = g->dbi->team.add_or_get(g->db, str_view(g->name), cstr_view(""))) < 0)
+            return -1;
+        if (g->dbi->team.add_member(g->db, set->team_ids[i], g->person_ids[p1]) != 0 ||
+            g->dbi->team.add_member(g->db, set->team_ids[i], g->person_ids[p2]) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+write_frame_data(struct generator* g, const struct set* set, int game_id, int duration_ms)
+{
+    struct frame_data fdata;
+    int f, i;
+    int fighter_count = set->team_count * set->players_per_team;
+    int frame_count = g->params->frames / 2 + rng_range(&g->rng, g->params->frames + 1);
+
+    frame_data_init(&fdata);
+    if (frame_data_alloc_structure(&fdata, fighter_count, frame_count) != 0)
+        return -1;
+
+    for (f = 0; f != fighter_count; ++f)
+    {
+        int motion = 0, motion_frames = 0;
+        for (i = 0; i != frame_count; ++i)
+        {
+            if (motion_frames == 0)
+            {
+                double r = (double)rng_next(&g->rng) / 0x1000000 * g->motion_weight_total;
+                for (motion = 0; motion != MOTION_COUNT - 1; ++motion)
+                    if ((r -= g->motion_weights[motion]) < 0.0)
+                        break;
+                motion_frames = 5 + rng_range(&g->rng, 30);
+            }
+            motion_frames--;
+
+            fdata.timestamp[f][i] = (uint64_t)i * (uint64_t)duration_ms / (uint64_t)frame_count;
+            fdata.motion[f][i] = g->motion_hashes[motion];
+            fdata.frames_left[f][i] = (uint32_t)motion_frames;
+            fdata.posx[f][i] = (float)rng_range(&g->rng, 200) - 100.0f;
+            fdata.posy[f][i] = (float)rng_range(&g->rng, 100);
+            fdata.damage[f][i] = (float)(i * 150 / frame_count);
+            fdata.hitstun[f][i] = 0.0f;
+            fdata.shield[f][i] = 50.0f;
+            fdata.status[f][i] = (uint16_t)motion;
+            fdata.hit_status[f][i] = 0;
+            fdata.stocks[f][i] = (uint8_t)(3 - i * 3 / frame_count);
+            fdata.flags[f][i] = (uint8_t)(f & 1 ? FRAME_DATA_FACING_LEFT : 0);
+        }
+    }
+
+    if (frame_data_save(&fdata, game_id) != 0)
+    {
+        log_err("Failed to save frame data of game %d\n", game_id);
+        frame_data_deinit(&fdata);
+        return -1;
+    }
+    frame_data_deinit(&fdata);
+
+    if (vec_push(&g->lib->fdat_game_ids, &game_id) != 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * Uses the same layout as the fingerprints the importer creates, so the
+ * unique index sees realistic keys. Start times are unique, so they stand in
+ * for the frame data hash.
+ */
+static int
+make_fingerprint(struct generator* g, const struct set* set, uint64_t time_started)
+{
+    int i, count = set->team_count * set->players_per_team;
+    if (str_fmt(&g->fingerprint, "%016" PRIx64 ":", time_started * 0x9E3779B97F4A7C15) != 0)
+        return -1;
+    for (i = 0; i != count; ++i)
+    {
+        if (str_fmt(&g->name, "%s%d\x1f%d",
+                i ? "\x1e" : "", g->person_ids[set->people[i]], set->fighter_ids[i]) != 0)
+            return -1;
+        if (str_append(&g->fingerprint, str_view(g->name)) != 0)
+            return -1;
+    }
+    str_terminate(&g->fingerprint);
+    return 0;
+}
+
+static int
+add_set(struct generator* g, const struct set* set, uint64_t* time_ms, int64_t* video_frame)
+{
+    struct db_interface* dbi = g->dbi;
+    struct db* db = g->db;
+    int scores[2] = { 0, 0 };
+
+    while (scores[0] < set->wins_needed && scores[1] < set->wins_needed)
+    {
+        int i, game_id, winner, duration, stage_id;
+        int count = set->team_count * set->players_per_team;
+
+        if (g->lib->games == g->params->games)
+            break;
+
+        winner = rng_range(&g->rng, 2);
+        stage_id = rng_range(&g->rng, STAGE_COUNT);
+        duration = (120 + rng_range(&g->rng, 300)) * 1000;
+
+        if (make_fingerprint(g, set, *time_ms) != 0)
+            return -1;
+        game_id = dbi->game.add(db,
+            set->round_type_id,
+            set->round_number,
+            set->set_format_id,
+            set->team_ids[winner],
+            stage_id,
+            *time_ms,
+            duration,
+            g->fingerprint.data);
+        if (game_id < 0)
+            return -1;
+        if (strlist_add_terminated(&g->lib->fingerprints, str_view(g->fingerprint)) != 0)
+            return -1;
+
+        if (set->tournament_id != -1)
+            if (dbi->game.associate_tournament(db, game_id, set->tournament_id) < 0)
+                return -1;
+        if (dbi->game.associate_event(db, game_id, set->event_id) < 0)
+            return -1;
+        if (dbi->game.associate_video(db, game_id, set->video_id, *video_frame) < 0)
+            return -1;
+
+        for (i = 0; i != count; ++i)
+        {
+            int team = i / set->players_per_team;
+            if (dbi->game.add_player(db, g->person_ids[set->people[i]], game_id, i,
+                    set->team_ids[team], set->fighter_ids[i], set->costumes[i],
+                    set->round_type_id == g->round_type_ids[1]) != 0)
+                return -1;
+        }
+        /* Scores are the number of games each team won before this one */
+        for (i = 0; i != set->team_count; ++i)
+            if (dbi->score.add(db, game_id, set->team_ids[i], scores[i]) != 0)
+                return -1;
+
+        if (g->lib->games < g->params->fdat_games)
+            if (write_frame_data(g, set, game_id, duration) != 0)
+                return -1;
+
+        scores[winner]++;
+        g->lib->games++;
+        *time_ms += (uint64_t)duration + 60000;
+        *video_frame += (duration + 60000) * 60 / 1000;
+    }
+
+    return 0;
+}
+
+static int
+add_tournament(struct generator* g, int t)
+{
+    struct db_interface* dbi = g->dbi;
+    struct db* db = g->db;
+    int event_ids[EVENT_KIND_COUNT];
+    int video_ids[EVENT_KIND_COUNT];
+    int tournament_id, e, games_left;
+    uint64_t time_ms[EVENT_KIND_COUNT];
+    int64_t video_frame[EVENT_KIND_COUNT];
+
+    /* Weekly tournaments, with a few practice sessions that aren't part of one */
+    if (t % 10 == 9)
+        tournament_id = -1;
+    else
+    {
+        if (str_fmt(&g->name, "Weekly #%d", t) != 0)
+            return -1;
+        if ((tournament_id = dbi->tournament.add_or_get(db, str_view(g->name), cstr_view(""))) < 0)
+            return -1;
+        if (dbi->tournament.add_organizer(db, tournament_id, g->person_ids[rng_range(&g->rng, g->params->people)]) != 0)
+            return -1;
+        g->lib->tournaments++;
+    }
+
+    for (e = 0; e != EVENT_KIND_COUNT; ++e)
+    {
+        if (str_fmt(&g->name, "bench://%d/%s", t, event_type_names[e]) != 0)
+            return -1;
+        if ((event_ids[e] = dbi->event.add_or_get(db, g->event_type_ids[e], str_view(g->name))) < 0)
+            return -1;
+        if (str_fmt(&g->name, "%d-%s.mp4", t, event_type_names[e]) != 0)
+            return -1;
+        if ((video_ids[e] = dbi->video.add_or_get(db, str_view(g->name), cstr_view("videos"))) < 0)
+            return -1;
+        time_ms[e] = BASE_TIME_MS + (uint64_t)t * 7 * DAY_MS + (uint64_t)e * 600000;
+        video_frame[e] = 0;
+        g->lib->events++;
+        g->lib->videos++;
+    }
+
+    games_left = g->params->games - g->lib->games;
+    if (games_left > g->params->games_per_tournament)
+        games_left = g->params->games_per_tournament;
+    games_left += g->lib->games;
+
+    while (g->lib->games < games_left)
+    {
+        struct set set;
+        int round = 0;
+
+        if (rng_range(&g->rng, 100) < g->params->doubles_percent)
+            e = EVENT_DOUBLES;
+        else
+            e = rng_range(&g->rng, 4) == 0 ? EVENT_AMATEURS : EVENT_SINGLES;
+
+        set.event_id = event_ids[e];
+        set.video_id = video_ids[e];
+        set.tournament_id = tournament_id;
+        set.team_count = 2;
+        set.players_per_team = e == EVENT_DOUBLES ? 2 : 1;
+
+        /* Amateurs and practice sets are played outside of a bracket */
+        if (e == EVENT_AMATEURS || tournament_id == -1)
+        {
+            set.round_type_id = -1;
+            set.round_number = -1;
+        }
+        else
+        {
+            round = rng_range(&g->rng, ROUND_TYPE_COUNT);
+            set.round_type_id = g->round_type_ids[round];
+            set.round_number = round_types[round].numbered ? 1 + rng_range(&g->rng, 6) : -1;
+        }
+
+        /* Top 8 is best of 5 */
+        if (set.round_type_id != -1 && !round_types[round].numbered)
+        {
+            set.set_format_id = g->set_format_ids[1];
+            set.wins_needed = 3;
+        }
+        else
+        {
+            set.set_format_id = g->set_format_ids[0];
+            set.wins_needed = 2;
+        }
+
+        if (pick_set_players(g, &set) != 0)
+            return -1;
+        if (add_set(g, &set, &time_ms[e], &video_frame[e]) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+void
+synth_library_init(struct synth_library* lib)
+{
+    strlist_init(&lib->fingerprints);
+    vec_init(&lib->fdat_game_ids, sizeof(int));
+    vec_init(&lib->fighter_ids, sizeof(int));
+    strlist_init(&lib->labels);
+    lib->label_usage_id = -1;
+    lib->games = 0;
+    lib->people = 0;
+    lib->tournaments = 0;
+    lib->events = 0;
+    lib->videos = 0;
+}
+
+void
+synth_library_deinit(struct synth_library* lib)
+{
+    strlist_deinit(&lib->labels);
+    vec_deinit(&lib->fighter_ids);
+    vec_deinit(&lib->fdat_game_ids);
+    strlist_deinit(&lib->fingerprints);
+}
+
+int
+synth_library_generate(
+        struct synth_library* lib,
+        struct db_interface* dbi,
+        struct db* db,
+        const struct synth_library_params* params)
+{
+    struct generator g;
+    int t;
+
+    if (params->people < 4 || params->games_per_tournament < 1)
+    {
+        log_err("Need at least 4 people and 1 game per tournament\n");
+        return -1;
+    }
+
+    g.lib = lib;
+    g.dbi = dbi;
+    g.db = db;
+    g.params = params;
+    g.rng = params->seed;
+    str_init(&g.name);
+    str_init(&g.name2);
+    str_init(&g.fingerprint);
+
+    g.person_ids = mem_alloc(sizeof(int) * (mem_size)params->people);
+    if (g.person_ids == NULL)
+        goto alloc_person_ids_failed;
+    g.person_team_ids = mem_alloc(sizeof(int) * (mem_size)params->people);
+    if (g.person_team_ids == NULL)
+        goto alloc_person_team_ids_failed;
+
+    if (dbi->transaction.begin(db) != 0)
+        goto begin_failed;
+    if (add_static_data(&g) != 0)
+        goto generate_failed;
+    if (add_people(&g) != 0)
+        goto generate_failed;
+    for (t = 0; lib->games < params->games; ++t)
+        if (add_tournament(&g, t) != 0)
+            goto generate_failed;
+    if (dbi->transaction.commit(db) != 0)
+        goto generate_failed;
+
+    mem_free(g.person_team_ids);
+    mem_free(g.person_ids);
+    str_deinit(&g.fingerprint);
+    str_deinit(&g.name2);
+    str_deinit(&g.name);
+    return 0;
+
+    generate_failed              : dbi->transaction.rollback(db);
+    begin_failed                 : mem_free(g.person_team_ids);
+    alloc_person_team_ids_failed : mem_free(g.person_ids);
+    alloc_person_ids_failed      : str_deinit(&g.fingerprint);
+                                   str_deinit(&g.name2);
+                                   str_deinit(&g.name);
+    return -1;
+}
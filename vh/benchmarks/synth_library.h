@@ -0,0 +1,66 @@
+#pragma once
+
+#include "vh/str.h"
+#include "vh/vec.h"
+
+#include <stdint.h>
+
+struct db;
+struct db_interface;
+
+struct synth_library_params
+{
+    uint32_t seed;
+    int games;                  /* Total number of games */
+    int people;                 /* Size of the player pool */
+    int games_per_tournament;
+    int doubles_percent;        /* Percentage of sets that are played 2v2 */
+    int fdat_games;             /* The first N games get a .fdat file */
+    int frames;                 /* Average number of frames per .fdat file */
+};
+
+struct synth_library
+{
+    struct strlist fingerprints;  /* Of every game, in the order they were added */
+    struct vec fdat_game_ids;     /* int */
+    struct vec fighter_ids;       /* int, fighters that have motion labels */
+    struct strlist labels;        /* Every motion label given to those fighters */
+    int label_usage_id;
+    int games;
+    int people;
+    int tournaments;
+    int events;
+    int videos;
+};
+
+static inline void
+synth_library_default_params(struct synth_library_params* params)
+{
+    params->seed = 0x5EED;
+    params->games = 100000;
+    params->people = 5000;
+    params->games_per_tournament = 200;
+    params->doubles_percent = 20;
+    params->fdat_games = 200;
+    params->frames = 7200;
+}
+
+void
+synth_library_init(struct synth_library* lib);
+
+void
+synth_library_deinit(struct synth_library* lib);
+
+/*!
+ * \brief Fills an empty database with a library of made up tournaments,
+ * brackets, sets, videos and players, and writes matching frame data to
+ * fdata/ in the current directory. The same parameters always produce the
+ * same library.
+ * \return Returns 0 on success, negative on error.
+ */
+int
+synth_library_generate(
+        struct synth_library* lib,
+        struct db_interface* dbi,
+        struct db* db,
+        const struct synth_library_params* params);
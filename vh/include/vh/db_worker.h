@@ -0,0 +1,75 @@
+#pragma once
+
+#include "vh/config.h"
+
+C_BEGIN
+
+struct db;
+struct db_interface;
+struct db_worker;
+
+/*!
+ * Requests of a higher priority always run before requests of a lower
+ * priority. Requests of the same priority run in the order they were
+ * submitted.
+ */
+enum db_worker_priority
+{
+    DB_WORKER_HIGH,    /* The user is waiting for the result */
+    DB_WORKER_NORMAL,
+    DB_WORKER_LOW,     /* Refreshes that nobody is actively waiting for */
+
+    DB_WORKER_PRIORITY_COUNT
+};
+
+/*!
+ * \brief Runs on the worker thread. Use the connection passed in, and nothing
+ * else, to query the database.
+ * \return The return value is passed to the done callback.
+ */
+typedef int (*db_worker_func)(struct db_interface* dbi, struct db* db, void* data);
+
+/*!
+ * \brief Runs on the main context after the request has finished. It is not
+ * called if the request was cancelled.
+ */
+typedef void (*db_worker_done_func)(int result, void* data);
+
+/*!
+ * The application runs a single thread with its own database connection.
+ * Plugins are given this interface so they can move queries off of the main
+ * thread too. See application/db_worker.h for the details of each function.
+ *
+ * The worker is stopped before plugins are destroyed. Requests still queued
+ * at that point run, but their done callbacks are not called. Plugins must
+ * not submit requests from their destroy function.
+ */
+struct db_worker_interface
+{
+    /*!
+     * \brief Queues a request. Must be called from the main thread.
+     * \return Returns an ID greater than 0 that can be passed to cancel(),
+     * or -1 on error. If an error occurs, destroy is not called.
+     */
+    int (*submit)(
+            struct db_worker* worker,
+            enum db_worker_priority priority,
+            db_worker_func func,
+            db_worker_done_func done,
+            void* data,
+            void (*destroy)(void* data));
+
+    /*!
+     * \brief Cancels a request, e.g. because its result would be stale.
+     * Must be called from the main thread.
+     */
+    void (*cancel)(struct db_worker* worker, int request_id);
+
+    /*!
+     * \brief Can be called by func on the worker thread to abort long
+     * running requests early.
+     */
+    int (*is_cancelled)(struct db_worker* worker);
+};
+
+C_END
@@ -55,6 +55,22 @@ frame_data_load(struct frame_data* fdata, int game_id);
 VH_PUBLIC_API int
 frame_data_save(const struct frame_data* fdata, int game_id);
 
+/*!
+ * \brief Gets a value that changes whenever the game's frame data file is
+ * written. Used to tell whether results derived from it are still valid.
+ * \return Returns 0 on success, or negative if the game has no frame data.
+ */
+VH_PUBLIC_API int
+frame_data_stamp(int game_id, uint64_t* stamp);
+
+/*!
+ * \brief Hashes the timestamps and motions of every fighter. Identical replays
+ * hash to the same value no matter when or where they were imported. Used as
+ * part of the game fingerprint (see db.sqlgen).
+ */
+VH_PUBLIC_API uint64_t
+frame_data_hash(const struct frame_data* fdata);
+
 VH_PUBLIC_API void
 frame_data_delete(int game_id);
 
@@ -97,6 +97,14 @@ fs_file_exists(const char* file_path);
 VH_PUBLIC_API int
 fs_dir_exists(const char* file_path);
 
+/*!
+ * \brief Gets a value that changes whenever the file is modified, made from
+ * its modification time and size.
+ * \return Returns 0 on success, or negative if the file doesn't exist.
+ */
+VH_PUBLIC_API int
+fs_file_stamp(const char* file_path, uint64_t* stamp);
+
 VH_PUBLIC_API int
 fs_make_dir(const char* path);
 
@@ -35,7 +35,9 @@ typedef int32_t mem_idx;
  * called for every thread. This is called from cs_threadlocal_init().
  *
  * In release mode this does nothing. In debug mode it will initialize
- * memory reports and backtraces, if enabled.
+ * memory reports and backtraces, if enabled. All threads share one report,
+ * so memory can be freed on a different thread than it was allocated on.
+ * The first thread must be initialized before any other thread is started.
  */
 VH_PRIVATE_API int
 mem_threadlocal_init(void);
@@ -44,9 +46,11 @@ mem_threadlocal_init(void);
  * @brief De-initializes memory tracking for the current thread. This is called
  * from cs_threadlocal_deinit().
  *
- * In release mode this does nothing. In debug mode this will output the memory
- * report and print backtraces, if enabled.
- * @return Returns the number of memory leaks.
+ * In release mode this does nothing. In debug mode, the last thread to be
+ * de-initialized will output the memory report and print backtraces, if
+ * enabled.
+ * @return Returns the number of memory leaks, or 0 if other threads are still
+ * being tracked.
  */
 VH_PRIVATE_API mem_size
 mem_threadlocal_deinit(void);
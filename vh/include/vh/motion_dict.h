@@ -0,0 +1,73 @@
+#pragma once
+
+#include "vh/config.h"
+#include "vh/str.h"
+#include <stdint.h>
+
+C_BEGIN
+
+struct db;
+struct db_interface;
+struct motion_dict;
+
+/*!
+ * In-memory copy of the motions and motion_labels tables, shared by the
+ * whole process. Every lookup is a single probe into a table indexed by a
+ * minimal perfect hash (see vh/mph.h) and doesn't access the database.
+ *
+ * A dictionary never changes once it was loaded, so it can be read from any
+ * thread while it is acquired. motion_dict_acquire() checks the revision the
+ * database keeps of both tables, and loads a new dictionary only if motions
+ * or labels were edited since. Dictionaries that were acquired before stay
+ * valid until they are released.
+ */
+
+VH_PRIVATE_API int
+motion_dict_init(void);
+
+VH_PRIVATE_API void
+motion_dict_deinit(void);
+
+/*!
+ * \brief Returns the current dictionary of the database, loading it first
+ * if necessary. Must be called on the thread that owns the database.
+ * \return Returns a new reference, or NULL on error. Release it with
+ * motion_dict_release().
+ */
+VH_PUBLIC_API struct motion_dict*
+motion_dict_acquire(struct db_interface* dbi, struct db* db);
+
+VH_PUBLIC_API void
+motion_dict_release(struct motion_dict* dict);
+
+/*!
+ * \brief Returns the revision of the database the dictionary was loaded
+ * from. Data derived from a dictionary is out of date if the revision of
+ * the current dictionary is different.
+ */
+VH_PUBLIC_API uint64_t
+motion_dict_revision(const struct motion_dict* dict);
+
+/*!
+ * \brief Returns the name of a motion, or NULL if the motion is unknown.
+ */
+VH_PUBLIC_API const char*
+motion_dict_string(const struct motion_dict* dict, uint64_t hash40);
+
+/*!
+ * \brief Returns the label of the highest priority layer for a motion, or
+ * NULL if the fighter has no label of this usage for the motion.
+ */
+VH_PUBLIC_API const char*
+motion_dict_label(const struct motion_dict* dict, int fighter_id, uint64_t hash40, int usage_id);
+
+/*!
+ * \brief Looks up the motions a label stands for, across all usages.
+ * \param[out] motions Receives a pointer to the motions. Valid until the
+ * dictionary is released.
+ * \return Returns the number of motions, 0 if the fighter has no such label.
+ */
+VH_PUBLIC_API int
+motion_dict_label_motions(const struct motion_dict* dict, int fighter_id, struct str_view label, const uint64_t** motions);
+
+C_END
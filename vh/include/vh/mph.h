@@ -0,0 +1,69 @@
+#pragma once
+
+#include "vh/config.h"
+#include <stdint.h>
+
+C_BEGIN
+
+/*!
+ * Minimal perfect hash function over a fixed set of 64-bit keys ("hash and
+ * displace"). Every key of the set maps to a distinct slot in [0, count), so
+ * tables indexed by the slot have no empty entries and a lookup is a single
+ * probe. Keys that are not part of the set map to an arbitrary slot, which
+ * means the caller has to store the key in the slot and compare it.
+ */
+struct mph
+{
+    uint32_t* displacements;  /* One per bucket */
+    uint32_t bucket_count;
+    uint32_t slot_count;
+};
+
+static inline void
+mph_init(struct mph* mph)
+{
+    mph->displacements = NULL;
+    mph->bucket_count = 0;
+    mph->slot_count = 0;
+}
+
+VH_PUBLIC_API void
+mph_deinit(struct mph* mph);
+
+/*!
+ * \brief Builds the function for a set of keys. Any previous function is
+ * replaced.
+ * \param[in] keys Keys of the set. Every key must be unique.
+ * \return Returns 0 on success or negative on error, e.g. if a key appears
+ * more than once.
+ */
+VH_PUBLIC_API int
+mph_build(struct mph* mph, const uint64_t* keys, int count);
+
+static inline uint64_t
+mph_mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= UINT64_C(0xbf58476d1ce4e5b9);
+    x ^= x >> 27;
+    x *= UINT64_C(0x94d049bb133111eb);
+    x ^= x >> 31;
+    return x;
+}
+
+/*!
+ * \brief Returns the slot of a key, or -1 if the set is empty.
+ */
+static inline int
+mph_slot(const struct mph* mph, uint64_t key)
+{
+    uint64_t h;
+    uint32_t d;
+    if (mph->slot_count == 0)
+        return -1;
+    h = mph_mix(key);
+    d = mph->displacements[(uint32_t)(h >> 32) % mph->bucket_count];
+    return (int)(mph_mix(h + d) % mph->slot_count);
+}
+
+C_END
@@ -7,6 +7,8 @@ C_BEGIN
 
 struct db;
 struct db_interface;
+struct db_worker;
+struct db_worker_interface;
 struct plugin_ctx;
 typedef struct _GtkWidget GtkWidget;
 typedef struct _GTypeModule GTypeModule;
@@ -149,7 +151,17 @@ struct plugin_interface
     uint32_t plugin_version;
     uint32_t vh_version;
     struct plugin_info* info;
-    struct plugin_ctx* (*create)(GTypeModule* type_module, struct db_interface* dbi, struct db* db);
+    /*!
+     * \brief Create a plugin context.
+     * \param[in] dbi,db The main thread's database connection.
+     * \param[in] dbwi,dbw The application's database worker (see
+     * vh/db_worker.h). Queries that aren't instant should be submitted to it
+     * instead of running on the main thread.
+     */
+    struct plugin_ctx* (*create)(
+            GTypeModule* type_module,
+            struct db_interface* dbi, struct db* db,
+            struct db_worker_interface* dbwi, struct db_worker* dbw);
     void (*destroy)(GTypeModule* type_module, struct plugin_ctx* ctx);
     struct ui_center_interface* ui_center;
     struct ui_pane_interface* ui_pane;
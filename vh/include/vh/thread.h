@@ -12,6 +12,10 @@ struct mutex
 {
     void* handle;
 };
+struct cond
+{
+    void* handle;
+};
 
 VH_PUBLIC_API int
 thread_start(struct thread* t, void* (*func)(void*), void* args);
@@ -45,3 +49,23 @@ mutex_trylock(struct mutex m);
 
 VH_PUBLIC_API void
 mutex_unlock(struct mutex m);
+
+VH_PUBLIC_API void
+cond_init(struct cond* c);
+
+VH_PUBLIC_API void
+cond_deinit(struct cond c);
+
+/*!
+ * \brief Atomically unlocks the mutex and waits for the condition to be
+ * signalled. The mutex is locked again before returning. Spurious wakeups
+ * are possible, so always check the predicate in a loop.
+ */
+VH_PUBLIC_API void
+cond_wait(struct cond c, struct mutex m);
+
+VH_PUBLIC_API void
+cond_signal(struct cond c);
+
+VH_PUBLIC_API void
+cond_broadcast(struct cond c);
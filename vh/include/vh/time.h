@@ -0,0 +1,16 @@
+#pragma once
+
+#include "vh/config.h"
+#include <stdint.h>
+
+C_BEGIN
+
+/*!
+ * \brief Returns the time of a monotonic clock in microseconds. The point the
+ * clock starts at is unspecified, only differences between two calls are
+ * meaningful.
+ */
+VH_PUBLIC_API uint64_t
+time_get_us(void);
+
+C_END
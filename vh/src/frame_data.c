@@ -1,3 +1,4 @@
+#include "vh/crc32.h"
 #include "vh/frame_data.h"
 #include "vh/fs.h"
 #include "vh/mem.h"
@@ -229,6 +230,37 @@ frame_data_save(const struct frame_data* fdata, int game_id)
     return 0;
 }
 
+int
+frame_data_stamp(int game_id, uint64_t* stamp)
+{
+    char file_name[64];
+    sprintf(file_name, "fdata/%d.fdat", game_id);
+    return fs_file_stamp(file_name, stamp);
+}
+
+uint64_t
+frame_data_hash(const struct frame_data* fdata)
+{
+    int f;
+    uint32_t counts[2];
+    uint32_t timestamps, motions;
+
+    counts[0] = (uint32_t)fdata->fighter_count;
+    counts[1] = (uint32_t)fdata->frame_count;
+    timestamps = crc32_buf(counts, (int)sizeof(counts), 0);
+    motions = crc32_buf(counts, (int)sizeof(counts), 0);
+
+    /* Timestamps are the wall clock time of each frame, so they alone tell
+     * games apart. Motions are added so the hash has 64 bits. */
+    for (f = 0; f != fdata->fighter_count; ++f)
+    {
+        timestamps = crc32_buf(fdata->timestamp[f], (int)sizeof(uint64_t) * fdata->frame_count, timestamps);
+        motions = crc32_buf(fdata->motion[f], (int)sizeof(uint64_t) * fdata->frame_count, motions);
+    }
+
+    return ((uint64_t)timestamps << 32) | motions;
+}
+
 void
 frame_data_delete(int game_id)
 {
@@ -1,4 +1,5 @@
 #include "vh/db.h"
+#include "vh/frame_data.h"
 #include "vh/mem.h"
 #include "vh/mstream.h"
 
@@ -6,10 +7,14 @@
 #include "zlib.h"
 
 int
-import_reframed_framedata_1_5(struct mstream* ms, int game_id);
+import_reframed_framedata_1_5(struct mstream* ms, struct frame_data* fdata);
 
+/*
+ * Only decodes the frame data. The caller saves it once the game has an ID,
+ * because the fingerprint of the game needs the frame data first.
+ */
 int
-import_reframed_framedata(struct mstream* ms, int game_id)
+import_reframed_framedata(struct mstream* ms, struct frame_data* fdata)
 {
     uint8_t major = mstream_read_u8(ms);
     uint8_t minor = mstream_read_u8(ms);
@@ -30,7 +35,7 @@ import_reframed_framedata(struct mstream* ms, int game_id)
 
         struct mstream uncompressed_stream = mstream_from_memory(
                 uncompressed_data, (int)uncompressed_size);
-        int result = import_reframed_framedata_1_5(&uncompressed_stream, game_id);
+        int result = import_reframed_framedata_1_5(&uncompressed_stream, fdata);
         mem_free(uncompressed_data);
         return result;
     }
@@ -0,0 +1,76 @@
+#include "vh/frame_data.h"
+#include "vh/log.h"
+#include "vh/str.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PLAYERS 8
+
+static int
+entry_cmp(const void* a, const void* b)
+{
+    const struct str* e1 = a;
+    const struct str* e2 = b;
+    int len = e1->len < e2->len ? e1->len : e2->len;
+    int result = memcmp(e1->data, e2->data, (size_t)len);
+    if (result != 0)
+        return result;
+    return e1->len < e2->len ? -1 : e1->len > e2->len;
+}
+
+/*
+ * Must produce the same text as the backfill in %upgrade 6 of db.sqlgen.
+ * The entries are sorted bytewise, like SQLite's BINARY collation does.
+ * Replays without frame data get an empty fingerprint, because the backfill
+ * can't fingerprint them either.
+ */
+int
+reframed_game_fingerprint(
+        struct str* fp,
+        const struct frame_data* fdata,
+        const int* person_ids,
+        const int* fighter_ids,
+        int count)
+{
+    struct str entries[MAX_PLAYERS];
+    int i;
+
+    if (count > MAX_PLAYERS)
+    {
+        log_err("Can't create fingerprint of a game with %d players\n", count);
+        return -1;
+    }
+
+    str_clear(fp);
+    if (fdata == NULL)
+        return 0;
+
+    for (i = 0; i != count; ++i)
+        str_init(&entries[i]);
+    for (i = 0; i != count; ++i)
+        if (str_fmt(&entries[i], "%d\x1f%d", person_ids[i], fighter_ids[i]) != 0)
+            goto fail;
+    qsort(entries, (size_t)count, sizeof(struct str), entry_cmp);
+
+    if (str_fmt(fp, "%016" PRIx64 ":", frame_data_hash(fdata)) != 0)
+        goto fail;
+    for (i = 0; i != count; ++i)
+    {
+        if (i != 0 && cstr_append(fp, "\x1e") != 0)
+            goto fail;
+        if (str_append(fp, str_view(entries[i])) != 0)
+            goto fail;
+    }
+    str_terminate(fp);
+
+    for (i = 0; i != count; ++i)
+        str_deinit(&entries[i]);
+    return 0;
+
+fail:
+    for (i = 0; i != count; ++i)
+        str_deinit(&entries[i]);
+    return -1;
+}
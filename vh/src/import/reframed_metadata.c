@@ -1,4 +1,5 @@
 #include "vh/db.h"
+#include "vh/frame_data.h"
 #include "vh/log.h"
 #include "vh/mstream.h"
 
@@ -8,25 +9,29 @@ int
 import_reframed_metadata_1_5(
         struct db_interface* dbi,
         struct db* db,
-        struct json_object* root);
+        struct json_object* root,
+        const struct frame_data* fdata);
 
 int
 import_reframed_metadata_1_6(
         struct db_interface* dbi,
         struct db* db,
-        struct json_object* root);
+        struct json_object* root,
+        const struct frame_data* fdata);
 
 int
 import_reframed_metadata_1_7(
         struct db_interface* dbi,
         struct db* db,
-        struct json_object* root);
+        struct json_object* root,
+        const struct frame_data* fdata);
 
 int
 import_reframed_metadata(
         struct db_interface* dbi,
         struct db* db,
-        struct mstream* ms)
+        struct mstream* ms,
+        const struct frame_data* fdata)
 {
     int game_id;
     struct json_tokener* tok = json_tokener_new();
@@ -41,9 +46,9 @@ import_reframed_metadata(
     if (version_str == NULL)
         goto fail;
 
-    if      (strcmp(version_str, "1.7") == 0) game_id = import_reframed_metadata_1_7(dbi, db, root);
-    else if (strcmp(version_str, "1.6") == 0) game_id = import_reframed_metadata_1_6(dbi, db, root);
-    else if (strcmp(version_str, "1.5") == 0) game_id = import_reframed_metadata_1_5(dbi, db, root);
+    if      (strcmp(version_str, "1.7") == 0) game_id = import_reframed_metadata_1_7(dbi, db, root, fdata);
+    else if (strcmp(version_str, "1.6") == 0) game_id = import_reframed_metadata_1_6(dbi, db, root, fdata);
+    else if (strcmp(version_str, "1.5") == 0) game_id = import_reframed_metadata_1_5(dbi, db, root, fdata);
     else
     {
         log_err("Failed to import RFR: Unsupported metadata version %s\n", version_str);
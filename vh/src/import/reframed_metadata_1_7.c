@@ -1,4 +1,5 @@
 #include "vh/db.h"
+#include "vh/frame_data.h"
 #include "vh/log.h"
 
 #include "json-c/json.h"
@@ -12,11 +13,20 @@ reframed_add_or_get_person_to_db(
     struct str_view name, struct str_view tag,
     struct str_view social, struct str_view pronouns);
 
+int
+reframed_game_fingerprint(
+        struct str* fp,
+        const struct frame_data* fdata,
+        const int* person_ids,
+        const int* fighter_ids,
+        int count);
+
 int
 import_reframed_metadata_1_7(
         struct db_interface* dbi,
         struct db* db,
-        struct json_object* root)
+        struct json_object* root,
+        const struct frame_data* fdata)
 {
     struct json_object* tournament = json_object_object_get(root, "tournament");
     struct json_object* tournament_name = json_object_object_get(tournament, "name");
@@ -203,7 +213,8 @@ import_reframed_metadata_1_7(
     if (player_info && json_object_get_type(player_info) != json_type_array)
         return -1;
     int player_count = (int)json_object_array_length(player_info);
-    int people_ids[4] = {-1, -1, -1, -1};
+    int person_ids[8];
+    int fighter_ids[8];
     for (int i = 0; i != player_count; ++i)
     {
         struct json_object* player = json_object_array_get_idx(player_info, (size_t)i);
@@ -241,8 +252,11 @@ import_reframed_metadata_1_7(
             cstr_view(pronouns ? pronouns : ""));
         if (person_id < 0)
             return -1;
-        if (i < 4)
-            people_ids[i] = person_id;
+        if (i < 8)
+        {
+            person_ids[i] = person_id;
+            fighter_ids[i] = json_object_get_int(json_object_object_get(player, "fighterid"));
+        }
 
         int team_id = dbi->team.add_or_get(db, cstr_view(name), cstr_view(""));
         if (team_id < 0)
@@ -256,20 +270,16 @@ import_reframed_metadata_1_7(
     }
 
     /*
-     * Checks if a game with the same timestamp and same people exists.
-     * The reason for checking for person_id as well as timestamp is because
-     * it is possible for two games to have the same timestamp but with
-     * different players. By also checking if the game has the same players,
-     * we support importing games with identical timestamps.
+     * The fingerprint identifies a game by its frame data and players, so
+     * the same replay can't be imported twice, while different games that
+     * happen to share a timestamp still can.
      */
-    if (player_count == 2 && dbi->game.exists_1v1(db, people_ids[0], people_ids[1], time_started))
-    {
-        log_warn("Duplicate rfr, skipping...\n");
-        return -1;
-    }
-    if (player_count == 4 && dbi->game.exists_2v2(db, people_ids[0], people_ids[1], people_ids[2], people_ids[3], time_started))
+    struct str fingerprint;
+    str_init(&fingerprint);
+    if (reframed_game_fingerprint(&fingerprint,
+            fdata, person_ids, fighter_ids, player_count) != 0)
     {
-        log_warn("Duplicate rfr, skipping...\n");
+        str_deinit(&fingerprint);
         return -1;
     }
 
@@ -280,7 +290,11 @@ import_reframed_metadata_1_7(
         winner_team_id,
         stage_id,
         time_started,
-        (int)(time_ended - time_started));
+        (int)(time_ended - time_started),
+        fingerprint.len ? fingerprint.data : NULL);
+    if (game_id < 0 && fingerprint.len && dbi->game.exists_fingerprint(db, fingerprint.data) > 0)
+        log_warn("Duplicate rfr, skipping...\n");
+    str_deinit(&fingerprint);
     if (game_id < 0)
         return -1;
 
@@ -300,9 +314,8 @@ import_reframed_metadata_1_7(
         int fighter_id = json_object_get_int(json_object_object_get(player, "fighterid"));
         int costume = json_object_get_int(json_object_object_get(player, "costume"));
 
-        int person_id = dbi->person.get_id_from_name(db, cstr_view(name));
-        if (person_id < 0)
-            return -1;
+        /* Must be the player the fingerprint was made from */
+        int person_id = person_ids[i];
 
         int team_id = dbi->person.get_team_id_from_name(db, cstr_view(name));
         if (team_id < 0)
@@ -1,4 +1,5 @@
 #include "vh/db.h"
+#include "vh/frame_data.h"
 #include "vh/log.h"
 #include "vh/mfile.h"
 #include "vh/mstream.h"
@@ -7,7 +8,8 @@ int
 import_reframed_metadata(
         struct db_interface* dbi,
         struct db* db,
-        struct mstream* ms);
+        struct mstream* ms,
+        const struct frame_data* fdata);
 
 int
 import_reframed_videometadata(
@@ -17,7 +19,7 @@ import_reframed_videometadata(
         int game_id);
 
 int
-import_reframed_framedata(struct mstream* ms, int game_id);
+import_reframed_framedata(struct mstream* ms, struct frame_data* fdata);
 
 int
 import_reframed_replay(
@@ -34,11 +36,13 @@ import_reframed_replay(
 
     struct mfile mf;
     struct mstream ms;
+    struct frame_data fdata;
 
     uint8_t num_entries;
     int i;
     int entry_idx;
     int game_id;
+    int have_fdata;
 
     if (mfile_map_read(&mf, file_name) != 0)
     {
@@ -58,9 +62,11 @@ import_reframed_replay(
     /*
      * Blobs can be in any order within the RFR file. We have to import them
      * in a specific order for the db operations to work. This order is:
-     *   1) META (metadata)
-     *   2) VIDM (video metadata) depends on game_id from META
-     *   3) FDAT (frame data) depends on game_id from META
+     *   1) FDAT (frame data) is decoded first, because the fingerprint of
+     *      the game is made from it
+     *   2) META (metadata)
+     *   3) VIDM (video metadata) depends on game_id from META
+     *   4) FDAT is saved, which depends on game_id from META
      * The "MAPI" (mapping info) blob doesn't need to be loaded, because we
      * create the mapping info structures from a JSON file now.
      */
@@ -81,38 +87,56 @@ import_reframed_replay(
     }
 
     num_entries = (uint8_t)entry_idx;
-    game_id = -1;
+    frame_data_init(&fdata);
+    have_fdata = 0;
     for (i = 0; i != num_entries; ++i)
-        if (memcmp(entries[i].type, "META", 4) == 0)
+        if (memcmp(entries[i].type, "FDAT", 4) == 0)
         {
             struct mstream blob = mstream_from_mstream(&ms, entries[i].offset, entries[i].size);
-            game_id = import_reframed_metadata(dbi, db, &blob);
-            if (game_id < 0)
+            if (import_reframed_framedata(&blob, &fdata) < 0)
                 goto fail;
+            have_fdata = 1;
             break;
         }
+
+    game_id = -1;
     for (i = 0; i != num_entries; ++i)
-        if (memcmp(entries[i].type, "VIDM", 4) == 0)
+        if (memcmp(entries[i].type, "META", 4) == 0)
         {
             struct mstream blob = mstream_from_mstream(&ms, entries[i].offset, entries[i].size);
-            if (import_reframed_videometadata(dbi, db, &blob, game_id) < 0)
+            game_id = import_reframed_metadata(dbi, db, &blob, have_fdata ? &fdata : NULL);
+            if (game_id < 0)
                 goto fail;
             break;
         }
-
     for (i = 0; i != num_entries; ++i)
-        if (memcmp(entries[i].type, "FDAT", 4) == 0)
+        if (memcmp(entries[i].type, "VIDM", 4) == 0)
         {
             struct mstream blob = mstream_from_mstream(&ms, entries[i].offset, entries[i].size);
-            if (import_reframed_framedata(&blob, game_id) < 0)
+            if (import_reframed_videometadata(dbi, db, &blob, game_id) < 0)
                 goto fail;
             break;
         }
 
+    if (have_fdata)
+    {
+        if (frame_data_save(&fdata, game_id) != 0)
+            goto fail;
+
+        /*
+         * Running the tag queries needs the search plugin and would slow
+         * down importing, so the game is only queued. The search plugin
+         * tags queued games in the background.
+         */
+        if (dbi->game_tag.queue(db, game_id) < 0)
+            goto fail;
+    }
+
+    frame_data_deinit(&fdata);
     mfile_unmap(&mf);
     return 0;
 
-    fail                     :
+    fail                     : frame_data_deinit(&fdata);
     invalid_header           : mfile_unmap(&mf);
     mmap_failed              : return -1;
 }
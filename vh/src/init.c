@@ -3,6 +3,7 @@
 #include "vh/db.h"
 #include "vh/fs.h"
 #include "vh/mem.h"
+#include "vh/motion_dict.h"
 #include "vh/init.h"
 
 /* ------------------------------------------------------------------------- */
@@ -15,11 +16,14 @@ vh_init(void)
         goto fs_init_failed;
     if (db_init() < 0)
         goto db_init_failed;
+    if (motion_dict_init() < 0)
+        goto motion_dict_init_failed;
 
     crc32_init();
 
     return 0;
 
+    motion_dict_init_failed : db_deinit();
     db_init_failed          : fs_deinit();
     fs_init_failed          : backtrace_deinit();
     backtrace_init_failed   : return -1;
@@ -29,6 +33,7 @@ vh_init(void)
 void
 vh_deinit(void)
 {
+    motion_dict_deinit();
     db_deinit();
     fs_deinit();
     backtrace_deinit();
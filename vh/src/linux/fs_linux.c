@@ -185,6 +185,17 @@ fs_dir_exists(const char* file_path)
     return S_ISDIR(st.st_mode);
 }
 
+int
+fs_file_stamp(const char* file_path, uint64_t* stamp)
+{
+    struct stat st;
+    if (stat(file_path, &st))
+        return -1;
+    *stamp = ((uint64_t)st.st_mtim.tv_sec * 1000000000 + (uint64_t)st.st_mtim.tv_nsec) ^
+             ((uint64_t)st.st_size * 0x9E3779B97F4A7C15);
+    return 0;
+}
+
 struct str_view
 fs_appdata_dir(void)
 {
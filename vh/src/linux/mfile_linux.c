@@ -23,7 +23,8 @@ int mfile_map_read(struct mfile* mf, const char* file_name)
     /*if (stbuf.st_size >= (1UL<<32))
         goto file_too_large;*/
 
-    mf->address = mmap(NULL, (size_t)stbuf.st_size, PROT_READ, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    /* Writable, but private, so writes are copied and never reach the file */
+    mf->address = mmap(NULL, (size_t)stbuf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
     if (mf->address == MAP_FAILED)
         goto mmap_failed;
 
@@ -32,9 +32,13 @@ thread_join(struct thread t, int timeout_ms)
     struct timespec ts;
     struct timespec off;
 
+    /* Same as on Windows, a timeout of 0 waits forever */
+    if (timeout_ms == 0)
+        return pthread_join((pthread_t)t.handle, &ret) == 0 ? 0 : -1;
+
     clock_gettime(CLOCK_REALTIME, &ts);
     off.tv_sec = timeout_ms / 1000;
-    off.tv_nsec = (timeout_ms - ts.tv_sec * 1000) * 1000000;
+    off.tv_nsec = (timeout_ms - off.tv_sec * 1000) * 1000000;
     ts.tv_nsec += off.tv_nsec;
     while (ts.tv_nsec >= 1000000000)
     {
@@ -99,3 +103,35 @@ mutex_unlock(struct mutex m)
 {
     pthread_mutex_unlock(m.handle);
 }
+
+void
+cond_init(struct cond* c)
+{
+    c->handle = mem_alloc(sizeof(pthread_cond_t));
+    pthread_cond_init(c->handle, NULL);
+}
+
+void
+cond_deinit(struct cond c)
+{
+    pthread_cond_destroy(c.handle);
+    mem_free(c.handle);
+}
+
+void
+cond_wait(struct cond c, struct mutex m)
+{
+    pthread_cond_wait(c.handle, m.handle);
+}
+
+void
+cond_signal(struct cond c)
+{
+    pthread_cond_signal(c.handle);
+}
+
+void
+cond_broadcast(struct cond c)
+{
+    pthread_cond_broadcast(c.handle);
+}
@@ -0,0 +1,11 @@
+#include "vh/time.h"
+
+#include <time.h>
+
+uint64_t
+time_get_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
@@ -3,6 +3,7 @@
 #include "vh/hash.h"
 #include "vh/log.h"
 #include "vh/mem.h"
+#include "vh/thread.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -12,14 +13,22 @@
 
 #define BACKTRACE_OMIT_COUNT 2
 
+/*
+ * Memory is often allocated on one thread and freed on another, e.g. when a
+ * worker thread hands its results to the main thread. All threads therefore
+ * share one report, which is protected by a mutex. The report is printed when
+ * the last thread de-initializes.
+ */
 struct state
 {
+    struct mutex mutex;
     struct hm report;
     mem_size allocations;
     mem_size deallocations;
     mem_size bytes_in_use;
     mem_size bytes_in_use_peak;
-    unsigned ignore_malloc : 1;
+    int threads;  /* Protected by mutex */
+    unsigned initialized : 1;  /* Only changed by the first thread */
 };
 
 struct report_info
@@ -32,23 +41,36 @@ struct report_info
 #   endif
 };
 
-static VH_THREADLOCAL struct state state;
+static struct state state;
+
+/*
+ * Set while the report is being modified. The hashmap, the mutex and
+ * backtraces allocate memory themselves, which must not be tracked.
+ */
+static VH_THREADLOCAL int ignore_malloc;
 
 /* ------------------------------------------------------------------------- */
 static int report_info_cmp(const void* a, const void* b, int size) { return memcmp(a, b, (size_t)size); }
 int
 mem_threadlocal_init(void)
 {
-    state.allocations = 0;
-    state.deallocations = 0;
-    state.bytes_in_use = 0;
-    state.bytes_in_use_peak = 0;
+    /*
+     * The first thread is initialized before any other threads are started,
+     * and is the last one to be de-initialized, so it doesn't need to lock.
+     */
+    if (state.initialized)
+    {
+        mutex_lock(state.mutex);
+            state.threads++;
+        mutex_unlock(state.mutex);
+        return 0;
+    }
 
     /*
      * Hashmap will call mem_alloc during init, need to ignore this to avoid
      * crashing.
      */
-    state.ignore_malloc = 1;
+    ignore_malloc = 1;
         if (hm_init_with_options(
             &state.report,
             sizeof(uintptr_t),
@@ -57,9 +79,18 @@ mem_threadlocal_init(void)
             hash32_ptr,
             report_info_cmp) != 0)
         {
+            ignore_malloc = 0;
             return -1;
         }
-    state.ignore_malloc = 0;
+        mutex_init(&state.mutex);
+    ignore_malloc = 0;
+
+    state.allocations = 0;
+    state.deallocations = 0;
+    state.bytes_in_use = 0;
+    state.bytes_in_use_peak = 0;
+    state.threads = 1;
+    state.initialized = 1;
 
     return 0;
 }
@@ -72,7 +103,7 @@ print_backtrace(void)
     char** bt;
     int bt_size, i;
 
-    if (state.ignore_malloc)
+    if (ignore_malloc)
         return;
 
     if (!(bt = backtrace_get(&bt_size)))
@@ -98,7 +129,6 @@ static void
 track_allocation(uintptr_t addr, mem_size size)
 {
     struct report_info* info;
-    ++state.allocations;
 
     if (size == 0)
     {
@@ -108,9 +138,12 @@ track_allocation(uintptr_t addr, mem_size size)
 #endif
     }
 
-    if (state.ignore_malloc)
+    if (ignore_malloc)
         return;
 
+    mutex_lock(state.mutex);
+    ++state.allocations;
+
     /*
      * Record allocation info. Call to hashmap and backtrace_get() may allocate
      * memory, so set flag to ignore the call to malloc() when inserting.
@@ -119,7 +152,7 @@ track_allocation(uintptr_t addr, mem_size size)
     if (state.bytes_in_use_peak < state.bytes_in_use)
         state.bytes_in_use_peak = state.bytes_in_use;
 
-    state.ignore_malloc = 1;
+    ignore_malloc = 1;
         /* insert info into hashmap */
         switch (hm_insert(&state.report, &addr, (void**)&info))
         {
@@ -140,16 +173,14 @@ track_allocation(uintptr_t addr, mem_size size)
         if (!(info->backtrace = backtrace_get(&info->backtrace_size)))
             log_mem_warn("Failed to generate backtrace\n");
 #endif
-    state.ignore_malloc = 0;
-
-    return;
+    ignore_malloc = 0;
+    mutex_unlock(state.mutex);
 }
 
 static void
 track_deallocation(uintptr_t addr, const char* free_type)
 {
     struct report_info* info;
-    state.deallocations++;
 
     if (addr == 0)
     {
@@ -159,9 +190,12 @@ track_deallocation(uintptr_t addr, const char* free_type)
 #endif
     }
 
-    if (state.ignore_malloc)
+    if (ignore_malloc)
         return;
 
+    mutex_lock(state.mutex);
+    state.deallocations++;
+
     /* find matching allocation and remove from hashmap */
     info = hm_erase(&state.report, &addr);
     if (info)
@@ -181,6 +215,7 @@ track_deallocation(uintptr_t addr, const char* free_type)
         print_backtrace();
 #endif
     }
+    mutex_unlock(state.mutex);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -237,8 +272,15 @@ mem_size
 mem_threadlocal_deinit(void)
 {
     uintptr_t leaks;
+    int threads;
+
+    mutex_lock(state.mutex);
+        threads = --state.threads;
+    mutex_unlock(state.mutex);
 
-    --state.allocations; /* this is the single allocation still held by the report hashmap */
+    /* Memory of this thread may still be freed by the remaining threads */
+    if (threads > 0)
+        return 0;
 
     log_mem_note("Memory report:\n");
 
@@ -270,10 +312,11 @@ mem_threadlocal_deinit(void)
     log_mem_note("  memory leaks  : %" PRIu64 "\n", leaks);
     log_mem_note("  peak memory   : %" PRIu32 " bytes\n", state.bytes_in_use_peak);
 
-    ++state.allocations; /* this is the single allocation still held by the report hashmap */
-    state.ignore_malloc = 1;
+    ignore_malloc = 1;
+        mutex_deinit(state.mutex);
         hm_deinit(&state.report);
-    state.ignore_malloc = 0;
+    ignore_malloc = 0;
+    state.initialized = 0;
 
     return (mem_size)leaks;
 }
@@ -0,0 +1,417 @@
+#include "vh/db.h"
+#include "vh/hash40.h"
+#include "vh/log.h"
+#include "vh/mem.h"
+#include "vh/motion_dict.h"
+#include "vh/mph.h"
+#include "vh/thread.h"
+#include "vh/vec.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * All tables store the key in the first member, followed by offsets into
+ * "chars" where the strings are stored null-terminated.
+ */
+struct motion_entry
+{
+    uint64_t key;
+    int string;
+};
+
+struct label_group
+{
+    uint64_t key;
+    int label;
+    int first;  /* Index into "group_motions" */
+    int count;
+};
+
+struct group_row
+{
+    uint64_t key;
+    uint64_t motion;
+    int label;
+};
+
+struct motion_dict
+{
+    struct mph motion_hash;
+    struct mph label_hash;
+    struct mph group_hash;
+    struct vec motions;        /* struct motion_entry, hash40 -> string */
+    struct vec labels;         /* struct motion_entry, (fighter, hash40, usage) -> label */
+    struct vec groups;         /* struct label_group, (fighter, label) -> motions */
+    struct vec group_motions;  /* uint64_t */
+    struct vec chars;
+    uint64_t db_id;
+    uint64_t db_revision;
+    uint64_t revision;
+    int refs;
+};
+
+struct load_ctx
+{
+    struct motion_dict* dict;
+    struct vec group_rows;     /* struct group_row */
+};
+
+static struct mutex g_mutex;
+static struct motion_dict* g_current;
+static uint64_t g_revision;
+
+/*
+ * Composite keys are packed into 64 bits. hash40 values are 40 bits wide
+ * (string length and CRC32), which leaves room for a fighter and a usage ID.
+ */
+static int
+pack_key(uint64_t hash40, int fighter_id, int usage_id, uint64_t* key)
+{
+    if ((hash40 >> 40) || fighter_id < 0 || fighter_id > 0xFFFF || usage_id < 0 || usage_id > 0xFF)
+        return -1;
+    *key = ((uint64_t)usage_id << 56) | ((uint64_t)fighter_id << 40) | hash40;
+    return 0;
+}
+
+static int
+add_string(struct vec* chars, const char* str)
+{
+    vec_size offset = vec_count(chars);
+    vec_size len = (vec_size)strlen(str) + 1;
+    if (chars->capacity < offset + len)
+        if (vec_reserve(chars, offset + len > chars->capacity * 2 ? offset + len : chars->capacity * 2) < 0)
+            return -1;
+    if (vec_resize(chars, offset + len) < 0)
+        return -1;
+    memcpy(vec_get(chars, (vec_idx)offset), str, len);
+    return (int)offset;
+}
+
+static const char*
+get_string(const struct motion_dict* dict, int offset)
+{
+    return (const char*)vec_get(&dict->chars, offset);
+}
+
+/*
+ * Builds the perfect hash over the keys of the table, then moves every entry
+ * into the slot of its key.
+ */
+static int
+build_table(struct mph* mph, struct vec* table)
+{
+    struct vec keys, placed;
+    vec_size i;
+
+    vec_init(&keys, sizeof(uint64_t));
+    vec_init(&placed, table->element_size);
+    if (vec_resize(&keys, vec_count(table)) < 0 ||
+        vec_resize(&placed, vec_count(table)) < 0)
+        goto fail;
+    for (i = 0; i != vec_count(table); ++i)
+        *(uint64_t*)vec_get(&keys, (vec_idx)i) = *(uint64_t*)vec_get(table, (vec_idx)i);
+    if (mph_build(mph, vec_data(&keys), (int)vec_count(&keys)) < 0)
+        goto fail;
+    for (i = 0; i != vec_count(table); ++i)
+    {
+        uint64_t key = *(uint64_t*)vec_get(table, (vec_idx)i);
+        memcpy(vec_get(&placed, mph_slot(mph, key)), vec_get(table, (vec_idx)i), table->element_size);
+    }
+
+    vec_steal_vector(table, &placed);
+    vec_deinit(&keys);
+    return 0;
+
+fail:
+    vec_deinit(&placed);
+    vec_deinit(&keys);
+    return -1;
+}
+
+static const void*
+find(const struct mph* mph, const struct vec* table, uint64_t key)
+{
+    int slot = mph_slot(mph, key);
+    const void* entry;
+    if (slot < 0)
+        return NULL;
+    entry = vec_get(table, slot);
+    return *(const uint64_t*)entry == key ? entry : NULL;
+}
+
+static int
+on_motion(uint64_t hash40, const char* string, void* user_data)
+{
+    struct load_ctx* ctx = user_data;
+    struct motion_entry* entry = vec_emplace(&ctx->dict->motions);
+    if (entry == NULL)
+        return -1;
+    entry->key = hash40;
+    if ((entry->string = add_string(&ctx->dict->chars, string)) < 0)
+        return -1;
+    return 0;
+}
+
+static int
+on_label(int fighter_id, uint64_t hash40, int usage_id, const char* label, void* user_data)
+{
+    struct load_ctx* ctx = user_data;
+    struct motion_entry* entry;
+    struct group_row* row;
+    uint64_t key;
+    int offset;
+
+    if (pack_key(hash40, fighter_id, usage_id, &key) < 0)
+    {
+        log_warn("Ignoring label \"%s\" of motion 0x%" PRIx64 ", fighter %d\n", label, hash40, fighter_id);
+        return 0;
+    }
+
+    if ((offset = add_string(&ctx->dict->chars, label)) < 0)
+        return -1;
+
+    /* Rows are ordered by priority, so only the first label of a motion is kept */
+    entry = vec_count(&ctx->dict->labels) ? vec_back(&ctx->dict->labels) : NULL;
+    if (entry == NULL || entry->key != key)
+    {
+        if ((entry = vec_emplace(&ctx->dict->labels)) == NULL)
+            return -1;
+        entry->key = key;
+        entry->string = offset;
+    }
+
+    if (pack_key(hash40_cstr(label), fighter_id, 0, &key) < 0)
+        return 0;  /* Too long to be typed in anyway */
+    if ((row = vec_emplace(&ctx->group_rows)) == NULL)
+        return -1;
+    row->key = key;
+    row->motion = hash40;
+    row->label = offset;
+    return 0;
+}
+
+static int
+on_revision(uint64_t id, uint64_t revision, void* user_data)
+{
+    uint64_t* out = user_data;
+    out[0] = id;
+    out[1] = revision;
+    return 0;
+}
+
+static int
+group_row_cmp(const void* a, const void* b)
+{
+    const struct group_row* r1 = a;
+    const struct group_row* r2 = b;
+    if (r1->key != r2->key)
+        return r1->key < r2->key ? -1 : 1;
+    return r1->motion < r2->motion ? -1 : r1->motion > r2->motion;
+}
+
+/*
+ * A label usually stands for several motions, e.g. "nair" can be
+ * "attack_air_n" and "landing_air_n". Rows are grouped by label, and each
+ * group refers to a range of motions.
+ */
+static int
+build_groups(struct motion_dict* dict, struct vec* rows)
+{
+    struct label_group* group = NULL;
+    const struct group_row* prev = NULL;
+
+    if (vec_count(rows) > 0)
+        qsort(vec_data(rows), vec_count(rows), sizeof(struct group_row), group_row_cmp);
+
+    VEC_FOR_EACH(rows, const struct group_row, row)
+        if (group == NULL || group->key != row->key)
+        {
+            if ((group = vec_emplace(&dict->groups)) == NULL)
+                return -1;
+            group->key = row->key;
+            group->label = row->label;
+            group->first = (int)vec_count(&dict->group_motions);
+            group->count = 0;
+            prev = NULL;
+        }
+        /* Another label that happens to have the same hash40 is dropped */
+        else if (strcmp(get_string(dict, group->label), get_string(dict, row->label)) != 0)
+            continue;
+
+        /* The same motion can have the label in more than one usage or layer */
+        if (prev && prev->motion == row->motion)
+            continue;
+        if (vec_push(&dict->group_motions, &row->motion) < 0)
+            return -1;
+        group->count++;
+        prev = row;
+    VEC_END_EACH
+
+    return 0;
+}
+
+static void
+dict_free(struct motion_dict* dict)
+{
+    vec_deinit(&dict->chars);
+    vec_deinit(&dict->group_motions);
+    vec_deinit(&dict->groups);
+    vec_deinit(&dict->labels);
+    vec_deinit(&dict->motions);
+    mph_deinit(&dict->group_hash);
+    mph_deinit(&dict->label_hash);
+    mph_deinit(&dict->motion_hash);
+    mem_free(dict);
+}
+
+static struct motion_dict*
+dict_load(struct db_interface* dbi, struct db* db, const uint64_t* db_revision)
+{
+    struct load_ctx ctx;
+    struct motion_dict* dict = mem_alloc(sizeof *dict);
+    if (dict == NULL)
+        goto alloc_failed;
+
+    mph_init(&dict->motion_hash);
+    mph_init(&dict->label_hash);
+    mph_init(&dict->group_hash);
+    vec_init(&dict->motions, sizeof(struct motion_entry));
+    vec_init(&dict->labels, sizeof(struct motion_entry));
+    vec_init(&dict->groups, sizeof(struct label_group));
+    vec_init(&dict->group_motions, sizeof(uint64_t));
+    vec_init(&dict->chars, sizeof(char));
+    dict->db_id = db_revision[0];
+    dict->db_revision = db_revision[1];
+    dict->refs = 1;
+
+    ctx.dict = dict;
+    vec_init(&ctx.group_rows, sizeof(struct group_row));
+
+    if (dbi->motion.get_all(db, on_motion, &ctx) < 0)
+        goto fail;
+    if (dbi->motion_label.get_all(db, on_label, &ctx) < 0)
+        goto fail;
+    if (build_groups(dict, &ctx.group_rows) < 0)
+        goto fail;
+    if (build_table(&dict->motion_hash, &dict->motions) < 0 ||
+        build_table(&dict->label_hash, &dict->labels) < 0 ||
+        build_table(&dict->group_hash, &dict->groups) < 0)
+        goto fail;
+
+    vec_deinit(&ctx.group_rows);
+    log_dbg("Loaded %d motions and %d labels\n",
+        (int)vec_count(&dict->motions), (int)vec_count(&dict->labels));
+    return dict;
+
+fail:
+    vec_deinit(&ctx.group_rows);
+    dict_free(dict);
+alloc_failed:
+    log_err("Failed to load motion dictionary\n");
+    return NULL;
+}
+
+int
+motion_dict_init(void)
+{
+    mutex_init(&g_mutex);
+    g_current = NULL;
+    return 0;
+}
+
+void
+motion_dict_deinit(void)
+{
+    if (g_current)
+        motion_dict_release(g_current);
+    g_current = NULL;
+    mutex_deinit(g_mutex);
+}
+
+struct motion_dict*
+motion_dict_acquire(struct db_interface* dbi, struct db* db)
+{
+    struct motion_dict* dict;
+    uint64_t db_revision[2] = { 0, 0 };
+
+    if (dbi->motion.revision(db, on_revision, db_revision) < 0)
+        return NULL;
+
+    mutex_lock(g_mutex);
+        if (g_current == NULL ||
+            g_current->db_id != db_revision[0] ||
+            g_current->db_revision != db_revision[1])
+        {
+            /* Loading is rare, so it's fine to hold the lock */
+            if ((dict = dict_load(dbi, db, db_revision)) == NULL)
+            {
+                mutex_unlock(g_mutex);
+                return NULL;
+            }
+            dict->revision = ++g_revision;
+            if (g_current && --g_current->refs == 0)
+                dict_free(g_current);
+            g_current = dict;
+        }
+        dict = g_current;
+        dict->refs++;
+    mutex_unlock(g_mutex);
+
+    return dict;
+}
+
+void
+motion_dict_release(struct motion_dict* dict)
+{
+    int refs;
+    mutex_lock(g_mutex);
+        refs = --dict->refs;
+    mutex_unlock(g_mutex);
+    if (refs == 0)
+        dict_free(dict);
+}
+
+uint64_t
+motion_dict_revision(const struct motion_dict* dict)
+{
+    return dict->revision;
+}
+
+const char*
+motion_dict_string(const struct motion_dict* dict, uint64_t hash40)
+{
+    const struct motion_entry* entry = find(&dict->motion_hash, &dict->motions, hash40);
+    return entry ? get_string(dict, entry->string) : NULL;
+}
+
+const char*
+motion_dict_label(const struct motion_dict* dict, int fighter_id, uint64_t hash40, int usage_id)
+{
+    const struct motion_entry* entry;
+    uint64_t key;
+    if (pack_key(hash40, fighter_id, usage_id, &key) < 0)
+        return NULL;
+    entry = find(&dict->label_hash, &dict->labels, key);
+    return entry ? get_string(dict, entry->string) : NULL;
+}
+
+int
+motion_dict_label_motions(const struct motion_dict* dict, int fighter_id, struct str_view label, const uint64_t** motions)
+{
+    const struct label_group* group;
+    const char* str;
+    uint64_t key;
+
+    if (pack_key(hash40_str(label), fighter_id, 0, &key) < 0)
+        return 0;
+    group = find(&dict->group_hash, &dict->groups, key);
+    if (group == NULL)
+        return 0;
+    str = get_string(dict, group->label);
+    if ((int)strlen(str) != label.len || memcmp(str, label.data, (size_t)label.len) != 0)
+        return 0;
+
+    *motions = vec_get(&dict->group_motions, group->first);
+    return group->count;
+}
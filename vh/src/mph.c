@@ -0,0 +1,156 @@
+#include "vh/log.h"
+#include "vh/mem.h"
+#include "vh/mph.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Average number of keys per bucket */
+#define KEYS_PER_BUCKET 4
+
+struct bucket
+{
+    uint32_t idx;
+    uint32_t first;  /* Index into "order" */
+    uint32_t count;
+};
+
+static int
+bucket_cmp(const void* a, const void* b)
+{
+    const struct bucket* b1 = a;
+    const struct bucket* b2 = b;
+    if (b1->count != b2->count)
+        return b1->count < b2->count ? 1 : -1;
+    return b1->idx < b2->idx ? -1 : b1->idx > b2->idx;
+}
+
+void
+mph_deinit(struct mph* mph)
+{
+    if (mph->displacements)
+        mem_free(mph->displacements);
+    mph_init(mph);
+}
+
+/*
+ * Keys are distributed into buckets, and the buckets are placed largest
+ * first. For each bucket, displacements are tried until all of its keys land
+ * in slots that are still free. The large buckets are placed while most slots
+ * are free, and the single keys at the end only need one free slot each.
+ */
+int
+mph_build(struct mph* mph, const uint64_t* keys, int count)
+{
+    struct bucket* buckets;
+    uint64_t* hashes;
+    uint32_t* order;     /* Key indices grouped by bucket */
+    uint32_t* placed;    /* Slots taken by the bucket being placed */
+    uint8_t* taken;
+    uint32_t bucket_count, b, i;
+    uint32_t n = (uint32_t)count;
+
+    mph_deinit(mph);
+    if (count <= 0)
+        return 0;
+
+    bucket_count = (n + KEYS_PER_BUCKET - 1) / KEYS_PER_BUCKET;
+    mph->displacements = mem_alloc(sizeof(uint32_t) * bucket_count);
+    buckets = mem_alloc(sizeof(struct bucket) * bucket_count);
+    hashes = mem_alloc(sizeof(uint64_t) * n);
+    order = mem_alloc(sizeof(uint32_t) * n);
+    placed = mem_alloc(sizeof(uint32_t) * n);
+    taken = mem_alloc(n);
+    if (!mph->displacements || !buckets || !hashes || !order || !placed || !taken)
+    {
+        log_err("Failed to allocate memory for perfect hash of %d keys\n", count);
+        goto fail;
+    }
+
+    memset(taken, 0, n);
+    for (b = 0; b != bucket_count; ++b)
+    {
+        buckets[b].idx = b;
+        buckets[b].first = 0;
+        buckets[b].count = 0;
+        mph->displacements[b] = 0;
+    }
+    for (i = 0; i != n; ++i)
+    {
+        hashes[i] = mph_mix(keys[i]);
+        buckets[(uint32_t)(hashes[i] >> 32) % bucket_count].count++;
+    }
+    for (b = 1; b != bucket_count; ++b)
+        buckets[b].first = buckets[b-1].first + buckets[b-1].count;
+    for (b = 0; b != bucket_count; ++b)
+        buckets[b].count = 0;
+    for (i = 0; i != n; ++i)
+    {
+        struct bucket* bucket = &buckets[(uint32_t)(hashes[i] >> 32) % bucket_count];
+        order[bucket->first + bucket->count++] = i;
+    }
+
+    qsort(buckets, bucket_count, sizeof(struct bucket), bucket_cmp);
+
+    for (b = 0; b != bucket_count && buckets[b].count > 0; ++b)
+    {
+        const struct bucket* bucket = &buckets[b];
+        uint32_t d, k;
+
+        /* Keys with the same hash collide with every displacement */
+        for (k = 0; k != bucket->count; ++k)
+            for (i = k + 1; i != bucket->count; ++i)
+                if (hashes[order[bucket->first + k]] == hashes[order[bucket->first + i]])
+                {
+                    log_err("Failed to build perfect hash: Key 0x%" PRIx64 " is not unique\n",
+                        keys[order[bucket->first + k]]);
+                    goto fail;
+                }
+
+        for (d = 0; ; ++d)
+        {
+            /* There is always a free slot, so this only happens on bad luck */
+            if (d == UINT32_MAX)
+            {
+                log_err("Failed to build perfect hash of %d keys\n", count);
+                goto fail;
+            }
+
+            for (k = 0; k != bucket->count; ++k)
+            {
+                uint32_t slot = (uint32_t)(mph_mix(hashes[order[bucket->first + k]] + d) % n);
+                if (taken[slot])
+                    break;
+                taken[slot] = 1;
+                placed[k] = slot;
+            }
+            if (k == bucket->count)
+                break;
+
+            /* Undo the keys of this bucket that already found a slot */
+            while (k--)
+                taken[placed[k]] = 0;
+        }
+
+        mph->displacements[bucket->idx] = d;
+    }
+
+    mph->bucket_count = bucket_count;
+    mph->slot_count = n;
+
+    mem_free(taken);
+    mem_free(placed);
+    mem_free(order);
+    mem_free(hashes);
+    mem_free(buckets);
+    return 0;
+
+fail:
+    if (taken) mem_free(taken);
+    if (placed) mem_free(placed);
+    if (order) mem_free(order);
+    if (hashes) mem_free(hashes);
+    if (buckets) mem_free(buckets);
+    mph_deinit(mph);
+    return -1;
+}
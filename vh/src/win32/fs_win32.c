@@ -205,6 +205,17 @@ fs_path_exists(const char* file_path)
     return !!(attr & FILE_ATTRIBUTE_DIRECTORY);
 }
 
+int
+fs_file_stamp(const char* file_path, uint64_t* stamp)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesEx(file_path, GetFileExInfoStandard, &data))
+        return -1;
+    *stamp = (((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime) ^
+             ((((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow) * 0x9E3779B97F4A7C15);
+    return 0;
+}
+
 struct str_view
 fs_appdata_dir(void)
 {
@@ -92,3 +92,35 @@ mutex_unlock(struct mutex m)
 {
     LeaveCriticalSection(m.handle);
 }
+
+void
+cond_init(struct cond* c)
+{
+    c->handle = mem_alloc(sizeof(CONDITION_VARIABLE));
+    InitializeConditionVariable(c->handle);
+}
+
+void
+cond_deinit(struct cond c)
+{
+    /* Condition variables don't need to be deleted on Windows */
+    mem_free(c.handle);
+}
+
+void
+cond_wait(struct cond c, struct mutex m)
+{
+    SleepConditionVariableCS(c.handle, m.handle, INFINITE);
+}
+
+void
+cond_signal(struct cond c)
+{
+    WakeConditionVariable(c.handle);
+}
+
+void
+cond_broadcast(struct cond c)
+{
+    WakeAllConditionVariable(c.handle);
+}
@@ -1,5 +1,13 @@
 #include "gmock/gmock.h"
 #include "vh/db.h"
+#include "vh/frame_data.h"
+#include "vh/fs.h"
+#include "vh/hash40.h"
+#include "vh/motion_dict.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <vector>
 
 #define NAME vh_db
 
@@ -32,36 +40,267 @@ TEST_F(NAME, motions)
     EXPECT_THAT(dbi->motion.exists(db, 0x1236), IsFalse());
 }
 
+TEST_F(NAME, nested_transactions)
+{
+    ASSERT_THAT(dbi->transaction.begin_nested(db, cstr_view("outer")), Eq(0));
+    EXPECT_THAT(dbi->motion.add(db, 0x1234, cstr_view("test")), Eq(0));
+    ASSERT_THAT(dbi->transaction.begin_nested(db, cstr_view("inner \"quoted\"")), Eq(0));
+    EXPECT_THAT(dbi->motion.add(db, 0x1235, cstr_view("foo")), Eq(0));
+    ASSERT_THAT(dbi->transaction.rollback_nested(db, cstr_view("inner \"quoted\"")), Eq(0));
+    ASSERT_THAT(dbi->transaction.commit_nested(db, cstr_view("inner \"quoted\"")), Eq(0));
+    ASSERT_THAT(dbi->transaction.commit_nested(db, cstr_view("outer")), Eq(0));
+
+    EXPECT_THAT(dbi->motion.exists(db, 0x1234), IsTrue());
+    EXPECT_THAT(dbi->motion.exists(db, 0x1235), IsFalse());
+}
+
 TEST_F(NAME, duplicate_games_1v1)
 {
     int round_type_id = dbi->round.add_or_get_type(db, cstr_view("WR"), cstr_view("Winner's Round"));
-
     int set_format_id = dbi->set_format.add_or_get(db, cstr_view("Bo3"), cstr_view("Best of 3"));
+    int team_id = dbi->team.add_or_get(db, cstr_view("p1"), cstr_view(""));
+    const char* fingerprint = "0011223344556677:1\x1f" "8\x1e" "2\x1f" "8";
+
+    EXPECT_THAT(dbi->game.exists_fingerprint(db, fingerprint), IsFalse());
+
+    int game_id = dbi->game.add(db, round_type_id, 1, set_format_id, team_id, 3, 1600000000, 100, fingerprint);
+    ASSERT_THAT(game_id, Gt(0));
+    EXPECT_THAT(dbi->game.exists_fingerprint(db, fingerprint), IsTrue());
+
+    /* Adding the same game again fails without a new row */
+    EXPECT_THAT(dbi->game.add(db, round_type_id, 1, set_format_id, team_id, 3, 1600000000, 100, fingerprint), Eq(-1));
+    EXPECT_THAT(dbi->game.count(db), Eq(1));
 
+    /* Games without a fingerprint are never duplicates */
+    EXPECT_THAT(dbi->game.add(db, round_type_id, 1, set_format_id, team_id, 3, 1600000000, 100, NULL), Gt(game_id));
+    EXPECT_THAT(dbi->game.add(db, round_type_id, 1, set_format_id, team_id, 3, 1600000000, 100, NULL), Gt(game_id));
+    EXPECT_THAT(dbi->game.count(db), Eq(3));
+}
+
+TEST_F(NAME, fingerprints_are_backfilled)
+{
+    int round_type_id = dbi->round.add_or_get_type(db, cstr_view("WR"), cstr_view("Winner's Round"));
+    int set_format_id = dbi->set_format.add_or_get(db, cstr_view("Bo3"), cstr_view("Best of 3"));
     int p1_id = dbi->person.add_or_get(db, -1, cstr_view("p1"), cstr_view("p1"), cstr_view(""), cstr_view(""));
     int p2_id = dbi->person.add_or_get(db, -1, cstr_view("p2"), cstr_view("p2"), cstr_view(""), cstr_view(""));
-
     int team1_id = dbi->team.add_or_get(db, cstr_view("p1"), cstr_view(""));
-    dbi->team.add_member(db, team1_id, p1_id);
     int team2_id = dbi->team.add_or_get(db, cstr_view("p2"), cstr_view(""));
-    dbi->team.add_member(db, team2_id, p2_id);
-    int winner_team_id = team1_id;
 
-    int round_number = 1;
-    int stage_id = 3;
-    uint64_t time_started = 1600000000;
-    int duration = 100;
+    struct frame_data fdata;
+    ASSERT_THAT(frame_data_alloc_structure(&fdata, 2, 3), Eq(0));
+    for (int fighter = 0; fighter != 2; ++fighter)
+        for (int frame = 0; frame != 3; ++frame)
+        {
+            fdata.timestamp[fighter][frame] = 1600000000000 + 16 * frame;
+            fdata.motion[fighter][frame] = 0x100 * fighter + frame;
+        }
+    uint64_t hash = frame_data_hash(&fdata);
+    fs_make_dir("fdata");
+
+    /* Two copies of the same game, imported before fingerprints existed, and
+     * one without frame data */
+    int game_ids[3];
+    for (int i = 0; i != 3; ++i)
+    {
+        game_ids[i] = dbi->game.add(db, round_type_id, 1, set_format_id, team1_id, 3, 1600000000, 100, NULL);
+        ASSERT_THAT(game_ids[i], Gt(0));
+        EXPECT_THAT(dbi->game.add_player(db, p2_id, game_ids[i], 0, team2_id, 20, 0, 0), Eq(0));
+        EXPECT_THAT(dbi->game.add_player(db, p1_id, game_ids[i], 1, team1_id, 8, 0, 0), Eq(0));
+    }
+    frame_data_delete(game_ids[2]);
+    ASSERT_THAT(frame_data_save(&fdata, game_ids[0]), Eq(0));
+    ASSERT_THAT(frame_data_save(&fdata, game_ids[1]), Eq(0));
+    frame_data_deinit(&fdata);
+
+    EXPECT_THAT(dbi->game.count(db), Eq(3));
+    ASSERT_THAT(dbi->migrate_to(db, 5), Eq(0));
+    EXPECT_THAT(dbi->game.count(db), Eq(3));
+    ASSERT_THAT(dbi->migrate_to(db, 6), Eq(0));
+    frame_data_delete(game_ids[0]);
+    frame_data_delete(game_ids[1]);
+
+    /* Entries are sorted, so this is the fingerprint the importer creates */
+    char fingerprint[128];
+    snprintf(fingerprint, sizeof(fingerprint), "%016" PRIx64 ":%d\x1f" "8\x1e%d\x1f" "20", hash, p1_id, p2_id);
+    ASSERT_THAT(p1_id, Lt(p2_id));
+    ASSERT_THAT(p2_id, Lt(10));
+    EXPECT_THAT(dbi->game.exists_fingerprint(db, fingerprint), IsTrue());
+    EXPECT_THAT(dbi->game.add(db, round_type_id, 1, set_format_id, team1_id, 3, 1600000000, 100, fingerprint), Eq(-1));
+    EXPECT_THAT(dbi->game.count(db), Eq(3));
+}
+
+static int on_search_result(int symbol_start, int symbol_end, int distance, void* user)
+{
+    static_cast<std::vector<int>*>(user)->push_back(symbol_start);
+    return 0;
+}
+
+TEST_F(NAME, search_results_are_invalidated)
+{
+    int round_type_id = dbi->round.add_or_get_type(db, cstr_view("WR"), cstr_view("Winner's Round"));
+    int set_format_id = dbi->set_format.add_or_get(db, cstr_view("Bo3"), cstr_view("Best of 3"));
+    int team_id = dbi->team.add_or_get(db, cstr_view("p1"), cstr_view(""));
+    int game_id = dbi->game.add(db, round_type_id, 1, set_format_id, team_id, 3, 1600000000, 100, NULL);
+    std::vector<int> starts;
+
+    int motions_set = dbi->search_result.add_set(db, 0x1234, game_id, 0, -1, 0, 0, 42, 1, 1);
+    int labels_set = dbi->search_result.add_set(db, 0x5678, game_id, 0, -1, 0, 1, 42, 1, 1);
+    int empty_set = dbi->search_result.add_set(db, 0x9abc, game_id, 0, -1, 0, 0, 42, 1, 1);
+    ASSERT_THAT(motions_set, Gt(0));
+    ASSERT_THAT(labels_set, Gt(0));
+    ASSERT_THAT(empty_set, Gt(0));
+    EXPECT_THAT(dbi->search_result.add(db, motions_set, 5, 7, 0), Eq(0));
+    EXPECT_THAT(dbi->search_result.add(db, motions_set, 1, 3, 0), Eq(0));
+    EXPECT_THAT(dbi->search_result.add(db, labels_set, 2, 4, 0), Eq(0));
+
+    EXPECT_THAT(dbi->search_result.get(db, 0x1234, game_id, 0, -1, 0, 42, 1, 1, on_search_result, &starts), Eq(0));
+    EXPECT_THAT(starts, ElementsAre(1, 5));
+
+    /* A set without matches is a single row of NULLs, a missing set has no rows */
+    starts.clear();
+    EXPECT_THAT(dbi->search_result.get(db, 0x9abc, game_id, 0, -1, 0, 42, 1, 1, on_search_result, &starts), Eq(0));
+    EXPECT_THAT(starts, ElementsAre(-1));
+    starts.clear();
+    EXPECT_THAT(dbi->search_result.get(db, 0x9abc, game_id, 1, -1, 0, 42, 1, 1, on_search_result, &starts), Eq(0));
+    EXPECT_THAT(starts, IsEmpty());
+
+    /* Different frame data or versions */
+    EXPECT_THAT(dbi->search_result.get(db, 0x1234, game_id, 0, -1, 0, 43, 1, 1, on_search_result, &starts), Eq(0));
+    EXPECT_THAT(dbi->search_result.get(db, 0x1234, game_id, 0, -1, 0, 42, 2, 1, on_search_result, &starts), Eq(0));
+    EXPECT_THAT(dbi->search_result.get(db, 0x1234, game_id, 0, -1, 0, 42, 1, 2, on_search_result, &starts), Eq(0));
+    EXPECT_THAT(starts, IsEmpty());
+
+    /* Changing motion labels only removes sets of queries that use labels */
+    EXPECT_THAT(dbi->fighter.add(db, 8, cstr_view("mario")), Eq(0));
+    EXPECT_THAT(dbi->motion.add(db, 0x1234, cstr_view("test")), Eq(0));
+    int group_id = dbi->motion_label.add_or_get_group(db, cstr_view("group"));
+    int layer_id = dbi->motion_label.add_or_get_layer(db, group_id, cstr_view("layer"));
+    int category_id = dbi->motion_label.add_or_get_category(db, cstr_view("category"));
+    int usage_id = dbi->motion_label.add_or_get_usage(db, cstr_view("usage"));
+    EXPECT_THAT(dbi->motion_label.add_or_get_label(db, 0x1234, 8, layer_id, category_id, usage_id, cstr_view("label")), Gt(0));
+
+    EXPECT_THAT(dbi->search_result.get(db, 0x5678, game_id, 0, -1, 0, 42, 1, 1, on_search_result, &starts), Eq(0));
+    EXPECT_THAT(starts, IsEmpty());
+    EXPECT_THAT(dbi->search_result.get(db, 0x1234, game_id, 0, -1, 0, 42, 1, 1, on_search_result, &starts), Eq(0));
+    EXPECT_THAT(starts, ElementsAre(1, 5));
+
+    /* Replacing a set also removes its matches */
+    EXPECT_THAT(dbi->search_result.delete_set(db, 0x1234, game_id, 0, -1, 0), Eq(0));
+    motions_set = dbi->search_result.add_set(db, 0x1234, game_id, 0, -1, 0, 0, 43, 1, 1);
+    ASSERT_THAT(motions_set, Gt(0));
+    starts.clear();
+    EXPECT_THAT(dbi->search_result.get(db, 0x1234, game_id, 0, -1, 0, 43, 1, 1, on_search_result, &starts), Eq(0));
+    EXPECT_THAT(starts, ElementsAre(-1));
+}
+
+TEST_F(NAME, motion_dict_reloads_when_labels_change)
+{
+    uint64_t nair = hash40_cstr("attack_air_n");
+    uint64_t landing = hash40_cstr("landing_air_n");
+    const uint64_t* motions;
+
+    EXPECT_THAT(dbi->fighter.add(db, 8, cstr_view("mario")), Eq(0));
+    EXPECT_THAT(dbi->motion.add(db, nair, cstr_view("attack_air_n")), Eq(0));
+    EXPECT_THAT(dbi->motion.add(db, landing, cstr_view("landing_air_n")), Eq(0));
+    int group_id = dbi->motion_label.add_or_get_group(db, cstr_view("group"));
+    int layer1_id = dbi->motion_label.add_or_get_layer(db, group_id, cstr_view("layer1"));
+    int layer2_id = dbi->motion_label.add_or_get_layer(db, group_id, cstr_view("layer2"));
+    int category_id = dbi->motion_label.add_or_get_category(db, cstr_view("category"));
+    EXPECT_THAT(dbi->motion_label.add_or_get_label(db, nair, 8, layer2_id, category_id, 1, cstr_view("nair (fallback)")), Gt(0));
+    EXPECT_THAT(dbi->motion_label.add_or_get_label(db, nair, 8, layer1_id, category_id, 1, cstr_view("nair")), Gt(0));
+    EXPECT_THAT(dbi->motion_label.add_or_get_label(db, landing, 8, layer1_id, category_id, 1, cstr_view("nair")), Gt(0));
+
+    struct motion_dict* dict = motion_dict_acquire(dbi, db);
+    ASSERT_THAT(dict, NotNull());
+    EXPECT_THAT(motion_dict_string(dict, nair), StrEq("attack_air_n"));
+    EXPECT_THAT(motion_dict_string(dict, 0x1234), IsNull());
+    EXPECT_THAT(motion_dict_label(dict, 8, nair, 1), StrEq("nair"));
+    EXPECT_THAT(motion_dict_label(dict, 8, nair, 2), IsNull());
+    EXPECT_THAT(motion_dict_label(dict, 9, nair, 1), IsNull());
+    ASSERT_THAT(motion_dict_label_motions(dict, 8, cstr_view("nair"), &motions), Eq(2));
+    EXPECT_THAT(std::vector<uint64_t>(motions, motions + 2), UnorderedElementsAre(nair, landing));
+    EXPECT_THAT(motion_dict_label_motions(dict, 8, cstr_view("fair"), &motions), Eq(0));
+
+    /* Nothing changed, so the same dictionary is returned */
+    struct motion_dict* same = motion_dict_acquire(dbi, db);
+    EXPECT_THAT(same, Eq(dict));
+    motion_dict_release(same);
+
+    EXPECT_THAT(dbi->motion_label.add_or_get_label(db, landing, 8, layer1_id, category_id, 2, cstr_view("landing")), Gt(0));
+    struct motion_dict* updated = motion_dict_acquire(dbi, db);
+    ASSERT_THAT(updated, NotNull());
+    EXPECT_THAT(motion_dict_revision(updated), Ne(motion_dict_revision(dict)));
+    EXPECT_THAT(motion_dict_label(updated, 8, landing, 2), StrEq("landing"));
+
+    /* The old dictionary stays valid until it is released */
+    EXPECT_THAT(motion_dict_label(dict, 8, landing, 2), IsNull());
+    motion_dict_release(dict);
+    motion_dict_release(updated);
+}
+
+static int on_queued(int game_id, int fighter_id, void* user)
+{
+    static_cast<std::vector<int>*>(user)->push_back(game_id);
+    return 0;
+}
+
+static int on_tagged_game(int game_id, void* user)
+{
+    static_cast<std::vector<int>*>(user)->push_back(game_id);
+    return 0;
+}
+
+TEST_F(NAME, tag_queries_queue_games)
+{
+    int round_type_id = dbi->round.add_or_get_type(db, cstr_view("WR"), cstr_view("Winner's Round"));
+    int set_format_id = dbi->set_format.add_or_get(db, cstr_view("Bo3"), cstr_view("Best of 3"));
+    int p1_id = dbi->person.add_or_get(db, -1, cstr_view("p1"), cstr_view("p1"), cstr_view(""), cstr_view(""));
+    int team_id = dbi->team.add_or_get(db, cstr_view("p1"), cstr_view(""));
+    int game1_id = dbi->game.add(db, round_type_id, 1, set_format_id, team_id, 3, 1600000000, 100, NULL);
+    int game2_id = dbi->game.add(db, round_type_id, 2, set_format_id, team_id, 3, 1600000100, 100, NULL);
+    dbi->game.add_player(db, p1_id, game1_id, 0, team_id, 8, 0, 0);
+    dbi->game.add_player(db, p1_id, game2_id, 0, team_id, 8, 0, 0);
+    std::vector<int> games;
+
+    /* Saved queries that aren't tags don't need to run on any game */
+    int query_id = dbi->saved_query.set(db, cstr_view("0-to-death"), cstr_view("nair"), 0, 0);
+    ASSERT_THAT(query_id, Gt(0));
+    EXPECT_THAT(dbi->game_tag.get_queued(db, 10, on_queued, &games), Eq(0));
+    EXPECT_THAT(games, IsEmpty());
 
-    EXPECT_THAT(dbi->game.exists_1v1(db, p1_id, p2_id, time_started), IsFalse());
+    /* Turning it into a tag queues every game */
+    EXPECT_THAT(dbi->saved_query.set(db, cstr_view("0-to-death"), cstr_view("nair"), 0, 1), Eq(query_id));
+    EXPECT_THAT(dbi->game_tag.get_queued(db, 10, on_queued, &games), Eq(0));
+    EXPECT_THAT(games, ElementsAre(game1_id, game2_id));
+    games.clear();
+    EXPECT_THAT(dbi->game_tag.get_queued(db, 1, on_queued, &games), Eq(0));
+    EXPECT_THAT(games, ElementsAre(game1_id));
 
-    int game_id = dbi->game.add(db, round_type_id, round_number, set_format_id, winner_team_id, stage_id, time_started, duration);
-    dbi->game.add_player(db, p1_id, game_id, 0, team1_id, 8, 0, 0);
-    dbi->game.add_player(db, p2_id, game_id, 0, team2_id, 8, 0, 0);
+    EXPECT_THAT(dbi->game_tag.set(db, game1_id, query_id, 3), Eq(0));
+    EXPECT_THAT(dbi->game_tag.dequeue(db, game1_id), Eq(0));
+    EXPECT_THAT(dbi->game_tag.set(db, game2_id, query_id, 1), Eq(0));
+    EXPECT_THAT(dbi->game_tag.dequeue(db, game2_id), Eq(0));
+    games.clear();
+    EXPECT_THAT(dbi->game_tag.find_games(db, cstr_view("0-to-death"), 2, on_tagged_game, &games), Eq(0));
+    EXPECT_THAT(games, ElementsAre(game1_id));
 
-    EXPECT_THAT(dbi->game.exists_1v1(db, p1_id, p2_id, time_started), IsTrue());
+    /* Saving the same query again changes nothing */
+    EXPECT_THAT(dbi->saved_query.set(db, cstr_view("0-to-death"), cstr_view("nair"), 0, 1), Eq(query_id));
+    games.clear();
+    EXPECT_THAT(dbi->game_tag.get_queued(db, 10, on_queued, &games), Eq(0));
+    EXPECT_THAT(games, IsEmpty());
 
-    /* The issue occurs when adding another player with the same name, but a different in-game tag */
-    p1_id = dbi->person.add_or_get(db, -1, cstr_view("p1"), cstr_view("another tag"), cstr_view(""), cstr_view(""));
+    /* Editing the query throws away its counts and queues every game again */
+    EXPECT_THAT(dbi->saved_query.set(db, cstr_view("0-to-death"), cstr_view("nair nair"), 0, 1), Eq(query_id));
+    EXPECT_THAT(dbi->game_tag.find_games(db, cstr_view("0-to-death"), 1, on_tagged_game, &games), Eq(0));
+    EXPECT_THAT(games, IsEmpty());
+    EXPECT_THAT(dbi->game_tag.get_queued(db, 10, on_queued, &games), Eq(0));
+    EXPECT_THAT(games, ElementsAre(game1_id, game2_id));
 
-    EXPECT_THAT(dbi->game.exists_1v1(db, p1_id, p2_id, time_started), IsTrue());
+    /* Removing the query removes its counts */
+    EXPECT_THAT(dbi->game_tag.set(db, game1_id, query_id, 3), Eq(0));
+    EXPECT_THAT(dbi->saved_query.remove(db, cstr_view("0-to-death")), Eq(0));
+    games.clear();
+    EXPECT_THAT(dbi->game_tag.find_games(db, cstr_view("0-to-death"), 1, on_tagged_game, &games), Eq(0));
+    EXPECT_THAT(games, IsEmpty());
 }
@@ -0,0 +1,47 @@
+#include "gmock/gmock.h"
+#include "vh/mph.h"
+
+#include <vector>
+
+#define NAME vh_mph
+
+using namespace testing;
+
+class NAME : public Test
+{
+protected:
+    void SetUp() override { mph_init(&mph); }
+    void TearDown() override { mph_deinit(&mph); }
+
+    struct mph mph;
+};
+
+TEST_F(NAME, empty_set)
+{
+    EXPECT_THAT(mph_build(&mph, nullptr, 0), Eq(0));
+    EXPECT_THAT(mph_slot(&mph, 42), Eq(-1));
+}
+
+TEST_F(NAME, every_key_gets_its_own_slot)
+{
+    std::vector<uint64_t> keys;
+    for (uint64_t i = 0; i != 10000; ++i)
+        keys.push_back(i * 0x100000001 + 7);
+    ASSERT_THAT(mph_build(&mph, keys.data(), (int)keys.size()), Eq(0));
+
+    std::vector<int> used(keys.size(), 0);
+    for (uint64_t key : keys)
+    {
+        int slot = mph_slot(&mph, key);
+        ASSERT_THAT(slot, AllOf(Ge(0), Lt((int)keys.size())));
+        used[slot]++;
+    }
+    EXPECT_THAT(used, Each(Eq(1)));
+}
+
+TEST_F(NAME, duplicate_keys_fail)
+{
+    uint64_t keys[] = { 1, 2, 3, 2 };
+    EXPECT_THAT(mph_build(&mph, keys, 4), Eq(-1));
+    EXPECT_THAT(mph_slot(&mph, 1), Eq(-1));
+}